@@ -20,21 +20,68 @@
 #include <cerrno>
 #include <atomic>
 #include <csignal>
+#include <memory>
+#include <shared_mutex>
+#include <algorithm>
+#include <unordered_set>
+#include <deque>
+#include <cmath>
+#include <string_view>
+#include <charconv>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
+#include "stats.h"
+#include "logger.h"
+#include "shard_map.h"
 
 constexpr int MASTER_PORT = 5050;
-constexpr int REPLICATION_FACTOR = 3;
+int replication_factor = 3;      // replicas per shard ("replication_factor N" in config.txt)
+bool chain_replication = false;  // "replication_mode chain": writes go to the primary (head), reads to the last alive replica (tail)
 static std::atomic<bool> running {true};
-std::vector<std::pair<std::string, int>> node_addresses;  // {ip, port} pairs learned from config.txt
+std::vector<std::pair<std::string, int>> node_addresses;  // {ip, port} pairs learned from config.txt (+ nodes that JOINed later)
 std::vector<bool> node_alive;  // status of all nodes
 std::vector<int> primary_map;       // primary_map[shard_i] = primary_index (at most 1 primary at any moment)
+std::vector<int> standby_map;       // standby_map[shard_i] = secondary kept warm to take over from the primary (-1 if none)
+std::vector<std::vector<int>> members;  // members[shard_i] = node indices of that replica group (config: 3i..3i+2)
+std::vector<int> node_group;  // node_group[i] = replica group of node i, -1 once it LEFT (indices are never reused)
 int num_nodes;
-int num_shards;
-static constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;  // for hashing
-static constexpr uint64_t FNV_PRIME        = 0x100000001b3ULL;   // for hashing
-std::mutex coord_mutex;
+std::atomic<int> num_shards {0};  // replica groups (grows when a JOIN finds every group full)
+std::atomic<int> active_shards {0};  // groups currently on the hash ring (the rest are spares for ADD_SHARD)
+std::vector<std::pair<uint64_t, int>> ring;  // sorted {point, shard}: a key belongs to the first point at or after its hash
+std::atomic<uint64_t> epoch {0};  // version of the SHARD_MAP reply: bumped at every cutover, membership change, failover and liveness change
+std::shared_mutex ring_mutex;  // ring (lookups share it, a cutover takes it exclusively)
+std::mutex migration_mutex;  // one ADD_SHARD / JOIN / LEAVE at a time (also guards node_addresses growth)
+std::mutex watch_mutex;  // guards the three below
+std::vector<std::string> watch_queue;  // pushes for WATCH subscribers, written out by the event loop
+std::vector<std::string> published;    // group entries as of the last push (deltas only carry what changed)
+uint64_t published_epoch = 0;
+std::unordered_set<int> watchers;  // connections that sent WATCH (event loop only)
+int done_fd = -1;  // eventfd: a worker finished (results in done_queue) or a push is queued (watch_queue)
+const std::string STATE_FILE = "master_state";  // epoch, ring size and membership, so a restarted master keeps them
+stats::TimedSharedMutex coord_mutex;  // membership + liveness: lookups share it, heartbeat/JOIN/LEAVE write (records lock wait for STATS)
+enum Op { OP_ASK, OP_ASK_READ, OP_ASK_PRIMARY, OP_LIST_NODES, OP_ADD_SHARD, OP_GROUP, OP_MEMBERSHIP, OP_ASK_MANY, OP_SHARD_MAP, OP_OTHER };  // command groups for STATS
+const std::vector<std::string> OP_NAMES = {"ASK", "ASK_READ", "ASK_PRIMARY", "LIST_NODES", "ADD_SHARD", "GROUP", "MEMBERSHIP", "ASK_MANY", "SHARD_MAP", "OTHER"};
+std::atomic<int> open_connections {0};
+std::atomic<uint64_t> offloaded {0};  // commands the event loop handed to a worker thread
+constexpr size_t MAX_LINE = 1 << 20;  // longest accepted command line (ASK_MANY with many keys)
+stats::Duration heartbeat_time;  // one heartbeat round: CHECK every member, apply verdicts, re-elect primaries
+stats::Duration failover_time;   // RTO: old primary last heard -> new primary promoted (and pushed to WATCH subscribers)
+std::atomic<uint64_t> read_ticket {0};  // round-robin position for ASK_READ
+constexpr int HEARTBEAT_MS = 100;        // probe period
+constexpr double PHI_THRESHOLD = 8.0;    // suspect a silent node once phi exceeds this (~1e-8 chance it is merely slow)
+constexpr int PHI_WINDOW = 100;          // inter-arrival times kept per node
+constexpr double MIN_STDDEV_MS = 20.0;   // floor for the deviation, so a very regular node is not suspected on small jitter
 
 // Since master node never fails, it only shuts down at the end of session when we hit Ctrl+C
-void handle_shutdown(int) { running = false; std::cout << "[Coordinator] Shutdown\n"; exit(0);}
+int shutdown_fd = -1;  // eventfd written by the SIGINT handler: the event loop wakes up and returns
+
+// SIGINT: only async-signal-safe work here (no logging, no exit); main() shuts down
+void handle_shutdown(int) {
+    running = false;
+    uint64_t one = 1;
+    if (write(shutdown_fd, &one, sizeof(one)) < 0) {}
+}
 
 // Trim leading/trailing " \t\r\n"
 static std::string trim(const std::string &s) {
@@ -53,190 +100,1040 @@ void load_config(const std::string &filename) {
         if (pos != std::string::npos) line = trim(line.substr(0, pos));
         if (line.empty()) continue;
         auto colon = line.find(':');
-        if (colon == std::string::npos) continue;
+        if (colon == std::string::npos) {  // "replication_factor N" / "replication_mode primary|chain"
+            std::istringstream directive(line);
+            std::string key, value;
+            directive >> key >> value;
+            if (key == "replication_factor") replication_factor = std::max(1, std::stoi(value));
+            else if (key == "replication_mode") chain_replication = value == "chain";
+            continue;
+        }
         std::string ip = trim(line.substr(0, colon));
         int port = std::stoi(trim(line.substr(colon + 1)));
         node_addresses.emplace_back(ip, port);
     }
     num_nodes = node_addresses.size();
-    num_shards = num_nodes / REPLICATION_FACTOR;
+    num_shards = num_nodes / replication_factor;
+    members.assign(num_shards, {});
+    node_group.assign(num_nodes, -1);
+    for (int i = 0; i < num_shards * replication_factor; ++i) {
+        members[i / replication_factor].push_back(i);
+        node_group[i] = i / replication_factor;
+    }
 }
 
-// Hash row key (as evenly as possible)
-static int get_shard(const std::string &key) {
-    uint64_t h = FNV_OFFSET_BASIS;
-    for (unsigned char c : key) {
-        h ^= c;
-        h *= FNV_PRIME;
+// Key hashing and the ring layout live in shard_map.h, so clients that cache SHARD_MAP resolve keys exactly like ASK
+using shardmap::build_ring;
+using shardmap::ring_owner;
+
+static std::string address_of(int node) {
+    return node_addresses[node].first + ":" + std::to_string(node_addresses[node].second);
+}
+
+// " shard primary_ip:port|- alive_count ip:port ..." for SHARD_MAP and WATCH deltas (caller holds coord_mutex)
+static std::string group_entry(int s) {
+    int prim = primary_map[s];
+    std::string e = " " + std::to_string(s) + " " + (prim == -1 ? "-" : address_of(prim));
+    int alive = 0;
+    for (int idx : members[s]) alive += node_alive[idx];
+    e += " " + std::to_string(alive);
+    if (chain_replication && prim != -1) e += " " + address_of(prim);  // chain order: head first, tail last
+    for (int idx : members[s]) {
+        if (node_alive[idx] && !(chain_replication && idx == prim)) e += " " + address_of(idx);
     }
-    return static_cast<int>(h % num_shards);
+    return e;
 }
 
-// Try to connect to node i, return status
-bool check_node(int i) {
-    auto [ip, port] = node_addresses[i];
+// Chain mode: the last alive replica in chain order (primary, then the other members in order), which every write reaches last
+static int chain_tail(int s) {
+    int tail = primary_map[s];
+    for (int idx : members[s]) {
+        if (node_alive[idx] && idx != primary_map[s]) tail = idx;
+    }
+    return tail;
+}
+
+// Tell WATCH subscribers about a new epoch (caller holds coord_mutex and has just bumped epoch): "DELTA from to count entry ...",
+// with only the groups that differ from the previous push, or "RESYNC epoch" when the ring itself changed
+static void publish(bool ring_changed) {
+    std::lock_guard<std::mutex> lk(watch_mutex);
+    std::vector<std::string> entries;
+    for (int s = 0; s < active_shards; ++s) entries.push_back(group_entry(s));
+    std::string line;
+    if (ring_changed || entries.size() != published.size()) {
+        line = "RESYNC " + std::to_string(epoch) + "\r\n";
+    } else {
+        std::string changed;
+        int count = 0;
+        for (size_t s = 0; s < entries.size(); ++s) {
+            if (entries[s] != published[s]) { changed += entries[s]; ++count; }
+        }
+        line = "DELTA " + std::to_string(published_epoch) + " " + std::to_string(epoch) + " " + std::to_string(count) + changed + "\r\n";
+    }
+    published = std::move(entries);
+    published_epoch = epoch;
+    watch_queue.push_back(line);
+    uint64_t one = 1;
+    if (done_fd >= 0 && write(done_fd, &one, sizeof(one)) < 0) LOG_ERROR("[Master] eventfd write failed");
+}
+
+// Persist "epoch active_shards\nnodes\nip:port group\n..." (written atomically via rename)
+static void save_state() {
+    static std::mutex file_mutex;  // ADD_SHARD (ring lock) and the heartbeat (coord lock) may both save
+    std::lock_guard<std::mutex> lk(file_mutex);
+    std::ofstream out(STATE_FILE + ".tmp", std::ios::trunc);
+    out << epoch << " " << active_shards << "\n" << num_nodes << "\n";
+    for (int i = 0; i < num_nodes; ++i) out << node_addresses[i].first << ":" << node_addresses[i].second << " " << node_group[i] << "\n";
+    out.close();
+    rename((STATE_FILE + ".tmp").c_str(), STATE_FILE.c_str());
+}
+
+// Restore the state saved above (membership replaces the one from config.txt); returns the ring size, 0 if there is no state
+static int load_state() {
+    std::ifstream in(STATE_FILE);
+    uint64_t e = 0;
+    int shards = 0, nodes = 0;
+    if (!(in >> e >> shards)) return 0;
+    epoch = e;
+    if (in >> nodes) {
+        std::vector<std::pair<std::string, int>> addrs;
+        std::vector<int> groups;
+        int max_group = -1;
+        for (int i = 0; i < nodes; ++i) {
+            std::string addr;
+            int g;
+            if (!(in >> addr >> g) || addr.find(':') == std::string::npos) return shards;  // keep config membership
+            addrs.emplace_back(addr.substr(0, addr.find(':')), std::stoi(addr.substr(addr.find(':') + 1)));
+            groups.push_back(g);
+            max_group = std::max(max_group, g);
+        }
+        node_addresses = addrs;
+        node_group = groups;
+        num_nodes = nodes;
+        num_shards = std::max((int)num_shards, max_group + 1);
+        members.assign(num_shards, {});
+        for (int i = 0; i < num_nodes; ++i) {
+            if (node_group[i] >= 0) members[node_group[i]].push_back(i);
+        }
+    }
+    return shards;
+}
+
+// Phi-accrual failure detector state of one node (only touched by the heartbeat thread)
+struct Detector {
+    int fd = -1;              // persistent connection the CHECKs go over
+    bool waiting = false;     // a CHECK is outstanding on fd
+    bool down = false;        // refused / reset / fake dead ("-ERR"): certain, no need to wait for phi
+    uint64_t last_ms = 0;     // arrival of the last "+OK"
+    uint64_t lsn = 0;         // applied LSN and resident subtablet from the last "+OK lsn subtablet"
+    int resident = -1;
+    std::deque<double> intervals;  // latest PHI_WINDOW inter-arrival times (ms)
+    double sum = 0, sum_sq = 0;
+
+    void heard(uint64_t now) {
+        if (last_ms) {
+            double d = now - last_ms;
+            intervals.push_back(d);
+            sum += d; sum_sq += d * d;
+            if (intervals.size() > (size_t)PHI_WINDOW) {
+                double old = intervals.front();
+                intervals.pop_front();
+                sum -= old; sum_sq -= old * old;
+            }
+        }
+        last_ms = now;
+        down = false;
+    }
+    // -log10(probability that a heartbeat arrives even later than now), with inter-arrival times modelled as a normal distribution
+    double phi(uint64_t now) const {
+        if (!last_ms) return 0;
+        double mean = intervals.empty() ? HEARTBEAT_MS : sum / intervals.size();
+        double var = intervals.empty() ? 0 : sum_sq / intervals.size() - mean * mean;
+        double stddev = std::max(std::sqrt(std::max(var, 0.0)), MIN_STDDEV_MS);
+        double p_later = 0.5 * std::erfc((now - last_ms - mean) / (stddev * std::sqrt(2.0)));
+        return -std::log10(std::max(p_later, 1e-300));
+    }
+    bool alive(uint64_t now) const { return !down && last_ms && phi(now) < PHI_THRESHOLD; }
+    void drop() {
+        if (fd >= 0) close(fd);
+        fd = -1;
+        waiting = false;
+    }
+};
+std::vector<Detector> detectors;  // detectors[node_i]
+std::vector<uint64_t> node_heard_ms;  // copies of detector state for NODE_STATUS: last "+OK" (0 = never) and phi of each node,
+std::vector<double> node_phi;         // taken at the end of every heartbeat round (guarded by coord_mutex)
+uint64_t last_round_ms = 0;           // when that round ended
+
+static uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Non-blocking connect with a deadline, then wait for the "+OK Connected" greeting; -1 if the node cannot be reached
+static int connect_node(const std::pair<std::string, int> &node, int timeout_ms) {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
-    addr.sin_port   = htons(port);
-    inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
-    bool alive = false;
-    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) == 0) {
-        char buffer[32]; recv(sock, buffer, 31, 0);
-        std::string check = "CHECK\r\n";
-        send(sock, check.c_str(), check.size(), 0);
-        char buf[10]; recv(sock, buf, 9, 0);
-        if (buf[0] == '+') {
-            alive = true;
-        }
-        std::string quit = "QUIT\r\n";
-        send(sock, quit.c_str(), quit.size(), 0);
-    }
-    close(sock);
-    return alive;
+    addr.sin_port   = htons(node.second);
+    inet_pton(AF_INET, node.first.c_str(), &addr.sin_addr);
+    pollfd p{sock, POLLOUT, 0};
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0 &&
+        (errno != EINPROGRESS || poll(&p, 1, timeout_ms) != 1 || getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)) {
+        close(sock);
+        return -1;
+    }
+    char buf[64];
+    p = {sock, POLLIN, 0};
+    if (poll(&p, 1, timeout_ms) != 1 || recv(sock, buf, sizeof(buf), 0) <= 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Alive member of shard_i (other than skip) that is furthest along: highest applied LSN, then the one already holding
+// the primary's resident subtablet, then member order; -1 if none (heartbeat thread only, it owns the detectors)
+static int most_caught_up(int shard_i, int skip) {
+    int resident = skip != -1 ? detectors[skip].resident : -1;
+    int best = -1;
+    for (int idx : members[shard_i]) {
+        if (idx == skip || !node_alive[idx]) continue;
+        const Detector &d = detectors[idx];
+        if (best == -1 || d.lsn > detectors[best].lsn ||
+            (d.lsn == detectors[best].lsn && d.resident == resident && detectors[best].resident != resident)) best = idx;
+    }
+    return best;
 }
 
-// Scan shard i and re‐elect primary if necessary
-void refresh(int shard_i) {
-    std::lock_guard<std::mutex> lk(coord_mutex);
-    int base = shard_i * REPLICATION_FACTOR;
-    // update aliveness for this shard’s nodes
-    for (int j = 0; j < REPLICATION_FACTOR; ++j) {
-        int idx = base + j;
-        node_alive[idx] = check_node(idx);
-    }
-    int cur_prim  = primary_map[shard_i];
-    // if current primary died, pick another alive replica
-    if (cur_prim == -1 || !node_alive[cur_prim]) {
-        int new_prim = -1;
-        for (int j = 0; j < REPLICATION_FACTOR; ++j) {
-            int idx = base + j;
-            if (node_alive[idx]) { new_prim = idx; break; }
+// Pick a new primary for shard_i if its current one is dead or gone, preferring the warm standby (caller holds
+// coord_mutex exclusively), then re-pick the standby; true if the primary changed
+static bool elect(int shard_i) {
+    int cur_prim = primary_map[shard_i];
+    bool changed = false;
+    if (cur_prim == -1 || !node_alive[cur_prim] || node_group[cur_prim] != shard_i) {
+        int standby = standby_map[shard_i];
+        int new_prim = most_caught_up(shard_i, -1);
+        // the standby wins unless it fell behind (missed replicated writes) another member
+        if (standby != -1 && new_prim != -1 && node_alive[standby] && node_group[standby] == shard_i &&
+            detectors[standby].lsn >= detectors[new_prim].lsn) new_prim = standby;
+        if (new_prim != cur_prim) {
+            LOG_INFO("[Master] shard" << shard_i << " primary " << cur_prim << " -> " << new_prim
+                     << (new_prim != -1 && new_prim == standby ? " (standby)" : ""));
+            if (cur_prim != -1 && new_prim != -1 && detectors[cur_prim].last_ms) failover_time.add((now_ms() - detectors[cur_prim].last_ms) * 1000);
+            changed = true;
         }
         primary_map[shard_i] = new_prim;
     }
+    int standby = most_caught_up(shard_i, primary_map[shard_i]);
+    if (standby != standby_map[shard_i]) LOG_DEBUG("[Master] shard" << shard_i << " standby " << standby_map[shard_i] << " -> " << standby);
+    standby_map[shard_i] = standby;
+    return changed;
 }
 
-// Handle client connection
-void handle_client(int client_fd) {
-    char buffer[1024];
-    std::string line;
+// Every HEARTBEAT_MS: one CHECK per member over its persistent connection (all in flight at once, so a hung node
+// costs nothing extra), then the verdicts are applied and primaries re-elected. Lookups only read the result.
+void heartbeat_loop() {
     while (running) {
-        ssize_t n = recv(client_fd, buffer, 1023, 0);
-        buffer[n] = '\0';
-        std::istringstream iss(buffer);
-        while (std::getline(iss, line)) {
-            line = trim(line);
-            if (line.empty()) continue;
-            std::istringstream cmd(line);
-            std::string op;
-            cmd >> op;
-            if (op == "ASK") {  // lookup for a row key
-                std::string row;
-                cmd >> row;
-                std::cout << "[Master] client" << client_fd << " lookup for: " << row << std::endl;
-                int shard = get_shard(row);
-                refresh(shard);
-                int prim;
-                std::lock_guard<std::mutex> lk(coord_mutex);
-                prim = primary_map[shard];
-                if (prim == -1) {  // all dead for that group
-                    std::string resp = "-ERR ALL DEAD\r\n";
-                    send(client_fd, resp.c_str(), resp.size(), 0);
-                    std::cout << "[Master] tablets of "<< row << " (shard" << shard << ") all dead" << std::endl;
-                } else {
-                    auto [ip, port] = node_addresses[prim];
-                    std::ostringstream os;
-                    os << "+OK REDIRECT " << ip << ":" << port << "\r\n";
-                    send(client_fd, os.str().c_str(), os.str().size(), 0);
-                    std::cout << "[Master] "<< row << " should go to " << ip << ":" << port << std::endl;
+        uint64_t t0 = now_ms();
+        std::vector<std::pair<int, std::pair<std::string, int>>> targets;  // {node, address} of current members
+        std::vector<bool> is_standby;  // is_standby[k]: targets[k] is its group's standby
+        {
+            std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);
+            for (int i = 0; i < num_nodes; ++i) {
+                if (node_group[i] == -1) continue;
+                targets.push_back({i, node_addresses[i]});
+                is_standby.push_back(standby_map[node_group[i]] == i);
+            }
+            if ((int)detectors.size() < num_nodes) detectors.resize(num_nodes);
+        }
+        for (size_t k = 0; k < targets.size(); ++k) {
+            auto &[i, node] = targets[k];
+            // tells every tablet the current epoch and whether it is the standby (which keeps the primary's subtablet resident)
+            const std::string check = "CHECK " + std::to_string(epoch) + (is_standby[k] ? " 1" : " 0") + "\r\n";
+            Detector &d = detectors[i];
+            if (d.waiting) continue;  // still waiting for the previous reply
+            if (d.fd < 0) d.fd = connect_node(node, HEARTBEAT_MS);
+            if (d.fd < 0 || send(d.fd, check.data(), check.size(), MSG_NOSIGNAL) != (ssize_t)check.size()) {
+                d.drop();
+                d.down = true;
+                continue;
+            }
+            d.waiting = true;
+        }
+        // collect replies until the end of this period
+        uint64_t deadline = t0 + HEARTBEAT_MS;
+        while (true) {
+            std::vector<pollfd> fds;
+            std::vector<int> who;
+            for (auto &[i, node] : targets) {
+                if (detectors[i].waiting) { fds.push_back({detectors[i].fd, POLLIN, 0}); who.push_back(i); }
+            }
+            uint64_t now = now_ms();
+            if (fds.empty() || now >= deadline || poll(fds.data(), fds.size(), deadline - now) <= 0) break;
+            for (size_t k = 0; k < fds.size(); ++k) {
+                if (!fds[k].revents) continue;
+                Detector &d = detectors[who[k]];
+                char buf[64];
+                ssize_t n = recv(d.fd, buf, sizeof(buf), 0);
+                d.waiting = false;
+                if (n > 0 && buf[0] == '+') {
+                    d.heard(now_ms());
+                    std::istringstream reply(std::string(buf, n));
+                    std::string ok;
+                    reply >> ok >> d.lsn >> d.resident;
+                } else {  // "-ERR" (fake dead) or closed
+                    d.down = true;
+                    if (n <= 0) d.drop();
                 }
             }
-            else if (op == "LIST_NODES") {  // know the primary and status of all nodes
-                std::ostringstream os;
-                std::cout << "[Master] client" << client_fd << " wants to list status of all nodes" << std::endl;
-                os << "+OK ";
-                for (int i = 0; i < num_shards; ++i) refresh(i);
-                std::lock_guard<std::mutex> lk(coord_mutex);
-                for (int s = 0; s < num_shards; ++s) {
-                    // Primary
-                    os << "Shard" << s << ": Primary: " << primary_map[s];
-                    // Alive list
-                    os << " Alive:";
-                    bool any_alive = false;
-                    int base = s * REPLICATION_FACTOR;
-                    for (int j = 0; j < REPLICATION_FACTOR; ++j) {
-                        int idx = base + j;
-                        if (node_alive[idx]) {
-                            os << " " << idx;
-                            any_alive = true;
-                        }
-                    }
-                    if (!any_alive) {
-                        os << " -1";
+        }
+        {
+            std::lock_guard<stats::TimedSharedMutex> lk(coord_mutex);
+            uint64_t now = now_ms();
+            bool changed = false;
+            node_heard_ms.resize(num_nodes, 0);
+            node_phi.resize(num_nodes, 0);
+            last_round_ms = now;
+            for (auto &[i, node] : targets) {
+                if (node_group[i] == -1) continue;  // LEFT during this round
+                bool alive = detectors[i].alive(now);
+                node_heard_ms[i] = detectors[i].last_ms;
+                node_phi[i] = detectors[i].phi(now);
+                if (alive == node_alive[i]) continue;
+                LOG_INFO("[Master] node" << i << (alive ? " is alive" : " is suspected dead") << " (phi " << detectors[i].phi(now) << ")");
+                node_alive[i] = alive;
+                changed = true;
+            }
+            for (int s = 0; s < num_shards; ++s) changed |= elect(s);
+            if (changed) {  // cached shard maps are now out of date: WATCH subscribers get the delta, tablets reject the old epoch after the next CHECK
+                ++epoch;
+                save_state();
+                publish(false);
+            }
+        }
+        for (auto &[i, node] : targets) {
+            if (node_group[i] == -1) detectors[i].drop();
+        }
+        uint64_t spent = now_ms() - t0;
+        heartbeat_time.add(spent * 1000);
+        if (spent < (uint64_t)HEARTBEAT_MS) std::this_thread::sleep_for(std::chrono::milliseconds(HEARTBEAT_MS - spent));
+    }
+}
+
+// Blocking request/reply connection to one tablet (used by ADD_SHARD to move rows)
+struct TabletConn {
+    int fd = -1;
+    bool open(int node) {
+        auto [ip, port] = node_addresses[node];
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port   = htons(port);
+        inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) return false;
+        return read_line().rfind("+OK", 0) == 0;  // "+OK Connected\r\n"
+    }
+    ~TabletConn() {
+        if (fd < 0) return;
+        send_all("QUIT\r\n");
+        close(fd);
+    }
+    bool send_all(const std::string &s) {
+        size_t sent = 0;
+        while (sent < s.size()) {
+            ssize_t n = send(fd, s.data() + sent, s.size() - sent, 0);
+            if (n <= 0) return false;
+            sent += n;
+        }
+        return true;
+    }
+    // One reply line without "\r\n" ("" on error)
+    std::string read_line() {
+        std::string out;
+        char buf[4096];
+        while (out.size() < 2 || out.compare(out.size() - 2, 2, "\r\n") != 0) {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0) return "";
+            out.append(buf, n);
+        }
+        out.resize(out.size() - 2);
+        return out;
+    }
+    std::string request(const std::string &line) { return send_all(line + "\r\n") ? read_line() : ""; }
+    // "+OK a b c" -> {a, b, c}; false on "-ERR ..."
+    bool request_list(const std::string &line, std::vector<std::string> &items) {
+        std::string resp = request(line);
+        if (resp.rfind("+OK", 0) != 0) return false;
+        std::istringstream is(resp.substr(3));
+        std::string w;
+        while (is >> w) items.push_back(w);
+        return true;
+    }
+    bool get(const std::string &row, const std::string &col, std::string &val) {
+        std::string resp = request("GET " + row + " " + col);
+        if (resp.rfind("+OK ", 0) != 0) return false;
+        size_t size = std::stoull(resp.substr(4));
+        if (!send_all("READY\r\n")) return false;
+        val.resize(size);
+        size_t got = 0;
+        while (got < size) {
+            ssize_t n = recv(fd, &val[got], size - got, 0);
+            if (n <= 0) return false;
+            got += n;
+        }
+        return true;
+    }
+    bool put(const std::string &row, const std::string &col, const std::string &val) {
+        if (request("PUT " + row + " " + col + " " + std::to_string(val.size())) != "+OK") return false;
+        return send_all(val) && read_line().rfind("+OK", 0) == 0;
+    }
+};
+
+static int current_primary(int shard) {
+    std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);
+    return primary_map[shard];
+}
+
+// Make row on dst identical to row on src (columns missing at src are deleted at dst)
+static bool copy_row(TabletConn &src, TabletConn &dst, const std::string &row) {
+    std::vector<std::string> src_cols, dst_cols;
+    src.request_list("GET_COLS " + row, src_cols);  // "-ERR Not found" = row deleted meanwhile
+    dst.request_list("GET_COLS " + row, dst_cols);
+    std::unordered_set<std::string> keep(src_cols.begin(), src_cols.end());
+    for (const auto &col : src_cols) {
+        std::string val;
+        if (!src.get(row, col, val)) continue;  // deleted between GET_COLS and GET
+        if (!dst.put(row, col, val)) return false;
+    }
+    for (const auto &col : dst_cols) {
+        if (!keep.count(col)) dst.request("DELETE " + row + " " + col);
+    }
+    return true;
+}
+
+// Delete every column of row on t
+static void drop_row(TabletConn &t, const std::string &row) {
+    std::vector<std::string> cols;
+    t.request_list("GET_COLS " + row, cols);
+    for (const auto &col : cols) t.request("DELETE " + row + " " + col);
+}
+
+// Put the next spare replica group on the ring and move its rows there while the old shards keep serving:
+// the old primaries track rows written during the bulk copy, those are re-copied until the set is small,
+// then the ring is swapped under the exclusive lock (the only moment ASK waits) and old copies are deleted.
+static std::string add_shard() {
+    std::lock_guard<std::mutex> mig(migration_mutex);
+    int target = active_shards;
+    if (target >= num_shards) return "-ERR NO SPARE GROUP";
+    int target_prim = current_primary(target);
+    if (target_prim == -1) return "-ERR NEW GROUP DEAD";
+    auto next_ring = build_ring(target + 1);
+    std::vector<int> src_prim(target);
+    std::vector<std::unique_ptr<TabletConn>> src(target);
+    TabletConn dst;
+    if (!dst.open(target_prim)) return "-ERR NEW GROUP DEAD";
+    for (int s = 0; s < target; ++s) {
+        src_prim[s] = current_primary(s);
+        src[s] = std::make_unique<TabletConn>();
+        if (src_prim[s] == -1 || !src[s]->open(src_prim[s])) return "-ERR SHARD" + std::to_string(s) + " DEAD";
+    }
+    std::unordered_set<std::string> moved;
+    auto abort_all = [&](const std::string &why) {
+        for (int s = 0; s < target; ++s) src[s]->request("TRACK_STOP");
+        for (const auto &row : moved) drop_row(dst, row);  // not on the ring yet, so nobody saw these
+        LOG_WARN("[Master] ADD_SHARD " << target << " aborted: " << why);
+        return "-ERR " + why;
+    };
+    // copy the rows named by list (a GET_ROWS / TRACK_DRAIN reply) that the new ring gives to the target
+    auto copy_rows = [&](int s, const std::string &list_cmd, size_t &copied) {
+        std::vector<std::string> rows;
+        if (!src[s]->request_list(list_cmd, rows)) return false;
+        for (const auto &row : rows) {
+            if (ring_owner(next_ring, row) != target) continue;
+            if (!copy_row(*src[s], dst, row)) return false;
+            moved.insert(row);
+            ++copied;
+        }
+        return true;
+    };
+    auto primaries_unchanged = [&]() {
+        for (int s = 0; s < target; ++s) {
+            if (current_primary(s) != src_prim[s]) return false;
+        }
+        return current_primary(target) == target_prim;
+    };
+    // 1. bulk copy while writes keep flowing to the old shards
+    for (int s = 0; s < target; ++s) {
+        size_t copied = 0;
+        if (src[s]->request("TRACK_START") != "+OK") return abort_all("TRACK_START FAILED");
+        if (!copy_rows(s, "GET_ROWS", copied)) return abort_all("COPY FAILED");
+    }
+    // 2. catch up on rows written during the copy until a round moves only a few of them
+    for (int round = 0; round < 10; ++round) {
+        size_t copied = 0;
+        for (int s = 0; s < target; ++s) {
+            if (!copy_rows(s, "TRACK_DRAIN", copied)) return abort_all("COPY FAILED");
+        }
+        if (copied < 16) break;
+    }
+    if (!primaries_unchanged()) return abort_all("PRIMARY CHANGED");
+    // 3. cutover: last catch-up and ring swap while lookups are blocked
+    {
+        std::unique_lock<std::shared_mutex> lk(ring_mutex);
+        size_t copied = 0;
+        for (int s = 0; s < target; ++s) {
+            if (!copy_rows(s, "TRACK_DRAIN", copied)) return abort_all("COPY FAILED");
+        }
+        ring = next_ring;
+        active_shards = target + 1;
+        ++epoch;
+        save_state();
+        std::shared_lock<stats::TimedSharedMutex> coord_lk(coord_mutex);
+        publish(true);
+    }
+    // 4. writes routed by a lookup made just before the swap may still land on the old shards
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    size_t late = 0;
+    for (int s = 0; s < target; ++s) {
+        copy_rows(s, "TRACK_DRAIN", late);
+        src[s]->request("TRACK_STOP");
+    }
+    // 5. old copies are no longer reachable through the ring
+    for (int s = 0; s < target; ++s) {
+        std::vector<std::string> rows;
+        if (!src[s]->request_list("GET_ROWS", rows)) continue;
+        for (const auto &row : rows) {
+            if (ring_owner(next_ring, row) == target) drop_row(*src[s], row);
+        }
+    }
+    LOG_INFO("[Master] ADD_SHARD " << target << " done, epoch " << epoch << ", moved " << moved.size() << " rows");
+    return "+OK ADDED shard " + std::to_string(target) + " epoch " + std::to_string(epoch) + " moved " + std::to_string(moved.size()) + " rows";
+}
+
+// Register a new tablet (ip:port): it fills the group with the fewest members, or opens a new (spare) group when all are full.
+// A member that JOINs again (restart) keeps its index; the tablet then bootstraps from its group's primary.
+static std::string join_node(const std::string &addr) {
+    size_t colon = addr.find(':');
+    int port = colon == std::string::npos ? 0 : std::atoi(addr.c_str() + colon + 1);
+    if (port <= 0) return "-ERR BAD ADDRESS";
+    std::string ip = addr.substr(0, colon);
+    std::lock_guard<std::mutex> mig(migration_mutex);
+    std::lock_guard<stats::TimedSharedMutex> lk(coord_mutex);
+    for (int i = 0; i < num_nodes; ++i) {
+        if (node_group[i] != -1 && node_addresses[i] == std::make_pair(ip, port)) {
+            return "+OK JOINED node " + std::to_string(i) + " group " + std::to_string(node_group[i]) + " epoch " + std::to_string(epoch);
+        }
+    }
+    int group = -1;
+    for (int s = 0; s < num_shards; ++s) {
+        if (members[s].size() < (size_t)replication_factor && (group == -1 || members[s].size() < members[group].size())) group = s;
+    }
+    if (group == -1) {
+        group = num_shards;
+        members.emplace_back();
+        primary_map.push_back(-1);
+        standby_map.push_back(-1);
+        ++num_shards;
+    }
+    int idx = num_nodes++;
+    node_addresses.emplace_back(ip, port);
+    node_alive.push_back(false);  // until its first CHECK succeeds
+    node_group.push_back(group);
+    members[group].push_back(idx);
+    ++epoch;
+    save_state();
+    publish(false);
+    LOG_INFO("[Master] " << addr << " joined as node" << idx << " in group " << group << ", epoch " << epoch);
+    return "+OK JOINED node " + std::to_string(idx) + " group " + std::to_string(group) + " epoch " + std::to_string(epoch);
+}
+
+// Take node idx out of its group (its process can be stopped afterwards); refused for the last alive replica of a shard on the ring
+static std::string leave_node(int idx) {
+    std::lock_guard<std::mutex> mig(migration_mutex);
+    std::lock_guard<stats::TimedSharedMutex> lk(coord_mutex);
+    if (idx < 0 || idx >= num_nodes || node_group[idx] == -1) return "-ERR UNKNOWN NODE";
+    int group = node_group[idx];
+    auto &m = members[group];
+    int others_alive = 0;
+    for (int j : m) others_alive += (j != idx && node_alive[j]);
+    if (group < active_shards && others_alive == 0) return "-ERR LAST REPLICA";
+    m.erase(std::find(m.begin(), m.end(), idx));
+    node_group[idx] = -1;
+    node_alive[idx] = false;
+    if (primary_map[group] == idx) {
+        primary_map[group] = -1;
+        int standby = standby_map[group];
+        if (standby != -1 && standby != idx && node_alive[standby]) primary_map[group] = standby;
+        for (int j : m) {
+            if (primary_map[group] == -1 && node_alive[j]) primary_map[group] = j;
+        }
+    }
+    if (standby_map[group] == idx || standby_map[group] == primary_map[group]) standby_map[group] = -1;  // re-picked next heartbeat round
+    ++epoch;
+    save_state();
+    publish(false);
+    LOG_INFO("[Master] node" << idx << " left group " << group << ", epoch " << epoch);
+    return "+OK LEFT node " + std::to_string(idx) + " group " + std::to_string(group) + " epoch " + std::to_string(epoch);
+}
+
+// Split a command line on spaces/tabs without copying (views into line)
+static std::vector<std::string_view> split_words(std::string_view line) {
+    std::vector<std::string_view> words;
+    size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && (line[i] == ' ' || line[i] == '\t')) ++i;
+        size_t j = i;
+        while (j < line.size() && line[j] != ' ' && line[j] != '\t') ++j;
+        if (j > i) words.push_back(line.substr(i, j - i));
+        i = j;
+    }
+    return words;
+}
+
+static int to_int(std::string_view w, int fallback = -1) {
+    int v = fallback;
+    std::from_chars(w.data(), w.data() + w.size(), v);
+    return v;
+}
+
+static Op op_of(std::string_view op) {
+    if (op == "ASK") return OP_ASK;
+    if (op == "ASK_MANY") return OP_ASK_MANY;
+    if (op == "ASK_READ") return OP_ASK_READ;
+    if (op == "ASK_PRIMARY") return OP_ASK_PRIMARY;
+    if (op == "LIST_NODES" || op == "NODE_STATUS") return OP_LIST_NODES;
+    if (op == "ADD_SHARD") return OP_ADD_SHARD;
+    if (op == "GROUP") return OP_GROUP;
+    if (op == "SHARD_MAP") return OP_SHARD_MAP;
+    if (op == "JOIN" || op == "LEAVE" || op == "NODE_ADDR") return OP_MEMBERSHIP;
+    return OP_OTHER;
+}
+
+// Commands that may wait on migration_mutex for a long time always run on a worker thread
+static bool is_slow(std::string_view op) { return op == "ADD_SHARD" || op == "JOIN" || op == "LEAVE"; }
+
+// Execute one command line and append its reply to out. Returns false when the event loop must not block
+// (the ring is locked by an ADD_SHARD cutover, whose row copies need this loop to answer GROUP) and the line
+// should be retried on a worker with may_block = true. *quit is set for QUIT.
+static bool run_command(int client_fd, std::string_view line, std::string &out, bool may_block, bool *quit) {
+    auto words = split_words(line);
+    if (words.empty()) return true;
+    std::string_view op = words[0];
+    // ring lookups: shared lock, but never wait for it on the event loop
+    std::shared_lock<std::shared_mutex> ring_lk(ring_mutex, std::defer_lock);
+    if (op == "ASK" || op == "ASK_READ" || op == "ASK_MANY" || op == "SHARD_MAP") {
+        if (may_block) ring_lk.lock();
+        else if (!ring_lk.try_lock()) return false;
+    }
+    stats::OpScope op_scope(op_of(op));
+    if (op == "ASK") {  // lookup for a row key
+        std::string row(words.size() > 1 ? words[1] : "");
+        LOG_DEBUG("[Master] client" << client_fd << " lookup for: " << row);
+        int shard = ring_owner(ring, row);
+        std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);
+        int prim = primary_map[shard];
+        if (prim == -1) {  // all dead for that group
+            out += "-ERR ALL DEAD\r\n";
+            LOG_WARN("[Master] tablets of "<< row << " (shard" << shard << ") all dead");
+        } else {
+            out += "+OK REDIRECT " + address_of(prim) + "\r\n";
+            LOG_DEBUG("[Master] "<< row << " should go to " << address_of(prim));
+        }
+    }
+    else if (op == "ASK_MANY") {  // primaries of many row keys in one round trip: "+OK ip:port ip:port - ..." ("-" = all dead)
+        std::vector<int> shards;
+        for (size_t i = 1; i < words.size(); ++i) shards.push_back(ring_owner(ring, words[i]));
+        std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);
+        out += "+OK";
+        for (int shard : shards) {
+            int prim = primary_map[shard];
+            out += prim == -1 ? std::string(" -") : " " + address_of(prim);
+        }
+        out += "\r\n";
+        LOG_DEBUG("[Master] client" << client_fd << " resolved " << shards.size() << " keys");
+    }
+    else if (op == "ASK_READ") {  // lookup for a row key, spreading reads over all alive replicas of its shard (chain mode: its tail)
+        std::string row(words.size() > 1 ? words[1] : "");
+        LOG_DEBUG("[Master] client" << client_fd << " read lookup for: " << row);
+        int shard = ring_owner(ring, row);
+        std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);
+        const auto &group = members[shard];
+        int pick = chain_replication ? chain_tail(shard) : -1;
+        uint64_t ticket = read_ticket.fetch_add(1, std::memory_order_relaxed);
+        for (size_t j = 0; pick == -1 && j < group.size(); ++j) {
+            int idx = group[(ticket + j) % group.size()];
+            if (node_alive[idx]) { pick = idx; break; }
+        }
+        if (pick == -1) {  // all dead for that group
+            out += "-ERR ALL DEAD\r\n";
+            LOG_WARN("[Master] tablets of "<< row << " (shard" << shard << ") all dead");
+        } else {
+            out += "+OK REDIRECT " + address_of(pick) + "\r\n";
+            LOG_DEBUG("[Master] read of "<< row << " should go to " << address_of(pick));
+        }
+    }
+    else if (op == "SHARD_MAP") {  // the whole routing table, so a client can resolve keys itself until the epoch changes
+        std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);  // with ring_lk: nothing below can change, so neither can epoch
+        std::ostringstream os;
+        os << "+OK epoch " << epoch << " ring " << ring.size();
+        for (const auto &[point, shard] : ring) os << " " << point << " " << shard;
+        os << " groups " << active_shards;
+        for (int s = 0; s < active_shards; ++s) os << group_entry(s);
+        if (chain_replication) os << " mode chain";
+        os << "\r\n";
+        out += os.str();
+    }
+    else if (op == "LIST_NODES") {  // know the primary and status of all nodes
+        std::ostringstream os;
+        LOG_DEBUG("[Master] client" << client_fd << " wants to list status of all nodes");
+        os << "+OK ";
+        std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);
+        int shards = num_shards;
+        for (int s = 0; s < shards; ++s) {
+            // Primary
+            os << "Shard" << s << ": Primary: " << primary_map[s];
+            // Alive list
+            os << " Alive:";
+            bool any_alive = false;
+            for (int idx : members[s]) {
+                if (node_alive[idx]) {
+                    os << " " << idx;
+                    any_alive = true;
+                }
+            }
+            if (!any_alive) {
+                os << " -1";
+            }
+            // Dead list
+            os << " Dead:";
+            bool any_dead = false;
+            for (int idx : members[s]) {
+                if (!node_alive[idx]) {
+                    os << " " << idx;
+                    any_dead = true;
+                }
+            }
+            if (!any_dead) {
+                os << " -1";
+            }
+            if (s + 1 < shards) os << " ";
+        }
+        os << "\r\n";
+        out += os.str();
+        LOG_DEBUG("[Master] "<< os.str());
+    }
+    else if (op == "ASK_PRIMARY") {
+        int shard = words.size() > 1 ? to_int(words[1]) : -1;
+        LOG_DEBUG("[Master] client" << client_fd << " asks for primary of shard" << shard);
+        std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);
+        int prim = shard < 0 || shard >= num_shards ? -1 : primary_map[shard];
+        if (prim == -1) {  // all dead for that group
+            out += "+OK -1\r\n";
+            LOG_WARN("[Master] Shard" << shard << " all dead");
+        } else {
+            out += "+OK " + std::to_string(prim) + "\r\n";
+            LOG_DEBUG("[Master] Primary for shard" << shard << " now is: " << prim);
+        }
+    }
+    else if (op == "GROUP") {  // primary and members (with addresses) of one replica group, for its tablets
+        int shard = words.size() > 1 ? to_int(words[1]) : -1;
+        if (shard < 0 || shard >= num_shards) {
+            out += "-ERR NO SUCH GROUP\r\n";
+            return true;
+        }
+        std::ostringstream os;
+        {
+            std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);
+            os << "+OK " << epoch << " " << primary_map[shard] << " " << members[shard].size();
+            for (int idx : members[shard]) os << " " << idx << " " << address_of(idx);
+        }
+        os << "\r\n";
+        out += os.str();
+    }
+    else if (op == "JOIN") {  // a new tablet announces itself
+        out += join_node(std::string(words.size() > 1 ? words[1] : "")) + "\r\n";
+    }
+    else if (op == "LEAVE") {  // only for Admin Console
+        out += leave_node(words.size() > 1 ? to_int(words[1]) : -1) + "\r\n";
+    }
+    else if (op == "NODE_ADDR") {  // address of a node index (for Admin Console)
+        int idx = words.size() > 1 ? to_int(words[1]) : -1;
+        std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);
+        if (idx < 0 || idx >= num_nodes) {
+            out += "-ERR UNKNOWN NODE\r\n";
+        } else {
+            out += "+OK " + address_of(idx) + "\r\n";
+        }
+    }
+    else if (op == "NODE_STATUS") {  // LIST_NODES with addresses and how fresh each verdict is (all from the last heartbeat round)
+        std::ostringstream os;
+        std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);
+        uint64_t now = now_ms();
+        os << "+OK " << (last_round_ms ? (int64_t)(now - last_round_ms) : -1) << " " << num_nodes;
+        for (int i = 0; i < num_nodes; ++i) {
+            uint64_t heard = i < (int)node_heard_ms.size() ? node_heard_ms[i] : 0;
+            double phi = i < (int)node_phi.size() ? node_phi[i] : 0;
+            os << " " << i << " " << address_of(i) << " " << node_group[i]
+               << " " << (node_group[i] == -1 ? "left" : node_alive[i] ? "alive" : "dead")
+               << " " << (heard ? (int64_t)(now - heard) : -1) << " " << (int)(phi * 10) / 10.0;
+        }
+        os << "\r\n";
+        out += os.str();
+    }
+    else if (op == "WATCH") {  // subscribe this connection to shard map pushes (event loop only: WATCH never goes to a worker)
+        std::lock_guard<std::mutex> lk(watch_mutex);
+        watchers.insert(client_fd);
+        out += "+OK WATCHING " + std::to_string(published_epoch) + "\r\n";
+        LOG_DEBUG("[Master] client" << client_fd << " watches the shard map from epoch " << published_epoch);
+    }
+    else if (op == "STATS") {
+        std::ostringstream os;
+        os << "+OK" << stats::dump(OP_NAMES) << " rss_bytes=" << stats::rss_bytes();
+        heartbeat_time.print(os, "heartbeat");
+        failover_time.print(os, "failover");
+        {
+            std::shared_lock<stats::TimedSharedMutex> lk(coord_mutex);
+            int alive = 0;
+            for (bool a : node_alive) alive += a;
+            os << " nodes_alive=" << alive << " nodes_total=" << num_nodes;
+        }
+        os << " epoch=" << epoch << " active_shards=" << active_shards << " shards_total=" << num_shards
+           << " connections=" << open_connections << " offloaded=" << offloaded;
+        {
+            std::lock_guard<std::mutex> lk(watch_mutex);
+            os << " watchers=" << watchers.size();
+        }
+        os << "\r\n";
+        out += os.str();
+        LOG_DEBUG("[Master] client" << client_fd << " asked for stats");
+    }
+    else if (op == "EPOCH") {  // version of the shard map
+        out += "+OK " + std::to_string(epoch) + " " + std::to_string(active_shards) + "\r\n";
+    }
+    else if (op == "ADD_SHARD") {  // only for Admin Console: bring the next spare replica group online
+        LOG_INFO("[Master] client" << client_fd << " adds shard " << active_shards);
+        out += add_shard() + "\r\n";
+    }
+    else if (op == "QUIT") {
+        LOG_DEBUG("[Master] client" << client_fd << " quit");
+        *quit = true;
+    }
+    return true;
+}
+
+// Event loop state of one client connection (only touched by the loop thread)
+struct Conn {
+    std::string in, out;   // unparsed input, unsent output
+    bool busy = false;     // a command of this connection runs on a worker; later lines wait (replies stay in order)
+    bool closing = false;  // close once busy is over and out is flushed
+    bool hung_up = false;  // the peer went away while busy: off epoll (it would report the hangup on every wait), dropped when the worker is done
+};
+std::unordered_map<int, Conn> conns;
+int epoll_fd = -1;
+std::mutex done_mutex;
+std::vector<std::pair<int, std::string>> done_queue;  // {client fd, reply} from workers (guarded by done_mutex)
+
+static void watch(int fd, Conn &c) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | (c.out.empty() ? 0u : (uint32_t)EPOLLOUT);
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static void drop_conn(int fd) {
+    {
+        std::lock_guard<std::mutex> lk(watch_mutex);
+        watchers.erase(fd);
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    conns.erase(fd);
+    --open_connections;
+    LOG_DEBUG("[Master] client" << fd << " closed");
+}
+
+// Send as much of c.out as the socket takes; returns false if the connection is gone
+static bool flush(int fd, Conn &c) {
+    while (!c.out.empty()) {
+        ssize_t n = send(fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return false;
+        stats::note_out(n);
+        c.out.erase(0, n);
+    }
+    return true;
+}
+
+// Run the complete lines buffered for fd until one has to go to a worker
+static void process(int fd) {
+    Conn &c = conns[fd];
+    size_t pos;
+    while (!c.busy && !c.closing && (pos = c.in.find('\n')) != std::string::npos) {
+        std::string line = c.in.substr(0, pos);
+        c.in.erase(0, pos + 1);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        auto words = split_words(line);
+        bool quit = false;
+        if (words.empty()) continue;
+        if (is_slow(words[0]) || !run_command(fd, line, c.out, false, &quit)) {
+            c.busy = true;
+            ++offloaded;
+            std::thread([fd, line] {
+                std::string reply;
+                bool quit_ = false;
+                run_command(fd, line, reply, true, &quit_);
+                {
+                    std::lock_guard<std::mutex> lk(done_mutex);
+                    done_queue.emplace_back(fd, std::move(reply));
+                }
+                uint64_t one = 1;
+                if (write(done_fd, &one, sizeof(one)) < 0) LOG_ERROR("[Master] eventfd write failed");
+            }).detach();
+            break;
+        }
+        if (quit) c.closing = true;
+    }
+    if (c.in.size() > MAX_LINE && c.in.find('\n') == std::string::npos) {  // no line end in sight
+        c.out += "-ERR LINE TOO LONG\r\n";
+        c.closing = true;
+    }
+    if (!flush(fd, c) || (c.closing && !c.busy && c.out.empty())) {
+        if (c.busy) c.closing = true;  // the worker's reply will find it and close
+        else drop_conn(fd);
+        return;
+    }
+    watch(fd, c);
+}
+
+// One thread multiplexes all clients; only JOIN / LEAVE / ADD_SHARD (and lookups during a ring swap) go to workers
+static void event_loop(int listen_fd) {
+    epoll_fd = epoll_create1(0);
+    done_fd = eventfd(0, EFD_NONBLOCK);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.fd = done_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, done_fd, &ev);
+    ev.data.fd = shutdown_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, shutdown_fd, &ev);
+    std::vector<epoll_event> events(256);
+    char buffer[16384];
+    while (running) {
+        int n = epoll_wait(epoll_fd, events.data(), events.size(), -1);
+        for (int e = 0; e < n; ++e) {
+            int fd = events[e].data.fd;
+            if (fd == listen_fd) {
+                while (true) {
+                    int cfd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK);
+                    if (cfd < 0) break;
+                    int one = 1;
+                    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    LOG_DEBUG("[Master] client" << cfd << " connected");
+                    Conn &c = conns[cfd];
+                    c.out = "+OK Master ready\r\n";
+                    ++open_connections;
+                    epoll_event cev{};
+                    cev.events = EPOLLIN | EPOLLRDHUP;
+                    cev.data.fd = cfd;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cfd, &cev);
+                    if (!flush(cfd, c)) drop_conn(cfd);
+                    else watch(cfd, c);
+                }
+            } else if (fd == shutdown_fd) {
+                return;  // running is false
+            } else if (fd == done_fd) {
+                uint64_t count;
+                if (read(done_fd, &count, sizeof(count)) < 0) continue;
+                std::vector<std::pair<int, std::string>> finished;
+                {
+                    std::lock_guard<std::mutex> lk(done_mutex);
+                    finished.swap(done_queue);
+                }
+                std::vector<std::string> pushes;
+                std::vector<int> subscribers;
+                {
+                    std::lock_guard<std::mutex> lk(watch_mutex);
+                    pushes.swap(watch_queue);
+                    if (!pushes.empty()) subscribers.assign(watchers.begin(), watchers.end());
+                }
+                for (int cfd : subscribers) {
+                    auto it = conns.find(cfd);
+                    if (it == conns.end() || it->second.hung_up) continue;
+                    for (const auto &line : pushes) it->second.out += line;
+                    if (!flush(cfd, it->second)) {
+                        if (it->second.busy) it->second.closing = true;
+                        else drop_conn(cfd);
+                    } else {
+                        watch(cfd, it->second);
                     }
-                    // Dead list
-                    os << " Dead:";
-                    bool any_dead = false;
-                    for (int j = 0; j < REPLICATION_FACTOR; ++j) {
-                        int idx = base + j;
-                        if (!node_alive[idx]) {
-                            os << " " << idx;
-                            any_dead = true;
-                        }
+                }
+                for (auto &[cfd, reply] : finished) {
+                    auto it = conns.find(cfd);
+                    if (it == conns.end()) continue;
+                    if (it->second.hung_up) {
+                        drop_conn(cfd);
+                        continue;
                     }
-                    if (!any_dead) {
-                        os << " -1";
+                    it->second.busy = false;
+                    it->second.out += reply;
+                    process(cfd);  // flushes the reply and runs any lines that queued up behind it
+                }
+            } else {
+                auto it = conns.find(fd);
+                if (it == conns.end()) continue;
+                Conn &c = it->second;
+                bool gone = events[e].events & (EPOLLERR | EPOLLHUP);
+                if (events[e].events & (EPOLLIN | EPOLLRDHUP)) {
+                    while (true) {
+                        ssize_t r = recv(fd, buffer, sizeof(buffer), 0);
+                        if (r > 0) { c.in.append(buffer, r); stats::note_in(r); continue; }
+                        if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) gone = true;  // peer closed (or error)
+                        break;
                     }
-                    if (s + 1 < num_shards) os << " ";
                 }
-                os << "\r\n";
-                auto resp = os.str();
-                send(client_fd, resp.c_str(), resp.size(), 0);
-                std::cout << "[Master] "<< resp << std::endl;
-            }
-            else if (op == "ASK_PRIMARY") {
-                std::string shard_i;
-                cmd >> shard_i;
-                int shard = std::stoi(shard_i);
-                std::cout << "[Master] client" << client_fd << " asks for primary of shard" << shard_i << std::endl;
-                int prim;
-                refresh(shard);
-                std::lock_guard<std::mutex> lk(coord_mutex);
-                prim = primary_map[shard];
-                if (prim == -1) {  // all dead for that group
-                    std::ostringstream os;
-                    std::string resp = "+OK -1\r\n";
-                    send(client_fd, resp.c_str(), resp.size(), 0);
-                    std::cout << "[Master] Shard" << shard_i << " all dead" <<  std::endl;
-                } else {
-                    std::ostringstream os;
-                    os << "+OK "<< std::to_string(prim) << "\r\n";
-                    send(client_fd, os.str().c_str(), os.str().size(), 0);
-                    std::cout << "[Master] Primary for shard" << shard_i << " now is: " << std::to_string(prim) <<  std::endl;
+                if (gone) {
+                    if (c.busy) {
+                        // keep the fd until the worker is done so it cannot be reused under it, but stop watching it: a
+                        // level-triggered hangup would wake every epoll_wait until then
+                        c.closing = c.hung_up = true;
+                        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                    } else {
+                        drop_conn(fd);
+                    }
+                    continue;
                 }
-            } 
-            else if (op == "QUIT") {
-                close(client_fd);
-                std::cout << "[Master] client" << client_fd << " quit" << std::endl;
-                return;
+                process(fd);
             }
         }
     }
-    close(client_fd);
 }
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr<<"Usage: ./master <config_file>\n";
+        std::cerr<<"Usage: ./master <config_file> [initial_shards]\n";
         return 1;
     }
     std::string cfg = argv[1];
     load_config(cfg);
+    // shard map and membership: restored if this master ran before, otherwise the first initial_shards groups (default all)
+    int shards = load_state();
+    if (shards == 0) shards = argc > 2 ? std::stoi(argv[2]) : (int)num_shards;
     primary_map.assign(num_shards, -1);
-    node_alive.assign(num_nodes, true); // assume all nodes are alive at the start
+    standby_map.assign(num_shards, -1);
+    node_alive.assign(num_nodes, true); // assume all nodes are alive at the start (the first heartbeat round corrects it)
     // init primaries (by default)
-    for (int s = 0; s < num_shards; ++s) primary_map[s] = s * REPLICATION_FACTOR;
+    for (int s = 0; s < num_shards; ++s) primary_map[s] = members[s].empty() ? -1 : members[s][0];
+    active_shards = std::max(1, std::min(shards, (int)num_shards));
+    ring = build_ring(active_shards);
+    save_state();
+    published_epoch = epoch;  // WATCH deltas start from here
+    for (int s = 0; s < active_shards; ++s) published.push_back(group_entry(s));
+    LOG_INFO("[Master] Shard map epoch " << epoch << ": " << active_shards << " of " << num_shards << " groups on the ring");
+    shutdown_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = handle_shutdown;
@@ -255,20 +1152,14 @@ int main(int argc, char* argv[]) {
         perror("Bind failed");
         exit(1);
     }
-    if (listen(sockfd, 100) < 0) {
+    if (listen(sockfd, 1024) < 0) {
         perror("listen failed");
         exit(1);
     } 
-    std::cout << "[Master] Listening on port " << MASTER_PORT << std::endl;
-    while (running) {
-        sockaddr_in cli{};
-        socklen_t len = sizeof(cli);
-        int fd = accept(sockfd, (sockaddr*)&cli, &len);
-        if (fd < 0) continue;
-        std::cout << "[Master] client" << fd << " connected" << std::endl;              
-        std::string resp = "+OK Master ready\r\n";
-        send(fd, resp.c_str(), resp.size(), 0);
-        std::thread(handle_client, fd).detach();
-    }
-    return 0;
+    LOG_INFO("[Master] Listening on port " << MASTER_PORT);
+    std::thread(heartbeat_loop).detach();
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+    event_loop(sockfd);
+    LOG_INFO("[Coordinator] Shutdown");
+    return 0;  // the logger drains on exit
 }
@@ -0,0 +1,212 @@
+// Counters and latency histograms behind the STATS command (shared by master and tablet)
+// Hot path: every handler thread writes only its own thread_local slot (single writer, relaxed atomics, no locks);
+// STATS sums all live slots plus the totals of threads that already exited.
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace stats {
+
+constexpr int MAX_OPS = 16;        // command groups per binary
+constexpr int SUB_BITS = 3;        // HDR-style: 8 linear sub-buckets per power of two (~12.5% precision)
+constexpr int SUB = 1 << SUB_BITS;
+constexpr int MAX_EXP = 40;        // values up to 2^40 us (~12 days)
+constexpr int NUM_BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB;
+
+inline int bucket_of(uint64_t us) {
+    if (us < (uint64_t)SUB) return (int)us;
+    int e = 63 - __builtin_clzll(us);
+    if (e > MAX_EXP) return NUM_BUCKETS - 1;
+    int shift = e - SUB_BITS;
+    return (shift + 1) * SUB + (int)((us >> shift) - SUB);
+}
+
+// Largest value that falls into bucket b
+inline uint64_t bucket_high(int b) {
+    if (b < SUB) return b;
+    int shift = b / SUB - 1;
+    return ((uint64_t)(SUB + b % SUB + 1) << shift) - 1;
+}
+
+// Only ever written by its owning thread, so load+store (no lock prefix) is enough; readers see relaxed values
+struct Counter {
+    std::atomic<uint64_t> v{0};
+    void add(uint64_t n) { v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    uint64_t get() const { return v.load(std::memory_order_relaxed); }
+};
+
+struct ThreadSlot {
+    Counter count[MAX_OPS], bytes_in[MAX_OPS], bytes_out[MAX_OPS], lock_wait_us[MAX_OPS];
+    Counter hist[MAX_OPS][NUM_BUCKETS];
+};
+
+struct Totals {
+    uint64_t count[MAX_OPS] = {}, bytes_in[MAX_OPS] = {}, bytes_out[MAX_OPS] = {}, lock_wait_us[MAX_OPS] = {};
+    uint64_t hist[MAX_OPS][NUM_BUCKETS] = {};
+
+    void add(const ThreadSlot &s) {
+        for (int op = 0; op < MAX_OPS; ++op) {
+            count[op] += s.count[op].get();
+            bytes_in[op] += s.bytes_in[op].get();
+            bytes_out[op] += s.bytes_out[op].get();
+            lock_wait_us[op] += s.lock_wait_us[op].get();
+            for (int b = 0; b < NUM_BUCKETS; ++b) hist[op][b] += s.hist[op][b].get();
+        }
+    }
+
+    uint64_t percentile(int op, double q) const {
+        uint64_t target = (uint64_t)(q * count[op]);
+        uint64_t seen = 0;
+        for (int b = 0; b < NUM_BUCKETS; ++b) {
+            seen += hist[op][b];
+            if (seen > target) return bucket_high(b);
+        }
+        return 0;
+    }
+};
+
+struct Registry {
+    std::mutex m;  // only taken when a thread starts/exits or STATS is served
+    std::vector<ThreadSlot*> live;
+    Totals retired;
+};
+
+inline Registry &registry() { static Registry r; return r; }
+
+// Registers on first use, folds its counts into the retired totals when the thread exits
+struct SlotOwner {
+    ThreadSlot *slot = new ThreadSlot();
+    SlotOwner() { std::lock_guard<std::mutex> lk(registry().m); registry().live.push_back(slot); }
+    ~SlotOwner() {
+        std::lock_guard<std::mutex> lk(registry().m);
+        auto &live = registry().live;
+        for (size_t i = 0; i < live.size(); ++i) {
+            if (live[i] == slot) { live[i] = live.back(); live.pop_back(); break; }
+        }
+        registry().retired.add(*slot);
+        delete slot;
+    }
+};
+
+inline ThreadSlot &slot() { thread_local SlotOwner owner; return *owner.slot; }
+
+// Bytes moved and lock time spent by the current thread since its last record()
+inline thread_local uint64_t pending_in = 0, pending_out = 0, pending_lock_wait_us = 0;
+
+inline void note_in(uint64_t n) { pending_in += n; }
+inline void note_out(uint64_t n) { pending_out += n; }
+
+inline uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void record(int op, uint64_t latency_us) {
+    ThreadSlot &s = slot();
+    s.count[op].add(1);
+    s.bytes_in[op].add(pending_in);
+    s.bytes_out[op].add(pending_out);
+    s.lock_wait_us[op].add(pending_lock_wait_us);
+    s.hist[op][bucket_of(latency_us)].add(1);
+    pending_in = pending_out = pending_lock_wait_us = 0;
+}
+
+// Times one command from construction to end of scope
+struct OpScope {
+    int op;
+    uint64_t start = now_us();
+    explicit OpScope(int op_) : op(op_) {}
+    ~OpScope() { record(op, now_us() - start); }
+};
+
+// Drop-in for std::mutex that charges contended acquisition time to the current command
+class TimedMutex {
+public:
+    void lock() {
+        if (m_.try_lock()) return;
+        uint64_t t0 = now_us();
+        m_.lock();
+        pending_lock_wait_us += now_us() - t0;
+    }
+    bool try_lock() { return m_.try_lock(); }
+    void unlock() { m_.unlock(); }
+private:
+    std::mutex m_;
+};
+
+// Same for std::shared_mutex: readers and writers both charge their wait
+class TimedSharedMutex {
+public:
+    void lock() {
+        if (m_.try_lock()) return;
+        uint64_t t0 = now_us();
+        m_.lock();
+        pending_lock_wait_us += now_us() - t0;
+    }
+    bool try_lock() { return m_.try_lock(); }
+    void unlock() { m_.unlock(); }
+    void lock_shared() {
+        if (m_.try_lock_shared()) return;
+        uint64_t t0 = now_us();
+        m_.lock_shared();
+        pending_lock_wait_us += now_us() - t0;
+    }
+    bool try_lock_shared() { return m_.try_lock_shared(); }
+    void unlock_shared() { m_.unlock_shared(); }
+private:
+    std::shared_mutex m_;
+};
+
+// Count/total/max of an occasional operation (checkpoint, replay, ...)
+struct Duration {
+    std::atomic<uint64_t> count{0}, total_us{0}, max_us{0};
+    void add(uint64_t us) {
+        count.fetch_add(1, std::memory_order_relaxed);
+        total_us.fetch_add(us, std::memory_order_relaxed);
+        uint64_t m = max_us.load(std::memory_order_relaxed);
+        while (us > m && !max_us.compare_exchange_weak(m, us, std::memory_order_relaxed)) {}
+    }
+    void print(std::ostream &os, const std::string &name) const {
+        uint64_t c = count.load(std::memory_order_relaxed);
+        os << " " << name << "_count=" << c << " " << name << "_avg_us=" << (c ? total_us.load(std::memory_order_relaxed) / c : 0)
+           << " " << name << "_max_us=" << max_us.load(std::memory_order_relaxed);
+    }
+};
+
+inline uint64_t rss_bytes() {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+// " GET.count=.. GET.bytes_in=.. GET.p50_us=.." for every op that has been used (names[i] for op i)
+inline std::string dump(const std::vector<std::string> &names) {
+    Totals t;
+    {
+        std::lock_guard<std::mutex> lk(registry().m);
+        t = registry().retired;
+        for (ThreadSlot *s : registry().live) t.add(*s);
+    }
+    std::ostringstream os;
+    for (size_t op = 0; op < names.size() && op < (size_t)MAX_OPS; ++op) {
+        if (t.count[op] == 0) continue;
+        const std::string &n = names[op];
+        os << " " << n << ".count=" << t.count[op] << " " << n << ".bytes_in=" << t.bytes_in[op]
+           << " " << n << ".bytes_out=" << t.bytes_out[op] << " " << n << ".lock_wait_us=" << t.lock_wait_us[op]
+           << " " << n << ".p50_us=" << t.percentile(op, 0.5) << " " << n << ".p99_us=" << t.percentile(op, 0.99)
+           << " " << n << ".p999_us=" << t.percentile(op, 0.999);
+    }
+    return os.str();
+}
+
+}  // namespace stats
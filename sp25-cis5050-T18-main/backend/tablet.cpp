@@ -6,6 +6,7 @@
 #include <fstream>
 #include <unordered_map>
 #include <vector>
+#include <algorithm>
 #include <thread>
 #include <mutex>
 #include <filesystem>
@@ -18,29 +19,91 @@
 #include <cerrno>
 #include <poll.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
 #include <atomic>
 #include <unordered_set>
+#include <condition_variable>
+#include <list>
+#include "stats.h"
+#include "logger.h"
 
 namespace fs = std::filesystem;
 constexpr int MASTER_PORT = 5050;
-constexpr int REPLICATION_FACTOR = 3;   // three replicas per shard
-std::mutex mutex;  // automatically release when out of scope
+int replication_factor = 3;     // replicas per shard ("replication_factor N" in config.txt)
+bool chain_replication = false; // "replication_mode chain": a write goes primary (head) -> ... -> tail, acks come back the same way
+stats::TimedMutex mutex;  // automatically release when out of scope (records lock wait for STATS)
 std::unordered_map<std::string, std::unordered_map<std::string,std::string>> kvstore;   // cache for current subtablet in memory
 int self_index;       // this tablet's index
-int shard_i;
+int shard_i;          // replica group (self_index / replication_factor for config.txt nodes, assigned by the master for nodes that JOIN)
 int num_nodes;
-int num_shards;
-static constexpr int num_tablets = 3;   // three smaller tablets for this node
-std::string log_file, checkpoint_file;  // file name prefixes
-std::vector<std::pair<std::string,int>> nodes;  // {ip, port} pairs
+int num_shards;       // groups in config.txt (only used as the subtablet hash divisor, so it never changes)
+std::vector<int> group;  // node indices of my replica group, refreshed from the master's GROUP reply
+static constexpr int initial_tablets = 3;   // three smaller tablets for this node at first start (they split as they grow)
+std::string log_file, checkpoint_file, layout_file;  // file name prefixes (layout_file is the full name)
+std::vector<std::pair<std::string,int>> nodes;  // {ip, port} pairs (config.txt, extended by GROUP replies)
 std::atomic<bool> running {true};
 bool dead {false};  // to mimic dead
 static constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;  // for hashing
 static constexpr uint64_t FNV_PRIME        = 0x100000001b3ULL;   // for hashing
-int current_tablet = 0;
+std::atomic<int> current_tablet {0};  // resident subtablet (written under mutex, atomic so CHECK can report it without the lock)
 std::unordered_map<std::string, std::unordered_set<std::string>> all_row_col;  // keep all row/col keys for this node (since they're much smaller than contents, they fit in memory)
+std::atomic<uint64_t> applied_lsn {0};   // sequence number of the last mutation applied here (assigned by the primary, written under mutex)
+std::condition_variable_any lsn_cv;  // signalled whenever applied_lsn advances
+constexpr int LSN_WAIT_MS = 500;  // how long a secondary waits to catch up to a client's LSN token before answering "-ERR STALE"
+int last_known_primary = -1;  // primary index from the latest query_primary() (secondaries must not propagate LOAD)
+std::atomic<bool> standby {false};  // the master keeps this secondary warm to take over: it holds on to the primary's subtablet
+std::atomic<uint64_t> known_epoch {0};  // shard map epoch as last heard from the master (CHECK / GROUP); older client tags are refused
+int64_t group_epoch = -1;  // epoch of the cached group / last_known_primary, -1 before the first GROUP reply (guarded by mutex)
+// Subtablet t owns the row keys whose (hash / num_shards) % modulus == residue; a split doubles the modulus and hands the
+// upper residue to a new subtablet, so the initial layout {0,3},{1,3},{2,3} is exactly the old "% num_tablets" scheme
+struct Subtablet {
+    uint64_t residue, modulus;
+    uint64_t window_start_ms = 0, window_ops = 0, last_qps = 0;  // request rate, for splitting hot subtablets
+    size_t next_split_bytes = 0;  // do not retry a size split that could not separate any rows until it grows this big
+};
+std::vector<Subtablet> layout;  // guarded by mutex
+bool tracking = false;  // master is migrating rows off this shard: remember which rows get written (guarded by mutex)
+std::unordered_set<std::string> dirty_rows;
+size_t resident_bytes = 0;      // approximate size of kvstore (current subtablet)
+constexpr size_t SPLIT_BYTES = 64 * 1024 * 1024;  // split the resident subtablet when it grows beyond this
+constexpr uint64_t SPLIT_QPS = 2000;              // ... or when it serves more requests per second than this
+constexpr size_t MAX_SUBTABLETS = 256;
+constexpr size_t READ_CACHE_BYTES = 8 * 1024 * 1024;   // budget of the hot-value read cache (keys + values)
+constexpr size_t READ_CACHE_MAX_ITEM = 64 * 1024;      // larger values (file chunks) are read once, never cached
+enum Op { OP_GET, OP_PUT, OP_CPUT, OP_DELETE, OP_GET_ROWS, OP_GET_COLS, OP_RECOVERY, OP_ADMIN, OP_FRAGMENT, OP_OTHER };  // command groups for STATS
+const std::vector<std::string> OP_NAMES = {"GET", "PUT", "CPUT", "DELETE", "GET_ROWS", "GET_COLS", "RECOVERY", "ADMIN", "FRAGMENT", "OTHER"};
+std::atomic<uint64_t> swap_count {0};   // subtablet loads (evict current + load another)
+stats::Duration checkpoint_time, replay_time, repl_time;  // repl_time: synchronous fan-out of one write to all replicas
+stats::Duration hint_time;  // a restarted replica catching up from the primary's hints (instead of a full restore)
+// Writes a down replica missed, kept by the primary (guarded by mutex) so that it can catch up by replaying them when it returns
+struct HintLog {
+    uint64_t from_lsn = 0;  // the replica must have applied exactly this much for the hints to fit
+    uint64_t to_lsn = 0;    // ... and they only help while nobody else wrote after them (another primary in between)
+    uint64_t count = 0;
+    std::string records;    // "lsn PUT row col N\n" + value, or "lsn DELETE row col\n"
+    bool lost = false;      // grew beyond MAX_HINT_BYTES or missed a SPLIT: only a full restore helps
+};
+std::unordered_map<int, HintLog> hints;  // hints[replica index]
+std::unordered_map<int, uint64_t> replica_lsn;  // primary: last LSN each replica acknowledged (its lag is applied_lsn - this)
+constexpr size_t MAX_HINT_BYTES = 64 * 1024 * 1024;  // per replica
+constexpr int HINTS_TIMEOUT_S = 30;  // a replica that stalls this long while catching up gives the primary's lock back
 
-void handle_shutdown(int) { running = false; std::cout << "[Tablet" << self_index << "] Shutdown\n"; exit(0);}
+// Bound every send/recv on fd by seconds (0: block again)
+void set_socket_timeout(int fd, int seconds) {
+    struct timeval tv = {seconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+std::string fragment_dir;  // erasure-coded fragments (FPUT/FGET/FDELETE): one file each, outside the subtablets and unreplicated
+
+int shutdown_fd = -1;  // eventfd written by the SIGINT handler: the accept loop wakes up, logs and exits
+
+// SIGINT: only async-signal-safe work here (no logging, no exit); main() shuts down
+void handle_shutdown(int) {
+    running = false;
+    uint64_t one = 1;
+    if (write(shutdown_fd, &one, sizeof(one)) < 0) {}
+}
 
 int get_tablet(const std::string &key) {  // get (sub)tablet for a row key
     uint64_t h = FNV_OFFSET_BASIS;
@@ -48,8 +111,12 @@ int get_tablet(const std::string &key) {  // get (sub)tablet for a row key
         h ^= c;
         h *= FNV_PRIME;
     }
-    int tablet = static_cast<int>((h / num_shards) % num_tablets);
-    std::cout << "[Tablet" << self_index << "] " << key << " in subtablet: "  << tablet <<  std::endl;
+    uint64_t x = h / num_shards;
+    int tablet = 0;
+    for (size_t t = 0; t < layout.size(); ++t) {
+        if (x % layout[t].modulus == layout[t].residue) { tablet = (int)t; break; }
+    }
+    LOG_DEBUG("[Tablet" << self_index << "] " << key << " in subtablet: "  << tablet);
     return tablet;
 }
 
@@ -61,14 +128,20 @@ static std::string trim(const std::string &s) {
     return s.substr(a, b - a + 1);
 }
 
-// Send all bytes in s
-static void send_all(int fd, const std::string &s) {
-    const char *buf = s.data(); size_t n = s.size();
+// Send all n bytes at buf
+static void send_all(int fd, const char *buf, size_t n) {
     size_t total = 0;
     while (total < n) {
         ssize_t w = send(fd, buf + total, n - total, 0);     
+        if (w <= 0) break;
         total += (size_t)w;
     }
+    stats::note_out(total);
+}
+
+// Send all bytes in s
+static void send_all(int fd, const std::string &s) {
+    send_all(fd, s.data(), s.size());
 }
 
 // Recv exactly n bytes
@@ -79,39 +152,213 @@ static std::string recv_all(int fd, size_t n) {
     while (buf.size() < n) {
         size_t to_read = std::min(CHUNK, n - buf.size());
         ssize_t r = recv(fd, tmp.data(), to_read, 0);
+        if (r <= 0) break;
         buf.append(tmp.data(), (size_t)r);
     }
+    stats::note_in(buf.size());
     return buf;
 }
 
-// Fetch current primary index for this shard from master
-int query_primary() {
+// File of an erasure-coded fragment: the key with everything but [A-Za-z0-9_-] percent-encoded (no '.', like the other data files)
+static std::string fragment_path(const std::string &key) {
+    static const char *hex = "0123456789ABCDEF";
+    std::string name;
+    for (unsigned char c : key) {
+        if (isalnum(c) || c == '_' || c == '-') name += (char)c;
+        else { name += '%'; name += hex[c >> 4]; name += hex[c & 15]; }
+    }
+    return fragment_dir + "/" + name;
+}
+
+// Size-aware W-TinyLFU read cache for small hot values of ANY subtablet (so hits never swap current_tablet).
+// A small LRU window admits new keys; when it overflows, a candidate only enters the segmented LRU (probation +
+// protected) if a count-min sketch says it is more popular than every entry it would push out. Guarded by mutex.
+class ReadCache {
+public:
+    ReadCache(size_t capacity, size_t max_item) : max_item_(max_item), sketch_(DEPTH * WIDTH, 0) {
+        cap_[WINDOW] = std::max(capacity / 16, max_item);
+        cap_[PROTECTED] = (capacity - cap_[WINDOW]) * 4 / 5;
+        cap_[PROBATION] = capacity - cap_[WINDOW] - cap_[PROTECTED];
+    }
+
+    bool get(const std::string &key, std::string &out) {
+        increment(key);
+        auto it = index_.find(key);
+        if (it == index_.end()) { ++misses; return false; }
+        ++hits;
+        auto e = it->second;
+        if (e->seg == PROBATION) {  // second hit: promote, demoting the coldest protected entries if needed
+            move(e, PROTECTED);
+            while (used_[PROTECTED] > cap_[PROTECTED]) move(std::prev(lists_[PROTECTED].end()), PROBATION);
+        } else {
+            lists_[e->seg].splice(lists_[e->seg].begin(), lists_[e->seg], e);
+        }
+        out = e->val;
+        return true;
+    }
+
+    // Called after a miss was served from kvstore
+    void offer(const std::string &key, const std::string &val) {
+        if (key.size() + val.size() > max_item_ || index_.count(key)) return;
+        lists_[WINDOW].push_front({key, val, WINDOW});
+        index_[key] = lists_[WINDOW].begin();
+        used_[WINDOW] += key.size() + val.size();
+        while (used_[WINDOW] > cap_[WINDOW]) admit(std::prev(lists_[WINDOW].end()));
+    }
+
+    void invalidate(const std::string &key) {
+        auto it = index_.find(key);
+        if (it == index_.end()) return;
+        erase(it->second);
+    }
+
+    void clear() {
+        for (auto &l : lists_) l.clear();
+        used_[WINDOW] = used_[PROBATION] = used_[PROTECTED] = 0;
+        index_.clear();
+    }
+
+    size_t bytes() const { return used_[WINDOW] + used_[PROBATION] + used_[PROTECTED]; }
+    size_t items() const { return index_.size(); }
+    uint64_t hits = 0, misses = 0, rejected = 0;
+
+private:
+    enum Seg { WINDOW, PROBATION, PROTECTED };
+    struct Entry { std::string key, val; Seg seg; };
+    using Iter = std::list<Entry>::iterator;
+    static constexpr int DEPTH = 4;
+    static constexpr size_t WIDTH = 1 << 12;   // counters per sketch row
+    static constexpr uint8_t MAX_COUNT = 15;   // 4-bit saturating counters, as in TinyLFU
+
+    // Window overflowed: move its LRU entry into probation if it beats the victims, otherwise drop it
+    void admit(Iter cand) {
+        size_t need = cand->key.size() + cand->val.size();
+        size_t main_cap = cap_[PROBATION] + cap_[PROTECTED];
+        size_t main_used = used_[PROBATION] + used_[PROTECTED];
+        std::vector<Iter> victims;
+        uint8_t cand_freq = frequency(cand->key);
+        for (Seg seg : {PROBATION, PROTECTED}) {
+            for (auto v = lists_[seg].rbegin(); v != lists_[seg].rend() && main_used + need > main_cap; ++v) {
+                if (frequency(v->key) >= cand_freq) { ++rejected; erase(cand); return; }
+                victims.push_back(std::prev(v.base()));
+                main_used -= v->key.size() + v->val.size();
+            }
+        }
+        for (auto v : victims) erase(v);
+        move(cand, PROBATION);
+    }
+
+    void move(Iter e, Seg to) {
+        size_t sz = e->key.size() + e->val.size();
+        used_[e->seg] -= sz;
+        used_[to] += sz;
+        lists_[to].splice(lists_[to].begin(), lists_[e->seg], e);
+        e->seg = to;
+    }
+
+    void erase(Iter e) {
+        used_[e->seg] -= e->key.size() + e->val.size();
+        index_.erase(e->key);
+        lists_[e->seg].erase(e);
+    }
+
+    size_t slot(uint64_t h, int i) const {
+        uint64_t h2 = (h >> 32) | 1;
+        return i * WIDTH + ((h + i * h2) & (WIDTH - 1));
+    }
+
+    static uint64_t fnv(const std::string &key) {
+        uint64_t h = FNV_OFFSET_BASIS;
+        for (unsigned char c : key) { h ^= c; h *= FNV_PRIME; }
+        return h;
+    }
+
+    void increment(const std::string &key) {
+        uint64_t h = fnv(key);
+        for (int i = 0; i < DEPTH; ++i) {
+            uint8_t &c = sketch_[slot(h, i)];
+            if (c < MAX_COUNT) ++c;
+        }
+        if (++additions_ >= 10 * WIDTH) {  // age the sketch so that yesterday's hot keys fade out
+            for (auto &c : sketch_) c >>= 1;
+            additions_ /= 2;
+        }
+    }
+
+    uint8_t frequency(const std::string &key) const {
+        uint64_t h = fnv(key);
+        uint8_t f = MAX_COUNT;
+        for (int i = 0; i < DEPTH; ++i) f = std::min(f, sketch_[slot(h, i)]);
+        return f;
+    }
+
+    size_t max_item_;
+    std::list<Entry> lists_[3];
+    size_t used_[3] = {0, 0, 0};
+    size_t cap_[3];
+    std::unordered_map<std::string, Iter> index_;
+    std::vector<uint8_t> sketch_;
+    size_t additions_ = 0;
+};
+ReadCache read_cache(READ_CACHE_BYTES, READ_CACHE_MAX_ITEM);
+
+// Send one command to the master and return its one-line reply ("" if the master is unreachable)
+std::string ask_master(const std::string &command) {
     int sock = socket(AF_INET,SOCK_STREAM,0);
     sockaddr_in m{}; m.sin_family=AF_INET; m.sin_port=htons(MASTER_PORT);
     inet_pton(AF_INET,"127.0.0.1",&m.sin_addr);
-    connect(sock,(sockaddr*)&m,sizeof(m));
-    char buf_[32];
+    if (connect(sock,(sockaddr*)&m,sizeof(m)) < 0) { close(sock); return ""; }
+    char buf_[1024];
     recv(sock,buf_,sizeof(buf_)-1,0); // expect "+OK Master ready\r\n"
-    std::ostringstream os;
-    os << "ASK_PRIMARY " << shard_i << "\r\n";
-    std::string cmd = os.str(); send_all(sock,cmd);
-    int n=recv(sock,buf_,sizeof(buf_)-1,0);
-    buf_[n] = '\0';
-    std::string resp(buf_);
+    send_all(sock, command + "\r\n");
+    std::string resp;
+    while (resp.size() < 2 || resp.compare(resp.size() - 2, 2, "\r\n") != 0) {
+        int n = recv(sock,buf_,sizeof(buf_),0);
+        if (n <= 0) break;
+        resp.append(buf_, n);
+    }
     send_all(sock, "QUIT\r\n");
     close(sock);
-    auto pos=resp.find_first_of(' ');
-    std::string primary_i=trim(resp.substr(pos+1));
-    std::cout << "[Tablet" << self_index << "] Primary for shard" << shard_i << " now is: "  << primary_i <<  std::endl;
-    return stoi(primary_i);
+    return trim(resp);
 }
 
-// Write the current kvstore (for current subtablet) to the checkpoint file (if log file is non-empty) and clear the on-disk log
-void checkpoint(int tablet) {
+// Fetch current primary index and members of this shard from master ("+OK epoch primary count idx ip:port ...")
+int query_primary() {
+    std::istringstream is(ask_master("GROUP " + std::to_string(shard_i)));
+    std::string ok;
+    uint64_t epoch;
+    int primary, count;
+    if (!(is >> ok >> epoch >> primary >> count) || ok != "+OK") return last_known_primary;
+    std::vector<int> fresh;
+    for (int i = 0; i < count; ++i) {
+        int idx;
+        std::string addr;
+        if (!(is >> idx >> addr) || addr.find(':') == std::string::npos) return last_known_primary;
+        if (idx >= (int)nodes.size()) nodes.resize(idx + 1);
+        nodes[idx] = {addr.substr(0, addr.find(':')), std::stoi(addr.substr(addr.find(':') + 1))};
+        fresh.push_back(idx);
+    }
+    group = fresh;
+    LOG_DEBUG("[Tablet" << self_index << "] Primary for shard" << shard_i << " now is: "  << primary);
+    last_known_primary = primary;
+    known_epoch = epoch;
+    group_epoch = epoch;
+    return last_known_primary;
+}
+
+// Primary of this shard for a write: the cached GROUP reply, unless the master has announced a newer epoch since
+int cached_primary() {
+    if (group_epoch != (int64_t)known_epoch.load()) return query_primary();
+    return last_known_primary;
+}
+
+// Write the current kvstore (for current subtablet) to the checkpoint file (if log file is non-empty, or if forced) and clear the on-disk log
+void checkpoint(int tablet, bool force = false) {
     std::ifstream logf(log_file + std::to_string(tablet), std::ios::binary | std::ios::ate);
     auto s = logf.tellg();
     logf.close();
-    if (s > 0) {  // if on–disk log for subtablet is empty, nothing’s changed → skip
+    if (s > 0 || force) {  // if on–disk log for subtablet is empty, nothing’s changed → skip
+        uint64_t t0 = stats::now_us();
         uint32_t prev_version = 0;
         {
             std::ifstream cp_in(checkpoint_file + std::to_string(tablet), std::ios::binary | std::ios::ate);
@@ -140,18 +387,30 @@ void checkpoint(int tablet) {
         cp.close();
         std::ofstream lf(log_file + std::to_string(tablet), std::ios::binary | std::ios::trunc);  // clear the log
         lf.close();
-        std::cout << "[Tablet" << self_index << "] Finished checkpoint v" << new_version << " for subtablet" << current_tablet << "\n";
+        checkpoint_time.add(stats::now_us() - t0);
+        LOG_INFO("[Tablet" << self_index << "] Finished checkpoint v" << new_version << " for subtablet" << current_tablet);
     } 
 }
 
+// Bytes held by kvstore (row + col + value of every cell)
+size_t kvstore_bytes() {
+    size_t total = 0;
+    for (const auto &[row, cols] : kvstore) {
+        for (const auto &[col, val] : cols) total += row.size() + col.size() + val.size();
+    }
+    return total;
+}
+
 // Load the checkpoint file of a subtablet back into kvstore in memory
 void load_back(int tablet) {
     kvstore.clear();   // must clear old data
+    resident_bytes = 0;
     current_tablet = tablet;  // must also update current tablet
+    swap_count++;
     std::ifstream cp(checkpoint_file + std::to_string(tablet), std::ios::binary | std::ios::ate);
     if (cp.tellg() == 0) {  // empty checkpoint → nothing to load back
         cp.close();
-        std::cout << "[Tablet" << self_index << "] No need to load back checkpoint (empty) for subtablet" << tablet << std::endl;
+        LOG_INFO("[Tablet" << self_index << "] No need to load back checkpoint (empty) for subtablet" << tablet);
         return;
     }
     // skip the 4-byte version header
@@ -159,7 +418,7 @@ void load_back(int tablet) {
     // if there's nothing else in the file, we're done
     if (cp.peek() == EOF) {
         cp.close();
-        std::cout << "[Tablet" << self_index << "] No need to load back checkpoint (empty) for subtablet" << tablet << std::endl;
+        LOG_INFO("[Tablet" << self_index << "] No need to load back checkpoint (empty) for subtablet" << tablet);
         return;
     }
     // now read all the triples
@@ -174,6 +433,8 @@ void load_back(int tablet) {
         cp.read(reinterpret_cast<char*>(&vl), sizeof(vl));
         std::string val(vl, '\0');
         cp.read(&val[0], vl);
+        if (get_tablet(row) != tablet) continue;  // left behind by a split that crashed before rewriting this file
+        resident_bytes += row.size() + col.size() + val.size();
         kvstore[row][col] = val;
     }
     cp.close();
@@ -214,6 +475,7 @@ void append_log(const std::string &entry) {
 void replay_log(int tablet) {
     std::ifstream lf(log_file + std::to_string(tablet), std::ios::binary);
     if (!lf) return;
+    uint64_t t0 = stats::now_us();
     uint32_t entry_count = 0;
     lf.read(reinterpret_cast<char*>(&entry_count), sizeof(entry_count));
     if (!lf) return;
@@ -231,51 +493,182 @@ void replay_log(int tablet) {
         std::string cmd = entry.substr(0, p1);
         std::string row = entry.substr(p1 + 1, p2 - p1 - 1);
         std::string col = entry.substr(p2 + 1, p3 - p2 - 1);
+        if (get_tablet(row) != tablet) continue;  // see load_back
         if (cmd == "PUT") {
             std::string payload = entry.substr(p3 + 1, L - p3 - 1);
             kvstore[row][col] = payload;
-            std::cout << "[Tablet" << self_index << "] Replayed PUT/CPUT " << row << " " << col << " with " << payload.size() << " bytes" <<  std::endl;
+            LOG_DEBUG("[Tablet" << self_index << "] Replayed PUT/CPUT " << row << " " << col << " with " << payload.size() << " bytes");
         } else if (cmd == "DELETE") {
             kvstore[row].erase(col);
-            std::cout << "[Tablet" << self_index << "] Replayed DELETE " << row << " " << col << std::endl;
+            LOG_DEBUG("[Tablet" << self_index << "] Replayed DELETE " << row << " " << col);
         }
     }
     lf.close();
+    resident_bytes = kvstore_bytes();
+    replay_time.add(stats::now_us() - t0);
 }
 
-// Return list of the sockets of all alive replicas in this shard
-std::vector<int> get_alive_replicas() {
+// Connect to another tablet and read its greeting; -1 if it cannot be reached
+int connect_tablet(int idx) {
+    const auto& [ip, port] = nodes[idx];
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+    char buf[32];
+    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0 || recv(sock, buf, sizeof(buf) - 1, 0) <= 0) {  // always "+OK Connected\r\n"
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Whether the tablet on sock is up (a KILLed one answers CHECK with -ERR)
+bool answers_check(int sock) {
+    send_all(sock, "CHECK\r\n");
+    char buf_[10];
+    ssize_t n = recv(sock, buf_, sizeof(buf_) - 1, 0);
+    return n > 0 && buf_[0] == '+';
+}
+
+// Return list of the sockets of all alive replicas in this shard, in group order (their indices go to reached and the
+// indices of the others to missed, if given). A replica that answers again has caught up (or was fully restored), so its hints are dropped.
+std::vector<int> get_alive_replicas(std::vector<int> *missed = nullptr, std::vector<int> *reached = nullptr) {
     std::vector<int> fds;
-    int base = shard_i * REPLICATION_FACTOR;
-    for (int i = 0; i < REPLICATION_FACTOR; ++i) {
-        int idx = base + i;
+    for (int idx : group) {
         if (idx == self_index) continue;
-        const auto& [ip, port] = nodes[idx];
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        sockaddr_in addr{};
-        addr.sin_family = AF_INET;
-        addr.sin_port   = htons(port);
-        inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
-        if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
-            close(sock);
+        int sock = connect_tablet(idx);
+        if (sock < 0) {
+            if (missed) missed->push_back(idx);
             continue;
         }
-        char buf[32];
-        recv(sock, buf , sizeof(buf) - 1, 0); // always "+OK Connected\r\n"
-        send_all(sock, "CHECK\r\n");
-        char buf_[10];
-        recv(sock, buf_, sizeof(buf_) - 1, 0);
-        if (buf_[0] == '+') {
+        if (answers_check(sock)) {
             fds.push_back(sock);
-            std::cout << "[Tablet" << self_index << "] Preparing to replicate to tablet" << idx <<  std::endl;
+            if (reached) reached->push_back(idx);
+            hints.erase(idx);
+            LOG_DEBUG("[Tablet" << self_index << "] Preparing to replicate to tablet" << idx);
         } else {
             send_all(sock, "QUIT\r\n");
             close(sock);
+            if (missed) missed->push_back(idx);
         }
     }
     return fds;
 }
 
+// Keep a write with this LSN for each replica that missed it (record as in HintLog)
+void add_hints(const std::vector<int> &missed, uint64_t lsn, const std::string &record) {
+    for (int idx : missed) {
+        auto [it, fresh] = hints.try_emplace(idx);
+        HintLog &h = it->second;
+        if (fresh) h.from_lsn = lsn - 1;  // writes are replicated synchronously: it had everything before this one
+        if (h.lost) continue;
+        if (h.records.size() + record.size() > MAX_HINT_BYTES) {
+            h.lost = true;
+            h.count = 0;
+            std::string().swap(h.records);
+            LOG_INFO("[Tablet" << self_index << "] Too many hints for tablet" << idx << ", it will need a full restore");
+            continue;
+        }
+        h.records += record;
+        h.count++;
+        h.to_lsn = lsn;
+    }
+}
+
+// Send one replicated write ("PUT row col N lsn [chain]" + payload, "CPUT ...", "DELETE ...") over rfd, wait for its ack and close;
+// returns the LSN the replica acknowledged (0 if it did not). In chain mode a replica that applied the write but could not
+// pass it on answers "-ERR MISSED i,j LSN n" instead: those replicas go to missed
+uint64_t send_write(int rfd, const std::string &header, const std::string *payload, std::vector<int> *missed = nullptr) {
+    char buf_[256];
+    send_all(rfd, header + "\r\n");
+    if (payload) {
+        recv(rfd, buf_, sizeof(buf_)-1, 0);  // "+OK\r\n"
+        send_all(rfd, *payload);
+    }
+    ssize_t n = recv(rfd, buf_, sizeof(buf_)-1, 0);  // "+OK ... LSN n\r\n"
+    buf_[std::max<ssize_t>(n, 0)] = '\0';
+    send_all(rfd, "QUIT\r\n");
+    close(rfd);
+    bool partial = strncmp(buf_, "-ERR MISSED ", 12) == 0;
+    if (partial && missed) {
+        std::istringstream ids(std::string(buf_ + 12, strcspn(buf_ + 12, " \r\n")));
+        for (std::string id; std::getline(ids, id, ',');) missed->push_back(std::stoi(id));
+    }
+    const char *acked = buf_[0] == '+' || partial ? strstr(buf_, " LSN ") : nullptr;
+    return acked ? strtoull(acked + 5, nullptr, 10) : 0;
+}
+
+// Chain mode: pass a write on to the first alive node of chain (replica indices in chain order), with the rest of the
+// chain appended as "i,j,..." so that it forwards it in turn. Returns the LSN the chain acknowledged (0 if no node got it)
+// and adds to missed every node of chain that did not get the write: the down ones skipped here, those reported back from
+// down the chain, and, if a node fails mid-write, that node and all after it (it is unknown how far the write went)
+uint64_t forward_chain(const std::vector<int> &chain, const std::string &header, const std::string *payload, std::vector<int> &missed) {
+    for (size_t k = 0; k < chain.size(); ++k) {
+        int rfd = chain[k] >= 0 && chain[k] < (int)nodes.size() ? connect_tablet(chain[k]) : -1;
+        if (rfd >= 0 && !answers_check(rfd)) {
+            send_all(rfd, "QUIT\r\n");
+            close(rfd);
+            rfd = -1;
+        }
+        if (rfd < 0) {  // down: the rest of the chain still gets the write
+            missed.push_back(chain[k]);
+            continue;
+        }
+        std::string rest;
+        for (size_t j = k + 1; j < chain.size(); ++j) rest += (rest.empty() ? " " : ",") + std::to_string(chain[j]);
+        uint64_t acked = send_write(rfd, header + rest, payload, &missed);
+        if (!acked) missed.insert(missed.end(), chain.begin() + k, chain.end());
+        return acked;
+    }
+    return 0;
+}
+
+// "i,j,..." of a replicated write: the replicas after us in the chain
+std::vector<int> parse_chain(const std::string &chain) {
+    std::vector<int> next;
+    std::istringstream ids(chain);
+    for (std::string id; std::getline(ids, id, ',');) next.push_back(std::stoi(id));
+    return next;
+}
+
+// Chain mode, on a replica: the ack for upstream, unless some of the chain after us did not get the write
+std::string chain_ack(const std::string &ack, uint64_t lsn, const std::vector<int> &missed) {
+    if (missed.empty()) return ack;
+    std::string ids;
+    for (int idx : missed) ids += (ids.empty() ? "" : ",") + std::to_string(idx);
+    return "-ERR MISSED " + ids + " LSN " + std::to_string(lsn) + "\r\n";
+}
+
+// Primary: push one write to the other replicas, to all of them (primary mode) or down the chain (chain mode); returns
+// the replicas that did not get it (for hints)
+std::vector<int> replicate(const std::string &header, const std::string *payload) {
+    uint64_t t0 = stats::now_us();
+    std::vector<int> missed, reached;
+    if (chain_replication) {
+        std::vector<int> chain;
+        for (int idx : group) if (idx != self_index) chain.push_back(idx);
+        uint64_t acked = forward_chain(chain, header, payload, missed);
+        for (int idx : chain) {
+            if (std::find(missed.begin(), missed.end(), idx) != missed.end()) continue;
+            reached.push_back(idx);
+            hints.erase(idx);  // answered CHECK: caught up (as in get_alive_replicas)
+            replica_lsn[idx] = acked;  // the write went down the chain through it
+        }
+    } else {
+        std::vector<int> fds = get_alive_replicas(&missed, &reached);
+        for (size_t k = 0; k < fds.size(); ++k) {
+            uint64_t acked = send_write(fds[k], header, payload);
+            if (acked) replica_lsn[reached[k]] = acked;
+        }
+    }
+    for (int idx : missed) replica_lsn.try_emplace(idx, applied_lsn - 1);  // synchronous: it had all before this write
+    repl_time.add(stats::now_us() - t0);
+    LOG_DEBUG("[Tablet" << self_index << "] propogated " << header.substr(0, header.find(' ')) << " to " << reached.size() << " replicas");
+    return missed;
+}
+
 // Return the latest checkpoint version for a given sub‐tablet (can be 0 if empty) based on the first 4 bytes
 int version_of_checkpoint(int tablet) {  // do not need lock since it's only used during recovery
     std::string path = checkpoint_file + std::to_string(tablet);
@@ -304,18 +697,53 @@ int log_count(int tablet) {
     return static_cast<int>(entry_count);
 }
 
-// Stay synced with primary's chk + log
+// After "LOG_NUM": fetch the last `wanted` of the primary's prim_count log entries for a subtablet, appended to my log
+// (which must hold the entries before them) or replacing it
+void copy_log_from_prim(int tablet, int sock, int prim_count, int wanted, bool append) {
+    char buffer[128];
+    send_all(sock, std::to_string(wanted) + "\r\n");
+    std::fstream log;
+    if (append) {
+        log.open(log_file + std::to_string(tablet), std::ios::binary | std::ios::in | std::ios::out);
+    } else {
+        log.open(log_file + std::to_string(tablet), std::ios::binary | std::ios::out | std::ios::trunc);
+    }
+    uint32_t cnt = static_cast<uint32_t>(prim_count);
+    log.seekp(0, std::ios::beg);
+    log.write(reinterpret_cast<const char*>(&cnt), sizeof(cnt));
+    log.seekp(0, std::ios::end);  // append to end the missing ones
+    int n = recv(sock, buffer, sizeof(buffer)-1, 0);
+    buffer[std::max(n, 0)] = '\0';
+    int bytes_count = (int)strtoull(buffer, nullptr, 10);
+    send_all(sock, "READY\r\n");
+    constexpr size_t chunk = 1024 * 1024;
+    std::vector<char> temp(chunk);
+    int remain = bytes_count;
+    while (remain > 0) {
+        int toread = std::min((int)chunk, remain);
+        ssize_t r_ = recv(sock, temp.data(), toread, 0);
+        if (r_ <= 0) break;
+        log.write(temp.data(), r_);
+        remain -= (int)r_;
+    }
+    log.close();
+    LOG_INFO("[Tablet" << self_index << "] Restored log file for subtablet" << tablet << " (" << wanted << (append ? " missing" : "") << " entries, " << bytes_count << " bytes)");
+}
+
+// Stay synced with primary's chk + log. Only an equal checkpoint version and a shorter log of mine are patched (my
+// entries are then the primary's first ones); any other difference takes the primary's checkpoint and/or whole log
 void restore_tablet_with_prim(int tablet, int sock) {
     send_all(sock, "CHECKPOINT_VERSION " + std::to_string(tablet) + "\r\n");
     char buffer[128];
     int n = recv(sock, buffer, sizeof(buffer)-1, 0);
-    buffer[n] = '\0';  
+    buffer[std::max(n, 0)] = '\0';
     int prim_version = (int)strtoull(buffer, nullptr, 10);
     int my_version = version_of_checkpoint(tablet);
-    if (prim_version > my_version) {
+    bool copy_checkpoint = prim_version != my_version;
+    if (copy_checkpoint) {
         send_all(sock, "WANT\r\n");
         n = recv(sock, buffer, sizeof(buffer)-1, 0);
-        buffer[n] = '\0';
+        buffer[std::max(n, 0)] = '\0';
         int byte_count = (int)strtoull(buffer, nullptr, 10);
         send_all(sock, "READY\r\n");
         std::ofstream cp(checkpoint_file + std::to_string(tablet), std::ios::binary | std::ios::trunc);
@@ -325,94 +753,103 @@ void restore_tablet_with_prim(int tablet, int sock) {
         while (remaining > 0) {
             int to_read = std::min((int)CHUNK, remaining);
             ssize_t r = recv(sock, tmp.data(), to_read, 0);
+            if (r <= 0) break;
             cp.write(tmp.data(), r);
             remaining -= r;
         }
         cp.close();
-        std::cout << "[Tablet" << self_index << "] Restored checkpoint v" << prim_version << " for subtablet" << tablet << " (" << byte_count << " bytes)\n";
-        send_all(sock, "LOG_NUM " + std::to_string(tablet) + "\r\n");
-        n = recv(sock, buffer, sizeof(buffer)-1, 0);
-        buffer[n] = '\0';  
-        int prim_log_count = (int)strtoull(buffer, nullptr, 10);
+        LOG_INFO("[Tablet" << self_index << "] Restored checkpoint v" << prim_version << " for subtablet" << tablet << " (" << byte_count << " bytes, had v" << my_version << ")");
+    } else {
+        send_all(sock, "NO_NEED\r\n");
+        char ack[32];
+        recv(sock, ack, sizeof(ack)-1, 0);
+        LOG_INFO("[Tablet" << self_index << "] No need to change chk file for subtablet" << tablet);
+    }
+    send_all(sock, "LOG_NUM " + std::to_string(tablet) + "\r\n");
+    n = recv(sock, buffer, sizeof(buffer)-1, 0);
+    buffer[std::max(n, 0)] = '\0';
+    int prim_log_count = (int)strtoull(buffer, nullptr, 10);
+    int my_log_count = log_count(tablet);
+    if (prim_log_count == 0 || (!copy_checkpoint && prim_log_count == my_log_count)) {
         if (prim_log_count == 0) {
             std::ofstream lf(log_file + std::to_string(tablet), std::ios::binary | std::ios::trunc);  // clear the log
-            lf.close();
-            send_all(sock, "NO_NEED\r\n");
-            recv(sock, buffer, sizeof(buffer)-1, 0);
-            std::cout << "[Tablet" << self_index << "] No need to change log file for subtablet" << tablet <<" \n";
-            return;
-        }
-        send_all(sock, std::to_string(prim_log_count) + "\r\n");
-        std::ofstream log(log_file + std::to_string(tablet), std::ios::binary | std::ios::trunc);
-        uint32_t cnt = static_cast<uint32_t>(prim_log_count);
-        log.write(reinterpret_cast<const char*>(&cnt), sizeof(cnt));
-        n = recv(sock, buffer, sizeof(buffer)-1, 0);
-        buffer[n] = '\0';
-        int bytes_count = (int)strtoull(buffer, nullptr, 10);
-        send_all(sock, "READY\r\n");
-        constexpr size_t chunk = 1024 * 1024;
-        std::vector<char> temp(chunk);
-        int remain = bytes_count;
-        while (remain > 0) {
-            int toread = std::min((int)chunk, remain);
-            ssize_t r_ = recv(sock, temp.data(), toread, 0);
-            log.write(temp.data(), r_);
-            remain -= (int)r_;
         }
-        log.close();
-        std::cout << "[Tablet" << self_index << "] Restored log file for subtablet" << tablet << " (" << bytes_count << " bytes)\n";
-    } else {  // must be equal (prim_version can never be smaller than mine)
         send_all(sock, "NO_NEED\r\n");
-        char ack[32];
-        recv(sock, ack, sizeof(ack)-1, 0);
-        std::cout << "[Tablet" << self_index << "] No need to change chk file for subtablet" << tablet << "\n";
-        send_all(sock, "LOG_NUM " + std::to_string(tablet) + "\r\n");
-        n = recv(sock, buffer, sizeof(buffer)-1, 0);
-        std::cout << n << "\n";
-        buffer[n] = '\0';
-        int prim_log_count = (int)strtoull(buffer, nullptr, 10);
-        int my_log_count = log_count(tablet);
-        if (prim_log_count == my_log_count) {
-            send_all(sock, "NO_NEED\r\n");
-            std::cout << "[Tablet" << self_index << "] No need to change log file for subtablet" << tablet <<" \n";
-            recv(sock, ack, sizeof(ack)-1, 0);
-        } else {   // then it must be "prim_log_count > my_log_count" here
-            int miss_log_count = prim_log_count - my_log_count;
-            send_all(sock, std::to_string(miss_log_count) + "\r\n");
-            std::fstream log(log_file + std::to_string(tablet), std::ios::binary | std::ios::in | std::ios::out);
-            uint32_t cnt = static_cast<uint32_t>(prim_log_count);
-            log.seekp(0, std::ios::beg);
-            log.write(reinterpret_cast<const char*>(&cnt), sizeof(cnt));
-            log.seekp(0, std::ios::end);  // append to end the missing ones
-            n = recv(sock, buffer, sizeof(buffer)-1, 0);
-            buffer[n] = '\0';
-            int bytes_count = (int)strtoull(buffer, nullptr, 10);
-            send_all(sock, "READY\r\n");
-            constexpr size_t chunk = 1024 * 1024;
-            std::vector<char> temp(chunk);
-            int remain = bytes_count;
-            while (remain > 0) {
-                int toread = std::min((int)chunk, remain);
-                ssize_t r_ = recv(sock, temp.data(), toread, 0);
-                log.write(temp.data(), r_);
-                remain -= (int)r_;
-            }
-            log.close();
-            std::cout << "[Tablet" << self_index << "] Restored log file for subtablet" << tablet << " (" << miss_log_count << " missing entries)\n";
+        recv(sock, buffer, sizeof(buffer)-1, 0);
+        LOG_INFO("[Tablet" << self_index << "] No need to change log file for subtablet" << tablet);
+    } else if (!copy_checkpoint && my_log_count > 0 && prim_log_count > my_log_count) {
+        copy_log_from_prim(tablet, sock, prim_log_count, prim_log_count - my_log_count, true);
+    } else {  // a new checkpoint, or a log that does not extend mine: all of the primary's
+        copy_log_from_prim(tablet, sock, prim_log_count, prim_log_count, false);
+    }
+}
+
+// Ask primary for its LSN so that this (recovered) replica continues the same sequence
+uint64_t query_lsn(int sock) {
+    send_all(sock, "LSN\r\n");
+    char buffer[64];
+    int n = recv(sock, buffer, sizeof(buffer)-1, 0);
+    if (n <= 0) return 0;
+    buffer[n] = '\0';
+    return strtoull(buffer + 4, nullptr, 10);  // "+OK lsn\r\n"
+}
+
+// Persist the subtablet layout ("count\nresidue modulus\n..."), atomically via rename
+void save_layout() {
+    std::ofstream out(layout_file + ".tmp", std::ios::trunc);
+    out << layout.size() << "\n";
+    for (const auto &t : layout) out << t.residue << " " << t.modulus << "\n";
+    out.close();
+    fs::rename(layout_file + ".tmp", layout_file);
+}
+
+// Read the layout back; a node without a layout file still has the initial 3 subtablets
+void load_layout() {
+    layout.clear();
+    std::ifstream in(layout_file);
+    size_t count = 0;
+    if (in >> count) {
+        for (size_t i = 0; i < count; ++i) {
+            Subtablet t{0, 1};
+            in >> t.residue >> t.modulus;
+            layout.push_back(t);
         }
     }
+    if (layout.empty()) {
+        for (int i = 0; i < initial_tablets; ++i) layout.push_back({(uint64_t)i, (uint64_t)initial_tablets});
+    }
+}
+
+// Adopt a layout given as "count r0 m0 r1 m1 ..." (from the primary) and make sure every subtablet has its files
+void adopt_layout(std::istream &in) {
+    size_t count = 0;
+    in >> count;
+    std::vector<Subtablet> fresh;
+    for (size_t i = 0; i < count; ++i) {
+        Subtablet t{0, 1};
+        in >> t.residue >> t.modulus;
+        fresh.push_back(t);
+    }
+    if (fresh.empty()) return;
+    layout = fresh;
+    save_layout();
+    for (size_t t = 0; t < layout.size(); ++t) {
+        if (!fs::exists(checkpoint_file + std::to_string(t))) std::ofstream(checkpoint_file + std::to_string(t), std::ios::binary);
+        if (!fs::exists(log_file + std::to_string(t))) std::ofstream(log_file + std::to_string(t), std::ios::binary);
+    }
 }
 
 // Recover
 void recover() {
-    std::cout << "[Tablet" << self_index << "] Recovering..." <<  std::endl;
+    LOG_INFO("[Tablet" << self_index << "] Recovering...");
     all_row_col.clear();
+    read_cache.clear();  // values may have changed while this node was down
     int primary = query_primary();   // get primary index
     // SCENARIO 1: I am the primary (but I just recovered, meaning others in this shard all died)
     if (primary == -1 || primary == self_index) {
-        std::cout << "[Tablet" << self_index << "] Recover: Now I am the only one alive for this shard\n";
+        LOG_INFO("[Tablet" << self_index << "] Recover: Now I am the only one alive for this shard");
         // rebuild kvstore & schema for each subtablet
-        for (int t = num_tablets - 1; t >= 0; --t) {
+        for (int t = (int)layout.size() - 1; t >= 0; --t) {
             // restore this sub-tablet’s data
             load_back(t);
             replay_log(t);
@@ -438,15 +875,22 @@ void recover() {
     connect(sock, (sockaddr*)&addr, sizeof(addr));
     char buf[64];
     recv(sock, buf, sizeof(buf)-1, 0);  // "+OK Connected\r\n"
-    send_all(sock, "CUR_TAB\r\n");
-    char buffer[128];
+    send_all(sock, "LAYOUT\r\n");  // subtablets may have split while I was down
+    char buffer[4096];
     int n = recv(sock, buffer, sizeof(buffer)-1, 0);
+    buffer[std::max(n, 0)] = '\0';
+    if (strncmp(buffer, "+OK ", 4) == 0) {
+        std::istringstream layout_in(buffer + 4);
+        adopt_layout(layout_in);
+    }
+    send_all(sock, "CUR_TAB\r\n");
+    n = recv(sock, buffer, sizeof(buffer)-1, 0);
     buffer[n] = '\0';
     // ask for current tablet in memory of primary to stay synced
     const int cur_tablet = (int)strtoull(buffer, nullptr, 10);
-    for (int i = 0; i < num_tablets; ++i) {
+    for (int i = 0; i < (int)layout.size(); ++i) {
         if (i == cur_tablet) continue;
-        std::cout << "[Tablet" << self_index << "] Recover: restore subtablet" << i << "\n";
+        LOG_INFO("[Tablet" << self_index << "] Recover: restore subtablet" << i);
         restore_tablet_with_prim(i, sock);  // restore based on many cases/scenarios optimally, see this helper function above
         load_back(i);
         replay_log(i);
@@ -457,7 +901,7 @@ void recover() {
         }
     }
     // now load_back + replay that current tablet
-    std::cout << "[Tablet" << self_index << "] Recover: restore subtablet" << cur_tablet << "\n";
+    LOG_INFO("[Tablet" << self_index << "] Recover: restore subtablet" << cur_tablet);
     restore_tablet_with_prim(cur_tablet, sock);
     load_back(cur_tablet);
     replay_log(cur_tablet);
@@ -467,30 +911,243 @@ void recover() {
         }
     }
     current_tablet = cur_tablet;
+    applied_lsn = query_lsn(sock);
     send_all(sock, "QUIT\r\n");
     close(sock);
-    std::cout << "[Tablet" << self_index << "] Recover: Synced chk+log with primary's" <<  std::endl;
+    LOG_INFO("[Tablet" << self_index << "] Recover: Synced chk+log with primary's");
 }
 
 void propogate_load(int tab) {
     for (const int& rfd : get_alive_replicas()) {
-        send_all(rfd, "LOAD " + std::to_string(tab) + "\r\n");
+        // name the subtablet checkpointed here too: a secondary may have another one resident (serving a read)
+        send_all(rfd, "LOAD " + std::to_string(tab) + " " + std::to_string(current_tablet) + "\r\n");
         char buf[32];
         recv(rfd, buf, sizeof(buf)-1, 0);  // "+OK\r\n"
         send_all(rfd, "QUIT\r\n");
         close(rfd);
-        std::cout << "[Tablet" << self_index << "] propogated LOAD to another replica" << std::endl;
+        LOG_DEBUG("[Tablet" << self_index << "] propogated LOAD to another replica");
     }
     checkpoint(current_tablet);
     load_back(tab);
-    std::cout << "[Tablet" << self_index << "] current subtab is " << current_tablet << std::endl;
+    LOG_DEBUG("[Tablet" << self_index << "] current subtab is " << current_tablet);
+}
+
+// Make subtablet tab resident without a checkpoint: the resident one is dropped (its checkpoint + log still hold it)
+// and tab is rebuilt from its checkpoint + log. Secondaries swap this way, so that they only checkpoint when the
+// primary does (on LOAD) and their checkpoint versions and log counts stay those of the primary (see recover()).
+void load_without_checkpoint(int tab) {
+    if (tab == current_tablet) return;
+    load_back(tab);
+    replay_log(tab);
+    resident_bytes = kvstore_bytes();
+}
+
+// Make subtablet tab resident; only the primary propagates the swap, a secondary (e.g. serving a read) swaps locally
+void ensure_resident(int tab, bool is_primary) {
+    if (tab == current_tablet) return;
+    if (is_primary) {
+        propogate_load(tab);
+    } else {
+        load_without_checkpoint(tab);
+    }
+}
+
+// Split resident subtablet tab: rows whose next hash bit is set move to a new subtablet with its own checkpoint and log.
+// Order on disk: new checkpoint, then layout, then the shrunk checkpoint (load_back/replay_log skip rows of other subtablets,
+// so a crash in between only leaves harmless duplicates). Returns the new subtablet index, or -1 if nothing would move
+// (replicas pass required = true: they must follow the primary's layout either way).
+int split_tablet(int tab, bool required = false) {
+    uint64_t t0 = stats::now_us();
+    int fresh = (int)layout.size();
+    Subtablet upper{layout[tab].residue + layout[tab].modulus, layout[tab].modulus * 2};
+    std::unordered_map<std::string, std::unordered_map<std::string,std::string>> moved;
+    for (const auto &[row, cols] : kvstore) {
+        uint64_t h = FNV_OFFSET_BASIS;
+        for (unsigned char c : row) { h ^= c; h *= FNV_PRIME; }
+        if ((h / num_shards) % upper.modulus == upper.residue) moved[row] = cols;
+    }
+    if (!required && (moved.empty() || moved.size() == kvstore.size())) return -1;  // cannot separate anything
+    for (const auto &[row, cols] : moved) kvstore.erase(row);
+    layout[tab].modulus *= 2;
+    layout.push_back(upper);
+    std::swap(kvstore, moved);  // write the new half as subtablet "fresh"
+    std::ofstream(log_file + std::to_string(fresh), std::ios::binary | std::ios::trunc);
+    checkpoint(fresh, true);
+    std::swap(kvstore, moved);
+    save_layout();
+    checkpoint(tab, true);
+    resident_bytes = kvstore_bytes();
+    LOG_INFO("[Tablet" << self_index << "] Split subtablet" << tab << " -> " << tab << "+" << fresh << " (" << moved.size()
+             << " rows moved, " << layout.size() << " subtablets, took " << (stats::now_us() - t0) << "us)");
+    return fresh;
+}
+
+// Count a request against subtablet tab (requests per second over 1s windows)
+void note_op(int tab) {
+    Subtablet &t = layout[tab];
+    uint64_t now_ms = stats::now_us() / 1000;
+    if (now_ms - t.window_start_ms >= 1000) {
+        t.last_qps = t.window_start_ms ? t.window_ops * 1000 / (now_ms - t.window_start_ms) : 0;
+        t.window_start_ms = now_ms;
+        t.window_ops = 0;
+    }
+    t.window_ops++;
+}
+
+// On the primary, split the resident subtablet once it is too big or too hot, and have the replicas do the same
+void maybe_split(int tab) {
+    if (last_known_primary != self_index || tab != current_tablet || layout.size() >= MAX_SUBTABLETS) return;
+    Subtablet &t = layout[tab];
+    bool too_big = resident_bytes > std::max(SPLIT_BYTES, t.next_split_bytes);
+    bool too_hot = t.last_qps > SPLIT_QPS;
+    if (!too_big && !too_hot) return;
+    t.last_qps = 0;  // at most one attempt per rate window
+    if (split_tablet(tab) < 0) {
+        layout[tab].next_split_bytes = resident_bytes * 2;
+        return;
+    }
+    std::vector<int> missed;
+    for (int rfd : get_alive_replicas(&missed)) {
+        send_all(rfd, "SPLIT " + std::to_string(tab) + "\r\n");
+        char buf_[64];
+        recv(rfd, buf_, sizeof(buf_)-1, 0);  // "+OK\r\n"
+        send_all(rfd, "QUIT\r\n");
+        close(rfd);
+        LOG_DEBUG("[Tablet" << self_index << "] propogated SPLIT to another replica");
+    }
+    for (int idx : missed) hints[idx].lost = true;  // hints cannot replay a layout change
+}
+
+// Record a mutation: the primary assigns the next LSN, a replica adopts the one the primary sent along (0 if none)
+uint64_t advance_lsn(uint64_t from_primary) {
+    applied_lsn = from_primary > 0 ? from_primary : applied_lsn + 1;
+    lsn_cv.notify_all();
+    return applied_lsn;
+}
+
+// Block (releasing the mutex) until this replica has applied min_lsn; false if it did not catch up in time
+bool wait_for_lsn(std::unique_lock<stats::TimedMutex> &lk, uint64_t min_lsn) {
+    if (applied_lsn >= min_lsn) return true;
+    return lsn_cv.wait_for(lk, std::chrono::milliseconds(LSN_WAIT_MS), [&] { return applied_lsn >= min_lsn; });
+}
+
+// Apply a PUT to the resident subtablet (log, kvstore, row/col index, cache) (caller holds mutex and made row resident)
+void store_put(const std::string &row, const std::string &col, const std::string &value) {
+    append_log("PUT " + row + " " + col + " " + value);
+    size_t before = kvstore.count(row) && kvstore[row].count(col) ? row.size() + col.size() + kvstore[row][col].size() : 0;
+    kvstore[row][col] = value;
+    resident_bytes += row.size() + col.size() + value.size() - before;
+    all_row_col[row].insert(col);
+    if (tracking) dirty_rows.insert(row);
+    read_cache.invalidate(row + " " + col);
+}
+
+// Same for a DELETE
+void store_delete(const std::string &row, const std::string &col) {
+    append_log("DELETE " + row + " " + col);
+    if (kvstore.count(row) && kvstore[row].count(col)) resident_bytes -= row.size() + col.size() + kvstore[row][col].size();
+    if (kvstore.count(row)) kvstore[row].erase(col);
+    if (all_row_col.count(row)) all_row_col[row].erase(col);
+    if (all_row_col.count(row) && all_row_col[row].empty()) {  // a row without columns is gone (as it would be after recovery)
+        all_row_col.erase(row);
+        if (kvstore.count(row) && kvstore[row].empty()) kvstore.erase(row);
+    }
+    if (tracking) dirty_rows.insert(row);
+    read_cache.invalidate(row + " " + col);
+}
+
+// After a KILL, catch up by replaying the writes the primary kept for us ("HINTS") instead of restoring every
+// subtablet; false if that is not possible (no state in memory, primary unknown, hints lost) and recover() must run
+bool catch_up_from_hints() {
+    uint64_t t0 = stats::now_us();
+    uint64_t lsn = applied_lsn;
+    if (lsn == 0) return false;
+    int primary = query_primary();
+    if (primary == -1 || primary == self_index) return false;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(nodes[primary].second);
+    inet_pton(AF_INET, nodes[primary].first.c_str(), &addr.sin_addr);
+    char buffer[128];
+    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0 || recv(sock, buffer, sizeof(buffer)-1, 0) <= 0) {  // "+OK Connected\r\n"
+        close(sock);
+        return false;
+    }
+    send_all(sock, "HINTS " + std::to_string(self_index) + " " + std::to_string(lsn) + "\r\n");
+    int n = recv(sock, buffer, sizeof(buffer)-1, 0);
+    buffer[std::max(n, 0)] = '\0';
+    std::istringstream header(buffer);
+    std::string ok;
+    uint64_t count = 0;
+    size_t bytes = 0;
+    int prim_tablet = 0;
+    if (!(header >> ok >> count >> bytes >> prim_tablet) || ok != "+OK") {  // "-ERR NO_HINTS"
+        LOG_INFO("[Tablet" << self_index << "] No usable hints at LSN " << lsn << ", full restore");
+        send_all(sock, "QUIT\r\n");
+        close(sock);
+        return false;
+    }
+    send_all(sock, "READY\r\n");
+    std::string records = recv_all(sock, bytes);
+    if (records.size() != bytes) {
+        close(sock);
+        return false;
+    }
+    {
+        std::lock_guard<stats::TimedMutex> m_(mutex);
+        size_t pos = 0;
+        while (pos < records.size()) {
+            size_t eol = records.find('\n', pos);
+            std::istringstream rec(records.substr(pos, eol - pos));
+            pos = eol + 1;
+            uint64_t rec_lsn;
+            std::string op, row, col;
+            size_t len = 0;
+            rec >> rec_lsn >> op >> row >> col >> len;
+            ensure_resident(get_tablet(row), false);
+            if (op == "PUT") {
+                store_put(row, col, records.substr(pos, len));
+                pos += len;
+            } else {
+                store_delete(row, col);
+            }
+            advance_lsn(rec_lsn);
+        }
+        ensure_resident(prim_tablet, false);  // follow the primary's resident subtablet again
+        dead = false;  // before the primary lets the next write through, so that one is replicated to us
+    }
+    send_all(sock, "+OK\r\n");
+    recv(sock, buffer, sizeof(buffer)-1, 0);  // "+OK\r\n": the primary dropped the hints
+    send_all(sock, "QUIT\r\n");
+    close(sock);
+    hint_time.add(stats::now_us() - t0);
+    LOG_INFO("[Tablet" << self_index << "] Caught up from LSN " << lsn << " to " << applied_lsn << " with " << count << " hints");
+    return true;
+}
+
+// Command group of cmd for STATS
+int op_of(const std::string &cmd) {
+    if (cmd == "GET") return OP_GET;
+    if (cmd == "PUT") return OP_PUT;
+    if (cmd == "CPUT") return OP_CPUT;
+    if (cmd == "DELETE") return OP_DELETE;
+    if (cmd == "GET_ROWS") return OP_GET_ROWS;
+    if (cmd == "GET_COLS") return OP_GET_COLS;
+    if (cmd == "CHECKPOINT_VERSION" || cmd == "LOG_NUM" || cmd == "CUR_TAB" || cmd == "LOAD" || cmd == "LSN" || cmd == "SPLIT" || cmd == "LAYOUT" || cmd == "HINTS") return OP_RECOVERY;
+    if (cmd == "TRACK_START" || cmd == "TRACK_DRAIN" || cmd == "TRACK_STOP") return OP_ADMIN;
+    if (cmd == "KILL" || cmd == "RESTART" || cmd == "CHECK" || cmd == "STATS") return OP_ADMIN;
+    if (cmd == "FPUT" || cmd == "FGET" || cmd == "FDELETE") return OP_FRAGMENT;
+    return OP_OTHER;
 }
 
 void handle_client(int cfd) {
     char buffer[4096];
     while (running) {
         ssize_t n = recv(cfd, buffer, sizeof(buffer)-1, 0);
+        if (n <= 0) break;  // peer closed (or error): do not spin on a dead socket
         buffer[n] = '\0';
+        stats::note_in(n);
         // Strip trailing "\r\n" (it must exist for normal commands)
         std::string command(buffer);
         if (command.size() >= 2 && command.substr(command.size()-2) == "\r\n") {
@@ -499,147 +1156,185 @@ void handle_client(int cfd) {
         std::istringstream line(command);
         std::string cmd; 
         line >> cmd;
+        if (!cmd.empty() && cmd[0] == '@') {  // "@epoch CMD ...": the client routed this request with that shard map
+            uint64_t tag = strtoull(cmd.c_str() + 1, nullptr, 10), known = known_epoch;
+            line >> cmd;
+            if (tag < known) {
+                stats::OpScope op_scope(op_of(cmd));
+                send_all(cfd, "-ERR STALE_EPOCH " + std::to_string(known) + "\r\n");
+                LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " routed " << cmd << " with epoch " << tag << " but the map is at " << known);
+                continue;
+            }
+            // a newer tag means the master moved on before its CHECK reached us: refresh the group on the next write
+            while (tag > known && !known_epoch.compare_exchange_weak(known, tag)) {}
+        }
+        stats::OpScope op_scope(op_of(cmd));
         if (cmd == "GET") {
             std::string row, col;
-            line >> row >> col;
-            std::lock_guard<std::mutex> m_(mutex);
-            std::cout << "[Tablet" << self_index << "] client" << cfd << ": GET " << row << " " << col <<  std::endl;
-            if (!all_row_col.count(row) || !all_row_col[row].count(col)) {
-                std::cout << "[Tablet" << self_index << "] client" << cfd << ": " << row << " " << col << " not found" << std::endl;
+            uint64_t min_lsn = 0;  // optional read-your-writes token
+            line >> row >> col >> min_lsn;
+            std::unique_lock<stats::TimedMutex> m_(mutex);
+            LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << ": GET " << row << " " << col);
+            if (!wait_for_lsn(m_, min_lsn)) {
+                send_all(cfd, "-ERR STALE " + std::to_string(applied_lsn) + "\r\n");
+                LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " wants LSN " << min_lsn << " but I am at " << applied_lsn);
+            } else if (!all_row_col.count(row) || !all_row_col[row].count(col)) {
+                LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << ": " << row << " " << col << " not found");
                 send_all(cfd, "-ERR Not found\r\n");
             } else {
+                std::string cached;
+                bool hit = read_cache.get(row + " " + col, cached);
                 int tab = get_tablet(row);
-                if (tab != current_tablet) {
-                    propogate_load(tab);
+                note_op(tab);
+                if (!hit && standby && tab != current_tablet && last_known_primary != self_index) {
+                    // swapping would cost the standby its warm subtablet (and the takeover a reload): the primary serves it
+                    send_all(cfd, "-ERR COLD\r\n");
+                    continue;
+                }
+                if (!hit) {
+                    ensure_resident(tab, last_known_primary == self_index);
+                    read_cache.offer(row + " " + col, kvstore[row][col]);
                 }
-                const auto &val = kvstore[row][col];
+                const auto &val = hit ? cached : kvstore[row][col];
                 // send size, recv READY, then send data
                 std::string hdr = "+OK " + std::to_string(val.size()) + "\r\n";
                 send_all(cfd, hdr);
-                std::cout << "[Tablet" << self_index << "] client" << cfd << " should be ready for " << std::to_string(val.size()) << " bytes" << std::endl;
+                LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " should be ready for " << std::to_string(val.size()) << " bytes");
                 char buf[64];
                 recv(cfd, buf, sizeof(buf)-1, 0); // expect "READY\r\n"
                 send_all(cfd, val);
-                std::cout << "[Tablet" << self_index << "] client" << cfd << " should have received " << std::to_string(val.size()) << " bytes" << std::endl;
+                LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " should have received " << std::to_string(val.size()) << " bytes");
+                if (!hit) maybe_split(tab);
             }
         } else if (cmd == "PUT") {
             std::string row, col;
             size_t N;
-            line >> row >> col >> N;
-            std::lock_guard<std::mutex> m_(mutex);
+            uint64_t lsn = 0;  // only present when the primary replicates to us
+            std::string chain;  // chain mode: the replicas after us
+            line >> row >> col >> N >> lsn >> chain;
+            std::lock_guard<stats::TimedMutex> m_(mutex);
             int tab = get_tablet(row);
-            int prim = query_primary();
-            if (prim == self_index && current_tablet != tab) {
-                propogate_load(tab);
-            }
+            int prim = cached_primary();
+            ensure_resident(tab, prim == self_index);
+            note_op(tab);
             send_all(cfd, "+OK\r\n"); // acknowledge before receiving payload
-            std::cout << "[Tablet" << self_index << "] Expect " << N << " bytes coming for PUT " << row << " " << col << " from client" << cfd << std::endl;
+            LOG_DEBUG("[Tablet" << self_index << "] Expect " << N << " bytes coming for PUT " << row << " " << col << " from client" << cfd);
             // receive exactly N bytes of data
             std::string payload = recv_all(cfd, N);
-            append_log("PUT " + row + " " + col + " " + payload);  // log
-            kvstore[row][col] = payload;
-            send_all(cfd, "+OK All bytes received\r\n");
-            all_row_col[row].insert(col);
-            std::cout << "[Tablet" << self_index << "] client" << cfd << ": successful PUT " << row << " " << col << " with " << N << " bytes" << std::endl;
-            // replicate
+            if (payload.size() != N) {  // the sender went away mid-payload: replicating a short value would hang the replicas
+                LOG_INFO("[Tablet" << self_index << "] client" << cfd << ": PUT " << row << " " << col << " cut short, dropped");
+                break;
+            }
+            store_put(row, col, payload);
+            lsn = advance_lsn(lsn);
+            const std::string ack = "+OK All bytes received LSN " + std::to_string(lsn) + "\r\n";
+            if (!chain_replication) send_all(cfd, ack);
+            LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << ": successful PUT " << row << " " << col << " with " << N << " bytes");
+            // replicate (in chain mode first: the ack comes back from the tail)
+            const std::string header = "PUT " + row + " " + col + " " + std::to_string(N) + " " + std::to_string(lsn);
+            std::vector<int> missed;  // replicas that did not get the write
             if (prim == self_index) {
-                for (const int& rfd : get_alive_replicas()) {
-                    send_all(rfd, "PUT " + row + " " + col + " " + std::to_string(N) + "\r\n");
-                    char buf_[64];
-                    recv(rfd, buf_, sizeof(buf_)-1, 0);  // "+OK\r\n"
-                    send_all(rfd, payload);
-                    recv(rfd, buf_, sizeof(buf_)-1, 0);  // "+OK All bytes received\r\n"
-                    send_all(rfd, "QUIT\r\n");
-                    close(rfd);
-                    std::cout << "[Tablet" << self_index << "] propogated PUT to another replica" << std::endl;
-                }
+                missed = replicate(header, &payload);
+                if (!missed.empty()) add_hints(missed, lsn, std::to_string(lsn) + " PUT " + row + " " + col + " " + std::to_string(N) + "\n" + payload);
+            } else if (!chain.empty()) {
+                forward_chain(parse_chain(chain), header, &payload, missed);
             }
+            if (chain_replication) send_all(cfd, prim == self_index ? ack : chain_ack(ack, lsn, missed));  // (the primary hinted its misses)
+            maybe_split(tab);
         } else if (cmd == "CPUT") {
             std::string row, col, oldv, newv;
-            line >> row >> col >> oldv >> newv;
-            std::lock_guard<std::mutex> m_(mutex);
+            uint64_t lsn = 0;
+            std::string chain;
+            line >> row >> col >> oldv >> newv >> lsn >> chain;
+            std::lock_guard<stats::TimedMutex> m_(mutex);
             int tab = get_tablet(row);
-            int prim = query_primary();
-            if (prim == self_index && current_tablet != tab) {
-                propogate_load(tab);
-            }
+            int prim = cached_primary();
+            ensure_resident(tab, prim == self_index);
+            note_op(tab);
             if (kvstore.count(row) && kvstore[row].count(col) && kvstore[row][col] == oldv) {
-                append_log("PUT " + row + " " + col + " " + newv); // reduce successful CPUT to PUT in LOG
-                kvstore[row][col] = newv;
-                send_all(cfd, "+OK CPUT Success\r\n");
-                std::cout << "[Tablet" << self_index << "] CPUT success for " << row << " " << col << " with new value " << newv << std::endl;
+                store_put(row, col, newv);  // reduce successful CPUT to PUT (in the log and in hints)
+                lsn = advance_lsn(lsn);
+                const std::string ack = "+OK CPUT Success LSN " + std::to_string(lsn) + "\r\n";
+                if (!chain_replication) send_all(cfd, ack);
+                LOG_DEBUG("[Tablet" << self_index << "] CPUT success for " << row << " " << col << " with new value " << newv);
                 // replicate
-                int prim = query_primary();
+                const std::string header = "CPUT " + row + " " + col + " " + oldv + " " + newv + " " + std::to_string(lsn);
+                std::vector<int> missed;
                 if (prim == self_index) {
-                    for (const int& rfd : get_alive_replicas()) {
-                        send_all(rfd, "CPUT " + row + " " + col + " " +  oldv + " " + newv + "\r\n");
-                        char buf_[64];
-                        recv(rfd, buf_, sizeof(buf_)-1, 0);  // "+OK CPUT Success\r\n"
-                        send_all(rfd, "QUIT\r\n");
-                        close(rfd);
-                        std::cout << "[Tablet" << self_index << "] propogated CPUT to another replica" << std::endl;
-                    }
+                    missed = replicate(header, nullptr);
+                    if (!missed.empty()) add_hints(missed, lsn, std::to_string(lsn) + " PUT " + row + " " + col + " " + std::to_string(newv.size()) + "\n" + newv);
+                } else if (!chain.empty()) {
+                    forward_chain(parse_chain(chain), header, nullptr, missed);
                 }
+                if (chain_replication) send_all(cfd, prim == self_index ? ack : chain_ack(ack, lsn, missed));
             } else {
                 send_all(cfd, "-ERR CPUT Failure\r\n");
-                std::cout << "[Tablet" << self_index << "] CPUT failure for " << row << " " << col << " with new value " << newv << std::endl;
+                LOG_DEBUG("[Tablet" << self_index << "] CPUT failure for " << row << " " << col << " with new value " << newv);
             }
         } else if (cmd == "DELETE") {
             std::string row, col;
-            line >> row >> col;
-            std::lock_guard<std::mutex> m_(mutex);
+            uint64_t lsn = 0;
+            std::string chain;
+            line >> row >> col >> lsn >> chain;
+            std::lock_guard<stats::TimedMutex> m_(mutex);
             if (!all_row_col.count(row) || !all_row_col[row].count(col)) {
                 send_all(cfd, "-ERR Not found\r\n");
-                std::cout << "[Tablet" << self_index << "] DELETE failure for " << row << " "  << col << std::endl;
+                LOG_DEBUG("[Tablet" << self_index << "] DELETE failure for " << row << " "  << col);
             } else {
-                append_log("DELETE " + row + " " + col); // log
                 int tab = get_tablet(row);
-                int prim = query_primary();
-                if (prim == self_index && current_tablet != tab) {
-                    propogate_load(tab);
-                }
-                kvstore[row].erase(col);
-                all_row_col[row].erase(col);
-                send_all(cfd, "+OK Deleted\r\n");
-                std::cout << "[Tablet" << self_index << "] DELETE success for " << row << " "  << col << std::endl;
-                // replicate
+                int prim = cached_primary();
+                ensure_resident(tab, prim == self_index);
+                note_op(tab);
+                store_delete(row, col);  // (after the swap so it lands in this subtablet's log)
+                lsn = advance_lsn(lsn);
+                const std::string ack = "+OK Deleted LSN " + std::to_string(lsn) + "\r\n";
+                if (!chain_replication) send_all(cfd, ack);
+                LOG_DEBUG("[Tablet" << self_index << "] DELETE success for " << row << " "  << col);
+                // replicate the same DELETE to each live replica (skip self & dead ones)
+                const std::string header = "DELETE " + row + " " + col + " " + std::to_string(lsn);
+                std::vector<int> missed;
                 if (prim == self_index) {
-                    for (int rfd : get_alive_replicas()) {
-                        // replicate the same DELETE to each live replica (skip self & dead ones)
-                        send_all(rfd, "DELETE " + row + " " + col + "\r\n");
-                        char buf_[64];
-                        recv(rfd, buf_, sizeof(buf_)-1, 0);  // expect "+OK Deleted\r\n"
-                        send_all(rfd, "QUIT\r\n");
-                        close(rfd);
-                        std::cout << "[Tablet" << self_index << "] propogated DELETE to another replica" << std::endl;
-                    }
+                    missed = replicate(header, nullptr);
+                    if (!missed.empty()) add_hints(missed, lsn, std::to_string(lsn) + " DELETE " + row + " " + col + "\n");
+                } else if (!chain.empty()) {
+                    forward_chain(parse_chain(chain), header, nullptr, missed);
                 }
+                if (chain_replication) send_all(cfd, prim == self_index ? ack : chain_ack(ack, lsn, missed));
             }
         } else if (cmd == "GET_ROWS") {
-            std::lock_guard<std::mutex> m_(mutex);
+            uint64_t min_lsn = 0;
+            line >> min_lsn;
+            std::unique_lock<stats::TimedMutex> m_(mutex);
+            if (!wait_for_lsn(m_, min_lsn)) {
+                send_all(cfd, "-ERR STALE " + std::to_string(applied_lsn) + "\r\n");
+                continue;
+            }
             std::ostringstream os;
             os << "+OK";
             for (auto &p : all_row_col) os << " " << p.first;
             os << "\r\n";
             send_all(cfd, os.str());
-            std::cout << "[Tablet" << self_index << "] client" << cfd << " should get all rows in this tablet" << std::endl;
+            LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " should get all rows in this tablet");
         } else if (cmd == "GET_COLS") {
             std::string row;
-            line >> row;
-            std::lock_guard<std::mutex> m_(mutex);
-            if (!all_row_col.count(row)) {
+            uint64_t min_lsn = 0;
+            line >> row >> min_lsn;
+            std::unique_lock<stats::TimedMutex> m_(mutex);
+            if (!wait_for_lsn(m_, min_lsn)) {
+                send_all(cfd, "-ERR STALE " + std::to_string(applied_lsn) + "\r\n");
+            } else if (!all_row_col.count(row)) {
                 send_all(cfd, "-ERR Not found\r\n");
-                std::cout << "[Tablet" << self_index << "] client" << cfd << " wants all cols of " << row << " but not found" << std::endl;
+                LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " wants all cols of " << row << " but not found");
             } else {
                 std::ostringstream os;
                 os << "+OK";
                 for (const auto &c : all_row_col[row]) os << " " << c;
                 os << "\r\n";
                 send_all(cfd, os.str());
-                std::cout << "[Tablet" << self_index << "] client" << cfd << " should have received all cols of " << row << std::endl;
+                LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " should have received all cols of " << row);
             }
         } else if (cmd == "CHECKPOINT_VERSION") {
-            std::lock_guard<std::mutex> m_(mutex);
+            std::lock_guard<stats::TimedMutex> m_(mutex);
             int subtablet;
             line >> subtablet;
             int version_number = version_of_checkpoint(subtablet);
@@ -665,13 +1360,13 @@ void handle_client(int cfd) {
                     sz -= chunk;
                 }
                 cp.close();
-                std::cout << "[Tablet" << self_index << "] client" << cfd << " should have received my checkpoint file" << std::endl;
+                LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " should have received my checkpoint file");
             } else {
-                std::cout << "[Tablet" << self_index << "] client" << cfd << " quit wanting chk file" << std::endl;
+                LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " quit wanting chk file");
                 send_all(cfd, "ACK\r\n");
             }
         } else if (cmd == "LOG_NUM") {
-            std::lock_guard<std::mutex> m_(mutex);
+            std::lock_guard<stats::TimedMutex> m_(mutex);
             int subtablet;
             line >> subtablet;
             int log_counter = log_count(subtablet);
@@ -726,78 +1421,269 @@ void handle_client(int cfd) {
                     remaining -= actuallyRead;
                 }
                 lf.close();
-                std::cout << "[Tablet" << self_index << "] client" << cfd << " should have received my log file" << std::endl;
+                LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " should have received my log file");
             } else {
-                std::cout << "[Tablet" << self_index << "] client" << cfd << " quit wanting log file" << std::endl;
+                LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " quit wanting log file");
                 send_all(cfd, "ACK\r\n");
             }
         } else if (cmd == "KILL") {  // this can only come from Admin Console
             dead = true;
-            std::cout << "[Tablet" << self_index << "] client" << cfd << " killed me" << std::endl;
+            LOG_INFO("[Tablet" << self_index << "] client" << cfd << " killed me");
         } else if (cmd == "RESTART") {  // this can only come from Admin Console
-            recover();
-            std::cout << "[Tablet" << self_index << "] client" << cfd << " restarted me" << std::endl;
+            if (!catch_up_from_hints()) recover();
+            LOG_INFO("[Tablet" << self_index << "] client" << cfd << " restarted me");
             dead = false;
         } else if (cmd == "QUIT") {
-            std::cout << "[Tablet" << self_index << "] client" << cfd << " quit" << std::endl;
+            LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << " quit");
             close(cfd);
             return;
         } else if (cmd == "CHECK") {
+            uint64_t epoch;
+            int is_standby = 0;
+            bool from_master = (bool)(line >> epoch);
+            if (from_master) {  // the master's heartbeat carries its current epoch and our standby role
+                known_epoch = epoch;
+                line >> is_standby;
+                standby = is_standby != 0;
+            }
             if (dead) {
                 send_all(cfd, "-ERR\r\n");   // to mimic fake dead (no requests will be accepted)
+            } else if (from_master) {
+                // without taking the mutex, so a busy tablet is not suspected; the master promotes the most caught-up secondary
+                send_all(cfd, "+OK " + std::to_string(applied_lsn.load()) + " " + std::to_string(current_tablet.load()) + "\r\n");
             } else {
                 send_all(cfd, "+OK\r\n");
             }
-        } else if (cmd == "LOAD") {  // must be sent from primary
-            int tab;
-            line >> tab;
-            std::lock_guard<std::mutex> m_(mutex);
+        } else if (cmd == "LOAD") {  // must be sent from primary: "LOAD tab primary_resident"
+            int tab, checkpointed = -1;
+            line >> tab >> checkpointed;
+            std::lock_guard<stats::TimedMutex> m_(mutex);
+            if (checkpointed >= 0) load_without_checkpoint(checkpointed);  // checkpoint the subtablet the primary did
             checkpoint(current_tablet);
-            load_back(tab);
+            load_without_checkpoint(tab);
             send_all(cfd, "+OK\r\n");
         } else if (cmd == "CUR_TAB") {
-            std::lock_guard<std::mutex> m_(mutex);
+            std::lock_guard<stats::TimedMutex> m_(mutex);
             send_all(cfd, std::to_string(current_tablet) + "\r\n");
+        } else if (cmd == "STATS") {
+            std::ostringstream os;
+            os << "+OK" << stats::dump(OP_NAMES);
+            std::lock_guard<stats::TimedMutex> m_(mutex);
+            uint64_t lookups = read_cache.hits + read_cache.misses;
+            os << " cache_hits=" << read_cache.hits << " cache_misses=" << read_cache.misses
+               << " cache_hit_rate=" << (lookups ? (double)read_cache.hits / lookups : 0.0)
+               << " cache_items=" << read_cache.items() << " cache_bytes=" << read_cache.bytes()
+               << " cache_rejected=" << read_cache.rejected << " swaps=" << swap_count
+               << " subtablets=" << layout.size() << " current_tablet=" << current_tablet << " kvstore_bytes=" << resident_bytes << " rss_bytes=" << stats::rss_bytes()
+               << " applied_lsn=" << applied_lsn;
+            checkpoint_time.print(os, "checkpoint");
+            replay_time.print(os, "replay");
+            repl_time.print(os, "repl");
+            hint_time.print(os, "hint_catchup");
+            uint64_t pending = 0;
+            for (const auto &[idx, h] : hints) pending += h.count;
+            os << " hints_pending=" << pending;
+            if (last_known_primary == self_index) {
+                for (int idx : group) {  // how many writes each replica is behind me (from the LSNs they acknowledged)
+                    auto acked = replica_lsn.find(idx);
+                    if (idx == self_index || acked == replica_lsn.end()) continue;
+                    os << " replica" << idx << "_lsn=" << acked->second << " replica" << idx << "_lag=" << applied_lsn - std::min<uint64_t>(acked->second, applied_lsn);
+                }
+            }
+            os << "\r\n";
+            send_all(cfd, os.str());
+        } else if (cmd == "SPLIT") {  // must be sent from primary
+            int tab;
+            line >> tab;
+            std::lock_guard<stats::TimedMutex> m_(mutex);
+            ensure_resident(tab, false);
+            split_tablet(tab, true);
+            send_all(cfd, "+OK\r\n");
+        } else if (cmd == "LAYOUT") {
+            std::lock_guard<stats::TimedMutex> m_(mutex);
+            std::ostringstream os;
+            os << "+OK " << layout.size();
+            for (const auto &t : layout) os << " " << t.residue << " " << t.modulus;
+            os << "\r\n";
+            send_all(cfd, os.str());
+        } else if (cmd == "TRACK_START") {  // only from master, before it copies rows to a new shard
+            std::lock_guard<stats::TimedMutex> m_(mutex);
+            tracking = true;
+            dirty_rows.clear();
+            send_all(cfd, "+OK\r\n");
+        } else if (cmd == "TRACK_DRAIN") {  // rows written since TRACK_START / the last drain
+            std::lock_guard<stats::TimedMutex> m_(mutex);
+            std::ostringstream os;
+            os << "+OK";
+            for (const auto &r : dirty_rows) os << " " << r;
+            os << "\r\n";
+            dirty_rows.clear();
+            send_all(cfd, os.str());
+        } else if (cmd == "TRACK_STOP") {
+            std::lock_guard<stats::TimedMutex> m_(mutex);
+            tracking = false;
+            dirty_rows.clear();
+            send_all(cfd, "+OK\r\n");
+        } else if (cmd == "HINTS") {  // a replica back from KILL wants the writes it missed since its applied LSN
+            int idx = -1;
+            uint64_t lsn = 0;
+            line >> idx >> lsn;
+            // held until the replica has applied them and answers CHECK again: no write can slip in between
+            std::lock_guard<stats::TimedMutex> m_(mutex);
+            auto it = hints.find(idx);
+            bool usable = cached_primary() == self_index &&
+                          (it == hints.end() ? lsn == applied_lsn : !it->second.lost && it->second.from_lsn == lsn && it->second.to_lsn == applied_lsn);
+            if (!usable) {
+                send_all(cfd, "-ERR NO_HINTS\r\n");
+                continue;
+            }
+            uint64_t count = it == hints.end() ? 0 : it->second.count;
+            static const std::string no_records;
+            const std::string &records = it == hints.end() ? no_records : it->second.records;
+            // every write waits for this lock: a replica that stalls or dies mid-way must not hold it for long
+            set_socket_timeout(cfd, HINTS_TIMEOUT_S);
+            send_all(cfd, "+OK " + std::to_string(count) + " " + std::to_string(records.size()) + " " + std::to_string(current_tablet) + "\r\n");
+            char buf_[64];
+            ssize_t r = recv(cfd, buf_, sizeof(buf_)-1, 0);  // "READY\r\n"
+            if (r > 0) {
+                send_all(cfd, records);
+                r = recv(cfd, buf_, sizeof(buf_)-1, 0);  // "+OK\r\n" once applied
+            }
+            set_socket_timeout(cfd, 0);
+            if (r > 0 && buf_[0] == '+') {
+                hints.erase(idx);  // only now: a replica that did not confirm can ask again (or is fully restored)
+                replica_lsn[idx] = applied_lsn;
+                send_all(cfd, "+OK\r\n");
+                LOG_INFO("[Tablet" << self_index << "] Replayed " << count << " hints to tablet" << idx);
+            } else {
+                LOG_INFO("[Tablet" << self_index << "] Tablet" << idx << " did not confirm " << count << " hints, keeping them");
+                break;  // the exchange is out of step (or timed out): drop the connection
+            }
+        } else if (cmd == "FPUT") {  // one fragment of an erasure-coded value: stored as is, the client spreads fragments over nodes
+            std::string key;
+            size_t N = 0;
+            line >> key >> N;
+            if (dead) {  // a killed node must look down to the client, so that it reconstructs from the other fragments
+                send_all(cfd, "-ERR\r\n");
+                continue;
+            }
+            send_all(cfd, "+OK\r\n");
+            std::string payload = recv_all(cfd, N);
+            std::string path = fragment_path(key), tmp = path + "_tmp" + std::to_string(cfd);
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            out.write(payload.data(), payload.size());
+            out.close();
+            if (payload.size() != N || !out || rename(tmp.c_str(), path.c_str()) != 0) {  // a reader never sees half a fragment
+                fs::remove(tmp);
+                send_all(cfd, "-ERR Fragment not stored\r\n");
+            } else {
+                send_all(cfd, "+OK\r\n");
+            }
+            LOG_DEBUG("[Tablet" << self_index << "] client" << cfd << ": FPUT " << key << " with " << N << " bytes");
+        } else if (cmd == "FGET") {
+            std::string key;
+            line >> key;
+            std::ifstream in(fragment_path(key), std::ios::binary);
+            if (dead || !in) {
+                send_all(cfd, dead ? "-ERR\r\n" : "-ERR Not found\r\n");
+                continue;
+            }
+            in.seekg(0, std::ios::end);
+            size_t sz = in.tellg();
+            in.seekg(0);
+            send_all(cfd, "+OK " + std::to_string(sz) + "\r\n");
+            char buf[64];
+            recv(cfd, buf, sizeof(buf)-1, 0); // expect "READY\r\n"
+            // 1MB at a time like the checkpoint transfer, so a large fragment is never held in memory whole
+            std::vector<char> chunk_buffer(std::min(sz, static_cast<size_t>(1024*1024)));
+            while (sz > 0 && in.read(chunk_buffer.data(), std::min(chunk_buffer.size(), sz))) {
+                send_all(cfd, chunk_buffer.data(), (size_t)in.gcount());
+                sz -= (size_t)in.gcount();
+            }
+            if (sz > 0) break;  // the file could not be read to the end: the client sees a short reply and drops it
+        } else if (cmd == "FDELETE") {
+            std::string key;
+            line >> key;
+            std::error_code ec;
+            if (dead) send_all(cfd, "-ERR\r\n");  // not done: the client must try again later
+            else send_all(cfd, fs::remove(fragment_path(key), ec) ? "+OK Deleted\r\n" : "-ERR Not found\r\n");
+        } else if (cmd == "LSN") {
+            std::lock_guard<stats::TimedMutex> m_(mutex);
+            send_all(cfd, "+OK " + std::to_string(applied_lsn) + "\r\n");
         }
     }
     close(cfd);
 }
 
 int main(int argc, char* argv[]) {
-    if(argc<3){ std::cerr<<"Usage: ./tablet <config> <self_index>\n"; return 1; }
-    std::string cfg=argv[1]; self_index=std::stoi(argv[2]);
+    if (argc < 3 || (std::string(argv[2]) == "join" && argc < 4)) {
+        std::cerr<<"Usage: ./tablet <config> <self_index> | ./tablet <config> join <ip:port>\n";
+        return 1;
+    }
+    std::string cfg=argv[1];
+    bool joining = std::string(argv[2]) == "join";
     std::ifstream f(cfg); std::string line;
     while (std::getline(f, line)) {
         auto pos = line.find('#');
         if (pos != std::string::npos) line = trim(line.substr(0, pos));
         if (line.empty()) continue;
         auto colon = line.find(':');
-        if (colon == std::string::npos) continue;
+        if (colon == std::string::npos) {  // "replication_factor N" / "replication_mode primary|chain" (same file as the master)
+            std::istringstream directive(line);
+            std::string key, value;
+            directive >> key >> value;
+            if (key == "replication_factor") replication_factor = std::max(1, std::stoi(value));
+            else if (key == "replication_mode") chain_replication = value == "chain";
+            continue;
+        }
         std::string ip = trim(line.substr(0, colon));
         int port = std::stoi(trim(line.substr(colon + 1)));
         nodes.emplace_back(ip, port);
     }
-    num_nodes = nodes.size(); num_shards = num_nodes / REPLICATION_FACTOR;
-    shard_i = self_index / REPLICATION_FACTOR;
+    num_nodes = nodes.size(); num_shards = std::max(1, num_nodes / replication_factor);
+    if (joining) {  // a node outside config.txt: the master assigns its index and group
+        std::string resp = ask_master(std::string("JOIN ") + argv[3]);
+        std::istringstream is(resp);
+        std::string ok, word;
+        if (!(is >> ok >> word >> word >> self_index >> word >> shard_i) || ok != "+OK") {
+            std::cerr << "JOIN failed: " << resp << "\n";
+            return 1;
+        }
+        std::string addr = argv[3];
+        if (self_index >= (int)nodes.size()) nodes.resize(self_index + 1);
+        nodes[self_index] = {addr.substr(0, addr.find(':')), std::stoi(addr.substr(addr.find(':') + 1))};
+    } else {
+        self_index = std::stoi(argv[2]);
+        shard_i = self_index / replication_factor;
+        for (int i = 0; i < replication_factor; ++i) group.push_back(shard_i * replication_factor + i);
+    }
     checkpoint_file = "checkpoint_node" + std::to_string(self_index) + "_";  // prefix
     log_file = "log_node" + std::to_string(self_index) + "_";  // prefix
+    layout_file = "layout_node" + std::to_string(self_index);
+    fragment_dir = "fragments_node" + std::to_string(self_index);
+    fs::create_directories(fragment_dir);
+    load_layout();
     // if the files exist, it means it's not the first time this node starts
     if (fs::exists(checkpoint_file + std::to_string(0)) && fs::exists(log_file + std::to_string(0))) {
         recover();  
     } else {  // create them if it's the first time to start
-        std::cout << "[Tablet" << self_index << "] First time started" <<  std::endl;
-        for (int i = 0; i < num_tablets; ++i) {
+        LOG_INFO("[Tablet" << self_index << "] First time started");
+        for (int i = 0; i < (int)layout.size(); ++i) {
             std::ofstream cp(checkpoint_file + std::to_string(i), std::ios::binary);
             std::ofstream lf(log_file + std::to_string(i), std::ios::binary);
         }
+        save_layout();
+        if (joining) recover();  // bootstrap: stream layout, checkpoints and logs from the group's primary
     }
     // handle shutdown
+    shutdown_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = handle_shutdown;
     sigfillset(&sa.sa_mask);
     sa.sa_flags = 0;
     sigaction(SIGINT, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);  // a peer that went away fails the send instead of killing the node
     // Create listening socket on our assigned port
     int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
     int opt = 1;
@@ -808,17 +1694,20 @@ int main(int argc, char* argv[]) {
     inet_pton(AF_INET, nodes[self_index].first.c_str(), &addr.sin_addr);
     ::bind(listen_fd, (sockaddr*)&addr, sizeof(addr));
     listen(listen_fd, 100);
-    std::cout << "[Tablet"<< self_index << "] Listening on port " << nodes[self_index].second << std::endl;
+    LOG_INFO("[Tablet"<< self_index << "] Listening on port " << nodes[self_index].second);
     // Accept loop: spawn one thread per client
     while (running) {
+        struct pollfd pfds[2] = {{listen_fd, POLLIN, 0}, {shutdown_fd, POLLIN, 0}};
+        if (poll(pfds, 2, -1) < 0 || !(pfds[0].revents & POLLIN)) continue;  // EINTR, or woken up to shut down
         sockaddr_in cli{};
         socklen_t len = sizeof(cli);
         int fd = accept(listen_fd, (sockaddr*)&cli, &len);
         if (fd < 0) continue;
         std::string resp = "+OK Connected\r\n";
         send_all(fd, resp);
-        std::cout << "[Tablet" << self_index << "] client" << fd << " connected" <<  std::endl;
+        LOG_DEBUG("[Tablet" << self_index << "] client" << fd << " connected");
         std::thread(handle_client, fd).detach();
     }
-    return 0;
+    LOG_INFO("[Tablet" << self_index << "] Shutdown");
+    return 0;  // the logger drains on exit
 }
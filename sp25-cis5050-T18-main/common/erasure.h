@@ -0,0 +1,185 @@
+// Reed-Solomon erasure code over GF(2^8) for large values (used by the frontend's webstorage)
+// A value is cut into k data fragments and m parity fragments; any k of them rebuild it, so k+m fragments on different
+// nodes survive m failures at (k+m)/k times the size instead of 3x. The code is systematic (data fragments are plain slices)
+// with a Cauchy parity matrix, so every k x k submatrix of the generator is invertible.
+// The inner loop (dst ^= c * src) uses the split-nibble table lookup with PSHUFB: AVX2 or SSSE3 picked at runtime, scalar otherwise.
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace erasure {
+
+struct Tables {
+    uint8_t exp[512];
+    uint8_t log[256];
+    Tables() {
+        int x = 1;
+        for (int i = 0; i < 255; ++i) {
+            exp[i] = exp[i + 255] = (uint8_t)x;
+            log[x] = (uint8_t)i;
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11d;  // x^8 + x^4 + x^3 + x^2 + 1
+        }
+        exp[510] = exp[511] = exp[0];
+        log[0] = 0;
+    }
+};
+
+inline const Tables &tables() { static const Tables t; return t; }
+
+inline uint8_t gf_mul(uint8_t a, uint8_t b) {
+    if (!a || !b) return 0;
+    const Tables &t = tables();
+    return t.exp[t.log[a] + t.log[b]];
+}
+
+inline uint8_t gf_inv(uint8_t a) { return tables().exp[255 - tables().log[a]]; }  // a != 0
+
+// dst[i] ^= c * src[i]
+using MulAdd = void (*)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+
+inline void mul_add_scalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len) {
+    uint8_t row[256];
+    for (int x = 0; x < 256; ++x) row[x] = gf_mul(c, (uint8_t)x);
+    for (size_t i = 0; i < len; ++i) dst[i] ^= row[src[i]];
+}
+
+// c * x = c * (x & 15) ^ c * (x & 240): two 16-entry tables, one PSHUFB each
+inline void nibble_tables(uint8_t c, uint8_t lo[16], uint8_t hi[16]) {
+    for (int x = 0; x < 16; ++x) {
+        lo[x] = gf_mul(c, (uint8_t)x);
+        hi[x] = gf_mul(c, (uint8_t)(x << 4));
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("ssse3"))) inline void mul_add_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len) {
+    alignas(16) uint8_t lo[16], hi[16];
+    nibble_tables(c, lo, hi);
+    const __m128i tlo = _mm_load_si128((const __m128i *)lo), thi = _mm_load_si128((const __m128i *)hi);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(s, mask)),
+                                  _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(dst + i)), p));
+    }
+    if (i < len) mul_add_scalar(dst + i, src + i, c, len - i);
+}
+
+__attribute__((target("avx2"))) inline void mul_add_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len) {
+    alignas(16) uint8_t lo[16], hi[16];
+    nibble_tables(c, lo, hi);
+    const __m256i tlo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)lo));
+    const __m256i thi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)hi));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask)),
+                                     _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i)), p));
+    }
+    if (i < len) mul_add_ssse3(dst + i, src + i, c, len - i);
+}
+#endif
+
+struct Kernel {
+    MulAdd fn;
+    const char *name;
+};
+
+inline Kernel pick_kernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {mul_add_avx2, "avx2"};
+    if (__builtin_cpu_supports("ssse3")) return {mul_add_ssse3, "ssse3"};
+#endif
+    return {mul_add_scalar, "scalar"};
+}
+
+inline const Kernel &kernel() { static const Kernel k = pick_kernel(); return k; }
+
+// Generator row `row` (0..k+m-1), column j: identity for the data rows, Cauchy 1 / (row ^ j) for the parity rows (row >= k > j)
+inline uint8_t coef(int k, int row, int j) {
+    if (row < k) return row == j;
+    return gf_inv((uint8_t)(row ^ j));
+}
+
+// Fragment size for a value of size bytes (the last data fragment is zero-padded)
+inline size_t fragment_size(size_t size, int k) { return size == 0 ? 1 : (size + k - 1) / k; }
+
+// k data fragments followed by m parity fragments (k + m <= 256)
+inline std::vector<std::string> encode(const std::string &value, int k, int m) {
+    size_t len = fragment_size(value.size(), k);
+    std::vector<std::string> frags(k + m, std::string(len, '\0'));
+    for (int j = 0; j < k; ++j) {
+        size_t off = (size_t)j * len;
+        if (off < value.size()) memcpy(&frags[j][0], value.data() + off, std::min(len, value.size() - off));
+    }
+    MulAdd mul_add = kernel().fn;
+    for (int r = k; r < k + m; ++r) {
+        uint8_t *dst = (uint8_t *)&frags[r][0];
+        for (int j = 0; j < k; ++j) mul_add(dst, (const uint8_t *)frags[j].data(), coef(k, r, j), len);
+    }
+    return frags;
+}
+
+// Rebuild a value of size bytes from at least k fragments (index -> bytes, all the same length); false if fewer than k
+inline bool decode(const std::map<int, std::string> &have, int k, size_t size, std::string &value) {
+    if ((int)have.size() < k) return false;
+    size_t len = have.begin()->second.size();
+    // the data fragments present, topped up with parity ones (map order: data rows come first)
+    std::vector<int> rows;
+    for (const auto &[row, frag] : have) {
+        if (frag.size() != len || row < 0) return false;
+        if ((int)rows.size() < k) rows.push_back(row);
+    }
+    // invert the k x k submatrix of the generator for those rows (Gauss-Jordan over GF(2^8))
+    std::vector<std::vector<uint8_t>> a(k, std::vector<uint8_t>(2 * k, 0));
+    for (int i = 0; i < k; ++i) {
+        for (int j = 0; j < k; ++j) a[i][j] = coef(k, rows[i], j);
+        a[i][k + i] = 1;
+    }
+    for (int col = 0; col < k; ++col) {
+        int pivot = col;
+        while (pivot < k && a[pivot][col] == 0) ++pivot;
+        if (pivot == k) return false;
+        std::swap(a[pivot], a[col]);
+        uint8_t inv = gf_inv(a[col][col]);
+        for (int j = 0; j < 2 * k; ++j) a[col][j] = gf_mul(a[col][j], inv);
+        for (int i = 0; i < k; ++i) {
+            if (i == col || a[i][col] == 0) continue;
+            uint8_t f = a[i][col];
+            for (int j = 0; j < 2 * k; ++j) a[i][j] ^= gf_mul(f, a[col][j]);
+        }
+    }
+    MulAdd mul_add = kernel().fn;
+    value.assign(len * k, '\0');
+    for (int j = 0; j < k; ++j) {
+        uint8_t *dst = (uint8_t *)&value[(size_t)j * len];
+        auto it = have.find(j);
+        if (it != have.end()) {
+            memcpy(dst, it->second.data(), len);
+            continue;
+        }
+        for (int i = 0; i < k; ++i) {
+            uint8_t c = a[j][k + i];
+            if (c) mul_add(dst, (const uint8_t *)have.at(rows[i]).data(), c, len);
+        }
+    }
+    value.resize(size);
+    return true;
+}
+
+}  // namespace erasure
@@ -0,0 +1,157 @@
+// Asynchronous logger shared by master, tablet, http_server and mail_server
+// LOG_INFO("[Tablet" << i << "] Recovering...") formats the message on the calling thread and pushes it into that
+// thread's lock-free single-producer ring; one background thread drains all rings and writes them in batches, so a
+// request never flushes or waits on the stdout lock. When a ring is full the message is dropped (and counted).
+// Messages below LOG_LEVEL (default INFO, build with "make LOG_LEVEL=0" for DEBUG) are compiled out entirely.
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/time.h>
+#include <thread>
+#include <vector>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+namespace logger {
+
+constexpr size_t RING_SLOTS = 1024;  // per thread, power of two
+
+struct Entry {
+    uint64_t ts_us;
+    int level;
+    std::string msg;
+};
+
+// Written by exactly one thread (head), read by the writer thread (tail)
+struct Ring {
+    Entry slots[RING_SLOTS];
+    std::atomic<uint64_t> head{0}, tail{0};
+    std::atomic<bool> closed{false};  // owning thread exited; writer frees the ring once drained
+};
+
+struct State {
+    std::mutex rings_mutex;  // only for registering rings and for draining (never on the logging path)
+    std::vector<Ring*> rings;
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> writer_started{false};
+};
+
+inline State &state() { static State *s = new State(); return *s; }  // leaked on purpose: usable during exit()
+
+inline uint64_t now_us() {
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Write everything queued so far; called by the writer thread and at exit
+inline void drain() {
+    static const char LETTER[] = {'D', 'I', 'W', 'E'};
+    State &st = state();
+    std::lock_guard<std::mutex> lk(st.rings_mutex);
+    std::string out, err;
+    for (size_t i = 0; i < st.rings.size();) {
+        Ring *r = st.rings[i];
+        bool closed = r->closed.load(std::memory_order_acquire);
+        uint64_t tail = r->tail.load(std::memory_order_relaxed);
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        for (; tail < head; ++tail) {
+            Entry &e = r->slots[tail & (RING_SLOTS - 1)];
+            time_t secs = e.ts_us / 1000000;
+            tm t;
+            localtime_r(&secs, &t);
+            char prefix[32];
+            snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%03d %c ", t.tm_hour, t.tm_min, t.tm_sec,
+                     (int)(e.ts_us / 1000 % 1000), LETTER[e.level]);
+            std::string &dst = e.level >= LOG_LEVEL_WARN ? err : out;
+            dst += prefix;
+            dst += e.msg;
+            dst += '\n';
+            std::string().swap(e.msg);
+        }
+        r->tail.store(tail, std::memory_order_release);
+        if (closed && tail == r->head.load(std::memory_order_acquire)) {
+            delete r;
+            st.rings[i] = st.rings.back();
+            st.rings.pop_back();
+        } else {
+            ++i;
+        }
+    }
+    uint64_t dropped = st.dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped) err += "[Logger] dropped " + std::to_string(dropped) + " messages (ring full)\n";
+    if (!out.empty()) { fwrite(out.data(), 1, out.size(), stdout); fflush(stdout); }
+    if (!err.empty()) { fwrite(err.data(), 1, err.size(), stderr); fflush(stderr); }
+}
+
+inline void start_writer() {
+    if (state().writer_started.exchange(true)) return;
+    std::atexit(drain);
+    std::thread([] {
+        while (true) {
+            drain();
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }).detach();
+}
+
+// Registers this thread's ring on first use and hands it to the writer when the thread exits
+struct RingOwner {
+    Ring *ring = new Ring();
+    RingOwner() {
+        start_writer();
+        std::lock_guard<std::mutex> lk(state().rings_mutex);
+        state().rings.push_back(ring);
+    }
+    ~RingOwner() { ring->closed.store(true, std::memory_order_release); }
+};
+
+inline void push(int level, std::string msg) {
+    thread_local RingOwner owner;
+    Ring *r = owner.ring;
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    if (head - r->tail.load(std::memory_order_acquire) >= RING_SLOTS) {
+        state().dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Entry &e = r->slots[head & (RING_SLOTS - 1)];
+    e.ts_us = now_us();
+    e.level = level;
+    e.msg = std::move(msg);
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+}  // namespace logger
+
+#define LOG_AT(level, expr) do { std::ostringstream log_os_; log_os_ << expr; logger::push(level, log_os_.str()); } while (0)
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(expr) LOG_AT(LOG_LEVEL_DEBUG, expr)
+#else
+#define LOG_DEBUG(expr) do {} while (0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(expr) LOG_AT(LOG_LEVEL_INFO, expr)
+#else
+#define LOG_INFO(expr) do {} while (0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(expr) LOG_AT(LOG_LEVEL_WARN, expr)
+#else
+#define LOG_WARN(expr) do {} while (0)
+#endif
+#define LOG_ERROR(expr) LOG_AT(LOG_LEVEL_ERROR, expr)
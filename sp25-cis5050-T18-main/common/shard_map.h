@@ -0,0 +1,136 @@
+// Consistent-hash shard map shared by the master (which owns it) and its clients (which cache the SHARD_MAP reply)
+// Clients resolve row keys with the same hash and ring as the master, tag tablet requests with the map's epoch and
+// keep the map current from the master's WATCH pushes; a tablet answering "-ERR STALE_EPOCH n" (or not answering) is the fallback.
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace shardmap {
+
+constexpr int VNODES = 128;  // ring points per shard
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+constexpr uint64_t FNV_PRIME        = 0x100000001b3ULL;
+
+using Ring = std::vector<std::pair<uint64_t, int>>;  // sorted {point, shard}
+
+// Hash row key (as evenly as possible); FNV-1a followed by a 64-bit finalizer so ring points spread evenly
+inline uint64_t hash_key(std::string_view key) {
+    uint64_t h = FNV_OFFSET_BASIS;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= FNV_PRIME;
+    }
+    h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Consistent-hash ring with VNODES points for each of shards 0..shards-1
+inline Ring build_ring(int shards) {
+    Ring r;
+    for (int s = 0; s < shards; ++s) {
+        for (int v = 0; v < VNODES; ++v) r.emplace_back(hash_key("shard" + std::to_string(s) + "#" + std::to_string(v)), s);
+    }
+    std::sort(r.begin(), r.end());
+    return r;
+}
+
+// A key belongs to the first point at or after its hash (wrapping around); -1 on an empty ring
+inline int ring_owner(const Ring &r, std::string_view key) {
+    if (r.empty()) return -1;
+    auto it = std::lower_bound(r.begin(), r.end(), std::make_pair(hash_key(key), -1));
+    return it == r.end() ? r.front().second : it->second;
+}
+
+struct Group {
+    std::string primary;              // "" when every replica is down
+    std::vector<std::string> alive;   // "ip:port" of the alive replicas (primary included; chain mode: in chain order, tail last)
+};
+
+// Client-side copy of one SHARD_MAP reply
+struct ShardMap {
+    uint64_t epoch = 0;
+    Ring ring;
+    std::vector<Group> groups;  // groups[shard]
+    bool chain = false;         // chain replication: only the tail has every acknowledged write, so reads go there
+
+    // "+OK epoch E ring P point shard ... groups G shard primary|- alive_count addr ... [mode chain]"
+    bool parse(const std::string &reply) {
+        std::istringstream is(reply);
+        std::string ok, word;
+        size_t points = 0, count = 0;
+        if (!(is >> ok >> word >> epoch) || ok != "+OK" || word != "epoch") return false;
+        if (!(is >> word >> points) || word != "ring") return false;
+        ring.resize(points);
+        for (auto &[point, shard] : ring) {
+            if (!(is >> point >> shard)) return false;
+        }
+        if (!(is >> word >> count) || word != "groups") return false;
+        groups.assign(count, Group());
+        for (size_t g = 0; g < count; ++g) {
+            if (!read_group(is)) return false;
+        }
+        for (const auto &[point, shard] : ring) {
+            if (shard < 0 || (size_t)shard >= groups.size()) return false;
+        }
+        std::string mode;
+        chain = (is >> word >> mode) && word == "mode" && mode == "chain";
+        return true;
+    }
+
+    // "DELTA from to count entry ..." pushed to WATCH subscribers; false if it does not follow this map (fetch SHARD_MAP again)
+    bool apply_delta(const std::string &line) {
+        std::istringstream is(line);
+        std::string word;
+        uint64_t from, to;
+        size_t count;
+        if (!(is >> word >> from >> to >> count) || word != "DELTA" || from != epoch) return false;
+        for (size_t g = 0; g < count; ++g) {
+            if (!read_group(is)) return false;
+        }
+        epoch = to;
+        return true;
+    }
+
+    // One group entry: "shard primary|- alive_count addr ..."
+    bool read_group(std::istream &is) {
+        size_t shard, alive;
+        std::string primary;
+        if (!(is >> shard >> primary >> alive) || shard >= groups.size()) return false;
+        groups[shard].primary = primary == "-" ? "" : primary;
+        groups[shard].alive.resize(alive);
+        for (auto &addr : groups[shard].alive) {
+            if (!(is >> addr)) return false;
+        }
+        return true;
+    }
+
+    const Group *group_of(std::string_view key) const {
+        int shard = ring_owner(ring, key);
+        return shard < 0 ? nullptr : &groups[shard];
+    }
+
+    // Primary of key's shard ("" if it is down or the map is empty)
+    std::string primary_of(std::string_view key) const {
+        const Group *g = group_of(key);
+        return g ? g->primary : "";
+    }
+
+    // Primary of key's shard and an alive replica to read from, rotating with ticket, or the tail in chain mode
+    // ("" for either if it is down), from one ring lookup
+    void route(std::string_view key, uint64_t ticket, std::string &primary, std::string &replica) const {
+        const Group *g = group_of(key);
+        primary = g ? g->primary : "";
+        if (!g || g->alive.empty()) replica = "";
+        else if (chain) replica = g->alive.back();
+        else replica = g->alive[ticket % g->alive.size()];
+    }
+};
+
+}  // namespace shardmap
@@ -5,12 +5,19 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <map>
-#include <sys/time.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 
 /*
@@ -18,178 +25,298 @@
  * 
  * Main HTTP server for the web application.
  * Implements:
- * - Multi-threaded request handling
- * - Socket communication
- * - Request parsing and routing to appropriate handlers
- * - Keep-alive connection management
+ * - An epoll reactor that accepts connections and waits for requests on all of them
+ * - A fixed pool of worker threads that run the (synchronous) handlers for one request at a time
+ * - Keep-alive timeouts on a timer wheel (one slot per second)
+ * - Incremental request parsing on a per-connection buffer (requests split across reads, pipelining)
+ * - Upload bodies streamed to their handler instead of buffered
+ * - Routing of the parsed requests to appropriate handlers
  * - Support for GET, POST, and HEAD methods
  * - Signal handling for graceful shutdown
- * - Non-blocking I/O for timeout management
  */
 
 #include "include/handlers/handlers.h"
 #include "include/routes/routes.h"
 #include "include/utils.h"
+#include "include/static_cache.h"
+#include "include/http_response.h"
 
 #define DEFAULT_PORT 8080
-#define BUFFER_SIZE 8192
-#define MAX_CONNECTIONS 100
+#define BUFFER_SIZE 65536  // one recv per readiness event
+#define LISTEN_BACKLOG 4096
+#define WORKER_THREADS 64  // handlers block on the backend, so more workers than cores
 #define KV_SERVER_PORT 5050
 #define KV_SERVER_IP "127.0.0.1"
 #define KEEP_ALIVE_TIMEOUT 15 // Timeout in seconds for keep-alive connections
+#define CLIENT_STALL_TIMEOUT 30 // A client that takes or sends no bytes for this long (seconds) is dropped
 
 int server_socket;
-int kv_socket = -1;
-pthread_mutex_t kv_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// Parse Connection header from HTTP request
-bool check_keep_alive(const char* buffer) {
-    std::string headers(buffer);
-    std::istringstream iss(headers);
-    std::string line;
-    
-    // Skip the request line
-    std::getline(iss, line);
-    
-    // Parse headers
-    while (std::getline(iss, line) && line != "\r" && line != "") {
-        // Remove trailing \r if present
-        if (!line.empty() && line[line.size() - 1] == '\r') {
-            line.erase(line.size() - 1);
-        }
-        
-        // Check for Connection header
-        if (line.find("Connection:") == 0 || line.find("connection:") == 0) {
-            std::string value = line.substr(line.find(":") + 1);
-            // Trim leading spaces
-            value = value.substr(value.find_first_not_of(" "));
-            return (value == "keep-alive");
+// Per-connection state: the reactor owns IDLE connections (armed in epoll, on the timer wheel), a worker owns BUSY ones
+enum ConnState { CONN_FREE, CONN_IDLE, CONN_BUSY };
+
+// Bytes read from a connection but not yet answered, and how far the parser got through them
+struct Session {
+    std::string buffer;
+    Http::Parser parser;
+};
+
+struct Connection {
+    ConnState state = CONN_FREE;
+    std::unique_ptr<Session> session;  // allocated on accept, freed on close
+    unsigned generation = 0;  // bumped whenever the connection goes idle again, so older wheel entries are ignored
+    long deadline = 0;        // reactor tick at which an idle connection is closed
+};
+
+struct WheelEntry {
+    int fd;
+    unsigned generation;
+};
+
+static std::vector<Connection> connections;  // indexed by fd, sized to the fd limit (flat memory per client)
+static std::vector<std::vector<WheelEntry>> timer_wheel(KEEP_ALIVE_TIMEOUT + 2);  // slot = deadline % size
+static long current_tick = 0;  // seconds since start, advanced by the reactor
+static pthread_mutex_t conn_mutex = PTHREAD_MUTEX_INITIALIZER;  // connections, timer_wheel, current_tick
+
+static std::deque<int> ready_queue;  // connections with a request waiting, for the workers
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static int epoll_fd = -1;
+
+// Hand an idle connection to the reactor: wait for its next request for at most KEEP_ALIVE_TIMEOUT seconds (conn_mutex held)
+static void arm_idle(int fd) {
+    Connection& conn = connections[fd];
+    conn.state = CONN_IDLE;
+    conn.generation++;
+    conn.deadline = current_tick + KEEP_ALIVE_TIMEOUT;
+    timer_wheel[conn.deadline % timer_wheel.size()].push_back({fd, conn.generation});
+}
+
+// conn_mutex held; the fd leaves epoll when it is closed
+static void close_connection(int fd) {
+    connections[fd].state = CONN_FREE;
+    connections[fd].session.reset();
+    close(fd);
+}
+
+// Close every idle connection whose deadline is this tick (entries of connections that were used since are stale)
+static void expire_idle_connections() {
+    pthread_mutex_lock(&conn_mutex);
+    current_tick++;
+    std::vector<WheelEntry>& slot = timer_wheel[current_tick % timer_wheel.size()];
+    for (const WheelEntry& entry : slot) {
+        Connection& conn = connections[entry.fd];
+        if (conn.state == CONN_IDLE && conn.generation == entry.generation && conn.deadline <= current_tick) {
+            close_connection(entry.fd);
         }
     }
-    
-    // Default to close if no Connection header is found
-    return false;
+    slot.clear();
+    slot.shrink_to_fit();
+    pthread_mutex_unlock(&conn_mutex);
 }
 
-// Set non-blocking mode on a socket
-void set_nonblocking(int sock) {
-    int flags = fcntl(sock, F_GETFL, 0);
-    flags |= O_NONBLOCK;
-    fcntl(sock, F_SETFL, flags);
+// Answer a request that could not be parsed and give up on the connection (its framing is lost)
+static void send_parse_error(int client_fd, Http::ParseStatus status) {
+    std::string status_line = "400 Bad Request";
+    std::string message = "Bad request syntax.";
+    if (status == Http::PARSE_HEADERS_TOO_LARGE) {
+        status_line = "431 Request Header Fields Too Large";
+        message = "The request headers are too large.";
+    } else if (status == Http::PARSE_BODY_TOO_LARGE) {
+        status_line = "413 Payload Too Large";
+        message = "The request body is too large.";
+    }
+    std::string body = "<html><body><h1>" + status_line + "</h1><p>" + message + "</p></body></html>";
+    Http::send_response(client_fd, status_line, "text/html", body, false);
 }
 
-// Set socket back to blocking mode
-void set_blocking(int sock) {
-    int flags = fcntl(sock, F_GETFL, 0);
-    flags &= ~O_NONBLOCK;
-    fcntl(sock, F_SETFL, flags);
+static void dispatch_request(int client_fd, const Http::Request& request) {
+    Http::clear_deferred_headers();
+    Utils::begin_request_token(request);
+    if (request.method == "GET") {
+        Routes::handle_get_request(client_fd, request);
+    } else if (request.method == "POST") {
+        Routes::handle_post_request(client_fd, request);
+    } else if (request.method == "HEAD") {
+        Routes::handle_head_request(client_fd, request);
+    } else {
+        std::string method(request.method);
+        std::string body = "<html><body><h1>501 Not Implemented</h1><p>The method " + method + " is not implemented by this server.</p></body></html>";
+        Http::send_response(client_fd, "501 Not Implemented", "text/html", body, request.keep_alive);
+    }
 }
 
-void* handle_client(void* arg) {
-    int client_fd = *(int*)arg;
-    free(arg);
-    char buffer[BUFFER_SIZE];
-    bool keep_alive = false;
-    
-    // Set timeout for keep-alive connections
-    struct timeval timeout;
-    timeout.tv_sec = KEEP_ALIVE_TIMEOUT;
-    timeout.tv_usec = 0;
-    
-    do {
-        memset(buffer, 0, BUFFER_SIZE);
-        
-        // Set socket to non-blocking for timeout handling
-        set_nonblocking(client_fd);
-        
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(client_fd, &read_fds);
-        
-        // Wait for data with timeout
-        int select_result = select(client_fd + 1, &read_fds, NULL, NULL, &timeout);
-        
-        if (select_result <= 0) {
-            // Timeout or error occurred
-            break;
+// Read what client_fd has sent and answer every complete request in it (pipelined ones in order); a partial request
+// stays buffered for the next readiness event. Returns whether the connection stays open.
+static bool serve_requests(int client_fd, Session& session) {
+    size_t old_size = session.buffer.size();
+    session.buffer.resize(old_size + BUFFER_SIZE);
+    int bytes = recv(client_fd, &session.buffer[old_size], BUFFER_SIZE, 0);
+    if (bytes <= 0) {
+        // Connection closed or error
+        return false;
+    }
+    session.buffer.resize(old_size + bytes);
+
+    while (true) {
+        Http::Request request;
+        Http::ParseStatus status = session.parser.parse(session.buffer, request);
+        if (status == Http::PARSE_INCOMPLETE) {
+            if (session.parser.take_expect_continue()) {
+                // the client holds the body back until it is told to go on
+                Http::write_all(client_fd, "HTTP/1.1 100 Continue\r\n\r\n");
+            }
+            if (!session.parser.head_complete(session.buffer, request) || !Routes::streams_body(request)) {
+                return true;
+            }
+            // the handler reads the body from the socket as it goes, so it is never buffered whole
+            size_t length = session.parser.message_length();
+            size_t head_len = request.head.size();
+            Http::BodyReader reader(client_fd, std::string_view(session.buffer).substr(head_len), length - head_len);
+            request.body_reader = &reader;
+            dispatch_request(client_fd, request);
+            if (!reader.drain() || !request.keep_alive) {
+                return false;
+            }
+            session.buffer.erase(0, std::min(session.buffer.size(), length));
+            session.parser.reset();
+            if (session.buffer.empty()) {
+                session.buffer.shrink_to_fit();
+                return true;
+            }
+            continue;
+        }
+        if (status != Http::PARSE_COMPLETE) {
+            send_parse_error(client_fd, status);
+            return false;
+        }
+        dispatch_request(client_fd, request);
+        if (!request.keep_alive) {
+            return false;
+        }
+        session.buffer.erase(0, session.parser.consumed());
+        session.parser.reset();
+        if (session.buffer.empty()) {
+            session.buffer.shrink_to_fit();  // idle connections hold no buffer
+            return true;
         }
-        
-        // Set socket back to blocking for regular operations
-        set_blocking(client_fd);
-        
-        int bytes = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
-        if (bytes <= 0) {
-            // Connection closed or error
-            break;
+    }
+}
+
+static void* worker_loop(void*) {
+    while (true) {
+        pthread_mutex_lock(&queue_mutex);
+        while (ready_queue.empty()) {
+            pthread_cond_wait(&queue_cond, &queue_mutex);
         }
-        
-        buffer[bytes] = '\0';
-        
-        // Check if client wants to keep the connection alive
-        keep_alive = check_keep_alive(buffer);
-        
-        std::string method, path;
-        if (Utils::parse_http_request(buffer, method, path)) {
-            if (method == "GET") {
-                Routes::handle_get_request(client_fd, path, buffer, keep_alive);
-            } else if (method == "POST") {
-                Routes::handle_post_request(client_fd, path, buffer, keep_alive);
-            } else if (method == "HEAD") {
-                Routes::handle_head_request(client_fd, path, buffer, keep_alive);
-            } else {
-                std::string not_implemented_response = "HTTP/1.1 501 Not Implemented\r\n"
-                                                      "Content-Type: text/html\r\n"
-                                                      "Content-Length: 129\r\n";
-                if (keep_alive) {
-                    not_implemented_response += "Connection: keep-alive\r\n"
-                                               "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-                } else {
-                    not_implemented_response += "Connection: close\r\n";
-                }
-                not_implemented_response += "\r\n"
-                                          "<html><body><h1>501 Not Implemented</h1><p>The method " + method + " is not implemented by this server.</p></body></html>";
-                send(client_fd, not_implemented_response.c_str(), not_implemented_response.size(), 0);
+        int client_fd = ready_queue.front();
+        ready_queue.pop_front();
+        pthread_mutex_unlock(&queue_mutex);
+
+        // a BUSY connection belongs to this worker alone, so its session is used without conn_mutex
+        bool keep_alive = serve_requests(client_fd, *connections[client_fd].session);
+
+        pthread_mutex_lock(&conn_mutex);
+        if (keep_alive) {
+            // idle again before the fd is re-armed, so that the reactor sees consistent state when the next request arrives
+            arm_idle(client_fd);
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+            ev.data.fd = client_fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client_fd, &ev) < 0) {
+                close_connection(client_fd);
             }
         } else {
-            std::string bad_request_response = "HTTP/1.1 400 Bad Request\r\n"
-                                              "Content-Type: text/html\r\n"
-                                              "Content-Length: 79\r\n";
-            if (keep_alive) {
-                bad_request_response += "Connection: keep-alive\r\n"
-                                       "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-            } else {
-                bad_request_response += "Connection: close\r\n";
-            }
-            bad_request_response += "\r\n"
-                                  "<html><body><h1>400 Bad Request</h1><p>Bad request syntax.</p></body></html>";
-            send(client_fd, bad_request_response.c_str(), bad_request_response.size(), 0);
+            close_connection(client_fd);
         }
-        
-        // Reset the timeout for the next request
-        timeout.tv_sec = KEEP_ALIVE_TIMEOUT;
-        timeout.tv_usec = 0;
-        
-    } while (keep_alive);
-    
-    // Close the connection
-    close(client_fd);
+        pthread_mutex_unlock(&conn_mutex);
+    }
     return NULL;
 }
 
+// Accept everything pending on the (non-blocking) listening socket; clients stay blocking for the synchronous handlers,
+// with send/receive timeouts so that a stalled client cannot hold a worker
+static void accept_connections() {
+    while (true) {
+        struct sockaddr_in client_addr;
+        socklen_t addrlen = sizeof(client_addr);
+        int client_fd = accept(server_socket, (struct sockaddr*)&client_addr, &addrlen);
+        if (client_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Accept failed");
+            }
+            return;
+        }
+        if (client_fd >= (int)connections.size()) {
+            close(client_fd);
+            continue;
+        }
+        struct timeval stall = {CLIENT_STALL_TIMEOUT, 0};
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &stall, sizeof(stall));
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &stall, sizeof(stall));
+        pthread_mutex_lock(&conn_mutex);
+        connections[client_fd].session.reset(new Session());
+        arm_idle(client_fd);
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.fd = client_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+            close_connection(client_fd);
+        }
+        pthread_mutex_unlock(&conn_mutex);
+    }
+}
+
+// The reactor: accepts, hands connections with a request (or a hang-up) to the workers, and ticks the timer wheel
+static void run_reactor() {
+    std::vector<struct epoll_event> events(1024);
+    long next_tick_ms = 1000;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (true) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        int n = epoll_wait(epoll_fd, events.data(), events.size(), std::max(0L, next_tick_ms - elapsed_ms));
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == server_socket) {
+                accept_connections();
+                continue;
+            }
+            pthread_mutex_lock(&conn_mutex);
+            bool idle = connections[fd].state == CONN_IDLE;
+            if (idle) {
+                connections[fd].state = CONN_BUSY;  // off the wheel: its entry goes stale
+            }
+            pthread_mutex_unlock(&conn_mutex);
+            if (idle) {
+                pthread_mutex_lock(&queue_mutex);
+                ready_queue.push_back(fd);
+                pthread_cond_signal(&queue_cond);
+                pthread_mutex_unlock(&queue_mutex);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        while (elapsed_ms >= next_tick_ms) {
+            expire_idle_connections();
+            next_tick_ms += 1000;
+        }
+    }
+}
+
 void cleanup_and_exit(int) {
     printf("HTTP Server shutting down...\n");
-    pthread_mutex_lock(&kv_mutex);
-    if (kv_socket >= 0) {
-        close(kv_socket);
-        kv_socket = -1;
-    }
-    pthread_mutex_unlock(&kv_mutex);
+    Utils::disconnect_from_kvstore();
     close(server_socket);
     _exit(0);
 }
 
 int main(int argc, char* argv[]) {
     signal(SIGINT, cleanup_and_exit);
+    signal(SIGPIPE, SIG_IGN);  // a client that hangs up mid-response must not take the server down
     
     int port = DEFAULT_PORT;
     if (argc > 1) {
@@ -226,30 +353,40 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
     
-    listen(server_socket, MAX_CONNECTIONS);
+    listen(server_socket, LISTEN_BACKLOG);
     printf("HTTP Server listening on port %d\n", port);
     printf("You can access the following pages:\n");
     printf("  - Home: http://localhost:%d/\n", port);
     printf("Press Ctrl+C to stop the server\n");
     
-    while (1) {
-        struct sockaddr_in client_addr;
-        memset(&client_addr, 0, sizeof(client_addr));
-        socklen_t addrlen = sizeof(client_addr);
-        
-        int* client_fd = (int*)malloc(sizeof(int));
-        *client_fd = accept(server_socket, (struct sockaddr*)&client_addr, &addrlen);
-        
-        if (*client_fd < 0) {
-            perror("Accept failed");
-            free(client_fd);
-            continue;
-        }
-        
+    // one Connection per possible fd
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    connections.resize(limit.rlim_cur == RLIM_INFINITY ? 1048576 : std::min<rlim_t>(limit.rlim_cur, 1048576));
+
+    // public/ is served from memory (and reloaded when it changes)
+    StaticCache::init("public");
+
+    fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL, 0) | O_NONBLOCK);
+    epoll_fd = epoll_create1(0);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = server_socket;
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &ev) < 0) {
+        perror("epoll setup failed");
+        exit(1);
+    }
+
+    for (int i = 0; i < WORKER_THREADS; i++) {
         pthread_t tid;
-        pthread_create(&tid, NULL, handle_client, client_fd);
+        pthread_create(&tid, NULL, worker_loop, NULL);
         pthread_detach(tid);
     }
+    run_reactor();
     
     return 0;
 }
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include "include/http_request.h"
 
 namespace Routes {
 
@@ -26,6 +27,10 @@ const std::vector<std::string> PROTECTED_ROUTES = {
 // utility function to check if a given path is protected
 bool is_protected_route(const std::string& path);
 
+// answer a request for file_path ("public/...") from the static cache: 304 if the client's copy is current, else 200
+// (gzip when accepted; headers only when with_body is false); false if there is no such file
+bool send_static_asset(int client_fd, const Http::Request& request, const std::string& file_path, bool with_body);
+
 } // namespace Routes
 
 #endif 
@@ -2,17 +2,22 @@
 #define HANDLERS_H
 
 #include <string>
+#include "include/http_request.h"
 
 namespace Routes {
     
     // handle a GET request
-    void handle_get_request(int client_fd, const std::string& path, const char* buffer, bool keep_alive = false);
+    void handle_get_request(int client_fd, const Http::Request& request);
     
     // handle a POST request
-    void handle_post_request(int client_fd, const std::string& path, const char* buffer, bool keep_alive = false);
+    void handle_post_request(int client_fd, const Http::Request& request);
+
+    // whether a request goes to its handler as soon as its head is in, the body read through request.body_reader
+    // (uploads, which would otherwise be buffered whole)
+    bool streams_body(const Http::Request& request);
     
     // handle a HEAD request
-    void handle_head_request(int client_fd, const std::string& path, const char* buffer, bool keep_alive = false);
+    void handle_head_request(int client_fd, const Http::Request& request);
 }
 
 #endif
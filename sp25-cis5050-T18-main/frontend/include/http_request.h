@@ -0,0 +1,111 @@
+#ifndef HTTP_REQUEST_H
+#define HTTP_REQUEST_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <sys/types.h>
+
+namespace Http {
+
+    class BodyReader;
+
+    // limits of one request (a larger one is answered 431 / 413 and the connection closed)
+    constexpr size_t MAX_HEADER_BYTES = 64 * 1024;
+    constexpr size_t MAX_BODY_BYTES = 256 * 1024 * 1024;
+
+    struct Header {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    // One parsed request; every view points into the connection's buffer (or the parser's de-chunked body),
+    // so it is only valid until the connection reads again or the request is consumed
+    struct Request {
+        std::string_view method;
+        std::string_view target;    // path and query, as sent
+        std::string_view version;
+        std::vector<Header> headers;
+        std::string_view head;      // request line and headers, up to and including the blank line
+        std::string_view body;
+        bool keep_alive = false;
+        BodyReader* body_reader = nullptr;  // set when the body is streamed to the handler: body is then empty
+
+        // value of the first header with this name (case-insensitive), "" if there is none
+        std::string_view header(std::string_view name) const;
+
+        // target without the query string
+        std::string_view path() const;
+    };
+
+    enum ParseStatus { PARSE_INCOMPLETE, PARSE_COMPLETE, PARSE_BAD_REQUEST, PARSE_HEADERS_TOO_LARGE, PARSE_BODY_TOO_LARGE };
+
+    // Incremental parser for the requests on one connection: call parse() each time more bytes were appended to the
+    // buffer; it resumes where it stopped (no rescanning), and after PARSE_COMPLETE the request occupies the first
+    // consumed() bytes of the buffer (pipelined requests may follow). reset() before parsing the next one.
+    class Parser {
+    public:
+        ParseStatus parse(const std::string& buffer, Request& request);
+        size_t consumed() const { return consumed_; }
+        // true once, when the head of a request with "Expect: 100-continue" is in and its body is not
+        bool take_expect_continue();
+        // after PARSE_INCOMPLETE: whether the head is in and the body has a Content-Length, so that the request can
+        // be handed on before its body (request is filled with an empty body); message_length() is then head + body
+        bool head_complete(const std::string& buffer, Request& request) const;
+        size_t message_length() const { return head_len_ + body_len_; }
+        void reset();
+
+    private:
+        enum State { READ_HEAD, READ_BODY, READ_CHUNK_SIZE, READ_CHUNK_DATA, READ_CHUNK_END, READ_TRAILER, DONE };
+        struct HeaderOffsets {
+            size_t name, name_len, value, value_len;
+        };
+
+        ParseStatus parse_head(const std::string& buffer);
+        ParseStatus parse_chunks(const std::string& buffer);
+        void fill(const std::string& buffer, Request& request) const;
+
+        State state_ = READ_HEAD;
+        size_t scanned_ = 0;       // where the search for the end of the head / the next line resumes
+        size_t head_len_ = 0;
+        size_t method_len_ = 0, target_off_ = 0, target_len_ = 0, version_off_ = 0, version_len_ = 0;
+        std::vector<HeaderOffsets> headers_;
+        bool keep_alive_ = false;
+        bool expect_continue_ = false;
+        size_t body_len_ = 0;      // Content-Length
+        size_t chunk_left_ = 0;
+        std::string chunked_body_; // chunked bodies are the only copy
+        size_t consumed_ = 0;
+    };
+
+    // The body of a request as a stream: the bytes already in the connection's buffer first, then the rest read from
+    // the socket as the handler asks for it (never past the end of the body, so a pipelined request stays unread)
+    class BodyReader {
+    public:
+        BodyReader(int fd, std::string_view buffered, size_t length);
+        // a body that is all in memory already
+        explicit BodyReader(std::string_view body) : BodyReader(-1, body, body.size()) {}
+
+        // up to max bytes of the body into out: the count, 0 at the end of the body, -1 if the client went away
+        // or stalled
+        ssize_t read(char* out, size_t max);
+        size_t remaining() const { return remaining_; }
+        // read and drop the rest (the next request starts after it); false if the client went away
+        bool drain();
+
+    private:
+        int fd_;
+        std::string_view buffered_;
+        size_t remaining_;
+    };
+
+    enum RangeStatus { RANGE_NONE, RANGE_SATISFIABLE, RANGE_UNSATISFIABLE };
+
+    // A Range header ("bytes=a-b", "bytes=a-" or "bytes=-n") against a representation of size bytes: on
+    // RANGE_SATISFIABLE the bytes [start, end) to send with 206; RANGE_UNSATISFIABLE is answered 416; RANGE_NONE
+    // (no header, another unit, bad syntax or several ranges) means the whole body with 200
+    RangeStatus parse_range(std::string_view header, size_t size, size_t& start, size_t& end);
+}
+
+#endif
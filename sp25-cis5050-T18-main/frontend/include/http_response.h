@@ -0,0 +1,32 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+namespace Http {
+
+    // Status line, Content-Type (omitted when empty), Content-Length, Connection / Keep-Alive, extra_headers (each line
+    // ending in "\r\n") and the blank line
+    std::string response_head(const std::string& status, const std::string& content_type, size_t content_length,
+                              bool keep_alive, const std::string& extra_headers = "");
+
+    // A header for the next response_head on this thread (replacing a deferred one of the same name), for something a
+    // handler learns on the way, e.g. the read-your-writes cookie of a write deep in a route; cleared before each request
+    void defer_header(const std::string& name, const std::string& value);
+    void clear_deferred_headers();
+
+    // Write head and then body with writev, resuming after partial writes; false if the client went away or stalled
+    // past the socket's send timeout
+    bool write_all(int fd, std::string_view head, std::string_view body = {});
+
+    // A complete response with an in-memory body: head and body leave in one writev, without being concatenated
+    bool send_response(int fd, const std::string& status, const std::string& content_type, std::string_view body,
+                       bool keep_alive, const std::string& extra_headers = "");
+
+    // A response whose body is length bytes of file_fd from offset, sent with sendfile (no copy through user space)
+    bool send_file(int fd, std::string_view head, int file_fd, off_t offset, size_t length);
+}
+
+#endif
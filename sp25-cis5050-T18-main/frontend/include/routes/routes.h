@@ -2,6 +2,7 @@
 #define ROUTES_H
 
 #include <string>
+#include "include/http_request.h"
 
 namespace Routes {
 
@@ -11,17 +12,17 @@ namespace Routes {
     
     void handle_reset_password(int client_fd, const std::string& body, bool keep_alive = false);
     
-    void handle_logout(int client_fd, const char* buffer, bool keep_alive = false);
+    void handle_logout(int client_fd, const Http::Request& request, bool keep_alive = false);
     
-    void handle_get_emails(int client_fd, const std::string& request_headers, bool keep_alive = false);
+    void handle_get_emails(int client_fd, const Http::Request& request, bool keep_alive = false);
     
-    void handle_send_email(int client_fd, const std::string& body, const char* request, bool keep_alive = false);
+    void handle_send_email(int client_fd, const std::string& body, const Http::Request& request, bool keep_alive = false);
     
-    void handle_forward_email(int client_fd, const std::string& body, const char* request, bool keep_alive = false);
+    void handle_forward_email(int client_fd, const std::string& body, const Http::Request& request, bool keep_alive = false);
     
-    void handle_reply_email(int client_fd, const std::string& body, const char* request, bool keep_alive = false);
+    void handle_reply_email(int client_fd, const std::string& body, const Http::Request& request, bool keep_alive = false);
     
-    void handle_delete_email(int client_fd, const std::string& body, const char* request, bool keep_alive = false);
+    void handle_delete_email(int client_fd, const std::string& body, const Http::Request& request, bool keep_alive = false);
     
     void handle_server_id(int client_fd, bool keep_alive = false);
     
@@ -32,6 +33,9 @@ namespace Routes {
     
     void handle_get_db_value(int client_fd, const std::string& path, bool keep_alive = false);
     
+    // Rewrite file chunks still stored as hex as raw bytes
+    void handle_migrate_storage(int client_fd, bool keep_alive = false);
+    
     // Admin nodes function
     void handle_admin_nodes(int client_fd, bool keep_alive = false);
     
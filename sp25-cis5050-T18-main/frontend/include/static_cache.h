@@ -0,0 +1,34 @@
+#ifndef STATIC_CACHE_H
+#define STATIC_CACHE_H
+
+#include <string>
+#include <memory>
+#include "include/http_request.h"
+
+namespace StaticCache {
+
+    // One file under public/, as served: its bytes, a gzip variant (empty when it would not be smaller) and validators
+    struct Asset {
+        std::string content;
+        std::string gzip;
+        std::string etag;       // strong, quoted, from the content hash
+        std::string gzip_etag;  // the gzip variant is a different representation, so it gets its own tag
+        std::string content_type;
+        std::string cache_control;
+        bool templated = false; // contains {{username}}: personalised per request, not cacheable by clients
+    };
+
+    // load every file under root and reload changed ones in the background (inotify)
+    void init(const std::string& root);
+
+    // the cached file at path ("public/index.html"), null if there is no such file
+    std::shared_ptr<const Asset> lookup(const std::string& path);
+
+    // whether the request's If-None-Match matches the asset (answer 304)
+    bool not_modified(const Http::Request& request, const Asset& asset);
+
+    // whether the client accepts the gzip variant (and the asset has one)
+    bool use_gzip(const Http::Request& request, const Asset& asset);
+}
+
+#endif
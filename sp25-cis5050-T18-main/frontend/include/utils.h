@@ -2,32 +2,78 @@
 #define UTILS_H
 
 #include <string>
+#include <string_view>
 #include <map>
+#include <vector>
+#include <cstdint>
+#include "include/http_request.h"
 
 namespace Utils {
-    // parse an http request
-    bool parse_http_request(const char* buffer, std::string& method, std::string& path);
-
-
+    // open a first pooled connection to the master (kvstore_command opens more as needed)
     bool connect_to_kvstore();
     
-    // send a command to the kvstore
+    // close the idle master connections
+    void disconnect_from_kvstore();
+    
+    // send a command to the kvstore (one round trip on a pooled connection, concurrent callers do not wait on each other)
     std::string kvstore_command(const std::string& command);
 
     // get a form value from a request body
     std::string get_form_value(const std::string& body, const std::string& field);
     
-    // get the tablet for a username
+    // get the tablet for a username (resolved locally from the cached shard map)
     std::string get_tablet_for_username(const std::string& username);
     
+    // epoch of the cached shard map (fetched from the master on first use)
+    uint64_t shard_map_epoch();
+    
+    // fetch SHARD_MAP again unless the cached one is already at min_epoch or newer
+    void refresh_shard_map(uint64_t min_epoch);
+    
+    // primary address of every shard on the hash ring (SHARD_MAP)
+    std::vector<std::string> get_all_primaries();
+    
+    // the primary (as get_tablet_for_username) and, in read_address, any alive replica (round-robin) for reading a
+    // username's row, from one shard map lookup
+    std::string get_tablets_for_username(const std::string& username, std::string& read_address);
+    
+    // up to count distinct alive nodes for the fragments of an erasure-coded value, spread over the replica groups from key's shard on
+    std::vector<std::string> get_fragment_nodes(const std::string& key, int count);
+    
+    // "ip:port" of a backend node index, as registered with the master (nodes can JOIN at runtime)
+    std::string get_node_address(int node_id);
+    
     // send a command to a tablet
     std::pair<std::string, bool> tablet_command(const std::string& tablet_address, const std::string& command);
     
-    // get a cookie value from a request headers
-    std::string get_cookie_value(const char* headers, const std::string& cookie_name);
+    // PUT a value of any bytes (a command line ends at the first newline and loses trailing CR/LF; this sends value as the
+    // length-prefixed payload untouched)
+    std::pair<std::string, bool> tablet_put(const std::string& tablet_address, const std::string& rowkey, const std::string& colkey, std::string_view value);
+    
+    // start the read-your-writes token of the request this thread handles: the rw_lsn cookie, which holds the highest
+    // LSN of the browser's writes to its own row (auth_user) whichever frontend made them; a write to that row during
+    // the request raises it and sends it back in Set-Cookie
+    void begin_request_token(const Http::Request& request);
+    void set_request_token(const std::string& rowkey, unsigned long long lsn);
+    
+    // send a read (GET / GET_COLS) to a secondary with the last write LSN known for the row (the request's token, or
+    // this frontend's recent writes), falling back to the primary
+    std::pair<std::string, bool> tablet_read_command(const std::string& read_address, const std::string& primary_address, const std::string& command);
+    
+    // "hits=.. misses=.. ..." of the keep-alive tablet connection pool used by tablet_command and the fragment commands
+    std::string tablet_pool_stats();
+    
+    // store / fetch / drop one erasure-coded fragment on a single tablet (FPUT / FGET / FDELETE, not replicated);
+    // fragment_delete is true once the fragment is gone, also when it was never there
+    bool fragment_put(const std::string& tablet_address, const std::string& key, const std::string& bytes);
+    bool fragment_get(const std::string& tablet_address, const std::string& key, std::string& bytes);
+    bool fragment_delete(const std::string& tablet_address, const std::string& key);
+    
+    // get a cookie value from a request's Cookie header
+    std::string get_cookie_value(const Http::Request& request, const std::string& cookie_name);
     
     // check if a user is authenticated
-    bool is_authenticated(const char* headers, std::string& username);
+    bool is_authenticated(const Http::Request& request, std::string& username);
     
     // make an auth cookie
     std::string make_auth_cookie(const std::string& username);
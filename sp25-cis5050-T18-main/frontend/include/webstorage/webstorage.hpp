@@ -3,6 +3,8 @@
 
 #include <string>
 #include <vector>
+#include <functional>
+#include <string_view>
 #include "include/webstorage/webstorage_file.hpp"
 
 namespace WebStorage {
@@ -36,19 +38,51 @@ namespace WebStorage {
         std::vector<char> data;
     };
 
-    StorageResult upload_file_chunk(const std::string& username,
-                              const std::string& filename,
-                              const std::vector<char>& chunk_data,
-                              int part,
-                              int total_parts,
-                              const std::string& tablet_address,
-                              const std::string& content_type);
+    // The metadata in a file's own column (File::Metadata::from_string reads it)
+    bool get_file_metadata(const std::string& username,
+                           const std::string& filename,
+                           const std::string& tablet_address,
+                           std::string& metadata);
+
+    // Store part `part` of a file's data under its metadata with that part number (large parts erasure coded); the
+    // file's own column is written with put_file_metadata once every part is in, so a half-uploaded file is never listed
+    StorageResult put_file_part(const std::string& username,
+                                const std::string& metadata,
+                                int part,
+                                const char* data,
+                                size_t size,
+                                const std::string& tablet_address);
+
+    StorageResult put_file_metadata(const std::string& username,
+                                    const std::string& filename,
+                                    const std::string& metadata,
+                                    const std::string& tablet_address);
+
+    // Drop parts 1..parts stored under metadata (an upload that failed half way)
+    void delete_file_parts(const std::string& username,
+                           const std::string& metadata,
+                           int parts,
+                           const std::string& tablet_address);
 
     StorageResult download_file_chunk(const std::string& username,
                                       const std::string& filename,
                                       int part,
                                       const std::string& tablet_address);
 
+    // Every part of a file, in order, in memory (for files stored before their size was recorded)
+    StorageResult download_file(const std::string& username,
+                                const std::string& filename,
+                                const std::string& tablet_address);
+
+    // Bytes [start, end) of a file whose metadata has its size: only the parts holding them are fetched, one at a
+    // time, each handed to sink before the next is fetched; false if a part is missing or short, or sink fails
+    bool read_file_range(const std::string& username,
+                         const std::string& metadata,
+                         size_t start,
+                         size_t end,
+                         const std::string& tablet_address,
+                         const std::function<bool(std::string_view)>& sink);
+
     bool file_exists(const std::string& username, 
                      const std::string& filename,
                      const std::string& tablet_address);
@@ -60,6 +94,18 @@ namespace WebStorage {
                               const std::string& filename,
                               const std::string& tablet_address);
 
+    struct MigrationReport {
+        size_t rows = 0;      // rows scanned, over all shards
+        size_t parts = 0;     // file chunks found
+        size_t migrated = 0;  // hex chunks rewritten as raw bytes
+        size_t failed = 0;
+        size_t fragment_deletes_pending = 0;  // fragments of deleted chunks still on nodes that could not be reached
+    };
+
+    // Rewrite every file chunk still stored as hex (before chunks were stored raw) in place as raw bytes, and retry the
+    // fragment deletes that failed; idempotent, so it can be run again until nothing is left to migrate
+    MigrationReport migrate_hex_chunks();
+
     StorageResult create_folder(const std::string& username,
                                 const std::string& folder_path,
                                 const std::string& tablet_address);
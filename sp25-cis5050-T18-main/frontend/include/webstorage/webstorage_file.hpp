@@ -10,8 +10,13 @@ namespace File {
         int part;
         int total;
         std::string timestamp;
+        long long size = -1;  // bytes in the file, -1 for files stored before sizes were recorded
+        size_t block = 0;     // bytes in each part before the last non-empty one (part i starts at (i - 1) * block)
         
+        // the key of part `part`'s data: type, part, total and timestamp
         std::string to_string() const;
+        // what the file's own column holds: to_string() with the size and block size
+        std::string to_file_string() const;
         static Metadata from_string(const std::string& str);
     };
 
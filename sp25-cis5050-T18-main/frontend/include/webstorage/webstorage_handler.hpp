@@ -2,12 +2,13 @@
 #define WEBSTORAGE_HANDLER_HPP
 
 #include <string>
+#include "include/http_request.h"
 
 namespace WebStorageHandler {
 
-std::string get_username_from_session(const char* buffer);
+std::string get_username_from_session(const Http::Request& request);
 
-void handle_storage_request(int client_fd, const std::string& path, const char* buffer, bool keep_alive = false);
+void handle_storage_request(int client_fd, const std::string& path, const Http::Request& request);
 
 std::string get_current_path(const std::string& url_path);
 
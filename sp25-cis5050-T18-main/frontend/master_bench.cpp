@@ -0,0 +1,82 @@
+// Concurrency benchmark for the frontend-to-master path (Utils::kvstore_command)
+// Usage: ./master_bench [threads] [requests_per_thread] [serial]
+// Every thread resolves distinct row keys with "ASK row_key"; "serial" puts one mutex around each round trip,
+// which is how the frontend behaved with a single shared master connection, for comparison.
+#include "include/utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+int server_socket = -1;  // referenced by the utils objects
+
+static int requests_per_thread = 2000;
+static bool serial = false;
+static pthread_mutex_t serial_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct Worker {
+    int id;
+    int errors = 0;
+    std::vector<long> latencies_us;
+};
+
+static long now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void* run_worker(void* arg) {
+    Worker* worker = (Worker*)arg;
+    worker->latencies_us.reserve(requests_per_thread);
+    for (int i = 0; i < requests_per_thread; i++) {
+        std::string command = "ASK bench" + std::to_string(worker->id) + "_" + std::to_string(i) + "\r\n";
+        long start = now_us();
+        if (serial) pthread_mutex_lock(&serial_mutex);
+        std::string reply = Utils::kvstore_command(command);
+        if (serial) pthread_mutex_unlock(&serial_mutex);
+        worker->latencies_us.push_back(now_us() - start);
+        if (reply.compare(0, 4, "+OK ") != 0) worker->errors++;
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : 16;
+    requests_per_thread = argc > 2 ? atoi(argv[2]) : requests_per_thread;
+    serial = argc > 3 && strcmp(argv[3], "serial") == 0;
+    if (threads <= 0 || requests_per_thread <= 0) {
+        fprintf(stderr, "Usage: %s [threads] [requests_per_thread] [serial]\n", argv[0]);
+        return 1;
+    }
+    if (!Utils::connect_to_kvstore()) {
+        fprintf(stderr, "Cannot reach the master\n");
+        return 1;
+    }
+
+    std::vector<Worker> workers(threads);
+    std::vector<pthread_t> tids(threads);
+    long start = now_us();
+    for (int t = 0; t < threads; t++) {
+        workers[t].id = t;
+        pthread_create(&tids[t], NULL, run_worker, &workers[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    long elapsed_us = std::max(1L, now_us() - start);
+
+    std::vector<long> all;
+    int errors = 0;
+    for (const auto& worker : workers) {
+        all.insert(all.end(), worker.latencies_us.begin(), worker.latencies_us.end());
+        errors += worker.errors;
+    }
+    std::sort(all.begin(), all.end());
+    printf("%s: %d threads x %d requests in %.2f s = %.0f req/s, p50 %ld us, p99 %ld us, errors %d\n",
+           serial ? "serial" : "pooled", threads, requests_per_thread, elapsed_us / 1e6,
+           all.size() * 1e6 / elapsed_us, all[all.size() / 2], all[all.size() * 99 / 100], errors);
+    return errors ? 1 : 0;
+}
@@ -1,4 +1,9 @@
 #include "include/handlers/handler_utils.h"
+#include "include/static_cache.h"
+#include "include/utils.h"
+#include "logger.h"
+#include "include/http_response.h"
+#include <sys/socket.h>
 
 namespace Routes {
 
@@ -18,5 +23,51 @@ bool is_protected_route(const std::string& path) {
     return false;
 }
 
+bool send_static_asset(int client_fd, const Http::Request& request, const std::string& file_path, bool with_body) {
+    std::shared_ptr<const StaticCache::Asset> asset = StaticCache::lookup(file_path);
+    if (!asset) {
+        return false;
+    }
+
+    bool not_modified = StaticCache::not_modified(request, *asset);
+    bool gzip = !not_modified && StaticCache::use_gzip(request, *asset);
+    const std::string* body = gzip ? &asset->gzip : &asset->content;
+
+    std::string personalised;
+    if (asset->templated) {
+        std::string username;
+        Utils::is_authenticated(request, username);
+        personalised = asset->content;
+        size_t pos = personalised.find("{{username}}");
+        if (pos != std::string::npos) {
+            personalised.replace(pos, 12, username);
+        }
+        body = &personalised;
+    }
+
+    std::string headers;
+    if (!asset->templated) {
+        headers += "ETag: " + (gzip ? asset->gzip_etag : asset->etag) + "\r\n";
+    }
+    headers += "Cache-Control: " + asset->cache_control + "\r\n";
+    if (!asset->gzip.empty()) {
+        headers += "Vary: Accept-Encoding\r\n";
+    }
+    if (gzip) {
+        headers += "Content-Encoding: gzip\r\n";
+    }
+    if (not_modified) {
+        // no body; Content-Length is the one a 200 would have had
+        Http::write_all(client_fd, Http::response_head("304 Not Modified", "", body->size(), request.keep_alive, headers));
+        return true;
+    }
+
+    std::string head = Http::response_head("200 OK", asset->content_type, body->size(), request.keep_alive, headers);
+    LOG_DEBUG("HTTP Response Headers:\n" << head << "[Content not shown, length: " << body->size() << " bytes]");
+    // the cached bytes go out straight from the cache (writev), HEAD stops after the headers
+    Http::write_all(client_fd, head, with_body ? std::string_view(*body) : std::string_view());
+    return true;
+}
+
 } // namespace Routes 
 
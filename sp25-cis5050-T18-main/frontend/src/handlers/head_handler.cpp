@@ -3,6 +3,8 @@
 #include "include/utils.h"
 #include "include/routes/routes.h"
 #include "include/webstorage/webstorage_handler.hpp"
+#include "logger.h"
+#include "include/http_response.h"
 
 #include <fstream>
 #include <sstream>
@@ -24,18 +26,11 @@
  * - Keep-alive connection management
  */
 
-// Keep alive timeout in seconds
-#define KEEP_ALIVE_TIMEOUT 15
-
 namespace Routes {
 
-void handle_head_request(int client_fd, const std::string& path, const char* request, bool keep_alive) {
-    std::string clean_path = path;
-    
-    size_t question_mark = path.find('?');
-    if (question_mark != std::string::npos) {
-        clean_path = path.substr(0, question_mark);
-    }
+void handle_head_request(int client_fd, const Http::Request& request) {
+    std::string clean_path(request.path());
+    bool keep_alive = request.keep_alive;
     
     if (clean_path.find("/storage/") == 0) {
         WebStorageHandler::handle_storage_request(client_fd, clean_path, request);
@@ -43,17 +38,7 @@ void handle_head_request(int client_fd, const std::string& path, const char* req
     }
     
     if (clean_path == "/server-id") {
-        std::string response = "HTTP/1.1 200 OK\r\n"
-                             "Content-Type: text/plain\r\n"
-                             "Content-Length: 0\r\n";
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                       "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        response += "\r\n";
-        send(client_fd, response.c_str(), response.size(), 0);
+        Http::send_response(client_fd, "200 OK", "text/plain", "", keep_alive);
         return;
     }
     
@@ -61,53 +46,22 @@ void handle_head_request(int client_fd, const std::string& path, const char* req
         clean_path == "/api/admin/rows" || 
         clean_path == "/api/admin/columns" || 
         clean_path == "/api/admin/value") {
-        std::string response = "HTTP/1.1 200 OK\r\n"
-                             "Content-Type: application/json\r\n"
-                             "Content-Length: 0\r\n";
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                       "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        response += "\r\n";
-        send(client_fd, response.c_str(), response.size(), 0);
+        Http::send_response(client_fd, "200 OK", "application/json", "", keep_alive);
         return;
     }
     
     if (is_protected_route(clean_path)) {
         std::string username;
         if (!Utils::is_authenticated(request, username)) {
-            std::string redirect_response = "HTTP/1.1 302 Found\r\n"
-                                         "Location: /login\r\n"
-                                         "Content-Length: 0\r\n";
-            if (keep_alive) {
-                redirect_response += "Connection: keep-alive\r\n"
-                                   "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-            } else {
-                redirect_response += "Connection: close\r\n";
-            }
-            redirect_response += "\r\n";
-            
-            send(client_fd, redirect_response.c_str(), redirect_response.size(), 0);
-            std::cout << "Unauthorized access to " << clean_path << ", redirecting to login" << std::endl;
+            Http::send_response(client_fd, "302 Found", "", "", keep_alive, "Location: /login\r\n");
+            LOG_DEBUG("Unauthorized access to " << clean_path << ", redirecting to login");
             return;
         }
     }
     
     if (clean_path.rfind("/api/", 0) == 0) {
-        std::string not_found_response = "HTTP/1.1 404 Not Found\r\n"
-                                        "Content-Type: application/json\r\n"
-                                        "Content-Length: 0\r\n";
-        if (keep_alive) {
-            not_found_response += "Connection: keep-alive\r\n"
-                                 "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            not_found_response += "Connection: close\r\n";
-        }
-        not_found_response += "\r\n";
-        send(client_fd, not_found_response.c_str(), not_found_response.size(), 0);
-        std::cout << "API endpoint not found: " << clean_path << std::endl;
+        Http::send_response(client_fd, "404 Not Found", "application/json", "", keep_alive);
+        LOG_DEBUG("API endpoint not found: " << clean_path);
         return;
     }
     
@@ -129,51 +83,10 @@ void handle_head_request(int client_fd, const std::string& path, const char* req
         file_path = "public" + clean_path + ".html";
     }
     
-    std::string content_type = "text/html";
-    if (ends_with(clean_path, ".css")) {
-        content_type = "text/css";
-    }
-    
-    std::ifstream file(file_path, std::ios::binary);
-    if (file.is_open()) {
-        file.seekg(0, std::ios::end);
-        size_t content_length = file.tellg();
-        file.close();
-        
-        std::cout << "Serving HEAD for file: " << file_path << " with content type: " << content_type << std::endl;
-        
-        std::ostringstream response;
-        response << "HTTP/1.1 200 OK\r\n"
-                 << "Content-Type: " << content_type << "\r\n"
-                 << "Content-Length: " << content_length << "\r\n";
-        
-        if (keep_alive) {
-            response << "Connection: keep-alive\r\n"
-                     << "Keep-Alive: timeout=" << KEEP_ALIVE_TIMEOUT << "\r\n";
-        } else {
-            response << "Connection: close\r\n";
-        }
-        
-        response << "\r\n";
-        
-        std::string response_str = response.str();
-        send(client_fd, response_str.c_str(), response_str.size(), 0);
-        
-        std::cout << "HTTP Response Headers:\n" << response_str << std::endl;
-    } else {
-        std::cout << "File not found: " << file_path << std::endl;
-        std::string not_found_response = "HTTP/1.1 404 Not Found\r\n"
-                                        "Content-Type: text/html\r\n"
-                                        "Content-Length: 0\r\n";
-        if (keep_alive) {
-            not_found_response += "Connection: keep-alive\r\n"
-                                 "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            not_found_response += "Connection: close\r\n";
-        }
-        not_found_response += "\r\n";
-        send(client_fd, not_found_response.c_str(), not_found_response.size(), 0);
-        std::cout << "HTTP Response:\n" << not_found_response << std::endl;
+    if (!send_static_asset(client_fd, request, file_path, false)) {
+        LOG_DEBUG("File not found: " << file_path);
+        Http::send_response(client_fd, "404 Not Found", "text/html", "", keep_alive);
+        LOG_DEBUG("HTTP Response: 404 Not Found");
     }
 }
 
@@ -1,5 +1,8 @@
 #include "include/routes/routes.h"
 #include "include/utils.h"
+#include "logger.h"
+#include "include/http_response.h"
+#include "include/webstorage/webstorage.hpp"
 
 #include <string>
 #include <sstream>
@@ -16,13 +19,11 @@
  * - Row retrieval across multiple tablet servers
  * - Column retrieval for specific rows
  * - Value retrieval for specific row/column pairs
+ * - Migration of file chunks stored as hex to raw bytes
  * - Error handling for missing tablets and data
  * - JSON response formatting
  */
 
-// Keep alive timeout in seconds
-#define KEEP_ALIVE_TIMEOUT 15
-
 namespace Routes {
 
 
@@ -41,73 +42,29 @@ std::vector<std::string> parse_space_separated_values(const std::string& data) {
 }
 
 void handle_get_db_rows(int client_fd, bool keep_alive) {
-    std::cout << "Admin request: Getting all database rows" << std::endl;
-    
-    std::vector<std::string> tablet_addresses;
-    
-    
-    for (int i = 0; i < 3; i++) {
-        std::string dummy_key = "dummy_key_" + std::to_string(i);
-        std::string tablet_address = Utils::get_tablet_for_username(dummy_key);
-        
-        if (tablet_address == "SERVICE_DOWN") {
-            
-            continue;
-        }
-        
-        if (!tablet_address.empty() && 
-            std::find(tablet_addresses.begin(), tablet_addresses.end(), tablet_address) == tablet_addresses.end()) {
-            tablet_addresses.push_back(tablet_address);
-        }
-    }
-    
+    LOG_DEBUG("Admin request: Getting all database rows");
     
-    std::vector<std::string> known_users = {"admin", "user1", "test"};
-    for (const auto& user : known_users) {
-        std::string tablet_address = Utils::get_tablet_for_username(user);
-        
-        if (tablet_address == "SERVICE_DOWN") {
-            
-            continue;
-        }
-        
-        if (!tablet_address.empty() && 
-            std::find(tablet_addresses.begin(), tablet_addresses.end(), tablet_address) == tablet_addresses.end()) {
-            tablet_addresses.push_back(tablet_address);
-        }
-    }
+    // one primary per shard on the hash ring, from a single SHARD_MAP call
+    std::vector<std::string> tablet_addresses = Utils::get_all_primaries();
     
     
     if (tablet_addresses.empty()) {
         std::string error_text = "{\"error\": \"No active tablet servers found\"}";
-        std::string response = "HTTP/1.1 500 Internal Server Error\r\n"
-                           "Content-Type: application/json\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: No active tablet servers" << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "application/json", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: No active tablet servers");
         return;
     }
     
     
     std::vector<std::string> all_rows;
     for (const auto& tablet_address : tablet_addresses) {
-        std::cout << "Querying tablet server: " << tablet_address << std::endl;
+        LOG_DEBUG("Querying tablet server: " << tablet_address);
         
         std::string get_rows_cmd = "GET_ROWS\r\n";
         auto [rows_response, success] = Utils::tablet_command(tablet_address, get_rows_cmd);
         
         if (success) {
-            std::cout << "Tablet response: " << rows_response << std::endl;
+            LOG_DEBUG("Tablet response: " << rows_response);
             
             if (rows_response.find("+OK") == 0) {
                 std::string rows_data = rows_response.substr(4); 
@@ -120,7 +77,7 @@ void handle_get_db_rows(int client_fd, bool keep_alive) {
                 all_rows.insert(all_rows.end(), tablet_rows.begin(), tablet_rows.end());
             }
         } else {
-            std::cout << "Failed to get rows from tablet: " << tablet_address << std::endl;
+            LOG_WARN("Failed to get rows from tablet: " << tablet_address);
         }
     }
     
@@ -136,21 +93,8 @@ void handle_get_db_rows(int client_fd, bool keep_alive) {
     json << "]}";
     
     std::string json_str = json.str();
-    std::string response = "HTTP/1.1 200 OK\r\n"
-                         "Content-Type: application/json\r\n"
-                         "Content-Length: " + std::to_string(json_str.size()) + "\r\n";
-    
-    if (keep_alive) {
-        response += "Connection: keep-alive\r\n"
-                   "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-    } else {
-        response += "Connection: close\r\n";
-    }
-    
-    response += "\r\n" + json_str;
-    
-    send(client_fd, response.c_str(), response.size(), 0);
-    std::cout << "HTTP Response: Sent " << all_rows.size() << " rows" << std::endl;
+    Http::send_response(client_fd, "200 OK", "application/json", json_str, keep_alive);
+    LOG_DEBUG("HTTP Response: Sent " << all_rows.size() << " rows");
 }
 
 void handle_get_db_columns(int client_fd, const std::string& path, bool keep_alive) {
@@ -158,21 +102,8 @@ void handle_get_db_columns(int client_fd, const std::string& path, bool keep_ali
     size_t pos = path.find("row=");
     if (pos == std::string::npos) {
         std::string error_text = "{\"error\": \"Missing row parameter\"}";
-        std::string response = "HTTP/1.1 400 Bad Request\r\n"
-                           "Content-Type: application/json\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Missing row parameter" << std::endl;
+        Http::send_response(client_fd, "400 Bad Request", "application/json", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: Missing row parameter");
         return;
     }
     
@@ -182,73 +113,34 @@ void handle_get_db_columns(int client_fd, const std::string& path, bool keep_ali
         row = row.substr(0, pos);
     }
     
-    std::cout << "Admin request: Getting columns for row: " << row << std::endl;
+    LOG_DEBUG("Admin request: Getting columns for row: " << row);
     
     
     std::string tablet_address = Utils::get_tablet_for_username(row);
     
     if (tablet_address == "SERVICE_DOWN") {
         std::string error_text = "{\"error\": \"Service unavailable for this data shard\"}";
-        std::string response = "HTTP/1.1 503 Service Unavailable\r\n"
-                           "Content-Type: application/json\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Service unavailable for this data shard" << std::endl;
+        Http::send_response(client_fd, "503 Service Unavailable", "application/json", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: Service unavailable for this data shard");
         return;
     }
     
     if (tablet_address.empty()) {
         std::string error_text = "{\"error\": \"Could not determine tablet server for row\"}";
-        std::string response = "HTTP/1.1 500 Internal Server Error\r\n"
-                           "Content-Type: application/json\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Could not determine tablet server" << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "application/json", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: Could not determine tablet server");
         return;
     }
     
     
     std::string get_cols_cmd = "GET_COLS " + row + "\r\n";
     auto [cols_response, success] = Utils::tablet_command(tablet_address, get_cols_cmd);
-    std::cout << "Tablet response for GET_COLS: " << cols_response << std::endl;
+    LOG_DEBUG("Tablet response for GET_COLS: " << cols_response);
     
     if (!success) {
         std::string error_text = "{\"error\": \"Failed to communicate with tablet server\"}";
-        std::string response = "HTTP/1.1 500 Internal Server Error\r\n"
-                           "Content-Type: application/json\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Failed to communicate with tablet" << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "application/json", error_text, keep_alive);
+        LOG_WARN("HTTP Response: Failed to communicate with tablet");
         return;
     }
     
@@ -273,39 +165,13 @@ void handle_get_db_columns(int client_fd, const std::string& path, bool keep_ali
         json << "]}";
         
         std::string json_str = json.str();
-        std::string response = "HTTP/1.1 200 OK\r\n"
-                             "Content-Type: application/json\r\n"
-                             "Content-Length: " + std::to_string(json_str.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + json_str;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Sent " << columns.size() << " columns for row " << row << std::endl;
+        Http::send_response(client_fd, "200 OK", "application/json", json_str, keep_alive);
+        LOG_DEBUG("HTTP Response: Sent " << columns.size() << " columns for row " << row);
     } else {
         
         std::string error_text = "{\"error\": \"Row not found or other error\"}";
-        std::string response = "HTTP/1.1 404 Not Found\r\n"
-                           "Content-Type: application/json\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Row not found - " << cols_response << std::endl;
+        Http::send_response(client_fd, "404 Not Found", "application/json", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: Row not found - " << cols_response);
     }
 }
 
@@ -316,21 +182,8 @@ void handle_get_db_value(int client_fd, const std::string& path, bool keep_alive
     
     if (row_pos == std::string::npos || col_pos == std::string::npos) {
         std::string error_text = "{\"error\": \"Missing row or column parameter\"}";
-        std::string response = "HTTP/1.1 400 Bad Request\r\n"
-                           "Content-Type: application/json\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Missing row or column parameter" << std::endl;
+        Http::send_response(client_fd, "400 Bad Request", "application/json", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: Missing row or column parameter");
         return;
     }
     
@@ -346,73 +199,34 @@ void handle_get_db_value(int client_fd, const std::string& path, bool keep_alive
         col = col.substr(0, col_end);
     }
     
-    std::cout << "Admin request: Getting value for row: " << row << ", col: " << col << std::endl;
+    LOG_DEBUG("Admin request: Getting value for row: " << row << ", col: " << col);
     
     
     std::string tablet_address = Utils::get_tablet_for_username(row);
     
     if (tablet_address == "SERVICE_DOWN") {
         std::string error_text = "{\"error\": \"Service unavailable for this data shard\"}";
-        std::string response = "HTTP/1.1 503 Service Unavailable\r\n"
-                           "Content-Type: application/json\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Service unavailable for this data shard" << std::endl;
+        Http::send_response(client_fd, "503 Service Unavailable", "application/json", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: Service unavailable for this data shard");
         return;
     }
     
     if (tablet_address.empty()) {
         std::string error_text = "{\"error\": \"Could not determine tablet server for row\"}";
-        std::string response = "HTTP/1.1 500 Internal Server Error\r\n"
-                           "Content-Type: application/json\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Could not determine tablet server" << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "application/json", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: Could not determine tablet server");
         return;
     }
     
     
     std::string get_value_cmd = "GET " + row + " " + col + "\r\n";
     auto [value_response, success] = Utils::tablet_command(tablet_address, get_value_cmd);
-    std::cout << "Tablet response for GET: " << value_response << std::endl;
+    LOG_DEBUG("Tablet response for GET: " << value_response);
     
     if (!success) {
         std::string error_text = "{\"error\": \"Failed to communicate with tablet server\"}";
-        std::string response = "HTTP/1.1 500 Internal Server Error\r\n"
-                           "Content-Type: application/json\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Failed to communicate with tablet" << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "application/json", error_text, keep_alive);
+        LOG_WARN("HTTP Response: Failed to communicate with tablet");
         return;
     }
     
@@ -424,44 +238,31 @@ void handle_get_db_value(int client_fd, const std::string& path, bool keep_alive
         }
         
         
+        if (value.compare(0, 4, "raw:") == 0) {
+            value = "raw:<" + std::to_string(value.size() - 4) + " bytes of file data>";  // binary, not JSON text
+        }
+        
         std::ostringstream json;
         json << "{\"value\":\"" << value << "\"}";
         
         std::string json_str = json.str();
-        std::string response = "HTTP/1.1 200 OK\r\n"
-                             "Content-Type: application/json\r\n"
-                             "Content-Length: " + std::to_string(json_str.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + json_str;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Sent value for row " << row << ", col " << col << std::endl;
+        Http::send_response(client_fd, "200 OK", "application/json", json_str, keep_alive);
+        LOG_DEBUG("HTTP Response: Sent value for row " << row << ", col " << col);
     } else {
         
         std::string error_text = "{\"error\": \"Value not found or other error\"}";
-        std::string response = "HTTP/1.1 404 Not Found\r\n"
-                           "Content-Type: application/json\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Value not found - " << value_response << std::endl;
+        Http::send_response(client_fd, "404 Not Found", "application/json", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: Value not found - " << value_response);
     }
 }
 
-} 
+void handle_migrate_storage(int client_fd, bool keep_alive) {
+    LOG_INFO("Admin request: Migrating hex file chunks to raw bytes");
+    WebStorage::MigrationReport report = WebStorage::migrate_hex_chunks();
+    std::ostringstream json;
+    json << "{\"rows\":" << report.rows << ",\"chunks\":" << report.parts << ",\"migrated\":" << report.migrated
+         << ",\"failed\":" << report.failed << ",\"fragment_deletes_pending\":" << report.fragment_deletes_pending << "}";
+    Http::send_response(client_fd, "200 OK", "application/json", json.str(), keep_alive);
+}
+
+}
@@ -1,5 +1,7 @@
 #include "include/routes/routes.h"
 #include "include/utils.h"
+#include "logger.h"
+#include "include/http_response.h"
 #include <sstream>
 #include <string>
 #include <unistd.h>
@@ -10,6 +12,9 @@
 #include <map>
 #include <iostream>
 #include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <poll.h>
 
 /*
  * Admin Nodes Handler
@@ -18,13 +23,13 @@
  * Implements:
  * - Node status checking and reporting
  * - Data retrieval from tablet nodes
- * - Frontend server status monitoring
+ * - Frontend server status monitoring (concurrent probes with a bounded timeout)
  * - JSON response formatting with proper escaping
  * - Port availability checking
  */
 
-// Keep alive timeout in seconds
-#define KEEP_ALIVE_TIMEOUT 15
+// Total time the frontend server probes may take (they run concurrently)
+#define FRONTEND_PROBE_TIMEOUT_MS 300
 
 namespace Routes {
     
@@ -52,38 +57,79 @@ namespace Routes {
         return escaped.str();
     }
 
-    bool is_port_open(int port) {
-        struct sockaddr_in addr;
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        if (sock < 0) return false;
+    // Connect to all ports at once (non-blocking) and wait at most timeout_ms in total;
+    // returns the connect time in ms for each port, or -1 if it refused or did not answer in time
+    std::vector<int> probe_ports(const std::vector<int>& ports, int timeout_ms) {
+        std::vector<int> result(ports.size(), -1);
+        std::vector<pollfd> fds;
+        std::vector<size_t> which;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < ports.size(); i++) {
+            int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            if (sock < 0) continue;
 
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-        addr.sin_port = htons(port);
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+            addr.sin_port = htons(ports[i]);
 
-        int result = connect(sock, (struct sockaddr*)&addr, sizeof(addr));
-        close(sock);
-        
-        return result == 0;
+            if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+                result[i] = 0;
+                close(sock);
+            } else if (errno == EINPROGRESS) {
+                fds.push_back({sock, POLLOUT, 0});
+                which.push_back(i);
+            } else {
+                close(sock);
+            }
+        }
+
+        size_t pending = fds.size();
+        while (pending > 0) {
+            int elapsed = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            if (elapsed >= timeout_ms || poll(fds.data(), fds.size(), timeout_ms - elapsed) <= 0) break;
+            for (size_t k = 0; k < fds.size(); k++) {
+                if (fds[k].fd < 0 || !fds[k].revents) continue;
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (getsockopt(fds[k].fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+                    result[which[k]] = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+                }
+                close(fds[k].fd);
+                fds[k].fd = -1;  // poll ignores negative fds
+                pending--;
+            }
+        }
+        for (auto& p : fds) {
+            if (p.fd >= 0) close(p.fd);
+        }
+        return result;
+    }
+
+    long long now_epoch_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
     }
 
     std::string get_frontend_status() {
         std::ostringstream status;
         status << "[\n";
         
-        int ports[] = {8081, 8082, 8083};
-        for (int i = 0; i < 3; i++) {
-            int port = ports[i];
-            bool is_alive = is_port_open(port);
+        std::vector<int> ports = {8081, 8082, 8083};
+        std::vector<int> probe_ms = probe_ports(ports, FRONTEND_PROBE_TIMEOUT_MS);
+        long long checked_at = now_epoch_ms();
+        for (size_t i = 0; i < ports.size(); i++) {
+            bool is_alive = probe_ms[i] >= 0;
             
             status << "  {\n"
                    << "    \"serverId\": " << (i + 1) << ",\n"
-                   << "    \"port\": " << port << ",\n"
-                   << "    \"status\": \"" << (is_alive ? "Alive" : "Unreachable") << "\"\n"
+                   << "    \"port\": " << ports[i] << ",\n"
+                   << "    \"status\": \"" << (is_alive ? "Alive" : "Unreachable") << "\",\n"
+                   << "    \"probeMs\": " << probe_ms[i] << ",\n"
+                   << "    \"checkedAt\": " << checked_at << "\n"
                    << "  }";
             
-            if (i < 2) status << ",";
+            if (i + 1 < ports.size()) status << ",";
             status << "\n";
         }
         
@@ -91,28 +137,48 @@ namespace Routes {
         return status.str();
     }
 
+    // NODE_STATUS from the master ("+OK round_age_ms count idx ip:port group status heard_ms_ago phi ...") as a JSON array;
+    // these are the heartbeat thread's verdicts, so nothing here waits on a tablet
+    std::string get_backend_status(long long& status_age_ms) {
+        std::string reply = Utils::kvstore_command("NODE_STATUS\r\n");
+        std::ostringstream status;
+        status << "[";
+        status_age_ms = -1;
+        if (reply.find("+OK ") == 0) {
+            std::istringstream iss(reply.substr(4));
+            int count = 0;
+            iss >> status_age_ms >> count;
+            for (int i = 0; i < count; i++) {
+                int node_id, group;
+                long long heard_ms_ago;
+                double phi;
+                std::string address, node_state;
+                if (!(iss >> node_id >> address >> group >> node_state >> heard_ms_ago >> phi)) break;
+                if (i > 0) status << ",";
+                status << "\n  {\"nodeId\": " << node_id << ", \"address\": \"" << escape_json_string(address)
+                       << "\", \"shard\": " << group << ", \"status\": \"" << node_state
+                       << "\", \"lastHeardMs\": " << heard_ms_ago << ", \"phi\": " << phi << "}";
+            }
+        }
+        status << "\n]";
+        return status.str();
+    }
+
     void handle_admin_nodes(int client_fd, bool keep_alive) {
         std::string nodes_response = Utils::kvstore_command("LIST_NODES\r\n");
         
+        long long status_age_ms;
+        std::string backend_status = get_backend_status(status_age_ms);
         std::string frontend_status = get_frontend_status();
         
-        std::ostringstream response_stream;
-        response_stream << "HTTP/1.1 200 OK\r\n"
-                      << "Content-Type: application/json\r\n";
-        
-        if (keep_alive) {
-            response_stream << "Connection: keep-alive\r\n"
-                          << "Keep-Alive: timeout=" << KEEP_ALIVE_TIMEOUT << "\r\n";
-        } else {
-            response_stream << "Connection: close\r\n";
-        }
-        
         std::string json_response;
         
         if (nodes_response.find("+OK") == 0) {
             json_response = "{\n  \"success\": true,\n  \"nodes\": \"" 
                           + escape_json_string(nodes_response) 
-                          + "\",\n  \"frontendServers\": " 
+                          + "\",\n  \"nodeStatus\": " + backend_status
+                          + ",\n  \"statusAgeMs\": " + std::to_string(status_age_ms)
+                          + ",\n  \"frontendServers\": " 
                           + frontend_status 
                           + "\n}";
         } else {
@@ -120,32 +186,14 @@ namespace Routes {
                           "  \"frontendServers\": " + frontend_status + "\n}";
         }
         
-        response_stream << "Content-Length: " << json_response.length() << "\r\n"
-                      << "\r\n"
-                      << json_response;
-        
-        std::string response = response_stream.str();
-        send(client_fd, response.c_str(), response.length(), 0);
+        Http::send_response(client_fd, "200 OK", "application/json", json_response, keep_alive);
     }
 
     void handle_admin_node_data(int client_fd, const std::string& path, bool keep_alive) {
         size_t pos = path.find("nodeId=");
         if (pos == std::string::npos) {
             std::string error_text = "{\"success\": false, \"error\": \"Missing nodeId parameter\"}";
-            std::string response = "HTTP/1.1 400 Bad Request\r\n"
-                               "Content-Type: application/json\r\n"
-                               "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-            
-            if (keep_alive) {
-                response += "Connection: keep-alive\r\n"
-                           "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-            } else {
-                response += "Connection: close\r\n";
-            }
-            
-            response += "\r\n" + error_text;
-            
-            send(client_fd, response.c_str(), response.size(), 0);
+            Http::send_response(client_fd, "400 Bad Request", "application/json", error_text, keep_alive);
             return;
         }
         
@@ -160,27 +208,13 @@ namespace Routes {
             nodeId = std::stoi(nodeIdStr);
         } catch (const std::exception& e) {
             std::string error_text = "{\"success\": false, \"error\": \"Invalid nodeId parameter\"}";
-            std::string response = "HTTP/1.1 400 Bad Request\r\n"
-                               "Content-Type: application/json\r\n"
-                               "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-            
-            if (keep_alive) {
-                response += "Connection: keep-alive\r\n"
-                           "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-            } else {
-                response += "Connection: close\r\n";
-            }
-            
-            response += "\r\n" + error_text;
-            
-            send(client_fd, response.c_str(), response.size(), 0);
+            Http::send_response(client_fd, "400 Bad Request", "application/json", error_text, keep_alive);
             return;
         }
         
-        int port = 6000 + nodeId;
-        std::string tablet_address = "127.0.0.1:" + std::to_string(port);
+        std::string tablet_address = Utils::get_node_address(nodeId);
         
-        std::cout << "Admin request: Getting data from node " << nodeId << " at " << tablet_address << std::endl;
+        LOG_DEBUG("Admin request: Getting data from node " << nodeId << " at " << tablet_address);
         
         std::vector<std::string> rows;
         std::map<std::string, std::vector<std::string>> columns;
@@ -192,20 +226,7 @@ namespace Routes {
         if (!rows_success) {
             std::string error_text = "{\"success\": false, \"error\": \"Failed to communicate with tablet node " + 
                 std::to_string(nodeId) + "\"}";
-            std::string response = "HTTP/1.1 502 Bad Gateway\r\n"
-                               "Content-Type: application/json\r\n"
-                               "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-            
-            if (keep_alive) {
-                response += "Connection: keep-alive\r\n"
-                           "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-            } else {
-                response += "Connection: close\r\n";
-            }
-            
-            response += "\r\n" + error_text;
-            
-            send(client_fd, response.c_str(), response.size(), 0);
+            Http::send_response(client_fd, "502 Bad Gateway", "application/json", error_text, keep_alive);
             return;
         }
         
@@ -252,7 +273,7 @@ namespace Routes {
                             }
                             
                             values[row][col] = value;
-                            std::cout << "Got value for " << row << "/" << col << ": " << value << std::endl;
+                            LOG_DEBUG("Got value for " << row << "/" << col << ": " << value);
                         }
                     }
                 }
@@ -321,20 +342,7 @@ namespace Routes {
         json << "}";
         
         std::string json_str = json.str();
-        std::string response = "HTTP/1.1 200 OK\r\n"
-                             "Content-Type: application/json\r\n"
-                             "Content-Length: " + std::to_string(json_str.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                       "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + json_str;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response: Sent data from node " << nodeId << " with " << rows.size() << " rows" << std::endl;
+        Http::send_response(client_fd, "200 OK", "application/json", json_str, keep_alive);
+        LOG_DEBUG("HTTP Response: Sent data from node " << nodeId << " with " << rows.size() << " rows");
     }
 } 
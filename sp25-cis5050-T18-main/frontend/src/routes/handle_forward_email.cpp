@@ -1,5 +1,7 @@
 #include "include/routes/routes.h"
 #include "include/utils.h"
+#include "logger.h"
+#include "include/http_response.h"
 
 #include <string>
 #include <sstream>
@@ -21,30 +23,14 @@
  * - Error handling for network and authentication issues
  */
 
-// Keep alive timeout in seconds
-#define KEEP_ALIVE_TIMEOUT 15
-
 namespace Routes {
 
-void handle_forward_email(int client_fd, const std::string& body, const char* request, bool keep_alive) {
+void handle_forward_email(int client_fd, const std::string& body, const Http::Request& request, bool keep_alive) {
     std::string username;
     if (!Utils::is_authenticated(request, username)) {
         std::string error_text = "error: Not authenticated";
-        std::string response = "HTTP/1.1 401 Unauthorized\r\n"
-                               "Content-Type: text/plain\r\n"
-                               "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response:\n" << response << std::endl;
+        Http::send_response(client_fd, "401 Unauthorized", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 401 Unauthorized " << error_text);
         return;
     }
     
@@ -55,45 +41,19 @@ void handle_forward_email(int client_fd, const std::string& body, const char* re
     
     if (email_id.empty() || recipients.empty()) {
         std::string error_text = "error: Missing required fields";
-        std::string response = "HTTP/1.1 400 Bad Request\r\n"
-                               "Content-Type: text/plain\r\n"
-                               "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response:\n" << response << std::endl;
+        Http::send_response(client_fd, "400 Bad Request", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 400 Bad Request " << error_text);
         return;
     }
     
-    std::cout << "Forwarding email ID " << email_id << " from " << username 
-              << " to " << recipients << std::endl;
+    LOG_DEBUG("Forwarding email ID " << email_id << " from " << username 
+              << " to " << recipients);
     
     int smtp_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (smtp_fd < 0) {
         std::string error_text = "error: Failed to create socket for SMTP";
-        std::string response = "HTTP/1.1 500 Internal Server Error\r\n"
-                               "Content-Type: text/plain\r\n"
-                               "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response:\n" << response << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 500 Internal Server Error " << error_text);
         return;
     }
     
@@ -104,14 +64,14 @@ void handle_forward_email(int client_fd, const std::string& body, const char* re
     
     if (connect(smtp_fd, (struct sockaddr*)&smtp_addr, sizeof(smtp_addr)) < 0) {
         close(smtp_fd);
-        std::cout << "SMTP service is down. Sending service down page." << std::endl;
+        LOG_DEBUG("SMTP service is down. Sending service down page.");
         Utils::redirect_to_service_down_page(client_fd, keep_alive);
         return;
     }
     
     char buffer[1024] = {0};
     read(smtp_fd, buffer, 1024);
-    std::cout << "SMTP server greeting: " << buffer << std::endl;
+    LOG_DEBUG("SMTP server greeting: " << buffer);
     
     std::string forw_command = "FORW " + username + " " + email_id + " " + recipients + "\r\n";
     std::string forw_response = Utils::send_smtp_command(smtp_fd, forw_command);
@@ -123,40 +83,14 @@ void handle_forward_email(int client_fd, const std::string& body, const char* re
     
     if (forw_response.find("+OK") != 0 && forw_response.find("250") != 0) {
         std::string error_text = "error: Failed to forward email - " + forw_response;
-        std::string response = "HTTP/1.1 500 Internal Server Error\r\n"
-                               "Content-Type: text/plain\r\n"
-                               "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response:\n" << response << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 500 Internal Server Error " << error_text);
         return;
     }
     
     std::string success_text = "success: Email forwarded successfully";
-    std::string success_response = "HTTP/1.1 200 OK\r\n"
-                                   "Content-Type: text/plain\r\n"
-                                   "Content-Length: " + std::to_string(success_text.size()) + "\r\n";
-    
-    if (keep_alive) {
-        success_response += "Connection: keep-alive\r\n"
-                            "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-    } else {
-        success_response += "Connection: close\r\n";
-    }
-    
-    success_response += "\r\n" + success_text;
-    
-    send(client_fd, success_response.c_str(), success_response.size(), 0);
-    std::cout << "HTTP Response:\n" << success_response << std::endl;
+    Http::send_response(client_fd, "200 OK", "text/plain", success_text, keep_alive);
+    LOG_DEBUG("HTTP Response: 200 OK " << success_text);
 }
 
 } 
\ No newline at end of file
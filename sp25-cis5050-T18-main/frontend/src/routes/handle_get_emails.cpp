@@ -1,5 +1,7 @@
 #include "include/routes/routes.h"
 #include "include/utils.h"
+#include "logger.h"
+#include "include/http_response.h"
 #include <string>
 #include <sys/socket.h>
 #include <iostream>
@@ -19,88 +21,47 @@
  * - Error handling for network and authentication issues
  */
 
-// Keep alive timeout in seconds
-#define KEEP_ALIVE_TIMEOUT 15
-
 namespace Routes {
 
-void handle_get_emails(int client_fd, const std::string& request_headers, bool keep_alive) {
+void handle_get_emails(int client_fd, const Http::Request& request, bool keep_alive) {
     std::string username;
-    bool is_authenticated = Utils::is_authenticated(request_headers.c_str(), username);
+    bool is_authenticated = Utils::is_authenticated(request, username);
     
     if (!is_authenticated || username.empty()) {
         std::string error_text = "error: Unauthorized";
-        std::string error_response = "HTTP/1.1 401 Unauthorized\r\n"
-                                  "Content-Type: text/plain\r\n"
-                                  "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            error_response += "Connection: keep-alive\r\n"
-                             "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            error_response += "Connection: close\r\n";
-        }
-        
-        error_response += "\r\n" + error_text;
-        
-        send(client_fd, error_response.c_str(), error_response.size(), 0);
-        std::cout << "HTTP Response:\n" << error_response << std::endl;
+        Http::send_response(client_fd, "401 Unauthorized", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 401 Unauthorized " << error_text);
         return;
     }
     
-    std::cout << "Getting emails for user: " << username << std::endl;
+    LOG_DEBUG("Getting emails for user: " << username);
     
-    std::string tablet_address = Utils::get_tablet_for_username(username);
+    std::string read_address;
+    std::string tablet_address = Utils::get_tablets_for_username(username, read_address);
     
     if (tablet_address == "SERVICE_DOWN") {
-        std::cout << "Service is down for this shard. Sending service down page." << std::endl;
+        LOG_DEBUG("Service is down for this shard. Sending service down page.");
         Utils::redirect_to_service_down_page(client_fd, keep_alive);
         return;
     }
     
     if (tablet_address.empty()) {
         std::string error_text = "error: Internal server error - Cannot determine tablet server";
-        std::string error_response = "HTTP/1.1 500 Internal Server Error\r\n"
-                                  "Content-Type: text/plain\r\n"
-                                  "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            error_response += "Connection: keep-alive\r\n"
-                             "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            error_response += "Connection: close\r\n";
-        }
-        
-        error_response += "\r\n" + error_text;
-        
-        send(client_fd, error_response.c_str(), error_response.size(), 0);
-        std::cout << "HTTP Response:\n" << error_response << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 500 Internal Server Error " << error_text);
         return;
     }
     
     std::string get_emails_cmd = "GET " + username + " emails\r\n";
-    std::cout << "Sending command to get email count: " << get_emails_cmd;
-    auto [emails_response, emails_success] = Utils::tablet_command(tablet_address, get_emails_cmd);
+    LOG_DEBUG("Sending command to get email count: " << get_emails_cmd);
+    auto [emails_response, emails_success] = Utils::tablet_read_command(read_address, tablet_address, get_emails_cmd);
     
     std::vector<int> email_ids;
     
     if (!emails_success) {
         std::string error_text = "error: Failed to retrieve email list";
-        std::string error_response = "HTTP/1.1 500 Internal Server Error\r\n"
-                                  "Content-Type: text/plain\r\n"
-                                  "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            error_response += "Connection: keep-alive\r\n"
-                             "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            error_response += "Connection: close\r\n";
-        }
-        
-        error_response += "\r\n" + error_text;
-        
-        send(client_fd, error_response.c_str(), error_response.size(), 0);
-        std::cout << "HTTP Response:\n" << error_response << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 500 Internal Server Error " << error_text);
         return;
     }
     
@@ -111,8 +72,8 @@ void handle_get_emails(int client_fd, const std::string& request_headers, bool k
             email_list_str = email_list_str.substr(0, email_list_str.length() - 2);
         }
         
-        std::cout << "Raw email list response: '" << emails_response << "'" << std::endl;
-        std::cout << "Extracted email IDs string: '" << email_list_str << "'" << std::endl;
+        LOG_DEBUG("Raw email list response: '" << emails_response << "'");
+        LOG_DEBUG("Extracted email IDs string: '" << email_list_str << "'");
         
         std::istringstream iss(email_list_str);
         int id;
@@ -120,28 +81,15 @@ void handle_get_emails(int client_fd, const std::string& request_headers, bool k
             email_ids.push_back(id);
         }
     } else if (emails_response.find("-ERR") == 0) {
-        std::cout << "User has no emails yet (no 'emails' key found)" << std::endl;
+        LOG_DEBUG("User has no emails yet (no 'emails' key found)");
     } else {
         std::string error_text = "error: Unexpected response from server";
-        std::string error_response = "HTTP/1.1 500 Internal Server Error\r\n"
-                                  "Content-Type: text/plain\r\n"
-                                  "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            error_response += "Connection: keep-alive\r\n"
-                             "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            error_response += "Connection: close\r\n";
-        }
-        
-        error_response += "\r\n" + error_text;
-        
-        send(client_fd, error_response.c_str(), error_response.size(), 0);
-        std::cout << "HTTP Response:\n" << error_response << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 500 Internal Server Error " << error_text);
         return;
     }
     
-    std::cout << "Found " << email_ids.size() << " email IDs" << std::endl;
+    LOG_DEBUG("Found " << email_ids.size() << " email IDs");
     
     std::vector<std::string> retrieved_emails;
     
@@ -149,16 +97,16 @@ void handle_get_emails(int client_fd, const std::string& request_headers, bool k
         std::string email_id = "EMAIL" + std::to_string(email_id_num);
         std::string get_email_cmd = "GET " + username + " " + email_id + "\r\n";
         
-        std::cout << "Sending tablet command: " << get_email_cmd;
-        auto [email_response, email_success] = Utils::tablet_command(tablet_address, get_email_cmd);
+        LOG_DEBUG("Sending tablet command: " << get_email_cmd);
+        auto [email_response, email_success] = Utils::tablet_read_command(read_address, tablet_address, get_email_cmd);
         
         if (!email_success) {
-            std::cout << "Network failure when retrieving email " << email_id << std::endl;
+            LOG_WARN("Network failure when retrieving email " << email_id);
             continue;
         }
         
         if (email_response.find("+OK") != 0) {
-            std::cout << "Failed to retrieve email " << email_id << ": " << email_response << std::endl;
+            LOG_WARN("Failed to retrieve email " << email_id << ": " << email_response);
             continue;
         }
         
@@ -168,7 +116,7 @@ void handle_get_emails(int client_fd, const std::string& request_headers, bool k
             email_content = email_content.substr(0, email_content.length() - 2);
         }
         
-        std::cout << "Successfully retrieved email " << email_id << ", content length: " << email_content.length() << std::endl;
+        LOG_DEBUG("Successfully retrieved email " << email_id << ", content length: " << email_content.length());
         
         std::string escaped_content = Utils::escape_email_content(email_content);
         
@@ -191,21 +139,8 @@ void handle_get_emails(int client_fd, const std::string& request_headers, bool k
     
     std::string response_text = response_body.str();
     
-    std::string response = "HTTP/1.1 200 OK\r\n"
-                       "Content-Type: text/plain\r\n"
-                       "Content-Length: " + std::to_string(response_text.size()) + "\r\n";
-    
-    if (keep_alive) {
-        response += "Connection: keep-alive\r\n"
-                    "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-    } else {
-        response += "Connection: close\r\n";
-    }
-    
-    response += "\r\n" + response_text;
-    
-    send(client_fd, response.c_str(), response.size(), 0);
-    std::cout << "Sent " << retrieved_emails.size() << " emails to client" << std::endl;
+    Http::send_response(client_fd, "200 OK", "text/plain", response_text, keep_alive);
+    LOG_DEBUG("Sent " << retrieved_emails.size() << " emails to client");
 }
 
 } 
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "include/routes/routes.h"
+#include "include/utils.h"
+#include "include/http_response.h"
 #include <string>
 #include <sstream>
 #include <unistd.h>
@@ -18,28 +20,13 @@
  * - Error handling for connection failures
  */
 
-// Keep alive timeout in seconds
-#define KEEP_ALIVE_TIMEOUT 15
-
 namespace Routes {
 
     void handle_kill_node(int client_fd, const std::string& body, bool keep_alive) {
         size_t pos = body.find("nodeId=");
         if (pos == std::string::npos) {
             std::string error_msg = "{\"error\":\"Missing nodeId parameter\"}";
-            std::string response = "HTTP/1.1 400 Bad Request\r\n"
-                                  "Content-Type: application/json\r\n"
-                                  "Content-Length: " + std::to_string(error_msg.length()) + "\r\n";
-            
-            if (keep_alive) {
-                response += "Connection: keep-alive\r\n"
-                           "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-            } else {
-                response += "Connection: close\r\n";
-            }
-            
-            response += "\r\n" + error_msg;
-            send(client_fd, response.c_str(), response.length(), 0);
+            Http::send_response(client_fd, "400 Bad Request", "application/json", error_msg, keep_alive);
             return;
         }
 
@@ -53,39 +40,17 @@ namespace Routes {
             node_id = std::stoi(id_str);
         } catch (...) {
             std::string error_msg = "{\"error\":\"Invalid nodeId parameter\"}";
-            std::string response = "HTTP/1.1 400 Bad Request\r\n"
-                                  "Content-Type: application/json\r\n"
-                                  "Content-Length: " + std::to_string(error_msg.length()) + "\r\n";
-            
-            if (keep_alive) {
-                response += "Connection: keep-alive\r\n"
-                           "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-            } else {
-                response += "Connection: close\r\n";
-            }
-            
-            response += "\r\n" + error_msg;
-            send(client_fd, response.c_str(), response.length(), 0);
+            Http::send_response(client_fd, "400 Bad Request", "application/json", error_msg, keep_alive);
             return;
         }
 
-        int node_port = 6000 + node_id;
+        std::string node_address = Utils::get_node_address(node_id);
+        std::string node_ip = node_address.substr(0, node_address.find(':'));
+        int node_port = std::stoi(node_address.substr(node_address.find(':') + 1));
         int sock = socket(AF_INET, SOCK_STREAM, 0);
         if (sock < 0) {
             std::string error_msg = "{\"error\":\"Failed to create socket\"}";
-            std::string response = "HTTP/1.1 500 Internal Server Error\r\n"
-                                  "Content-Type: application/json\r\n"
-                                  "Content-Length: " + std::to_string(error_msg.length()) + "\r\n";
-            
-            if (keep_alive) {
-                response += "Connection: keep-alive\r\n"
-                           "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-            } else {
-                response += "Connection: close\r\n";
-            }
-            
-            response += "\r\n" + error_msg;
-            send(client_fd, response.c_str(), response.length(), 0);
+            Http::send_response(client_fd, "500 Internal Server Error", "application/json", error_msg, keep_alive);
             return;
         }
 
@@ -93,23 +58,11 @@ namespace Routes {
         memset(&addr, 0, sizeof(addr));
         addr.sin_family = AF_INET;
         addr.sin_port = htons(node_port);
-        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        addr.sin_addr.s_addr = inet_addr(node_ip.c_str());
 
         if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
             std::string error_msg = "{\"error\":\"Failed to connect to node\"}";
-            std::string response = "HTTP/1.1 500 Internal Server Error\r\n"
-                                  "Content-Type: application/json\r\n"
-                                  "Content-Length: " + std::to_string(error_msg.length()) + "\r\n";
-            
-            if (keep_alive) {
-                response += "Connection: keep-alive\r\n"
-                           "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-            } else {
-                response += "Connection: close\r\n";
-            }
-            
-            response += "\r\n" + error_msg;
-            send(client_fd, response.c_str(), response.length(), 0);
+            Http::send_response(client_fd, "500 Internal Server Error", "application/json", error_msg, keep_alive);
             close(sock);
             return;
         }
@@ -121,20 +74,7 @@ namespace Routes {
         send(sock, cmd, strlen(cmd), 0);
         
         std::string success = "{\"success\":true}";
-        std::string response = "HTTP/1.1 200 OK\r\n"
-                              "Content-Type: application/json\r\n"
-                              "Content-Length: " + std::to_string(success.length()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                       "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + success;
-        
-        send(client_fd, response.c_str(), response.length(), 0);
+        Http::send_response(client_fd, "200 OK", "application/json", success, keep_alive);
         close(sock);
     }
 } 
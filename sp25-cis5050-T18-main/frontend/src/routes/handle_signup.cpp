@@ -1,5 +1,7 @@
 #include "include/routes/routes.h"
 #include "include/utils.h"
+#include "logger.h"
+#include "include/http_response.h"
 
 #include <string>
 #include <sys/socket.h>
@@ -18,62 +20,33 @@
  * - Appropriate HTTP status codes for different response conditions
  */
 
-// Keep alive timeout in seconds
-#define KEEP_ALIVE_TIMEOUT 15
-
 namespace Routes {
 
 void handle_signup(int client_fd, const std::string& body, bool keep_alive) {
     std::string username = Utils::get_form_value(body, "username");
     std::string password = Utils::get_form_value(body, "password");
     
-    std::cout << "Signup attempt for user: " << username << std::endl;
+    LOG_DEBUG("Signup attempt for user: " << username);
     
     if (username.empty() || password.empty()) {
         std::string error_text = "error: Missing credentials";
-        std::string response = "HTTP/1.1 400 Bad Request\r\n"
-                           "Content-Type: text/plain\r\n"
-                           "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        response += "\r\n" + error_text;
-        
-        send(client_fd, response.c_str(), response.size(), 0);
-        std::cout << "HTTP Response:\n" << response << std::endl;
+        Http::send_response(client_fd, "400 Bad Request", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 400 Bad Request " << error_text);
         return;
     }
     
     std::string tablet_address = Utils::get_tablet_for_username(username);
     
     if (tablet_address == "SERVICE_DOWN") {
-        std::cout << "Service is down for this shard. Sending service down page." << std::endl;
+        LOG_DEBUG("Service is down for this shard. Sending service down page.");
         Utils::redirect_to_service_down_page(client_fd, keep_alive);
         return;
     }
     
     if (tablet_address.empty()) {
         std::string error_text = "error: Internal server error";
-        std::string error_response = "HTTP/1.1 500 Internal Server Error\r\n"
-                                  "Content-Type: text/plain\r\n"
-                                  "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            error_response += "Connection: keep-alive\r\n"
-                             "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            error_response += "Connection: close\r\n";
-        }
-        
-        error_response += "\r\n" + error_text;
-        
-        send(client_fd, error_response.c_str(), error_response.size(), 0);
-        std::cout << "HTTP Response:\n" << error_response << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 500 Internal Server Error " << error_text);
         return;
     }
     
@@ -82,100 +55,35 @@ void handle_signup(int client_fd, const std::string& body, bool keep_alive) {
     
     if (!success) {
         std::string error_text = "error: Failed to communicate with tablet server";
-        std::string error_response = "HTTP/1.1 500 Internal Server Error\r\n"
-                                  "Content-Type: text/plain\r\n"
-                                  "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            error_response += "Connection: keep-alive\r\n"
-                             "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            error_response += "Connection: close\r\n";
-        }
-        
-        error_response += "\r\n" + error_text;
-        
-        send(client_fd, error_response.c_str(), error_response.size(), 0);
-        std::cout << "HTTP Response:\n" << error_response << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 500 Internal Server Error " << error_text);
         return;
     }
     
     if (kv_response.find("+OK") == 0) {
         std::string error_text = "error: Username already exists";
         
-        std::string error_response = "HTTP/1.1 409 Conflict\r\n"
-                                  "Content-Type: text/plain\r\n"
-                                  "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            error_response += "Connection: keep-alive\r\n"
-                             "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            error_response += "Connection: close\r\n";
-        }
-        
-        error_response += "\r\n" + error_text;
-        
-        send(client_fd, error_response.c_str(), error_response.size(), 0);
-        std::cout << "HTTP Response:\n" << error_response << std::endl;
+        Http::send_response(client_fd, "409 Conflict", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 409 Conflict " << error_text);
     } else if (kv_response.find("-ERR") == 0) {
         std::string put_command = "PUT " + username + " password " + password + "\r\n";
         auto [put_response, put_success] = Utils::tablet_command(tablet_address, put_command);
 
         if (!put_success) {
             std::string error_text = "error: Failed to communicate with tablet server";
-            std::string error_response = "HTTP/1.1 500 Internal Server Error\r\n"
-                                      "Content-Type: text/plain\r\n"
-                                      "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-            
-            if (keep_alive) {
-                error_response += "Connection: keep-alive\r\n"
-                                 "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-            } else {
-                error_response += "Connection: close\r\n";
-            }
-            
-            error_response += "\r\n" + error_text;
-            
-            send(client_fd, error_response.c_str(), error_response.size(), 0);
-            std::cout << "HTTP Response:\n" << error_response << std::endl;
+            Http::send_response(client_fd, "500 Internal Server Error", "text/plain", error_text, keep_alive);
+            LOG_DEBUG("HTTP Response: 500 Internal Server Error " << error_text);
             return;
         }
 
         std::string success_text = "success: User created";
-        std::string success_response = "HTTP/1.1 200 OK\r\n"
-                                      "Content-Type: text/plain\r\n"
-                                      "Content-Length: " + std::to_string(success_text.size()) + "\r\n";
-
-        if (keep_alive) {
-            success_response += "Connection: keep-alive\r\n"
-                               "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            success_response += "Connection: close\r\n";
-        }
-        
-        success_response += "\r\n" + success_text;
-
-        send(client_fd, success_response.c_str(), success_response.size(), 0);
-        std::cout << "HTTP Response:\n" << success_response << std::endl;
+        Http::send_response(client_fd, "200 OK", "text/plain", success_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 200 OK " << success_text);
     } else {
         std::string error_text = "error: Internal server error";
         
-        std::string error_response = "HTTP/1.1 500 Internal Server Error\r\n"
-                                  "Content-Type: text/plain\r\n"
-                                  "Content-Length: " + std::to_string(error_text.size()) + "\r\n";
-        
-        if (keep_alive) {
-            error_response += "Connection: keep-alive\r\n"
-                             "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            error_response += "Connection: close\r\n";
-        }
-        
-        error_response += "\r\n" + error_text;
-        
-        send(client_fd, error_response.c_str(), error_response.size(), 0);
-        std::cout << "HTTP Response:\n" << error_response << std::endl;
+        Http::send_response(client_fd, "500 Internal Server Error", "text/plain", error_text, keep_alive);
+        LOG_DEBUG("HTTP Response: 500 Internal Server Error " << error_text);
     }
 }
 } 
@@ -1,52 +1,34 @@
 #include "include/utils.h"
 #include <string>
 #include <iostream>
-#include <cstring>
+#include <cstdlib>
 
 namespace Utils {
 
-std::string get_cookie_value(const char* headers, const std::string& cookie_name) {
-    const char* cookie_header = strstr(headers, "Cookie:");
-    if (!cookie_header) {
-        cookie_header = strstr(headers, "cookie:");
-    }
-    
-    if (!cookie_header) {
-        return "";
-    }
-    
-    cookie_header = strchr(cookie_header, ':');
-    if (!cookie_header) {
+std::string get_cookie_value(const Http::Request& request, const std::string& cookie_name) {
+    std::string_view cookies = request.header("Cookie");
+    if (cookies.empty()) {
         return "";
     }
     
-    cookie_header++;
-    
-    const char* end = strstr(cookie_header, "\r\n");
-    if (!end) {
-        end = cookie_header + strlen(cookie_header);
-    }
-    
-    std::string cookies(cookie_header, end - cookie_header);
-    
     std::string search = cookie_name + "=";
     size_t pos = cookies.find(search);
-    if (pos == std::string::npos) {
+    if (pos == std::string_view::npos) {
         return "";
     }
     
     pos += search.length();
     size_t end_pos = cookies.find(';', pos);
     
-    if (end_pos == std::string::npos) {
-        return cookies.substr(pos);
+    if (end_pos == std::string_view::npos) {
+        return std::string(cookies.substr(pos));
     } else {
-        return cookies.substr(pos, end_pos - pos);
+        return std::string(cookies.substr(pos, end_pos - pos));
     }
 }
 
-bool is_authenticated(const char* headers, std::string& username) {
-    std::string auth_cookie = get_cookie_value(headers, "auth_user");
+bool is_authenticated(const Http::Request& request, std::string& username) {
+    std::string auth_cookie = get_cookie_value(request, "auth_user");
     if (auth_cookie.empty()) {
         return false;
     }
@@ -55,6 +37,10 @@ bool is_authenticated(const char* headers, std::string& username) {
     return true;
 }
 
+void begin_request_token(const Http::Request& request) {
+    set_request_token(get_cookie_value(request, "auth_user"), strtoull(get_cookie_value(request, "rw_lsn").c_str(), nullptr, 10));
+}
+
 std::string make_auth_cookie(const std::string& username) {
     return "Set-Cookie: auth_user=" + username + "; Path=/; HttpOnly\r\n";
 }
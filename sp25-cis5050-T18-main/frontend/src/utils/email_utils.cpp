@@ -1,4 +1,5 @@
 #include "include/utils.h"
+#include "logger.h"
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -71,14 +72,14 @@ std::string url_decode(const std::string& encoded) {
 
 std::string send_smtp_command(int smtp_fd, const std::string& command) {
     send(smtp_fd, command.c_str(), command.size(), 0);
-    std::cout << "SMTP command sent: " << command;
+    LOG_DEBUG("SMTP command sent: " << command);
     
     char buffer[1024] = {0};
     int bytes = recv(smtp_fd, buffer, sizeof(buffer) - 1, 0);
     
     if (bytes > 0) {
         buffer[bytes] = '\0';
-        std::cout << "SMTP response: " << buffer << std::endl;
+        LOG_DEBUG("SMTP response: " << buffer);
         return std::string(buffer);
     }
     
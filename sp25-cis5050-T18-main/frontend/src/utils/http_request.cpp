@@ -0,0 +1,303 @@
+#include "include/http_request.h"
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#include <strings.h>
+#include <cerrno>
+#include <cctype>
+#include <poll.h>
+#include <sys/socket.h>
+
+/*
+ * HTTP/1.1 Request Parser
+ *
+ * Parses requests in place in the connection's buffer:
+ * - The request line and headers are split once into offsets (views on completion)
+ * - Bodies by Content-Length or chunked Transfer-Encoding (the only case that copies)
+ * - Persistent connections (HTTP/1.1 default, HTTP/1.0 with "Connection: keep-alive") and pipelining
+ * - Streamed bodies: a handler can take the request after its head and read the body from the socket
+ * - Single byte ranges (Range: bytes=...) for resumable and parallel downloads
+ */
+
+// Give up on a client that sends no body bytes for this long (ms)
+#define READ_TIMEOUT_MS 30000
+
+namespace Http {
+
+namespace {
+    bool equals_ignore_case(std::string_view a, std::string_view b) {
+        return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+    }
+
+    // whether a comma-separated header value lists token (Connection: keep-alive, Upgrade)
+    bool has_token(std::string_view value, std::string_view token) {
+        while (!value.empty()) {
+            size_t comma = value.find(',');
+            std::string_view item = value.substr(0, comma);
+            while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+            while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+            if (equals_ignore_case(item, token)) return true;
+            if (comma == std::string_view::npos) break;
+            value.remove_prefix(comma + 1);
+        }
+        return false;
+    }
+
+    std::string_view trim(std::string_view s) {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+        return s;
+    }
+}
+
+std::string_view Request::header(std::string_view name) const {
+    for (const Header& h : headers) {
+        if (equals_ignore_case(h.name, name)) return h.value;
+    }
+    return {};
+}
+
+std::string_view Request::path() const {
+    return target.substr(0, target.find('?'));
+}
+
+bool Parser::take_expect_continue() {
+    bool expect = expect_continue_;
+    expect_continue_ = false;
+    return expect;
+}
+
+bool Parser::head_complete(const std::string& buffer, Request& request) const {
+    if (state_ != READ_BODY) return false;
+    fill(buffer, request);
+    request.body = {};
+    return true;
+}
+
+void Parser::reset() {
+    state_ = READ_HEAD;
+    scanned_ = head_len_ = 0;
+    headers_.clear();
+    keep_alive_ = expect_continue_ = false;
+    body_len_ = chunk_left_ = 0;
+    chunked_body_.clear();
+    consumed_ = 0;
+}
+
+ParseStatus Parser::parse(const std::string& buffer, Request& request) {
+    ParseStatus status = PARSE_INCOMPLETE;
+    if (state_ == READ_HEAD) {
+        status = parse_head(buffer);
+        if (status != PARSE_INCOMPLETE) return status;
+        if (state_ == READ_HEAD) return PARSE_INCOMPLETE;
+    }
+    if (state_ == READ_BODY) {
+        if (buffer.size() < head_len_ + body_len_) return PARSE_INCOMPLETE;
+        consumed_ = head_len_ + body_len_;
+        state_ = DONE;
+    } else if (state_ != DONE) {
+        status = parse_chunks(buffer);
+        if (status != PARSE_INCOMPLETE || state_ != DONE) return status;
+    }
+    fill(buffer, request);
+    return PARSE_COMPLETE;
+}
+
+// Request line and headers: wait for the blank line, then split them once
+ParseStatus Parser::parse_head(const std::string& buffer) {
+    size_t end = buffer.find("\r\n\r\n", scanned_ > 3 ? scanned_ - 3 : 0);
+    if (end == std::string::npos) {
+        scanned_ = buffer.size();
+        return buffer.size() > MAX_HEADER_BYTES ? PARSE_HEADERS_TOO_LARGE : PARSE_INCOMPLETE;
+    }
+    if (end + 4 > MAX_HEADER_BYTES) return PARSE_HEADERS_TOO_LARGE;
+    head_len_ = end + 4;
+
+    // "METHOD target HTTP/x.y"
+    size_t line_end = buffer.find("\r\n");
+    size_t sp1 = buffer.find(' ');
+    size_t sp2 = sp1 == std::string::npos ? sp1 : buffer.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos || sp2 == std::string::npos || sp2 > line_end || sp1 == 0 || sp2 == sp1 + 1) {
+        return PARSE_BAD_REQUEST;
+    }
+    method_len_ = sp1;
+    target_off_ = sp1 + 1;
+    target_len_ = sp2 - target_off_;
+    version_off_ = sp2 + 1;
+    version_len_ = line_end - version_off_;
+    std::string_view version(buffer.data() + version_off_, version_len_);
+    if (version.substr(0, 5) != "HTTP/") return PARSE_BAD_REQUEST;
+
+    std::string_view connection, transfer_encoding, content_length, expect;
+    for (size_t pos = line_end + 2; pos < end + 2;) {
+        size_t eol = buffer.find("\r\n", pos);
+        size_t colon = buffer.find(':', pos);
+        if (colon == std::string::npos || colon > eol || colon == pos) return PARSE_BAD_REQUEST;
+        std::string_view value = trim(std::string_view(buffer.data() + colon + 1, eol - colon - 1));
+        HeaderOffsets h = {pos, colon - pos, (size_t)(value.data() - buffer.data()), value.size()};
+        headers_.push_back(h);
+        std::string_view name(buffer.data() + pos, colon - pos);
+        if (equals_ignore_case(name, "Connection")) connection = value;
+        else if (equals_ignore_case(name, "Transfer-Encoding")) transfer_encoding = value;
+        else if (equals_ignore_case(name, "Content-Length")) content_length = value;
+        else if (equals_ignore_case(name, "Expect")) expect = value;
+        pos = eol + 2;
+    }
+
+    keep_alive_ = version == "HTTP/1.1" ? !has_token(connection, "close") : has_token(connection, "keep-alive");
+    expect_continue_ = version == "HTTP/1.1" && equals_ignore_case(expect, "100-continue") && buffer.size() == head_len_;
+    if (has_token(transfer_encoding, "chunked")) {
+        state_ = READ_CHUNK_SIZE;
+        scanned_ = head_len_;
+        return PARSE_INCOMPLETE;
+    }
+    if (!content_length.empty()) {
+        char* parsed_end = nullptr;
+        std::string digits(content_length);
+        unsigned long long n = strtoull(digits.c_str(), &parsed_end, 10);
+        if (digits[0] < '0' || digits[0] > '9' || *parsed_end != '\0') return PARSE_BAD_REQUEST;
+        if (n > MAX_BODY_BYTES) return PARSE_BODY_TOO_LARGE;
+        body_len_ = (size_t)n;
+    }
+    state_ = READ_BODY;
+    return PARSE_INCOMPLETE;
+}
+
+// "size[;ext]\r\n" data "\r\n" ... "0\r\n" [trailers] "\r\n", appended to chunked_body_ as it arrives
+ParseStatus Parser::parse_chunks(const std::string& buffer) {
+    while (state_ != DONE) {
+        if (state_ == READ_CHUNK_DATA) {
+            size_t n = std::min(chunk_left_, buffer.size() - scanned_);
+            if (n > MAX_BODY_BYTES - chunked_body_.size()) return PARSE_BODY_TOO_LARGE;
+            chunked_body_.append(buffer, scanned_, n);
+            scanned_ += n;
+            chunk_left_ -= n;
+            if (chunk_left_ > 0) return PARSE_INCOMPLETE;
+            state_ = READ_CHUNK_END;
+            continue;
+        }
+        size_t eol = buffer.find("\r\n", scanned_);
+        if (eol == std::string::npos) {
+            return buffer.size() - scanned_ > MAX_HEADER_BYTES ? PARSE_HEADERS_TOO_LARGE : PARSE_INCOMPLETE;
+        }
+        std::string_view line(buffer.data() + scanned_, eol - scanned_);
+        scanned_ = eol + 2;
+        if (state_ == READ_CHUNK_SIZE) {
+            // 1 to 16 hex digits (no sign, no "0x", no overflow), then only optional whitespace before ";ext" or the end
+            size_t digits = 0;
+            unsigned long long n = 0;
+            while (digits < line.size() && isxdigit((unsigned char)line[digits])) {
+                char c = line[digits++];
+                n = n * 16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+                if (digits > 16) return PARSE_BAD_REQUEST;
+            }
+            size_t rest = digits;
+            while (rest < line.size() && (line[rest] == ' ' || line[rest] == '\t')) rest++;
+            if (digits == 0 || (rest < line.size() && line[rest] != ';')) return PARSE_BAD_REQUEST;
+            if (n > MAX_BODY_BYTES - chunked_body_.size()) return PARSE_BODY_TOO_LARGE;
+            chunk_left_ = (size_t)n;
+            state_ = n == 0 ? READ_TRAILER : READ_CHUNK_DATA;
+        } else if (state_ == READ_CHUNK_END) {
+            if (!line.empty()) return PARSE_BAD_REQUEST;
+            state_ = READ_CHUNK_SIZE;
+        } else if (line.empty()) {  // READ_TRAILER: trailer fields are ignored
+            consumed_ = scanned_;
+            state_ = DONE;
+        }
+    }
+    return PARSE_INCOMPLETE;
+}
+
+void Parser::fill(const std::string& buffer, Request& request) const {
+    const char* base = buffer.data();
+    request.method = std::string_view(base, method_len_);
+    request.target = std::string_view(base + target_off_, target_len_);
+    request.version = std::string_view(base + version_off_, version_len_);
+    request.head = std::string_view(base, head_len_);
+    request.headers.clear();
+    for (const HeaderOffsets& h : headers_) {
+        request.headers.push_back({std::string_view(base + h.name, h.name_len), std::string_view(base + h.value, h.value_len)});
+    }
+    request.body = chunked_body_.empty() && body_len_ > 0 ? std::string_view(base + head_len_, body_len_) : std::string_view(chunked_body_);
+    request.keep_alive = keep_alive_;
+}
+
+BodyReader::BodyReader(int fd, std::string_view buffered, size_t length)
+    : fd_(fd), buffered_(buffered.substr(0, length)), remaining_(length) {}
+
+ssize_t BodyReader::read(char* out, size_t max) {
+    size_t n = std::min(max, remaining_);
+    if (n == 0) return 0;
+    if (!buffered_.empty()) {
+        n = std::min(n, buffered_.size());
+        memcpy(out, buffered_.data(), n);
+        buffered_.remove_prefix(n);
+        remaining_ -= n;
+        return n;
+    }
+    if (fd_ < 0) return -1;
+    while (true) {
+        // the client socket is blocking: wait with a deadline first, so a stalled upload cannot hold a worker forever
+        struct pollfd pfd = {fd_, POLLIN, 0};
+        int rc = poll(&pfd, 1, READ_TIMEOUT_MS);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc <= 0) return -1;
+        ssize_t got = recv(fd_, out, n, MSG_DONTWAIT);
+        if (got > 0) {
+            remaining_ -= got;
+            return got;
+        }
+        if (got == 0) return -1;
+        if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+    }
+}
+
+bool BodyReader::drain() {
+    char scratch[16384];
+    while (remaining_ > 0) {
+        if (read(scratch, sizeof(scratch)) < 0) return false;
+    }
+    return true;
+}
+
+namespace {
+    // a run of decimal digits (no sign, no spaces); false if empty or too long
+    bool parse_position(std::string_view digits, size_t& value) {
+        if (digits.empty() || digits.size() > 19) return false;
+        value = 0;
+        for (char c : digits) {
+            if (c < '0' || c > '9') return false;
+            value = value * 10 + (c - '0');
+        }
+        return true;
+    }
+}
+
+RangeStatus parse_range(std::string_view header, size_t size, size_t& start, size_t& end) {
+    header = trim(header);
+    if (header.size() < 6 || !equals_ignore_case(header.substr(0, 6), "bytes=")) return RANGE_NONE;
+    std::string_view spec = trim(header.substr(6));
+    size_t dash = spec.find('-');
+    if (dash == std::string_view::npos || spec.find(',') != std::string_view::npos) return RANGE_NONE;
+    std::string_view first = trim(spec.substr(0, dash));
+    std::string_view last = trim(spec.substr(dash + 1));
+    size_t a = 0, b = 0;
+    if (first.empty()) {
+        // "-n": the last n bytes
+        if (!parse_position(last, b)) return RANGE_NONE;
+        if (b == 0 || size == 0) return RANGE_UNSATISFIABLE;
+        start = size - std::min(b, size);
+        end = size;
+        return RANGE_SATISFIABLE;
+    }
+    if (!parse_position(first, a)) return RANGE_NONE;
+    if (!last.empty()) {
+        if (!parse_position(last, b) || b < a) return RANGE_NONE;
+    }
+    if (a >= size) return RANGE_UNSATISFIABLE;
+    start = a;
+    end = last.empty() ? size : std::min(b + 1, size);
+    return RANGE_SATISFIABLE;
+}
+
+} // namespace Http
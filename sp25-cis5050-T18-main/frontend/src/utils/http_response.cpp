@@ -0,0 +1,128 @@
+#include "include/http_response.h"
+#include <cerrno>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <utility>
+#include <vector>
+
+/*
+ * HTTP Response Writer
+ *
+ * The one way responses leave the server:
+ * - Headers built in one place (status, Content-Type/Length, keep-alive, headers deferred by the handler)
+ * - writev for headers + body, so a large body is never copied into a second string
+ * - sendfile for bodies that live in a file
+ * - Partial writes resumed and EINTR retried, so nothing is silently truncated; clients are blocking sockets with
+ *   SO_SNDTIMEO (http_server.cpp), so EAGAIN means the client took no bytes for that long and is given up on
+ */
+
+// Keep alive timeout in seconds
+#define KEEP_ALIVE_TIMEOUT 15
+
+namespace Http {
+
+namespace {
+    thread_local std::vector<std::pair<std::string, std::string>> deferred_headers;
+
+    // after a failed write: a client that stalled past the send timeout is cut off, so that the rest of this response
+    // and any pipelined ones fail at once and the worker drops the connection instead of waiting out each of them
+    bool give_up(int fd) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) shutdown(fd, SHUT_RDWR);
+        return false;
+    }
+}
+
+void defer_header(const std::string& name, const std::string& value) {
+    for (auto& header : deferred_headers) {
+        if (header.first == name) {
+            header.second = value;
+            return;
+        }
+    }
+    deferred_headers.emplace_back(name, value);
+}
+
+void clear_deferred_headers() {
+    deferred_headers.clear();
+}
+
+std::string response_head(const std::string& status, const std::string& content_type, size_t content_length,
+                          bool keep_alive, const std::string& extra_headers) {
+    std::string head = "HTTP/1.1 " + status + "\r\n";
+    if (!content_type.empty()) {
+        head += "Content-Type: " + content_type + "\r\n";
+    }
+    head += "Content-Length: " + std::to_string(content_length) + "\r\n";
+    if (keep_alive) {
+        head += "Connection: keep-alive\r\n"
+                "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
+    } else {
+        head += "Connection: close\r\n";
+    }
+    head += extra_headers;
+    for (const auto& [name, value] : deferred_headers) {
+        head += name + ": " + value + "\r\n";
+    }
+    deferred_headers.clear();  // they belong to this response only
+    head += "\r\n";
+    return head;
+}
+
+bool write_all(int fd, std::string_view head, std::string_view body) {
+    struct iovec iov[2] = {
+        {const_cast<char*>(head.data()), head.size()},
+        {const_cast<char*>(body.data()), body.size()}
+    };
+    struct iovec* next = iov;
+    int count = body.empty() ? 1 : 2;
+    while (count > 0) {
+        if (next->iov_len == 0) {
+            next++;
+            count--;
+            continue;
+        }
+        ssize_t n = writev(fd, next, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return give_up(fd);
+        }
+        // drop what went out: whole buffers first, then the front of a partially written one
+        while (count > 0 && (size_t)n >= next->iov_len) {
+            n -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0) {
+            next->iov_base = (char*)next->iov_base + n;
+            next->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+bool send_response(int fd, const std::string& status, const std::string& content_type, std::string_view body,
+                   bool keep_alive, const std::string& extra_headers) {
+    return write_all(fd, response_head(status, content_type, body.size(), keep_alive, extra_headers), body);
+}
+
+bool send_file(int fd, std::string_view head, int file_fd, off_t offset, size_t length) {
+    if (!write_all(fd, head)) {
+        return false;
+    }
+    while (length > 0) {
+        ssize_t n = sendfile(fd, file_fd, &offset, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return give_up(fd);
+        }
+        if (n == 0) {
+            return false;  // the file is shorter than promised; the client sees a short body and drops the connection
+        }
+        length -= n;
+    }
+    return true;
+}
+
+} // namespace Http
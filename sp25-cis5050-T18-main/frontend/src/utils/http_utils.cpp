@@ -1,4 +1,5 @@
 #include "include/utils.h"
+#include "include/http_response.h"
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -7,30 +8,10 @@
 #include <unistd.h>
 #include <cstring>
 
-// Keep alive timeout in seconds
-#define KEEP_ALIVE_TIMEOUT 15
-
 extern int server_socket;
 
 namespace Utils {
 
-bool parse_http_request(const char* buffer, std::string& method, std::string& path) {
-    std::istringstream iss(buffer);
-    std::string request_line;
-    std::getline(iss, request_line);
-    
-    size_t method_end = request_line.find(' ');
-    if (method_end == std::string::npos) return false;
-    
-    size_t path_end = request_line.find(' ', method_end + 1);
-    if (path_end == std::string::npos) return false;
-    
-    method = request_line.substr(0, method_end);
-    path = request_line.substr(method_end + 1, path_end - method_end - 1);
-    
-    return true;
-}
-
 std::string get_form_value(const std::string& body, const std::string& field) {
     size_t pos = body.find(field + "=");
     if (pos == std::string::npos) return "";
@@ -123,24 +104,8 @@ void redirect_to_service_down_page(int client_fd, bool keep_alive) {
         "</body>\n"
         "</html>";
     
-    size_t content_length = strlen(html_content);
-    
-    std::string header = "HTTP/1.1 503 Service Unavailable\r\n"
-                        "Content-Type: text/html; charset=UTF-8\r\n"
-                        "Content-Length: " + std::to_string(content_length) + "\r\n";
-    
-    if (keep_alive) {
-        header += "Connection: keep-alive\r\n"
-                 "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-    } else {
-        header += "Connection: close\r\n";
-    }
-    
-    header += "\r\n";
-    
     // Send header and HTML content
-    send(client_fd, header.c_str(), header.size(), 0);
-    send(client_fd, html_content, content_length, 0);
+    Http::send_response(client_fd, "503 Service Unavailable", "text/html; charset=UTF-8", html_content, keep_alive);
     
     fprintf(stderr, "[redirect_to_service_down_page] Sent service-down HTML content directly\n");
 }
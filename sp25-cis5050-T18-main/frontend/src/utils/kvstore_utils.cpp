@@ -6,29 +6,31 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <poll.h>
 #include <stdio.h>
-
-extern int kv_socket;
-extern pthread_mutex_t kv_mutex;
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include "shard_map.h"
 
 #define KV_SERVER_PORT 5050
 #define KV_SERVER_IP "127.0.0.1"
+#define MASTER_POOL_MAX_IDLE 16  // idle master connections kept for reuse (more are opened while many requests resolve at once)
 
 namespace Utils {
 
-bool connect_to_kvstore() {
-    pthread_mutex_lock(&kv_mutex);
-    
-    if (kv_socket >= 0) {
-        pthread_mutex_unlock(&kv_mutex);
-        return true;
-    }
-    
-    kv_socket = socket(AF_INET, SOCK_STREAM, 0);
+// Idle connections to the master: a request takes one for its round trip, so concurrent requests never wait on each other
+static std::vector<int> master_idle;
+static pthread_mutex_t master_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Connect to the master and read its greeting; -1 on failure
+static int open_master_connection() {
+    int kv_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (kv_socket < 0) {
         fprintf(stderr, "[connect_to_kvstore] KVStore socket creation failed\n");
-        pthread_mutex_unlock(&kv_mutex);
-        return false;
+        return -1;
     }
     
     struct sockaddr_in kv_addr;
@@ -39,17 +41,13 @@ bool connect_to_kvstore() {
     if (inet_pton(AF_INET, KV_SERVER_IP, &kv_addr.sin_addr) <= 0) {
         fprintf(stderr, "[connect_to_kvstore] Invalid KVStore server address\n");
         close(kv_socket);
-        kv_socket = -1;
-        pthread_mutex_unlock(&kv_mutex);
-        return false;
+        return -1;
     }
     
     if (connect(kv_socket, (struct sockaddr*)&kv_addr, sizeof(kv_addr)) < 0) {
         fprintf(stderr, "[connect_to_kvstore] KVStore connection failed\n");
         close(kv_socket);
-        kv_socket = -1;
-        pthread_mutex_unlock(&kv_mutex);
-        return false;
+        return -1;
     }
     
     char greeting[1024];
@@ -62,84 +60,342 @@ bool connect_to_kvstore() {
         if (strstr(greeting, "+OK Master ready") == NULL) {
             fprintf(stderr, "[connect_to_kvstore] Unexpected greeting from KVStore server: %s\n", greeting);
             close(kv_socket);
-            kv_socket = -1;
-            pthread_mutex_unlock(&kv_mutex);
-            return false;
+            return -1;
         }
     } else {
         fprintf(stderr, "[connect_to_kvstore] Failed to receive greeting from KVStore\n");
         close(kv_socket);
-        kv_socket = -1;
-        pthread_mutex_unlock(&kv_mutex);
-        return false;
+        return -1;
     }
     
     fprintf(stderr, "[connect_to_kvstore] Connected to KVStore server at %s:%d\n", KV_SERVER_IP, KV_SERVER_PORT);
-    pthread_mutex_unlock(&kv_mutex);
+    return kv_socket;
+}
+
+// An idle connection with something to read was closed by the master (it restarted)
+static bool master_connection_healthy(int fd) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 0;
+}
+
+static int take_master_connection(bool& reused) {
+    int fd = -1;
+    pthread_mutex_lock(&master_pool_mutex);
+    while (fd < 0 && !master_idle.empty()) {
+        fd = master_idle.back();
+        master_idle.pop_back();
+        if (!master_connection_healthy(fd)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&master_pool_mutex);
+    reused = fd >= 0;
+    return reused ? fd : open_master_connection();
+}
+
+static void return_master_connection(int fd) {
+    pthread_mutex_lock(&master_pool_mutex);
+    if (master_idle.size() < MASTER_POOL_MAX_IDLE) {
+        master_idle.push_back(fd);
+        fd = -1;
+    }
+    pthread_mutex_unlock(&master_pool_mutex);
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool connect_to_kvstore() {
+    bool reused;
+    int fd = take_master_connection(reused);
+    if (fd < 0) {
+        return false;
+    }
+    return_master_connection(fd);  // warm: the first request finds it in the pool
     return true;
 }
 
-std::string kvstore_command(const std::string& command) {
-    pthread_mutex_lock(&kv_mutex);
+void disconnect_from_kvstore() {
+    pthread_mutex_lock(&master_pool_mutex);
+    for (int fd : master_idle) {
+        close(fd);
+    }
+    master_idle.clear();
+    pthread_mutex_unlock(&master_pool_mutex);
+}
+
+// One round trip on fd; "" if the connection failed (got_reply: the master had started answering)
+static std::string master_round_trip(int fd, const std::string& command, bool& got_reply) {
+    got_reply = false;
+    if (send(fd, command.c_str(), command.length(), MSG_NOSIGNAL) != (ssize_t)command.length()) {
+        fprintf(stderr, "[kvstore_command] Failed to send command to Master\n");
+        return "";
+    }
     
-    if (kv_socket < 0) {
-        pthread_mutex_unlock(&kv_mutex);
-        if (!connect_to_kvstore()) {
-            return "error: Could not connect to KVStore";
+    // replies are one line, but SHARD_MAP / ASK_MANY lines can be longer than one recv
+    std::string response;
+    char chunk[4096];
+    while (response.size() < 2 || response.compare(response.size() - 2, 2, "\r\n") != 0) {
+        int bytes = recv(fd, chunk, sizeof(chunk), 0);
+        if (bytes <= 0) {
+            fprintf(stderr, "[kvstore_command] Failed to receive response from Master\n");
+            return "";
         }
-        pthread_mutex_lock(&kv_mutex);
+        got_reply = true;
+        response.append(chunk, bytes);
     }
-    
+    return response;
+}
+
+std::string kvstore_command(const std::string& command) {
     fprintf(stderr, "[kvstore_command] Sending to Master: %s", command.c_str());
-    if (send(kv_socket, command.c_str(), command.length(), 0) < 0) {
-        fprintf(stderr, "[kvstore_command] Failed to send command to Master\n");
-        close(kv_socket);
-        kv_socket = -1;
-        pthread_mutex_unlock(&kv_mutex);
-        return "error: Failed to communicate with Master";
+    bool reused, got_reply;
+    int fd = take_master_connection(reused);
+    if (fd < 0) {
+        return "error: Could not connect to KVStore";
     }
-    
-    char response[1024];
-    memset(response, 0, sizeof(response));
-    int bytes = recv(kv_socket, response, sizeof(response) - 1, 0);
-    
-    if (bytes <= 0) {
-        fprintf(stderr, "[kvstore_command] Failed to receive response from Master\n");
-        close(kv_socket);
-        kv_socket = -1;
-        pthread_mutex_unlock(&kv_mutex);
-        return "error: No response from Master";
+    std::string response = master_round_trip(fd, command, got_reply);
+    if (response.empty() && reused && !got_reply) {
+        // the pooled connection died while idle (master restart): once more on a new one
+        close(fd);
+        fd = open_master_connection();
+        if (fd < 0) {
+            return "error: Could not connect to KVStore";
+        }
+        response = master_round_trip(fd, command, got_reply);
     }
-    
-    response[bytes] = '\0';
-    fprintf(stderr, "[kvstore_command] Received from Master: %s", response);
-    
-    pthread_mutex_unlock(&kv_mutex);
-    return std::string(response);
+    if (response.empty()) {
+        close(fd);
+        return got_reply ? "error: No response from Master" : "error: Failed to communicate with Master";
+    }
+    return_master_connection(fd);
+    fprintf(stderr, "[kvstore_command] Received from Master: %.200s", response.c_str());
+    return response;
+}
+
+// Cached SHARD_MAP: keys are resolved locally, the master pushes changes (WATCH) and tablets refuse requests routed with an old epoch
+static std::shared_ptr<const shardmap::ShardMap> shard_map;
+static pthread_mutex_t shard_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::atomic<uint64_t> read_ticket {0};  // round-robin position for reads
+
+void refresh_shard_map(uint64_t min_epoch) {
+    pthread_mutex_lock(&shard_map_mutex);
+    bool fresh = shard_map && shard_map->epoch >= min_epoch;
+    pthread_mutex_unlock(&shard_map_mutex);
+    if (fresh) {
+        return;  // another request already refreshed it
+    }
+
+    std::string coordinator_response = kvstore_command("SHARD_MAP\r\n");
+    auto map = std::make_shared<shardmap::ShardMap>();
+    if (!map->parse(coordinator_response)) {
+        fprintf(stderr, "[refresh_shard_map] Could not get the shard map from Master\n");
+        return;
+    }
+    fprintf(stderr, "[refresh_shard_map] Shard map epoch %llu (%zu groups)\n", (unsigned long long)map->epoch, map->groups.size());
+
+    pthread_mutex_lock(&shard_map_mutex);
+    shard_map = map;
+    pthread_mutex_unlock(&shard_map_mutex);
+}
+
+// One line pushed by the master on the WATCH connection
+static void apply_shard_map_push(const std::string& line) {
+    std::istringstream iss(line);
+    std::string word;
+    uint64_t from = 0, to = 0;
+    iss >> word;
+    if (word == "+OK") {
+        iss >> word >> to;  // "+OK WATCHING epoch": the pushes start from there
+        if (word == "WATCHING") refresh_shard_map(to);
+    } else if (word == "RESYNC") {  // the ring changed: deltas cannot describe that
+        iss >> to;
+        refresh_shard_map(to);
+    } else if (word == "DELTA" && iss >> from >> to) {
+        pthread_mutex_lock(&shard_map_mutex);
+        bool applied = false;
+        if (shard_map && shard_map->epoch >= to) {
+            applied = true;  // already at least this new
+        } else if (shard_map) {
+            auto map = std::make_shared<shardmap::ShardMap>(*shard_map);
+            if (map->apply_delta(line)) {
+                shard_map = map;
+                applied = true;
+            }
+        }
+        pthread_mutex_unlock(&shard_map_mutex);
+        if (applied) {
+            fprintf(stderr, "[watch_shard_map] Shard map epoch %llu\n", (unsigned long long)to);
+        } else {
+            refresh_shard_map(to);  // missed a push (or have no map yet)
+        }
+    }
+}
+
+// Subscribes to the master's WATCH pushes on a connection of its own, so a failover reaches the cached map within
+// one heartbeat instead of on the next failed tablet request; reconnects every second while the master is away
+static void* watch_shard_map(void*) {
+    while (true) {
+        int watch_socket = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in kv_addr;
+        memset(&kv_addr, 0, sizeof(kv_addr));
+        kv_addr.sin_family = AF_INET;
+        kv_addr.sin_port = htons(KV_SERVER_PORT);
+        inet_pton(AF_INET, KV_SERVER_IP, &kv_addr.sin_addr);
+        if (watch_socket >= 0 && connect(watch_socket, (struct sockaddr*)&kv_addr, sizeof(kv_addr)) == 0 &&
+            send(watch_socket, "WATCH\r\n", 7, MSG_NOSIGNAL) == 7) {
+            std::string buffer;
+            char chunk[4096];
+            while (true) {
+                int bytes = recv(watch_socket, chunk, sizeof(chunk), 0);
+                if (bytes <= 0) {
+                    break;
+                }
+                buffer.append(chunk, bytes);
+                size_t pos;
+                while ((pos = buffer.find("\r\n")) != std::string::npos) {
+                    apply_shard_map_push(buffer.substr(0, pos));
+                    buffer.erase(0, pos + 2);
+                }
+            }
+            fprintf(stderr, "[watch_shard_map] Lost the WATCH connection to Master\n");
+        }
+        if (watch_socket >= 0) {
+            close(watch_socket);
+        }
+        sleep(1);
+    }
+    return nullptr;
+}
+
+static void start_shard_map_watch() {
+    pthread_t watcher;
+    if (pthread_create(&watcher, nullptr, watch_shard_map, nullptr) == 0) {
+        pthread_detach(watcher);
+    }
+}
+
+static std::shared_ptr<const shardmap::ShardMap> current_shard_map() {
+    static pthread_once_t watch_once = PTHREAD_ONCE_INIT;
+    pthread_once(&watch_once, start_shard_map_watch);
+    pthread_mutex_lock(&shard_map_mutex);
+    auto map = shard_map;
+    pthread_mutex_unlock(&shard_map_mutex);
+    if (map) {
+        return map;
+    }
+    refresh_shard_map(0);
+    pthread_mutex_lock(&shard_map_mutex);
+    map = shard_map;
+    pthread_mutex_unlock(&shard_map_mutex);
+    return map;
+}
+
+uint64_t shard_map_epoch() {
+    auto map = current_shard_map();
+    return map ? map->epoch : 0;
 }
 
 std::string get_tablet_for_username(const std::string& username) {
-    std::string ask_command = "ASK " + username + "\r\n";
+    auto map = current_shard_map();
+    if (!map) {
+        return "";
+    }
+
+    std::string tablet_address = map->primary_of(username);
+    if (tablet_address.empty()) {
+        // the cached map says the shard is down: it may have come back since
+        refresh_shard_map(map->epoch + 1);
+        map = current_shard_map();
+        tablet_address = map->primary_of(username);
+    }
 
-    std::string coordinator_response = kvstore_command(ask_command);
-    
     // Check for ALL DEAD error condition
-    if (coordinator_response.find("-ERR ALL DEAD") == 0) {
+    if (tablet_address.empty()) {
         fprintf(stderr, "[get_tablet_for_username] All nodes are dead for this shard. Service is down.\n");
         return "SERVICE_DOWN";
     }
-    
-    if (coordinator_response.find("+OK REDIRECT") != 0) {
+
+    fprintf(stderr, "[get_tablet_for_username] Tablet server address: [%s]\n", tablet_address.c_str());
+    return tablet_address;
+}
+
+std::string get_tablets_for_username(const std::string& username, std::string& read_address) {
+    auto map = current_shard_map();
+    read_address = "";
+    if (!map) {
         return "";
     }
-    
-    std::string tablet_address = coordinator_response.substr(13);
-    if (tablet_address.length() >= 2 && tablet_address.substr(tablet_address.length() - 2) == "\r\n") {
-        tablet_address = tablet_address.substr(0, tablet_address.length() - 2);
+
+    std::string tablet_address;
+    map->route(username, read_ticket++, tablet_address, read_address);
+    if (tablet_address.empty() || read_address.empty()) {
+        refresh_shard_map(map->epoch + 1);
+        map = current_shard_map();
+        map->route(username, read_ticket++, tablet_address, read_address);
     }
-    
-    fprintf(stderr, "[get_tablet_for_username] Tablet server address: [%s]\n", tablet_address.c_str());
+
+    if (tablet_address.empty()) {
+        fprintf(stderr, "[get_tablets_for_username] All nodes are dead for this shard. Service is down.\n");
+        read_address = "";
+        return "SERVICE_DOWN";
+    }
+
+    fprintf(stderr, "[get_tablets_for_username] Tablet server address: [%s], read replica: [%s]\n", tablet_address.c_str(), read_address.c_str());
     return tablet_address;
 }
 
-} // namespace Utils
\ No newline at end of file
+std::vector<std::string> get_all_primaries() {
+    std::vector<std::string> primaries;
+    // the admin console wants the current picture, not the cached one
+    refresh_shard_map(UINT64_MAX);
+    auto map = current_shard_map();
+    if (!map) {
+        return primaries;
+    }
+
+    for (const auto& group : map->groups) {
+        if (!group.primary.empty()) primaries.push_back(group.primary);
+    }
+    return primaries;
+}
+
+std::vector<std::string> get_fragment_nodes(const std::string& key, int count) {
+    std::vector<std::string> picked;
+    auto map = current_shard_map();
+    if (!map || map->groups.empty()) {
+        return picked;
+    }
+
+    // one node per group per round, so losing a whole group costs as few fragments as possible
+    size_t groups = map->groups.size(), first = (size_t)std::max(0, shardmap::ring_owner(map->ring, key));
+    for (size_t round = 0; (int)picked.size() < count; ++round) {
+        bool any = false;
+        for (size_t g = 0; g < groups && (int)picked.size() < count; ++g) {
+            const auto& alive = map->groups[(first + g) % groups].alive;
+            if (round >= alive.size()) continue;
+            any = true;
+            if (std::find(picked.begin(), picked.end(), alive[round]) == picked.end()) picked.push_back(alive[round]);
+        }
+        if (!any) break;
+    }
+    return picked;
+}
+
+std::string get_node_address(int node_id) {
+    std::string coordinator_response = kvstore_command("NODE_ADDR " + std::to_string(node_id) + "\r\n");
+
+    if (coordinator_response.find("+OK ") != 0) {
+        // master unreachable: fall back to the config.txt numbering (node i listens on 6000 + i)
+        return "127.0.0.1:" + std::to_string(6000 + node_id);
+    }
+
+    std::string node_address = coordinator_response.substr(4);
+    if (node_address.length() >= 2 && node_address.substr(node_address.length() - 2) == "\r\n") {
+        node_address = node_address.substr(0, node_address.length() - 2);
+    }
+    return node_address;
+}
+
+} // namespace Utils
@@ -0,0 +1,234 @@
+#include "include/static_cache.h"
+#include "logger.h"
+#include <map>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <zlib.h>
+
+/*
+ * Static Asset Cache
+ *
+ * Keeps every file under public/ in memory so that a page costs a copy, not a filesystem read:
+ * - Strong ETags from a content hash; If-None-Match is answered with 304
+ * - A gzip variant made once at load time, served when the client accepts it
+ * - Files are reloaded when they change on disk (inotify watch on every directory under the root)
+ */
+
+namespace StaticCache {
+
+namespace {
+    std::map<std::string, std::shared_ptr<const Asset>> assets;  // by path, e.g. "public/index.html"
+    pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    int inotify_fd = -1;
+    std::map<int, std::string> watched_dirs;  // inotify watch descriptor -> directory (inotify thread only after init)
+
+    const size_t MIN_GZIP_BYTES = 256;  // smaller files are not worth a variant
+
+    std::string content_type_for(const std::string& path) {
+        static const std::map<std::string, std::string> types = {
+            {".html", "text/html"}, {".css", "text/css"}, {".js", "application/javascript"},
+            {".json", "application/json"}, {".svg", "image/svg+xml"}, {".png", "image/png"},
+            {".jpg", "image/jpeg"}, {".ico", "image/x-icon"}, {".txt", "text/plain"}
+        };
+        auto it = types.find(std::filesystem::path(path).extension().string());
+        return it == types.end() ? "application/octet-stream" : it->second;
+    }
+
+    // "<size>-<FNV-1a 64>" in hex: equal bytes give equal tags across restarts and frontend servers
+    std::string make_etag(const std::string& content) {
+        uint64_t hash = 1469598103934665603ULL;
+        for (unsigned char c : content) {
+            hash = (hash ^ c) * 1099511628211ULL;
+        }
+        char tag[48];
+        snprintf(tag, sizeof(tag), "%zx-%016llx", content.size(), (unsigned long long)hash);
+        return tag;
+    }
+
+    bool gzip_compress(const std::string& in, std::string& out) {
+        z_stream zs = {};
+        if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        out.resize(deflateBound(&zs, in.size()) + 32);
+        zs.next_in = (Bytef*)in.data();
+        zs.avail_in = in.size();
+        zs.next_out = (Bytef*)&out[0];
+        zs.avail_out = out.size();
+        int rc = deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return rc == Z_STREAM_END;
+    }
+
+    void load_file(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return;
+        }
+        auto asset = std::make_shared<Asset>();
+        asset->content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        asset->content_type = content_type_for(path);
+        asset->templated = asset->content.find("{{username}}") != std::string::npos;
+        std::string tag = make_etag(asset->content);
+        asset->etag = "\"" + tag + "\"";
+        asset->gzip_etag = "\"" + tag + "-gz\"";
+        if (asset->templated) {
+            asset->cache_control = "private, no-store";
+        } else if (asset->content_type == "text/html") {
+            asset->cache_control = "no-cache";  // always revalidate (a 304 is cheap), so edits show up at once
+        } else {
+            asset->cache_control = "public, max-age=3600";
+        }
+        if (asset->content.size() >= MIN_GZIP_BYTES && !asset->templated) {
+            std::string gz;
+            if (gzip_compress(asset->content, gz) && gz.size() < asset->content.size() * 9 / 10) {
+                asset->gzip = std::move(gz);
+            }
+        }
+        LOG_DEBUG("Cached " << path << " (" << asset->content.size() << " bytes, gzip " << asset->gzip.size() << ")");
+
+        pthread_mutex_lock(&cache_mutex);
+        assets[path] = asset;
+        pthread_mutex_unlock(&cache_mutex);
+    }
+
+    void drop_file(const std::string& path) {
+        pthread_mutex_lock(&cache_mutex);
+        assets.erase(path);
+        pthread_mutex_unlock(&cache_mutex);
+    }
+
+    // watch dir and everything below it, loading the files found
+    void add_tree(const std::string& dir) {
+        if (inotify_fd >= 0) {
+            int wd = inotify_add_watch(inotify_fd, dir.c_str(),
+                                       IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE);
+            if (wd >= 0) {
+                watched_dirs[wd] = dir;
+            }
+        }
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            std::string path = entry.path().string();
+            if (entry.is_directory(ec)) {
+                add_tree(path);
+            } else if (entry.is_regular_file(ec)) {
+                load_file(path);
+            }
+        }
+    }
+
+    void* watch_loop(void*) {
+        alignas(struct inotify_event) char events[16384];
+        while (true) {
+            ssize_t len = read(inotify_fd, events, sizeof(events));
+            if (len <= 0) {
+                continue;
+            }
+            for (char* p = events; p < events + len;) {
+                struct inotify_event* event = (struct inotify_event*)p;
+                p += sizeof(struct inotify_event) + event->len;
+                auto dir = watched_dirs.find(event->wd);
+                if (dir == watched_dirs.end() || event->len == 0) {
+                    continue;
+                }
+                std::string path = dir->second + "/" + event->name;
+                if (event->mask & IN_ISDIR) {
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                        add_tree(path);
+                    }
+                } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                    load_file(path);
+                    LOG_INFO("Reloaded static file " << path);
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    drop_file(path);
+                }
+            }
+        }
+        return NULL;
+    }
+
+    std::string_view trim(std::string_view s) {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+        return s;
+    }
+}
+
+void init(const std::string& root) {
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        perror("inotify_init1 failed, static files will not be reloaded");
+    }
+    add_tree(root);
+    LOG_INFO("Static cache: " << assets.size() << " files from " << root);
+    if (inotify_fd >= 0) {
+        pthread_t tid;
+        pthread_create(&tid, NULL, watch_loop, NULL);
+        pthread_detach(tid);
+    }
+}
+
+std::shared_ptr<const Asset> lookup(const std::string& path) {
+    pthread_mutex_lock(&cache_mutex);
+    auto it = assets.find(path);
+    std::shared_ptr<const Asset> asset = it == assets.end() ? nullptr : it->second;
+    pthread_mutex_unlock(&cache_mutex);
+    return asset;
+}
+
+bool not_modified(const Http::Request& request, const Asset& asset) {
+    std::string_view tags = request.header("If-None-Match");
+    if (tags.empty() || asset.templated) {
+        return false;
+    }
+    while (!tags.empty()) {
+        size_t comma = tags.find(',');
+        std::string_view tag = trim(tags.substr(0, comma));
+        if (tag.substr(0, 2) == "W/") {
+            tag.remove_prefix(2);  // If-None-Match uses the weak comparison
+        }
+        if (tag == "*" || tag == asset.etag || tag == asset.gzip_etag) {
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        tags.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+bool use_gzip(const Http::Request& request, const Asset& asset) {
+    if (asset.gzip.empty()) {
+        return false;
+    }
+    std::string_view codings = request.header("Accept-Encoding");
+    while (!codings.empty()) {
+        size_t comma = codings.find(',');
+        std::string_view item = trim(codings.substr(0, comma));
+        size_t semicolon = item.find(';');
+        if (trim(item.substr(0, semicolon)) == "gzip") {
+            // "gzip;q=0" refuses it
+            std::string_view params = semicolon == std::string_view::npos ? "" : item.substr(semicolon + 1);
+            params = trim(params);
+            return !(params.substr(0, 2) == "q=" && std::strtod(std::string(params.substr(2)).c_str(), nullptr) == 0);
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        codings.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+} // namespace StaticCache
@@ -6,13 +6,80 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <sstream>
+#include <unordered_map>
+#include <pthread.h>
+#include <poll.h>
+#include <ctime>
+#include <atomic>
+#include <vector>
+#include <list>
+#include "include/http_response.h"
 
 namespace Utils {
 
+// highest LSN returned by a write for each of the rows this frontend wrote last (least recently written dropped first).
+// It only covers writes made through this process; a browser's own row is covered across frontends by its request token.
+constexpr size_t MAX_ROW_LSNS = 4096;
+struct RowLsn {
+    unsigned long long lsn;
+    std::list<std::string>::iterator age;  // position in row_lsn_order
+};
+static std::unordered_map<std::string, RowLsn> row_lsns;
+static std::list<std::string> row_lsn_order;  // most recently written first
+static pthread_mutex_t row_lsns_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// read-your-writes token of the request this worker thread is handling (see begin_request_token)
+struct RequestToken {
+    std::string rowkey;  // the browser's own row (auth_user)
+    unsigned long long lsn = 0;
+};
+static thread_local RequestToken request_token;
+
+void set_request_token(const std::string& rowkey, unsigned long long lsn) {
+    request_token.rowkey = rowkey;
+    request_token.lsn = lsn;
+}
+
+void record_write_lsn(const std::string& command, const std::string& response) {
+    size_t pos = response.find(" LSN ");
+    if (pos == std::string::npos) return;
+    std::istringstream iss(command);
+    std::string cmd, rowkey;
+    iss >> cmd >> rowkey;
+    unsigned long long lsn = strtoull(response.c_str() + pos + 5, nullptr, 10);
+    if (!rowkey.empty() && rowkey == request_token.rowkey && lsn > request_token.lsn) {
+        request_token.lsn = lsn;
+        Http::defer_header("Set-Cookie", "rw_lsn=" + std::to_string(lsn) + "; Path=/; HttpOnly");
+    }
+    pthread_mutex_lock(&row_lsns_mutex);
+    auto it = row_lsns.find(rowkey);
+    if (it != row_lsns.end()) {
+        if (lsn > it->second.lsn) it->second.lsn = lsn;
+        row_lsn_order.splice(row_lsn_order.begin(), row_lsn_order, it->second.age);
+    } else {
+        row_lsn_order.push_front(rowkey);
+        row_lsns[rowkey] = {lsn, row_lsn_order.begin()};
+        if (row_lsns.size() > MAX_ROW_LSNS) {
+            row_lsns.erase(row_lsn_order.back());
+            row_lsn_order.pop_back();
+        }
+    }
+    pthread_mutex_unlock(&row_lsns_mutex);
+}
+
+unsigned long long last_write_lsn(const std::string& rowkey) {
+    unsigned long long lsn = rowkey == request_token.rowkey ? request_token.lsn : 0;
+    pthread_mutex_lock(&row_lsns_mutex);
+    auto it = row_lsns.find(rowkey);
+    if (it != row_lsns.end() && it->second.lsn > lsn) lsn = it->second.lsn;
+    pthread_mutex_unlock(&row_lsns_mutex);
+    return lsn;
+}
+
 bool send_all(int socket, const char* data, size_t size) {
     size_t total_sent = 0;
     while (total_sent < size) {
-        int sent = send(socket, data + total_sent, size - total_sent, 0);
+        int sent = send(socket, data + total_sent, size - total_sent, MSG_NOSIGNAL);  // a pooled connection may have been closed by the tablet
         if (sent <= 0) return false;
         total_sent += sent;
     }
@@ -45,11 +112,12 @@ std::string parse_command(const std::string& command) {
     return command;
 }
 
-std::pair<std::string, bool> tablet_command(const std::string& tablet_address, const std::string& command) {
+// Connect to a tablet and read its "+OK Connected" greeting; -1 on failure
+static int open_tablet_connection(const std::string& tablet_address) {
     size_t colon_pos = tablet_address.find(':');
     if (colon_pos == std::string::npos) {
         fprintf(stderr, "[tablet_command] Invalid tablet address format: %s\n", tablet_address.c_str());
-        return {"", false};
+        return -1;
     }
     
     std::string tablet_ip = tablet_address.substr(0, colon_pos);
@@ -58,7 +126,7 @@ std::pair<std::string, bool> tablet_command(const std::string& tablet_address, c
     int tablet_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (tablet_socket < 0) {
         fprintf(stderr, "[tablet_command] Failed to create tablet socket\n");
-        return {"", false};
+        return -1;
     }
     
     struct sockaddr_in tablet_addr;
@@ -69,13 +137,13 @@ std::pair<std::string, bool> tablet_command(const std::string& tablet_address, c
     if (inet_pton(AF_INET, tablet_ip.c_str(), &tablet_addr.sin_addr) <= 0) {
         fprintf(stderr, "[tablet_command] Invalid tablet IP address: %s\n", tablet_ip.c_str());
         close(tablet_socket);
-        return {"", false};
+        return -1;
     }
     
     if (connect(tablet_socket, (struct sockaddr*)&tablet_addr, sizeof(tablet_addr)) < 0) {
         fprintf(stderr, "[tablet_command] Failed to connect to tablet server at %s\n", tablet_address.c_str());
         close(tablet_socket);
-        return {"", false};
+        return -1;
     }
     
     char ack_buffer[1024];
@@ -83,25 +151,143 @@ std::pair<std::string, bool> tablet_command(const std::string& tablet_address, c
     if (recv(tablet_socket, ack_buffer, sizeof(ack_buffer) - 1, 0) <= 0) {
         fprintf(stderr, "[tablet_command] Failed to receive connection acknowledgment\n");
         close(tablet_socket);
-        return {"", false};
+        return -1;
     }
     
     std::string ack_response = std::string(ack_buffer);
     if (ack_response != "+OK Connected\r\n") {
         fprintf(stderr, "[tablet_command] Invalid connection acknowledgment: %s\n", ack_response.c_str());
         close(tablet_socket);
-        return {"", false};
+        return -1;
     } else {
         fprintf(stderr, "[tablet_command] Received connection acknowledgment: %s", ack_response.c_str());
     }
+    return tablet_socket;
+}
 
-    
-    std::string new_command = parse_command(command);
+// Keep-alive connections to each tablet (a tablet serves commands on a connection until QUIT), shared by all worker threads
+#define POOL_MAX_IDLE 8           // idle connections kept per tablet
+#define POOL_MAX_IN_FLIGHT 32     // commands in flight per tablet; more wait for a connection to come back
+#define POOL_IDLE_TIMEOUT 30      // seconds an idle connection is kept
+
+struct IdleConnection {
+    int fd;
+    time_t since;
+};
+
+struct TabletPool {
+    std::vector<IdleConnection> idle;  // most recently used last
+    int in_flight = 0;
+    // threads waiting for this tablet only, so that a release never wakes a waiter of another tablet that is still full
+    pthread_cond_t freed = PTHREAD_COND_INITIALIZER;
+};
+
+static std::unordered_map<std::string, TabletPool> tablet_pools;  // never erased: waiters hold on to their pool's cond
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::atomic<unsigned long long> pool_hits{0}, pool_misses{0}, pool_evictions{0}, pool_waits{0}, pool_retries{0};
+
+// An idle connection must have nothing to read: readable means the tablet closed it (or left bytes we did not expect)
+static bool connection_healthy(int fd) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 0;
+}
+
+// A connection checked out of the pool for one command; closed on destruction unless marked reusable
+class PooledConnection {
+public:
+    explicit PooledConnection(const std::string& tablet_address, bool fresh = false) : address_(tablet_address) {
+        time_t now = time(nullptr);
+        pthread_mutex_lock(&pool_mutex);
+        TabletPool& pool = tablet_pools[address_];
+        if (pool.in_flight >= POOL_MAX_IN_FLIGHT) {
+            pool_waits++;
+            while (pool.in_flight >= POOL_MAX_IN_FLIGHT) pthread_cond_wait(&pool.freed, &pool_mutex);
+        }
+        pool.in_flight++;
+        while (!fresh && fd_ < 0 && !pool.idle.empty()) {
+            IdleConnection conn = pool.idle.back();
+            pool.idle.pop_back();
+            if (now - conn.since <= POOL_IDLE_TIMEOUT && connection_healthy(conn.fd)) {
+                fd_ = conn.fd;
+            } else {
+                close(conn.fd);
+                pool_evictions++;
+            }
+        }
+        pthread_mutex_unlock(&pool_mutex);
+        reused_ = fd_ >= 0;
+        if (reused_) {
+            pool_hits++;
+        } else {
+            pool_misses++;
+            fd_ = open_tablet_connection(address_);
+        }
+    }
+
+    ~PooledConnection() {
+        pthread_mutex_lock(&pool_mutex);
+        TabletPool& pool = tablet_pools[address_];
+        pool.in_flight--;
+        if (fd_ >= 0 && reusable && (int)pool.idle.size() < POOL_MAX_IDLE) {
+            pool.idle.push_back({fd_, time(nullptr)});
+        } else if (fd_ >= 0) {
+            close(fd_);
+        }
+        pthread_cond_signal(&pool.freed);
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    PooledConnection(const PooledConnection&) = delete;
+    PooledConnection& operator=(const PooledConnection&) = delete;
+
+    int fd() const { return fd_; }
+    bool reused() const { return reused_; }
+    bool reusable = false;  // set once the whole reply has been read, so the next command starts on a clean stream
+
+private:
+    std::string address_;
+    int fd_ = -1;
+    bool reused_ = false;
+};
+
+// A reply read with one recv is complete if it ends its line and did not fill the buffer
+static bool complete_reply(const std::string& response, size_t buffer_size) {
+    return response.size() < buffer_size - 1 && response.size() >= 2 && response.compare(response.size() - 2, 2, "\r\n") == 0;
+}
+
+std::string tablet_pool_stats() {
+    size_t idle = 0;
+    int in_flight = 0;
+    pthread_mutex_lock(&pool_mutex);
+    for (const auto& [address, pool] : tablet_pools) {
+        idle += pool.idle.size();
+        in_flight += pool.in_flight;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return "hits=" + std::to_string(pool_hits) + " misses=" + std::to_string(pool_misses) + " evictions=" + std::to_string(pool_evictions) +
+           " waits=" + std::to_string(pool_waits) + " retries=" + std::to_string(pool_retries) + " idle=" + std::to_string(idle) +
+           " in_flight=" + std::to_string(in_flight);
+}
+
+// One request on a pooled connection; epoch_tag ("@E ") is put in front of the command line only.
+// value, if given, is the payload of "PUT row col" as is (binary safe); otherwise a PUT's payload is the rest of its command line.
+// no_reply is set if the connection failed before the tablet answered anything (a reused connection the tablet had dropped),
+// sent once any of the request may have reached the tablet (so a failed write may still have been applied)
+static std::pair<std::string, bool> send_on_connection(PooledConnection& conn, const std::string& command, const std::string& epoch_tag,
+                                                       const std::string_view* value, bool& no_reply, bool& sent) {
+    int tablet_socket = conn.fd();
+    no_reply = true;
+    sent = false;
+    if (tablet_socket < 0) {
+        return {"", false};
+    }
+    sent = true;
+
+    std::string new_command = epoch_tag + (value ? command + " " + std::to_string(value->size()) + "\r\n" : parse_command(command));
     fprintf(stderr, "[tablet_command] Sending Tablet Command: %s\n", new_command.c_str());
     
     if (!send_all(tablet_socket, new_command.c_str(), new_command.length())) {
         fprintf(stderr, "[tablet_command] Failed to send command to tablet\n");
-        close(tablet_socket);
         return {"", false};
     }
     
@@ -111,18 +297,27 @@ std::pair<std::string, bool> tablet_command(const std::string& tablet_address, c
     
     if (recv(tablet_socket, buffer, sizeof(buffer) - 1, 0) <= 0) {
         fprintf(stderr, "[tablet_command] Failed to receive response from tablet\n");
-        close(tablet_socket);
         return {"", false};
     }
     
     response = std::string(buffer);
+    no_reply = false;
+    // every reply starts with one line; a list (GET_COLS of a row with many files, GET_ROWS) can take more than one recv
+    while (response.size() < 2 || response.compare(response.size() - 2, 2, "\r\n") != 0) {
+        ssize_t more = recv(tablet_socket, buffer, sizeof(buffer) - 1, 0);
+        if (more <= 0) {
+            fprintf(stderr, "[tablet_command] Reply cut short: %s\n", response.c_str());
+            return {"", false};
+        }
+        response.append(buffer, more);
+    }
+    bool complete = true;  // the whole line is in, so the connection may go back to the pool
     
     if (command.substr(0, 4) == "GET ") {
         if (response.substr(0, 4) == "+OK ") {
             size_t bytes_pos = response.find("\r\n");
             if (bytes_pos == std::string::npos) {
                 fprintf(stderr, "[tablet_command] Invalid response format: missing CRLF\n");
-                close(tablet_socket);
                 return {"", false};
             }
             
@@ -132,7 +327,6 @@ std::pair<std::string, bool> tablet_command(const std::string& tablet_address, c
                 std::string ready_msg = "READY\r\n";
                 if (!send_all(tablet_socket, ready_msg.c_str(), ready_msg.length())) {
                     fprintf(stderr, "[tablet_command] Failed to send READY message\n");
-                    close(tablet_socket);
                     return {"", false};
                 }
                 fprintf(stderr, "[tablet_command] Ready to receive data of size: %zu\n", data_size);
@@ -143,56 +337,203 @@ std::pair<std::string, bool> tablet_command(const std::string& tablet_address, c
                 if (!recv_all(tablet_socket, data_buffer, data_size)) {
                     fprintf(stderr, "[tablet_command] Failed to receive data from tablet\n");
                     delete[] data_buffer;
-                    close(tablet_socket);
                     return {"", false};
                 }
                 // fprintf(stderr, "[tablet_command] Received data: %s\n", data_buffer);
                 response = "+OK " + std::string(data_buffer, data_size);
                 delete[] data_buffer;
+                complete = true;
             } catch (const std::invalid_argument& e) {
                 fprintf(stderr, "[tablet_command] Invalid data size in response: %s\n", response.c_str());
-                close(tablet_socket);
                 return {"", false};
             } catch (const std::out_of_range& e) {
                 fprintf(stderr, "[tablet_command] Data size out of range in response: %s\n", response.c_str());
-                close(tablet_socket);
                 return {"", false};
             }
         }
     } else if (command.substr(0, 4) == "PUT ") {
+        if (response.substr(0, 16) == "-ERR STALE_EPOCH") {
+            conn.reusable = complete;
+            return {response, true};
+        }
         if (response != "+OK\r\n") {
             fprintf(stderr, "[tablet_command] Tablet did not return +OK after PUT\n");
-            close(tablet_socket);
             return {"", false};
         }
         
-        std::istringstream iss(command);
-        std::string cmd, rowkey, colkey, data;
-        iss >> cmd >> rowkey >> colkey;
-        std::getline(iss, data);
-        data = data.substr(1);
+        std::string data;
+        if (!value) {
+            std::istringstream iss(command);
+            std::string cmd, rowkey, colkey;
+            iss >> cmd >> rowkey >> colkey;
+            std::getline(iss, data);
+            data = data.substr(1);
+        }
         
-        if (!send_all(tablet_socket, data.c_str(), data.length())) {
+        if (!(value ? send_all(tablet_socket, value->data(), value->size()) : send_all(tablet_socket, data.c_str(), data.length()))) {
             fprintf(stderr, "[tablet_command] Failed to send data to tablet\n");
-            close(tablet_socket);
             return {"", false};
         }
         
         memset(buffer, 0, sizeof(buffer));
         if (recv(tablet_socket, buffer, sizeof(buffer) - 1, 0) <= 0) {
             fprintf(stderr, "[tablet_command] Failed to receive response after sending data\n");
-            close(tablet_socket);
             return {"", false};
         }
         response = std::string(buffer);
+        complete = complete_reply(response, sizeof(buffer));
         if (response.substr(0, 5) != "-ERR " && response.substr(0, 4) != "+OK ") {
             response = "+OK " + response;
         }
     }
     
     // fprintf(stderr, "[tablet_command] Tablet Response: %s", response.c_str());
-    close(tablet_socket);
+    if (command.substr(0, 4) == "PUT " || command.substr(0, 5) == "CPUT " || command.substr(0, 7) == "DELETE ") {
+        record_write_lsn(command, response);
+    }
+    conn.reusable = complete;
     return {response, true};
 }
 
+// sent: as in send_on_connection, for the last attempt
+static std::pair<std::string, bool> send_tablet_command(const std::string& tablet_address, const std::string& command, const std::string& epoch_tag,
+                                                        const std::string_view* value, bool& sent) {
+    bool no_reply;
+    {
+        PooledConnection conn(tablet_address);
+        auto result = send_on_connection(conn, command, epoch_tag, value, no_reply, sent);
+        if (result.second || !conn.reused() || !no_reply) {
+            return result;
+        }
+    }
+    // the tablet dropped the pooled connection before answering (it restarted): once more on a new one
+    pool_retries++;
+    fprintf(stderr, "[tablet_command] Pooled connection to %s was closed, reconnecting\n", tablet_address.c_str());
+    PooledConnection conn(tablet_address, true);
+    return send_on_connection(conn, command, epoch_tag, value, no_reply, sent);
+}
+
+// tablet_command and tablet_put: route by row key, retrying once at the row's current primary. A write is only retried
+// if the tablet refused it (stale map) or never got it: one that failed after it was sent may have been applied, and
+// running it again would turn a CPUT into a false failure, a DELETE into "Not found" or a PUT into a lost update
+static std::pair<std::string, bool> route_command(const std::string& tablet_address, const std::string& command, const std::string_view* value) {
+    std::istringstream iss(command);
+    std::string cmd, rowkey;
+    iss >> cmd >> rowkey;
+    bool sent;
+    if (cmd != "GET" && cmd != "PUT" && cmd != "CPUT" && cmd != "DELETE" && cmd != "GET_COLS") {
+        return send_tablet_command(tablet_address, command, "", nullptr, sent);  // not routed by row key (GET_ROWS, admin commands)
+    }
+
+    // tag the request with the shard map it was routed with, so a tablet can tell us when that map is out of date
+    uint64_t epoch = shard_map_epoch();
+    auto result = send_tablet_command(tablet_address, command, "@" + std::to_string(epoch) + " ", value, sent);
+    bool stale = result.second && result.first.substr(0, 16) == "-ERR STALE_EPOCH";
+    if (result.second && !stale) {
+        return result;
+    }
+    if (!stale && sent && cmd != "GET" && cmd != "GET_COLS") {
+        fprintf(stderr, "[tablet_command] %s %s failed after it was sent to %s, not retrying\n", cmd.c_str(), rowkey.c_str(), tablet_address.c_str());
+        refresh_shard_map(epoch + 1);  // the next request goes to the current primary
+        return result;
+    }
+
+    // stale map or unreachable node: refresh the map once and retry at the row's current primary
+    refresh_shard_map(stale ? strtoull(result.first.c_str() + 16, nullptr, 10) : epoch + 1);
+    std::string primary_address = get_tablet_for_username(rowkey);
+    if (primary_address.empty() || primary_address == "SERVICE_DOWN" || (!stale && primary_address == tablet_address)) {
+        fprintf(stderr, "[tablet_command] No other tablet to retry %s %s on\n", cmd.c_str(), rowkey.c_str());
+        return stale ? std::make_pair(std::string(""), false) : result;
+    }
+    fprintf(stderr, "[tablet_command] Retrying %s %s on %s (shard map epoch %llu)\n", cmd.c_str(), rowkey.c_str(), primary_address.c_str(), (unsigned long long)shard_map_epoch());
+    return send_tablet_command(primary_address, command, "@" + std::to_string(shard_map_epoch()) + " ", value, sent);
+}
+
+std::pair<std::string, bool> tablet_command(const std::string& tablet_address, const std::string& command) {
+    return route_command(tablet_address, command, nullptr);
+}
+
+std::pair<std::string, bool> tablet_put(const std::string& tablet_address, const std::string& rowkey, const std::string& colkey, std::string_view value) {
+    return route_command(tablet_address, "PUT " + rowkey + " " + colkey, &value);
+}
+
+std::pair<std::string, bool> tablet_read_command(const std::string& read_address, const std::string& primary_address, const std::string& command) {
+    std::istringstream iss(command);
+    std::string cmd, rowkey, colkey;
+    iss >> cmd >> rowkey >> colkey;
+    unsigned long long lsn = last_write_lsn(rowkey);
+    std::string tagged = command;
+    if (lsn > 0 && (cmd == "GET" || cmd == "GET_COLS")) {
+        tagged = cmd + " " + rowkey + (cmd == "GET" ? " " + colkey : "") + " " + std::to_string(lsn) + "\r\n";
+    }
+    if (!read_address.empty() && read_address != "SERVICE_DOWN" && read_address != primary_address) {
+        auto result = tablet_command(read_address, tagged);
+        // "-ERR STALE": behind the client's LSN; "-ERR COLD": the standby will not swap out the primary's subtablet
+        if (result.second && result.first.substr(0, 10) != "-ERR STALE" && result.first.substr(0, 9) != "-ERR COLD") {
+            return result;
+        }
+        fprintf(stderr, "[tablet_read_command] Secondary %s could not serve LSN %llu (%s), falling back to primary\n", read_address.c_str(), lsn, result.first.c_str());
+    }
+    return tablet_command(primary_address, command);
+}
+
+// Reply line of an unreplicated fragment command ("" if the connection failed)
+static std::string recv_reply(int tablet_socket) {
+    char buffer[1024];
+    memset(buffer, 0, sizeof(buffer));
+    if (recv(tablet_socket, buffer, sizeof(buffer) - 1, 0) <= 0) {
+        return "";
+    }
+    return std::string(buffer);
+}
+
+bool fragment_put(const std::string& tablet_address, const std::string& key, const std::string& bytes) {
+    PooledConnection conn(tablet_address);
+    int tablet_socket = conn.fd();
+    if (tablet_socket < 0) {
+        return false;
+    }
+    std::string command = "FPUT " + key + " " + std::to_string(bytes.size()) + "\r\n";
+    bool ok = send_all(tablet_socket, command.c_str(), command.length()) && recv_reply(tablet_socket) == "+OK\r\n" &&
+              send_all(tablet_socket, bytes.data(), bytes.size()) && recv_reply(tablet_socket) == "+OK\r\n";
+    conn.reusable = ok;
+    if (!ok) {
+        fprintf(stderr, "[fragment_put] Could not store %s on %s\n", key.c_str(), tablet_address.c_str());
+    }
+    return ok;
+}
+
+bool fragment_get(const std::string& tablet_address, const std::string& key, std::string& bytes) {
+    PooledConnection conn(tablet_address);
+    int tablet_socket = conn.fd();
+    if (tablet_socket < 0) {
+        return false;
+    }
+    std::string command = "FGET " + key + "\r\n";
+    std::string response;
+    if (!send_all(tablet_socket, command.c_str(), command.length()) || (response = recv_reply(tablet_socket)).substr(0, 4) != "+OK ") {
+        fprintf(stderr, "[fragment_get] %s not available on %s: %s\n", key.c_str(), tablet_address.c_str(), response.c_str());
+        conn.reusable = complete_reply(response, 1024);
+        return false;
+    }
+    size_t data_size = strtoull(response.c_str() + 4, nullptr, 10);
+    bytes.assign(data_size, '\0');
+    std::string ready_msg = "READY\r\n";
+    bool ok = send_all(tablet_socket, ready_msg.c_str(), ready_msg.length()) && (data_size == 0 || recv_all(tablet_socket, &bytes[0], data_size));
+    conn.reusable = ok;
+    return ok;
+}
+
+bool fragment_delete(const std::string& tablet_address, const std::string& key) {
+    PooledConnection conn(tablet_address);
+    int tablet_socket = conn.fd();
+    if (tablet_socket < 0) {
+        return false;
+    }
+    std::string command = "FDELETE " + key + "\r\n";
+    std::string response = send_all(tablet_socket, command.c_str(), command.length()) ? recv_reply(tablet_socket) : "";
+    conn.reusable = complete_reply(response, 1024);
+    return response.substr(0, 4) == "+OK " || response.substr(0, 13) == "-ERR Not found";  // either way it is gone
+}
+
 } // namespace Utils
@@ -1,10 +1,19 @@
 #include "include/webstorage/webstorage.hpp"
 #include "include/utils.h"
+#include "erasure.h"
 #include <sstream>
 #include <algorithm>
 #include <cstdio>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <string_view>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 namespace WebStorage {
 
@@ -21,101 +30,351 @@ namespace {
         return result;
     }
 
-    std::string hex_encode(const std::vector<char>& data) {
-        std::string hex_str;
-        hex_str.reserve(data.size() * 2);
-        for (unsigned char c : data) {
-            char hex[3];
-            snprintf(hex, sizeof(hex), "%02x", c);
-            hex_str += hex;
+    // A part's value is "raw:" and its bytes, an erasure-coding manifest "ec:rs:...", or (parts stored before raw values,
+    // until migrate_hex_chunks rewrites them) lowercase hex; hex has no ':', so the three cannot be confused
+    const std::string RAW_PREFIX = "raw:";
+
+    bool is_hex(std::string_view value) {
+        if (value.size() % 2 != 0) return false;
+        for (char c : value) {
+            if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))) return false;
         }
-        return hex_str;
+        return true;
     }
 
-    std::vector<char> hex_decode(const std::string& hex_str) {
-        std::vector<char> data;
-        data.reserve(hex_str.length() / 2);
-        for (size_t i = 0; i < hex_str.length(); i += 2) {
-            if (i + 1 >= hex_str.length()) break;
-            std::string byte_str = hex_str.substr(i, 2);
-            char byte = (char)strtol(byte_str.c_str(), nullptr, 16);
-            data.push_back(byte);
+    // One hex digit's value: the low nibble, plus 9 for letters (bit 6 set)
+    void hex_decode_scalar(const char* hex, size_t pairs, char* out) {
+        for (size_t i = 0; i < pairs; ++i) {
+            unsigned char hi = hex[2 * i], lo = hex[2 * i + 1];
+            out[i] = (char)((((hi & 0x0f) + 9 * (hi >> 6)) << 4) | ((lo & 0x0f) + 9 * (lo >> 6)));
         }
-        return data;
     }
-}
 
-StorageResult upload_file_chunk(const std::string& username,
-                              const std::string& filename,
-                              const std::vector<char>& chunk_data,
-                              int part,
-                              int total_parts,
-                              const std::string& tablet_address,
-                              const std::string& content_type) {
-    std::string metadata = File::create_file_metadata(part, total_parts, content_type);
-    std::stringstream cmd;
-    cmd << "PUT " << username << " " << filename << " " << metadata;
+#if defined(__x86_64__) || defined(__i386__)
+    // 16 digits per step: nibble values as above, then PMADDUBSW joins each pair (hi * 16 + lo) and PACKUSWB narrows
+    __attribute__((target("ssse3"))) void hex_decode_ssse3(const char* hex, size_t pairs, char* out) {
+        const __m128i low_mask = _mm_set1_epi8(0x0f), letter_add = _mm_set1_epi8(9), above_digits = _mm_set1_epi8(0x40);
+        const __m128i weights = _mm_set1_epi16(0x0110);
+        size_t i = 0;
+        for (; i + 8 <= pairs; i += 8) {
+            __m128i c = _mm_loadu_si128((const __m128i*)(hex + 2 * i));
+            __m128i v = _mm_add_epi8(_mm_and_si128(c, low_mask), _mm_and_si128(_mm_cmpgt_epi8(c, above_digits), letter_add));
+            __m128i bytes = _mm_maddubs_epi16(v, weights);
+            _mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(bytes, bytes));
+        }
+        hex_decode_scalar(hex + 2 * i, pairs - i, out + i);
+    }
+#endif
 
-    fprintf(stderr, "[WebStorage] Chunked: PUT %s %s (part %d/%d)\n",
-            username.c_str(), filename.c_str(), part, total_parts);
+    using HexDecode = void (*)(const char*, size_t, char*);
 
-    auto [response, success] = Utils::tablet_command(tablet_address, cmd.str());
+    HexDecode pick_hex_decode() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("ssse3")) return hex_decode_ssse3;
+#endif
+        return hex_decode_scalar;
+    }
+
+    // a legacy (hex) value appended to data as bytes
+    void hex_decode(std::string_view hex, std::vector<char>& data) {
+        static const HexDecode decode = pick_hex_decode();
+        size_t old_size = data.size();
+        data.resize(old_size + hex.size() / 2);
+        decode(hex.data(), hex.size() / 2, data.data() + old_size);
+    }
+
+    // Chunks this big are erasure coded (EC_DATA + EC_PARITY fragments on distinct nodes, 1.5x) instead of stored raw
+    // on every replica (3x); the replicated chunk value becomes the manifest
+    // "ec:rs:k:m:size:addr0,addr1,..." (fragment i of the chunk is "username/metadata#i" on addr i)
+    constexpr size_t EC_MIN_BYTES = 1024 * 1024;
+    constexpr int EC_DATA = 4;
+    constexpr int EC_PARITY = 2;
+
+    std::string fragment_key(const std::string& username, const std::string& metadata, int i) {
+        return username + "/" + metadata + "#" + std::to_string(i);
+    }
+
+    struct Manifest {
+        int k = 0, m = 0;
+        size_t size = 0;
+        std::vector<std::string> nodes;
+    };
+
+    bool parse_manifest(const std::string& value, Manifest& manifest) {
+        if (value.compare(0, 6, "ec:rs:") != 0) return false;
+        char nodes[4096];
+        if (sscanf(value.c_str() + 6, "%d:%d:%zu:%4095s", &manifest.k, &manifest.m, &manifest.size, nodes) != 4) return false;
+        std::stringstream ss(nodes);
+        std::string addr;
+        while (std::getline(ss, addr, ',')) manifest.nodes.push_back(addr);
+        return manifest.k > 0 && manifest.m >= 0 && (int)manifest.nodes.size() == manifest.k + manifest.m;
+    }
+
+    // FDELETEs that failed (node down or unreachable) as (node, fragment key), so that the fragments of deleted chunks
+    // are not left on disk for good: each later part delete retries a few, the storage migration all of them; the
+    // oldest are given up on past the cap
+    constexpr size_t MAX_PENDING_DELETES = 10000;
+    constexpr size_t SWEEP_PER_DELETE = 16;
+    std::mutex pending_deletes_mutex;
+    std::deque<std::pair<std::string, std::string>> pending_deletes;
+
+    void record_failed_delete(const std::string& node, const std::string& key) {
+        fprintf(stderr, "[WebStorage] Could not delete fragment %s on %s, will retry\n", key.c_str(), node.c_str());
+        std::lock_guard<std::mutex> lock(pending_deletes_mutex);
+        if (pending_deletes.size() >= MAX_PENDING_DELETES) {
+            fprintf(stderr, "[WebStorage] Giving up on deleting fragment %s on %s\n",
+                    pending_deletes.front().second.c_str(), pending_deletes.front().first.c_str());
+            pending_deletes.pop_front();
+        }
+        pending_deletes.emplace_back(node, key);
+    }
+
+    // Retry up to max recorded deletes (oldest first); those that fail again are recorded again. Returns how many are left
+    size_t sweep_pending_deletes(size_t max) {
+        std::vector<std::pair<std::string, std::string>> batch;
+        {
+            std::lock_guard<std::mutex> lock(pending_deletes_mutex);
+            while (!pending_deletes.empty() && batch.size() < max) {
+                batch.push_back(std::move(pending_deletes.front()));
+                pending_deletes.pop_front();
+            }
+        }
+        for (const auto& [node, key] : batch) {
+            if (!Utils::fragment_delete(node, key)) record_failed_delete(node, key);
+        }
+        std::lock_guard<std::mutex> lock(pending_deletes_mutex);
+        return pending_deletes.size();
+    }
+
+    void delete_fragments(const std::string& username, const std::string& metadata, const std::vector<std::string>& nodes) {
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            std::string key = fragment_key(username, metadata, (int)i);
+            if (!Utils::fragment_delete(nodes[i], key)) record_failed_delete(nodes[i], key);
+        }
+    }
+
+    // Encode and spread the fragments; the manifest to store as the chunk value, or "" to fall back to plain replication
+    std::string put_erasure_coded(const std::string& username, const std::string& metadata, const char* data, size_t size) {
+        std::vector<std::string> nodes = Utils::get_fragment_nodes(username + "/" + metadata, EC_DATA + EC_PARITY);
+        if ((int)nodes.size() < EC_DATA + EC_PARITY) {
+            fprintf(stderr, "[WebStorage] Only %zu nodes alive for %d fragments, replicating instead\n", nodes.size(), EC_DATA + EC_PARITY);
+            return "";
+        }
+        std::vector<std::string> fragments = erasure::encode(std::string(data, size), EC_DATA, EC_PARITY);
+        for (size_t i = 0; i < fragments.size(); ++i) {
+            if (!Utils::fragment_put(nodes[i], fragment_key(username, metadata, (int)i), fragments[i])) {
+                delete_fragments(username, metadata, std::vector<std::string>(nodes.begin(), nodes.begin() + i));
+                return "";
+            }
+        }
+        std::string manifest = "ec:rs:" + std::to_string(EC_DATA) + ":" + std::to_string(EC_PARITY) + ":" + std::to_string(size) + ":";
+        for (size_t i = 0; i < nodes.size(); ++i) manifest += (i ? "," : "") + nodes[i];
+        fprintf(stderr, "[WebStorage] Erasure coded %zu bytes into %d+%d fragments of %zu bytes (%s kernel)\n",
+                size, EC_DATA, EC_PARITY, fragments[0].size(), erasure::kernel().name);
+        return manifest;
+    }
+
+    // Data fragments first (no decoding work if they are all there), parity ones only for those that cannot be fetched
+    bool get_erasure_coded(const std::string& username, const std::string& metadata, const Manifest& manifest, std::vector<char>& data) {
+        std::map<int, std::string> have;
+        for (int i = 0; i < manifest.k + manifest.m && (int)have.size() < manifest.k; ++i) {
+            std::string bytes;
+            if (Utils::fragment_get(manifest.nodes[i], fragment_key(username, metadata, i), bytes)) have[i] = std::move(bytes);
+        }
+        std::string value;
+        if (!erasure::decode(have, manifest.k, manifest.size, value)) {
+            fprintf(stderr, "[WebStorage] Only %zu of %d fragments reachable\n", have.size(), manifest.k);
+            return false;
+        }
+        if (have.rbegin()->first >= manifest.k) {
+            fprintf(stderr, "[WebStorage] Degraded read: rebuilt %zu bytes from fragments with parity\n", manifest.size);
+        }
+        data.assign(value.begin(), value.end());
+        return true;
+    }
+
+    // The column holding part `part` of the file whose metadata is metadata: the metadata with that part number
+    std::string part_key(const std::string& metadata, int part) {
+        File::Metadata parsed = File::Metadata::from_string(metadata);
+        parsed.part = part;
+        return parsed.to_string();
+    }
+
+    // One stored part (raw bytes, a manifest of erasure coded fragments, or legacy hex), decoded and appended to data
+    bool get_part(const std::string& username, const std::string& key, const std::string& tablet_address, std::vector<char>& data) {
+        fprintf(stderr, "[WebStorage] Requesting chunk data: GET %s %s\n", username.c_str(), key.c_str());
+        auto [response, success] = Utils::tablet_command(tablet_address, "GET " + username + " " + key);
+        if (response.substr(0, 4) != "+OK ") {
+            return false;
+        }
+        std::string_view value = std::string_view(response).substr(4);
+        if (value.substr(0, RAW_PREFIX.size()) == RAW_PREFIX) {
+            data.insert(data.end(), value.begin() + RAW_PREFIX.size(), value.end());
+            return true;
+        }
+
+        while (!value.empty() && (value.back() == '\r' || value.back() == '\n' || value.back() == ' ')) {
+            value.remove_suffix(1);
+        }
+        Manifest manifest;
+        if (parse_manifest(std::string(value), manifest)) {
+            std::vector<char> decoded;
+            if (!get_erasure_coded(username, key, manifest, decoded)) {
+                return false;
+            }
+            data.insert(data.end(), decoded.begin(), decoded.end());
+            return true;
+        }
+        fprintf(stderr, "[WebStorage] Legacy hex chunk %s (%zu bytes): run the storage migration\n", key.c_str(), value.size() / 2);
+        hex_decode(value, data);
+        return true;
+    }
+
+    // A stored part and its fragments, if it was erasure coded
+    void delete_part(const std::string& username, const std::string& key, const std::string& tablet_address) {
+        sweep_pending_deletes(SWEEP_PER_DELETE);
+        auto [response, success] = Utils::tablet_command(tablet_address, "GET " + username + " " + key);
+        Manifest manifest;
+        if (response.substr(0, 4) == "+OK " && parse_manifest(response.substr(4), manifest)) {
+            delete_fragments(username, key, manifest.nodes);
+        }
+        Utils::tablet_command(tablet_address, "DELETE " + username + " " + key);
+    }
+}
+
+bool get_file_metadata(const std::string& username,
+                       const std::string& filename,
+                       const std::string& tablet_address,
+                       std::string& metadata) {
+    fprintf(stderr, "[WebStorage] Requesting file metadata: GET %s %s\n", username.c_str(), filename.c_str());
+    auto [response, success] = Utils::tablet_command(tablet_address, "GET " + username + " " + filename);
     if (response.substr(0, 4) != "+OK ") {
-        return {false, "Failed to upload chunk metadata: " + response, {}};
+        return false;
     }
+    metadata = response.substr(4);
+    return true;
+}
 
-    cmd.str("");
-    cmd << "PUT " << username << " " << metadata << " " << hex_encode(chunk_data);
+StorageResult put_file_part(const std::string& username,
+                            const std::string& metadata,
+                            int part,
+                            const char* data,
+                            size_t size,
+                            const std::string& tablet_address) {
+    std::string key = part_key(metadata, part);
+    std::string manifest = size >= EC_MIN_BYTES ? put_erasure_coded(username, key, data, size) : "";
 
     fprintf(stderr, "[WebStorage] Chunked: PUT %s %s (chunk size: %zu bytes)\n",
-            username.c_str(), metadata.c_str(), chunk_data.size());
+            username.c_str(), key.c_str(), size);
 
-    auto [data_response, data_success] = Utils::tablet_command(tablet_address, cmd.str());
-    return process_tablet_response(data_response, "Chunk uploaded successfully");
+    std::string value;
+    if (manifest.empty()) {
+        value.reserve(RAW_PREFIX.size() + size);
+        value.append(RAW_PREFIX).append(data, size);
+    } else {
+        value = manifest;
+    }
+    auto [response, success] = Utils::tablet_put(tablet_address, username, key, value);
+    if (!manifest.empty() && response.substr(0, 4) != "+OK ") {
+        Manifest placed;
+        if (parse_manifest(manifest, placed)) delete_fragments(username, key, placed.nodes);
+    }
+    return process_tablet_response(response, "Chunk uploaded successfully");
 }
 
-StorageResult download_file_chunk(const std::string& username,
+StorageResult put_file_metadata(const std::string& username,
                                 const std::string& filename,
-                                int part,
+                                const std::string& metadata,
                                 const std::string& tablet_address) {
     std::stringstream cmd;
-    cmd << "GET " << username << " " << filename;
-    
-    fprintf(stderr, "[WebStorage] Requesting file metadata: GET %s %s\n",
-            username.c_str(), filename.c_str());
-
-    auto [response, success] = Utils::tablet_command(tablet_address, cmd.str());
-    if (response.substr(0, 4) != "+OK ") {
-        return {false, "Download failed: " + response, {}};
-    }
+    cmd << "PUT " << username << " " << filename << " " << metadata;
 
-    std::string metadata_str = response.substr(4);
-    File::Metadata metadata = File::Metadata::from_string(metadata_str);
-    metadata.part = part;
-    std::string modified_metadata = metadata.to_string();
+    fprintf(stderr, "[WebStorage] Chunked: PUT %s %s (%s)\n",
+            username.c_str(), filename.c_str(), metadata.c_str());
 
-    cmd.str("");
-    cmd << "GET " << username << " " << modified_metadata;
-    
-    fprintf(stderr, "[WebStorage] Requesting chunk data: GET %s %s (part %d)\n",
-            username.c_str(), modified_metadata.c_str(), part);
+    auto [response, success] = Utils::tablet_command(tablet_address, cmd.str());
+    return process_tablet_response(response, "File uploaded successfully");
+}
 
-    auto [data_response, data_success] = Utils::tablet_command(tablet_address, cmd.str());
-    if (data_response.substr(0, 4) != "+OK ") {
-        return {false, "Download failed: " + data_response, {}};
+void delete_file_parts(const std::string& username,
+                       const std::string& metadata,
+                       int parts,
+                       const std::string& tablet_address) {
+    for (int part = 1; part <= parts; ++part) {
+        delete_part(username, part_key(metadata, part), tablet_address);
     }
+}
 
-    std::string hex_data = data_response.substr(4);
-    while (!hex_data.empty() && (hex_data.back() == '\r' || hex_data.back() == '\n' || hex_data.back() == ' ')) {
-        hex_data.pop_back();
+StorageResult download_file_chunk(const std::string& username,
+                                const std::string& filename,
+                                int part,
+                                const std::string& tablet_address) {
+    std::string metadata_str;
+    if (!get_file_metadata(username, filename, tablet_address, metadata_str)) {
+        return {false, "Download failed: file not found", {}};
     }
+    StorageResult result = {true, "", {}};
+    if (!get_part(username, part_key(metadata_str, part), tablet_address, result.data)) {
+        return {false, "Download failed: chunk " + std::to_string(part) + " unavailable", {}};
+    }
+    return result;
+}
 
-    StorageResult result;
-    result.success = true;
-    result.data = hex_decode(hex_data);
+StorageResult download_file(const std::string& username,
+                            const std::string& filename,
+                            const std::string& tablet_address) {
+    std::string metadata_str;
+    if (!get_file_metadata(username, filename, tablet_address, metadata_str)) {
+        return {false, "Download failed: file not found", {}};
+    }
+    File::Metadata metadata = File::Metadata::from_string(metadata_str);
+    StorageResult result = {true, "", {}};
+    for (int part = 1; part <= std::max(1, metadata.total); ++part) {
+        if (!get_part(username, part_key(metadata_str, part), tablet_address, result.data)) {
+            return {false, "Download failed: chunk " + std::to_string(part) + " unavailable", {}};
+        }
+    }
+    // files stored before sizes were recorded kept the CRLF that ends a multipart part (text files had it cleaned off)
+    if (metadata.size < 0 && metadata.type != "text/plain" && result.data.size() >= 2 &&
+        result.data[result.data.size() - 2] == '\r' && result.data.back() == '\n') {
+        result.data.resize(result.data.size() - 2);
+    }
     return result;
 }
 
+bool read_file_range(const std::string& username,
+                     const std::string& metadata_str,
+                     size_t start,
+                     size_t end,
+                     const std::string& tablet_address,
+                     const std::function<bool(std::string_view)>& sink) {
+    File::Metadata metadata = File::Metadata::from_string(metadata_str);
+    if (start >= end) {
+        return true;
+    }
+    size_t block = metadata.block > 0 ? metadata.block : end;  // a single part
+    std::vector<char> data;
+    for (size_t part_start = start - start % block; part_start < end; part_start += block) {
+        int part = (int)(part_start / block) + 1;
+        data.clear();
+        if (!get_part(username, part_key(metadata_str, part), tablet_address, data)) {
+            fprintf(stderr, "[WebStorage] Chunk %d of %s unavailable\n", part, metadata_str.c_str());
+            return false;
+        }
+        size_t from = std::max(start, part_start) - part_start;
+        size_t to = std::min(end, part_start + block) - part_start;
+        if (data.size() < to) {
+            fprintf(stderr, "[WebStorage] Chunk %d of %s has %zu bytes, %zu expected\n", part, metadata_str.c_str(), data.size(), to);
+            return false;
+        }
+        if (!sink(std::string_view(data.data() + from, to - from))) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool file_exists(const std::string& username, 
                 const std::string& filename,
                 const std::string& tablet_address) {
@@ -183,21 +442,14 @@ std::vector<FileEntry> list_files(const std::string& username,
 StorageResult delete_file(const std::string& username,
                         const std::string& filename,
                         const std::string& tablet_address) {
-    std::stringstream cmd;
-    cmd << "GET " << username << " " << filename;
-    
-    auto [response, success] = Utils::tablet_command(tablet_address, cmd.str());
-    if (response.substr(0, 4) != "+OK ") {
-        return {false, "File not found: " + response, {}};
+    std::string metadata_str;
+    if (!get_file_metadata(username, filename, tablet_address, metadata_str)) {
+        return {false, "File not found", {}};
     }
 
-    std::string metadata_str = response.substr(4);
-    
-    cmd.str("");
-    cmd << "DELETE " << username << " " << metadata_str;
-    auto [delete_response, delete_success] = Utils::tablet_command(tablet_address, cmd.str());
-    
-    cmd.str("");
+    delete_file_parts(username, metadata_str, std::max(1, File::Metadata::from_string(metadata_str).total), tablet_address);
+
+    std::stringstream cmd;
     cmd << "DELETE " << username << " " << filename;
     auto [final_response, final_success] = Utils::tablet_command(tablet_address, cmd.str());
     
@@ -368,6 +620,58 @@ StorageResult rename_item(const std::string& username,
     return move_item(username, old_path, new_path, type, tablet_address);
 }
 
+MigrationReport migrate_hex_chunks() {
+    MigrationReport report;
+    for (const std::string& primary : Utils::get_all_primaries()) {
+        auto [rows_response, rows_success] = Utils::tablet_command(primary, "GET_ROWS\r\n");
+        if (rows_response.substr(0, 3) != "+OK") {
+            fprintf(stderr, "[migrate_hex_chunks] No rows from %s: %s\n", primary.c_str(), rows_response.c_str());
+            continue;
+        }
+        std::istringstream rows(rows_response.substr(3));
+        for (std::string row; rows >> row;) {
+            report.rows++;
+            auto [cols_response, cols_success] = Utils::tablet_command(primary, "GET_COLS " + row);
+            if (cols_response.substr(0, 4) != "+OK ") {
+                continue;
+            }
+            std::istringstream cols(cols_response.substr(4));
+            for (std::string col; cols >> col;) {
+                // file data lives under "type:..;part:..;total:..;timestamp:.." (a file's own column starts with '/')
+                if (col.compare(0, 5, "type:") != 0 || col.find(";part:") == std::string::npos) {
+                    continue;
+                }
+                report.parts++;
+                auto [value_response, value_success] = Utils::tablet_command(primary, "GET " + row + " " + col);
+                if (value_response.substr(0, 4) != "+OK ") {
+                    report.failed++;
+                    continue;
+                }
+                std::string_view value = std::string_view(value_response).substr(4);
+                while (!value.empty() && (value.back() == '\r' || value.back() == '\n' || value.back() == ' ')) {
+                    value.remove_suffix(1);
+                }
+                if (!is_hex(value)) {
+                    continue;  // raw already, or a manifest
+                }
+                std::vector<char> raw(RAW_PREFIX.begin(), RAW_PREFIX.end());
+                hex_decode(value, raw);
+                auto [put_response, put_success] = Utils::tablet_put(primary, row, col, std::string_view(raw.data(), raw.size()));
+                if (put_response.substr(0, 4) == "+OK ") {
+                    report.migrated++;
+                } else {
+                    report.failed++;
+                    fprintf(stderr, "[migrate_hex_chunks] Could not rewrite %s %s: %s\n", row.c_str(), col.c_str(), put_response.c_str());
+                }
+            }
+        }
+    }
+    report.fragment_deletes_pending = sweep_pending_deletes(MAX_PENDING_DELETES);
+    fprintf(stderr, "[migrate_hex_chunks] %zu rows, %zu chunks, %zu rewritten as raw, %zu failed, %zu fragment deletes pending\n",
+            report.rows, report.parts, report.migrated, report.failed, report.fragment_deletes_pending);
+    return report;
+}
+
 } // namespace WebStorage
 
 
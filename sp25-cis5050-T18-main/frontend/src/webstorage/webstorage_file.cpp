@@ -17,6 +17,12 @@ std::string Metadata::to_string() const {
     return ss.str();
 }
 
+std::string Metadata::to_file_string() const {
+    std::stringstream ss;
+    ss << to_string() << ";size:" << size << ";block:" << block;
+    return ss.str();
+}
+
 Metadata Metadata::from_string(const std::string& str) {
     Metadata metadata;
     size_t pos = 0;
@@ -34,6 +40,8 @@ Metadata Metadata::from_string(const std::string& str) {
         else if (key == "part") metadata.part = std::stoi(value);
         else if (key == "total") metadata.total = std::stoi(value);
         else if (key == "timestamp") metadata.timestamp = value;
+        else if (key == "size") metadata.size = std::stoll(value);
+        else if (key == "block") metadata.block = std::stoull(value);
     }
     return metadata;
 }
@@ -1,6 +1,7 @@
 #include "include/webstorage/webstorage_handler.hpp"
 #include "include/webstorage/webstorage.hpp"
 #include "include/utils.h"
+#include "include/http_response.h"
 #include <sstream>
 #include <string>
 #include <vector>
@@ -13,11 +14,11 @@
 #include <thread>
 #include <chrono>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <cstddef>
 #include <algorithm>
 
-#define KEEP_ALIVE_TIMEOUT 15
-
 namespace WebStorageHandler {
 
 namespace {
@@ -38,23 +39,8 @@ namespace {
     }
 
     void send_response(int client_fd, const std::string& status, const std::string& content_type, 
-                      const std::string& body, const std::string& additional_headers = "", bool keep_alive = false) {
-        std::string response = "HTTP/1.1 " + status + "\r\n"
-                             "Content-Type: " + content_type + "\r\n"
-                             "Content-Length: " + std::to_string(body.length()) + "\r\n";
-                           
-	    if (keep_alive) {
-            response += "Connection: keep-alive\r\n"
-                        "Keep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT) + "\r\n";
-        } else {
-            response += "Connection: close\r\n";
-        }
-        
-        if (!additional_headers.empty()) {
-            response += additional_headers;
-        }
-        response += "\r\n" + body;
-        send(client_fd, response.c_str(), response.length(), 0);
+                      std::string_view body, const std::string& additional_headers = "", bool keep_alive = false) {
+        Http::send_response(client_fd, status, content_type, body, keep_alive, additional_headers);
     }
 
     void send_json_response(int client_fd, bool success, const std::string& message, bool keep_alive = false) {
@@ -65,119 +51,167 @@ namespace {
     }
 
     void send_file_response(int client_fd, const std::string& file_path, bool keep_alive = false) {
-        std::ifstream file(file_path);
-        if (file.is_open()) {
-            std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-            send_response(client_fd, "200 OK", "text/html", content, "", keep_alive);
+        int file_fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (file_fd >= 0 && fstat(file_fd, &st) == 0) {
+            std::string head = Http::response_head("200 OK", "text/html", st.st_size, keep_alive);
+            Http::send_file(client_fd, head, file_fd, 0, st.st_size);
+            close(file_fd);
         } else {
+            if (file_fd >= 0) {
+                close(file_fd);
+            }
             send_response(client_fd, "404 Not Found", "text/html", 
                          "<html><body><h1>404 Not Found</h1></body></html>", "", keep_alive);
         }
     }
 
-    bool find_boundary(const std::vector<std::byte>& data, const std::string& boundary, size_t start_pos, size_t& found_pos, bool& is_final) {
-        std::string boundary_marker = "--" + boundary;
-        std::string final_boundary = "--" + boundary + "--";
-        std::vector<std::byte> boundary_bytes;
-        std::vector<std::byte> final_boundary_bytes;
-        
-        boundary_bytes.reserve(boundary_marker.size());
-        final_boundary_bytes.reserve(final_boundary.size());
-        
-        for (char c : boundary_marker) {
-            boundary_bytes.push_back(static_cast<std::byte>(c));
-        }
-        for (char c : final_boundary) {
-            final_boundary_bytes.push_back(static_cast<std::byte>(c));
+    // the name a download is saved as: the last component of the file key, safe inside a quoted header value
+    std::string download_name(const std::string& file_key) {
+        std::string name;
+        for (char c : file_key.substr(file_key.rfind('/') + 1)) {
+            if (c == '"' || c == '\\') {
+                name += '\\';
+            } else if ((unsigned char)c < 0x20 || c == 0x7f) {
+                continue;
+            }
+            name += c;
         }
-        
-        for (size_t i = start_pos; i < data.size() - std::min(boundary_bytes.size(), final_boundary_bytes.size()); ++i) {
-            bool match = true;
-            bool is_final_match = true;
-            
-            for (size_t j = 0; j < boundary_bytes.size(); ++j) {
-                if (data[i + j] != boundary_bytes[j]) {
-                    match = false;
-                    break;
-                }
+        return name;
+    }
+
+    // Largest piece of an upload held in memory: each block is stored as one part as soon as it is full
+    constexpr size_t UPLOAD_BLOCK_BYTES = 4 * 1024 * 1024;
+    constexpr size_t MULTIPART_READ_BYTES = 64 * 1024;
+    constexpr size_t MAX_PART_HEADER_BYTES = 16 * 1024;
+
+    // A multipart/form-data body read from the client a window at a time: part headers are returned whole, part data
+    // in pieces, holding back only the bytes that could be the start of the next delimiter
+    class MultipartStream {
+    public:
+        MultipartStream(Http::BodyReader& body, const std::string& boundary)
+            : body_(body), delimiter_("\r\n--" + boundary), window_("\r\n") {}  // the first delimiter has no CRLF before it
+
+        // the headers of the next part (the rest of the current one is skipped); false after the closing delimiter
+        // or if the body is cut short or malformed
+        bool next_part(std::string& headers) {
+            std::string skipped;
+            while (in_part_) {  // the rest of the previous part, or the preamble
+                skipped.clear();
+                if (read_data(skipped, MULTIPART_READ_BYTES) < 0) return false;
             }
-            
-            if (match && i + final_boundary_bytes.size() <= data.size()) {
-                for (size_t j = 0; j < final_boundary_bytes.size(); ++j) {
-                    if (data[i + j] != final_boundary_bytes[j]) {
-                        is_final_match = false;
-                        break;
-                    }
-                }
-                if (is_final_match) {
-                    found_pos = i;
-                    is_final = true;
-                    return true;
-                }
+            while (window_.size() - pos_ < 2) {
+                if (!fill()) return false;
             }
-            
-            if (match) {
-                found_pos = i;
-                is_final = false;
-                return true;
+            if (window_.compare(pos_, 2, "--") == 0) return false;
+            size_t end;
+            while ((end = window_.find("\r\n\r\n", pos_)) == std::string::npos) {
+                if (window_.size() - pos_ > MAX_PART_HEADER_BYTES || !fill()) return false;
             }
+            headers = window_.substr(pos_, end + 2 - pos_);
+            pos_ = end + 4;
+            in_part_ = true;
+            return true;
         }
-        return false;
-    }
 
-    bool find_headers_end(const std::vector<std::byte>& data, size_t start_pos, size_t& end_pos) {
-        std::vector<std::byte> marker = {static_cast<std::byte>('\r'), static_cast<std::byte>('\n'), 
-                                       static_cast<std::byte>('\r'), static_cast<std::byte>('\n')};
-        
-        for (size_t i = start_pos; i < data.size() - marker.size(); ++i) {
-            bool match = true;
-            for (size_t j = 0; j < marker.size(); ++j) {
-                if (data[i + j] != marker[j]) {
-                    match = false;
-                    break;
+        // append up to max bytes of the current part's data to out: the count, 0 at the end of the part, -1 if the
+        // body ended inside it
+        ssize_t read_data(std::string& out, size_t max) {
+            while (in_part_) {
+                size_t found = window_.find(delimiter_, pos_);
+                size_t available = found != std::string::npos ? found - pos_
+                                 : window_.size() - pos_ >= delimiter_.size() ? window_.size() - pos_ - (delimiter_.size() - 1) : 0;
+                if (available > 0 || found != std::string::npos) {
+                    size_t n = std::min(max, available);
+                    out.append(window_, pos_, n);
+                    pos_ += n;
+                    if (pos_ == found) {
+                        pos_ += delimiter_.size();
+                        in_part_ = false;
+                    }
+                    return n;
                 }
+                if (!fill()) return -1;
             }
-            if (match) {
-                end_pos = i + marker.size();
-                return true;
-            }
+            return 0;
         }
-        return false;
-    }
 
-    std::string extract_header_value(const std::vector<std::byte>& data, const std::string& header_name) {
-        std::string header_start = header_name + "=\"";
-        std::vector<std::byte> header_bytes;
-        header_bytes.reserve(header_start.size());
-        for (char c : header_start) {
-            header_bytes.push_back(static_cast<std::byte>(c));
+        // bytes of the body not yet returned
+        size_t remaining() const { return body_.remaining() + window_.size() - pos_; }
+
+        // what follows the last part's data: "\r\n--boundary--"
+        size_t closing_size() const { return delimiter_.size() + 2; }
+
+    private:
+        bool fill() {
+            window_.erase(0, pos_);
+            pos_ = 0;
+            size_t old_size = window_.size();
+            window_.resize(old_size + MULTIPART_READ_BYTES);
+            ssize_t n = body_.read(&window_[old_size], MULTIPART_READ_BYTES);
+            window_.resize(old_size + std::max<ssize_t>(n, 0));
+            return n > 0;
         }
-        
-        for (size_t i = 0; i < data.size() - header_bytes.size(); ++i) {
-            bool match = true;
-            for (size_t j = 0; j < header_bytes.size(); ++j) {
-                if (data[i + j] != header_bytes[j]) {
-                    match = false;
-                    break;
-                }
-            }
-            if (match) {
-                size_t start = i + header_bytes.size();
-                size_t end = start;
-                while (end < data.size() && data[end] != static_cast<std::byte>('"')) {
-                    ++end;
+
+        Http::BodyReader& body_;
+        std::string delimiter_;
+        std::string window_;
+        size_t pos_ = 0;
+        bool in_part_ = true;  // the preamble counts as a part whose data is skipped
+    };
+
+    // Text uploads are stored with CRLF and lone CR turned into LF and without newlines at the start or end;
+    // trailing newlines are held back until more text shows they are not trailing
+    class TextCleaner {
+    public:
+        void feed(const char* data, size_t size, std::string& out) {
+            for (size_t i = 0; i < size; ++i) {
+                char c = data[i];
+                if (c == '\n' && after_cr_) {
+                    after_cr_ = false;
+                    continue;
                 }
-                if (end > start) {
-                    std::string result;
-                    result.reserve(end - start);
-                    for (size_t j = start; j < end; ++j) {
-                        result += static_cast<char>(data[j]);
-                    }
-                    return result;
+                after_cr_ = c == '\r';
+                if (c == '\r' || c == '\n') {
+                    if (started_) newlines_++;
+                    continue;
                 }
+                out.append(newlines_, '\n');
+                newlines_ = 0;
+                started_ = true;
+                out += c;
             }
         }
-        return "";
+
+    private:
+        bool started_ = false;
+        bool after_cr_ = false;
+        size_t newlines_ = 0;
+    };
+
+    // a quoted parameter of the part's Content-Disposition, e.g. filename="a.txt"
+    std::string disposition_param(const std::string& headers, const std::string& name) {
+        std::string marker = name + "=\"";
+        size_t start = headers.find(marker);
+        if (start == std::string::npos) return "";
+        start += marker.size();
+        size_t end = headers.find('"', start);
+        return end == std::string::npos ? "" : headers.substr(start, end - start);
+    }
+
+    // the part's media type, if it is one that can go into the file metadata
+    std::string part_content_type(const std::string& headers) {
+        std::string lower = headers;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        size_t start = lower.find("\r\ncontent-type:");
+        if (start == std::string::npos) return "application/octet-stream";
+        start += 15;
+        size_t end = headers.find_first_of(";\r", start);
+        std::string type = headers.substr(start, end - start);
+        type.erase(0, type.find_first_not_of(" \t"));
+        type.erase(type.find_last_not_of(" \t") + 1);
+        if (type.empty() || type.find_first_of(" :;") != std::string::npos) return "application/octet-stream";
+        return type;
     }
 
     bool is_text_file(const std::string& filename) {
@@ -196,96 +230,65 @@ namespace {
         return text_extensions.find(ext) != text_extensions.end();
     }
 
-    std::vector<char> convert_to_char_vector(const std::vector<std::byte>& data) {
-        std::vector<char> result;
-        result.reserve(data.size());
-        for (std::byte b : data) {
-            result.push_back(static_cast<char>(b));
-        }
-        return result;
-    }
+    // Stream the file part of an upload into storage a block at a time. The part count is in every data key, so it
+    // is fixed before the first block goes out: the rest of the body bounds the file's size, and if the file turns
+    // out shorter (a text file loses its CRs, another field follows) the parts left over are stored empty. Every
+    // part but the last non-empty one is then exactly one block, so a byte range maps straight to its parts
+    WebStorage::StorageResult store_upload(MultipartStream& form,
+                                           const std::string& filename,
+                                           const std::string& headers,
+                                           const std::string& file_key,
+                                           const std::string& username,
+                                           const std::string& tablet_address) {
+        bool text = is_text_file(filename);
+        size_t bound = form.remaining() > form.closing_size() ? form.remaining() - form.closing_size() : 0;
+        int total = (int)std::max<size_t>(1, (bound + UPLOAD_BLOCK_BYTES - 1) / UPLOAD_BLOCK_BYTES);
+        std::string metadata = File::create_file_metadata(1, total, text ? "text/plain" : part_content_type(headers));
+        fprintf(stderr, "[WebStorageHandler] Processing file: %s (at most %zu bytes, %d parts)\n",
+                filename.c_str(), bound, total);
 
-    std::vector<char> clean_text_data(const std::vector<char>& data) {
-        std::vector<char> result;
-        result.reserve(data.size());
-        
-        size_t start = 0;
-        while (start < data.size() && (data[start] == '\r' || data[start] == '\n')) {
-            start++;
-        }
-        
-        for (size_t i = start; i < data.size(); i++) {
-            if (data[i] == '\r' && i + 1 < data.size() && data[i + 1] == '\n') {
-                result.push_back('\n');
-                i++;
-            }
-            else if (data[i] == '\r' || data[i] == '\n') {
-                result.push_back('\n');
-            }
-            else {
-                result.push_back(data[i]);
+        int part = 1;
+        auto fail = [&](const std::string& message) {
+            WebStorage::delete_file_parts(username, metadata, part - 1, tablet_address);
+            return WebStorage::StorageResult{false, message, {}};
+        };
+
+        TextCleaner cleaner;
+        std::string block, raw;
+        block.reserve(std::min(bound, UPLOAD_BLOCK_BYTES) + MULTIPART_READ_BYTES);
+        while (true) {
+            raw.clear();
+            ssize_t n = form.read_data(text ? raw : block, MULTIPART_READ_BYTES);
+            if (n < 0) return fail("Upload cut short");
+            if (n == 0) break;
+            if (text) cleaner.feed(raw.data(), raw.size(), block);
+            // a full block is stored once more data shows it is not the last one
+            while (block.size() > UPLOAD_BLOCK_BYTES && part < total) {
+                auto result = WebStorage::put_file_part(username, metadata, part, block.data(), UPLOAD_BLOCK_BYTES, tablet_address);
+                if (!result.success) return fail(result.message);
+                block.erase(0, UPLOAD_BLOCK_BYTES);
+                part++;
             }
         }
-        
-        while (!result.empty() && (result.back() == '\r' || result.back() == '\n')) {
-            result.pop_back();
-        }
-        
-        return result;
-    }
-
-    bool process_text_file_upload(const std::vector<char>& file_data, 
-                                const std::string& filename,
-                                const std::string& current_path,
-                                const std::string& username,
-                                const std::string& tablet_address,
-                                int part,
-                                int total_parts) {
-        std::vector<char> cleaned_data = clean_text_data(file_data);
-        std::string file_key = File::get_file_key(current_path, filename);
-        auto result = WebStorage::upload_file_chunk(username, file_key, cleaned_data, part, total_parts, tablet_address, "text/plain");
-        return result.success;
-    }
 
-    bool process_binary_file_upload(const std::vector<std::byte>& file_data,
-                                  const std::string& filename,
-                                  const std::string& current_path,
-                                  const std::string& username,
-                                  const std::string& tablet_address,
-                                  int part,
-                                  int total_parts) {
-        std::vector<char> char_data = convert_to_char_vector(file_data);
-        std::string content_type = extract_header_value(file_data, "Content-Type");
-        if (content_type.empty()) {
-            content_type = "application/octet-stream";
+        size_t size = (size_t)(part - 1) * UPLOAD_BLOCK_BYTES + block.size();
+        for (; part <= total; part++) {
+            auto result = WebStorage::put_file_part(username, metadata, part, block.data(), block.size(), tablet_address);
+            if (!result.success) return fail(result.message);
+            block.clear();
         }
-        std::string file_key = File::get_file_key(current_path, filename);
-        auto result = WebStorage::upload_file_chunk(username, file_key, char_data, part, total_parts, tablet_address, content_type);
-        return result.success;
+        fprintf(stderr, "[WebStorageHandler] Stored %s (%zu bytes) in %d parts\n", filename.c_str(), size, total);
+        File::Metadata stored = File::Metadata::from_string(metadata);
+        stored.size = size;
+        stored.block = UPLOAD_BLOCK_BYTES;
+        auto result = WebStorage::put_file_metadata(username, file_key, stored.to_file_string(), tablet_address);
+        return result.success ? result : fail(result.message);
     }
 }
 
-std::string get_username_from_session(const char* buffer) {
-    const char* cookie_start = strstr(buffer, "Cookie: ");
-    if (!cookie_start) return "";
-    
-    cookie_start += strlen("Cookie: ");
-    const char* cookie_end = strstr(cookie_start, "\r\n");
-    if (!cookie_end) return "";
-    
-    std::string cookie_str(cookie_start, cookie_end - cookie_start);
-    size_t session_pos = cookie_str.find("auth_user=");
-    if (session_pos == std::string::npos) return "";
-    
-    session_pos += strlen("auth_user=");
-    std::string username = cookie_str.substr(session_pos);
-    
-    size_t end_pos = username.find(';');
-    if (end_pos != std::string::npos) {
-        username = username.substr(0, end_pos);
-    }
-    
-    return username;
+std::string get_username_from_session(
+const Http::Request& request) {
+    return Utils::get_cookie_value(request, "auth_user");
 }
 
 std::string get_current_path(const std::string& url_path) {
@@ -312,7 +315,8 @@ std::string get_current_path(const std::string& url_path) {
     return File::normalize_path(path);
 }
 
-void handle_storage_request(int client_fd, const std::string& path, const char* buffer, bool keep_alive) {
+void handle_storage_request(int client_fd, const std::string& path, const Http::Request& request) {
+    bool keep_alive = request.keep_alive;
     fprintf(stderr, "[WebStorageHandler] Received storage request: %s\n", path.c_str());
     
     if (path == "/storage" || path == "/storage/") {
@@ -320,7 +324,7 @@ void handle_storage_request(int client_fd, const std::string& path, const char*
         return;
     }
 
-    std::string username = get_username_from_session(buffer);
+    std::string username = get_username_from_session(request);
     if (username.empty()) {
         fprintf(stderr, "[WebStorageHandler] No valid session found\n");
         send_json_response(client_fd, false, "Not authenticated", keep_alive);
@@ -337,7 +341,7 @@ void handle_storage_request(int client_fd, const std::string& path, const char*
     std::string current_path = get_current_path(path);
     fprintf(stderr, "[WebStorageHandler] Current path: %s\n", current_path.c_str());
 
-    if (path.find("/storage/list") == 0 && buffer && strstr(buffer, "GET") != nullptr) {
+    if (path.find("/storage/list") == 0 && request.method == "GET") {
         std::vector<WebStorage::FileEntry> files = WebStorage::list_files(username, tablet_address);
         std::stringstream json_response;
         json_response << "{\"files\":[";
@@ -383,19 +387,17 @@ void handle_storage_request(int client_fd, const std::string& path, const char*
         return;
     }
 
-    if (path.find("/storage/upload") == 0 && buffer && strstr(buffer, "POST") != nullptr) {
+    if (path.find("/storage/upload") == 0 && request.method == "POST") {
         fprintf(stderr, "[WebStorageHandler] Processing upload request\n");
         
-        std::string request(buffer);
-        
-        size_t content_type_pos = request.find("Content-Type: multipart/form-data");
-        if (content_type_pos == std::string::npos) {
+        std::string content_type(request.header("Content-Type"));
+        if (content_type.find("multipart/form-data") == std::string::npos) {
             fprintf(stderr, "[WebStorageHandler] Error: Content-Type is not multipart/form-data\n");
             send_json_response(client_fd, false, "Invalid upload request", keep_alive);
             return;
         }
 
-        size_t boundary_pos = request.find("boundary=", content_type_pos);
+        size_t boundary_pos = content_type.find("boundary=");
         if (boundary_pos == std::string::npos) {
             fprintf(stderr, "[WebStorageHandler] Error: No boundary found\n");
             send_json_response(client_fd, false, "Invalid upload request", keep_alive);
@@ -403,134 +405,38 @@ void handle_storage_request(int client_fd, const std::string& path, const char*
         }
 
         boundary_pos += 9;
-        size_t boundary_end = request.find("\r\n", boundary_pos);
-        std::string boundary = request.substr(boundary_pos, boundary_end - boundary_pos);
-        fprintf(stderr, "[WebStorageHandler] Boundary: %s\n", boundary.c_str());
-
-        size_t content_length_pos = request.find("Content-Length: ");
-        if (content_length_pos == std::string::npos) {
-            fprintf(stderr, "[WebStorageHandler] Error: No Content-Length header\n");
-            send_json_response(client_fd, false, "Invalid upload request", keep_alive);
-            return;
-        }
-
-        content_length_pos += 16;
-        size_t content_length_end = request.find("\r\n", content_length_pos);
-        size_t content_length = std::stoul(request.substr(content_length_pos, content_length_end - content_length_pos));
-        fprintf(stderr, "[WebStorageHandler] Content-Length: %zu\n", content_length);
-
-        size_t body_start = request.find("\r\n\r\n");
-        if (body_start == std::string::npos) {
-            fprintf(stderr, "[WebStorageHandler] Error: No request body found\n");
-            send_json_response(client_fd, false, "Invalid upload request", keep_alive);
-            return;
-        }
-        body_start += 4;
-
-        std::vector<std::byte> complete_data;
-        complete_data.reserve(content_length);
-
-        size_t initial_data_size = request.size() - body_start;
-        for (size_t i = body_start; i < request.size(); ++i) {
-            complete_data.push_back(static_cast<std::byte>(request[i]));
-        }
-        
-        size_t total_bytes_received = initial_data_size;
-        fprintf(stderr, "[WebStorageHandler] Initial data size: %zu bytes\n", initial_data_size);
-        fprintf(stderr, "[WebStorageHandler] Expected content length: %zu bytes\n", content_length);
-
-        while (total_bytes_received < content_length) {
-            std::vector<std::byte> recv_buffer(8192);
-            ssize_t recv_size = recv(client_fd, reinterpret_cast<char*>(recv_buffer.data()), recv_buffer.size(), 0);
-            if (recv_size <= 0) {
-                fprintf(stderr, "[WebStorageHandler] Error: Failed to receive complete data. Received %zu/%zu bytes\n", 
-                        total_bytes_received, content_length);
-                send_json_response(client_fd, false, "Failed to receive complete data", keep_alive);
-                return;
-            }
-            complete_data.insert(complete_data.end(), recv_buffer.begin(), recv_buffer.begin() + recv_size);
-            total_bytes_received += recv_size;
-            // fprintf(stderr, "[WebStorageHandler] Received %zu/%zu bytes (total: %zu)\n", 
-            //         recv_size, content_length, total_bytes_received);
-        }
-
-        fprintf(stderr, "[WebStorageHandler] Complete data received: %zu bytes\n", total_bytes_received);
-
-        size_t part_start;
-        bool is_final = false;
-        if (!find_boundary(complete_data, boundary, 0, part_start, is_final)) {
-            fprintf(stderr, "[WebStorageHandler] Error: No part boundary found in %zu bytes of data\n", total_bytes_received);
-            send_json_response(client_fd, false, "Invalid upload request", keep_alive);
-            return;
+        std::string boundary = content_type.substr(boundary_pos, content_type.find(';', boundary_pos) - boundary_pos);
+        if (boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"') {
+            boundary = boundary.substr(1, boundary.size() - 2);
         }
+        fprintf(stderr, "[WebStorageHandler] Boundary: %s\n", boundary.c_str());
 
-        while (!is_final) {
-            size_t headers_end;
-            if (!find_headers_end(complete_data, part_start, headers_end)) {
-                fprintf(stderr, "[WebStorageHandler] Error: Could not find headers end at position %zu\n", part_start);
-                break;
-            }
-
-            std::string filename = extract_header_value(complete_data, "filename");
-            if (!filename.empty()) {
-                std::string part_str = extract_header_value(complete_data, "part");
-                std::string total_str = extract_header_value(complete_data, "total");
-                
-                int part = 1;
-                int total_parts = 1;
-                
-                if (!part_str.empty()) {
-                    part = std::stoi(part_str);
-                }
-                if (!total_str.empty()) {
-                    total_parts = std::stoi(total_str);
-                }
-
-                fprintf(stderr, "[WebStorageHandler] Processing file: %s (part %d/%d)\n", 
-                        filename.c_str(), part, total_parts);
-
-                size_t data_end;
-                if (!find_boundary(complete_data, boundary, headers_end, data_end, is_final)) {
-                    fprintf(stderr, "[WebStorageHandler] Error: Could not find data end boundary\n");
-                    send_json_response(client_fd, false, "Invalid upload request", keep_alive);
-                    return;
-                }
-
-                std::vector<std::byte> file_data;
-                file_data.reserve(data_end - headers_end);
-                file_data.assign(complete_data.begin() + headers_end, complete_data.begin() + data_end);
-
-                fprintf(stderr, "[WebStorageHandler] File data size: %zu bytes\n", file_data.size());
-                fprintf(stderr, "[WebStorageHandler] Total bytes received: %zu bytes\n", total_bytes_received);
-
-                bool success;
-                if (is_text_file(filename)) {
-                    std::vector<char> text_data = convert_to_char_vector(file_data);
-                    success = process_text_file_upload(text_data, filename, current_path, username, tablet_address, part, total_parts);
-                } else {
-                    success = process_binary_file_upload(file_data, filename, current_path, username, tablet_address, part, total_parts);
-                }
-
-                if (success) {
-                    send_json_response(client_fd, true, "File uploaded successfully", keep_alive);
-                } else {
-                    send_json_response(client_fd, false, "Failed to upload file", keep_alive);
-                }
-                return;
+        // streamed from the socket by the server; a body that arrived whole with its head is read from memory
+        Http::BodyReader in_memory(request.body);
+        MultipartStream form(request.body_reader ? *request.body_reader : in_memory, boundary);
+        std::string headers;
+        while (form.next_part(headers)) {
+            std::string filename = disposition_param(headers, "filename");
+            if (filename.empty()) {
+                continue;
             }
-
-            if (!find_boundary(complete_data, boundary, part_start + 2, part_start, is_final)) {
-                fprintf(stderr, "[WebStorageHandler] Error: Could not find next part boundary\n");
-                break;
+            std::string file_key = File::get_file_key(current_path, filename);
+            auto result = store_upload(form, filename, headers, file_key, username, tablet_address);
+            if (result.success) {
+                send_json_response(client_fd, true, "File uploaded successfully", keep_alive);
+            } else {
+                fprintf(stderr, "[WebStorageHandler] Upload of %s failed: %s\n", filename.c_str(), result.message.c_str());
+                send_json_response(client_fd, false, "Failed to upload file", keep_alive);
             }
+            return;
         }
 
-        fprintf(stderr, "[WebStorageHandler] Error: No valid file part found in %zu bytes of data\n", total_bytes_received);
+        fprintf(stderr, "[WebStorageHandler] Error: No valid file part found\n");
         send_json_response(client_fd, false, "Invalid upload request", keep_alive);
         return;
     }
 
-    if (path.find("/storage/delete_folder") == 0 && buffer && strstr(buffer, "POST") != nullptr) {
+    if (path.find("/storage/delete_folder") == 0 && request.method == "POST") {
         std::string folder_path = path.substr(22);
         if (folder_path.empty() || folder_path == "/") {
             send_json_response(client_fd, false, "Cannot delete root folder", keep_alive);
@@ -539,11 +445,9 @@ void handle_storage_request(int client_fd, const std::string& path, const char*
         auto result = WebStorage::delete_folder(username, folder_path, tablet_address);
         send_json_response(client_fd, result.success, result.message, keep_alive);
         return;
-    } else if (path.find("/storage/delete") == 0 && buffer && strstr(buffer, "POST") != nullptr) {
-        const char* content_start = strstr(buffer, "\r\n\r\n");
-        if (content_start) {
-            content_start += 4;
-            std::string form_data(content_start);
+    } else if (path.find("/storage/delete") == 0 && request.method == "POST") {
+        if (!request.body.empty()) {
+            std::string form_data(request.body);
             
             size_t filename_start = form_data.find("filename=");
             if (filename_start != std::string::npos) {
@@ -564,11 +468,9 @@ void handle_storage_request(int client_fd, const std::string& path, const char*
         return;
     }
 
-    if (path.find("/storage/create_folder") == 0 && buffer && strstr(buffer, "POST") != nullptr) {
-        const char* content_start = strstr(buffer, "\r\n\r\n");
-        if (content_start) {
-            content_start += 4;
-            std::string form_data(content_start);
+    if (path.find("/storage/create_folder") == 0 && request.method == "POST") {
+        if (!request.body.empty()) {
+            std::string form_data(request.body);
             
             size_t folder_start = form_data.find("folder=");
             if (folder_start != std::string::npos) {
@@ -589,90 +491,90 @@ void handle_storage_request(int client_fd, const std::string& path, const char*
         return;
     }
 
-    if (path.find("/storage/download") == 0 && buffer && strstr(buffer, "GET") != nullptr) {
+    if (path.find("/storage/download") == 0 && request.method == "GET") {
         std::string filename = path.substr(17);
-        size_t part_pos = filename.find("?part=");
-        int part = 1;
-        if (part_pos != std::string::npos) {
-            std::string part_str = filename.substr(part_pos + 6);
-            filename = filename.substr(0, part_pos);
-            part = std::stoi(part_str);
+        // ?part=N downloads one stored part (path has no query string: it is read from the target)
+        std::string_view query = request.target.substr(std::min(request.target.find('?'), request.target.size()));
+        size_t part_pos = query.find("part=");
+        int part = part_pos == std::string_view::npos ? 1 : atoi(std::string(query.substr(part_pos + 5)).c_str());
+        if (part_pos != std::string_view::npos && part < 1) {
+            send_json_response(client_fd, false, "Invalid part", keep_alive);
+            return;
         }
-        
-        auto result = WebStorage::download_file_chunk(username, filename, part, tablet_address);
-        
-        if (result.success) {
-            std::vector<WebStorage::FileEntry> files = WebStorage::list_files(username, tablet_address);
-            std::string display_filename = filename;
-            
-            for (const auto& file : files) {
-                if (file.path == filename) {
-                    display_filename = file.name;
-                    break;
-                }
+
+        std::string metadata_str;
+        if (!WebStorage::get_file_metadata(username, filename, tablet_address, metadata_str)) {
+            send_json_response(client_fd, false, "File not found", keep_alive);
+            return;
+        }
+        File::Metadata metadata = File::Metadata::from_string(metadata_str);
+        std::string headers = "Content-Disposition: attachment; filename=\"" + download_name(filename) + "\"\r\n"
+                              "Accept-Ranges: bytes\r\n";
+
+        // a single part, or a file stored before its size was recorded, is read whole; anything else is streamed
+        bool in_memory = part_pos != std::string::npos || metadata.size < 0;
+        std::vector<char> data;
+        if (in_memory) {
+            auto result = part_pos == std::string::npos ? WebStorage::download_file(username, filename, tablet_address)
+                                                        : WebStorage::download_file_chunk(username, filename, part, tablet_address);
+            if (!result.success) {
+                send_json_response(client_fd, false, "File not found", keep_alive);
+                return;
             }
-            
-            std::vector<char> clean_data;
-            const char* data_start = nullptr;
-            const char* data_end = nullptr;
-            
-            data_start = strstr(result.data.data(), "\r\n\r\n");
-            if (data_start) {
-                data_start += 4;
-                data_end = strstr(data_start, "\r\n--");
-                if (!data_end) {
-                    data_end = result.data.data() + result.data.size();
-                }
-                clean_data.assign(data_start, data_end);
-            } else {
-                clean_data = result.data;
+            data = std::move(result.data);
+        }
+        size_t size = in_memory ? data.size() : (size_t)metadata.size;
+
+        size_t start = 0, end = size;
+        std::string status = "200 OK";
+        // no validators are sent, so an If-Range can never match: the whole file then
+        Http::RangeStatus range = request.header("If-Range").empty()
+            ? Http::parse_range(request.header("Range"), size, start, end) : Http::RANGE_NONE;
+        if (range == Http::RANGE_UNSATISFIABLE) {
+            send_response(client_fd, "416 Range Not Satisfiable", "", "",
+                          "Content-Range: bytes */" + std::to_string(size) + "\r\n", keep_alive);
+            return;
+        }
+        if (range == Http::RANGE_SATISFIABLE) {
+            status = "206 Partial Content";
+            headers += "Content-Range: bytes " + std::to_string(start) + "-" + std::to_string(end - 1) + "/" +
+                       std::to_string(size) + "\r\n";
+        }
+        std::string head = Http::response_head(status, "application/octet-stream", end - start, keep_alive, headers);
+
+        if (in_memory) {
+            if (!Http::write_all(client_fd, head, std::string_view(data.data() + start, end - start))) {
+                fprintf(stderr, "[WebStorageHandler] [Download File] Error sending file data\n");
             }
-            
-            std::string content_disposition = "Content-Disposition: attachment; filename=\"" + 
-                                            display_filename + "\"\r\n";
-            std::string content_length = "Content-Length: " + 
-                                       std::to_string(clean_data.size()) + "\r\n";
-            std::string transfer_encoding = "Transfer-Encoding: chunked\r\n";
-            
-            std::string headers = std::string("HTTP/1.1 200 OK\r\n") +
-                                std::string("Content-Type: application/octet-stream\r\n") +
-                                content_disposition +
-                                transfer_encoding +
-                                std::string("\r\n");
-            
-            send(client_fd, headers.c_str(), headers.length(), 0);
-            
-            size_t total_sent = 0;
-            const size_t CHUNK_SIZE = 4096;
-            
-            while (total_sent < clean_data.size()) {
-                size_t remaining = clean_data.size() - total_sent;
-                size_t current_chunk = std::min(CHUNK_SIZE, remaining);
-                
-                std::stringstream chunk_header;
-                chunk_header << std::hex << current_chunk << "\r\n";
-                send(client_fd, chunk_header.str().c_str(), chunk_header.str().length(), 0);
-                
-                ssize_t sent = send(client_fd, clean_data.data() + total_sent, current_chunk, 0);
-                if (sent <= 0) {
-                    fprintf(stderr, "[WebStorageHandler] [Download File] Error sending file data\n");
-                    break;
-                }
-                send(client_fd, "\r\n", 2, 0);
-                total_sent += static_cast<size_t>(sent);
+            return;
+        }
+
+        // each part goes out as soon as its tablet returns it (the head with the first), so one part is held at a time
+        bool sent = WebStorage::read_file_range(username, metadata_str, start, end, tablet_address,
+                                                [&](std::string_view bytes) {
+            bool written = Http::write_all(client_fd, head, bytes);
+            head.clear();
+            return written;
+        });
+        if (sent && !head.empty()) {
+            sent = Http::write_all(client_fd, head);  // an empty file: no part went through
+            head.clear();
+        }
+        if (!sent) {
+            fprintf(stderr, "[WebStorageHandler] [Download File] Error streaming %s\n", filename.c_str());
+            if (!head.empty()) {
+                send_json_response(client_fd, false, "Download failed", keep_alive);
+            } else {
+                // the head promised more bytes than were sent: close, so the client sees a short body, not a hang
+                shutdown(client_fd, SHUT_RDWR);
             }
-            send(client_fd, "0\r\n\r\n", 5, 0);
-        } else {
-            send_json_response(client_fd, false, "File not found", keep_alive);
         }
         return;
     }
 
-    if (path.find("/storage/move") == 0 && buffer && strstr(buffer, "POST") != nullptr) {
-        const char* content_start = strstr(buffer, "\r\n\r\n");
-        if (content_start) {
-            content_start += 4;
-            std::string form_data(content_start);
+    if (path.find("/storage/move") == 0 && request.method == "POST") {
+        if (!request.body.empty()) {
+            std::string form_data(request.body);
             
             size_t item_name_start = form_data.find("item_name=");
             size_t destination_start = form_data.find("&destination=");
@@ -709,11 +611,9 @@ void handle_storage_request(int client_fd, const std::string& path, const char*
         return;
     }
 
-    if (path.find("/storage/rename") == 0 && buffer && strstr(buffer, "POST") != nullptr) {
-        const char* content_start = strstr(buffer, "\r\n\r\n");
-        if (content_start) {
-            content_start += 4;
-            std::string form_data(content_start);
+    if (path.find("/storage/rename") == 0 && request.method == "POST") {
+        if (!request.body.empty()) {
+            std::string form_data(request.body);
             
             size_t old_name_start = form_data.find("old_name=");
             size_t new_name_start = form_data.find("&new_name=");
@@ -21,6 +21,9 @@
 #include <dirent.h>
 #include <unordered_map>
 #include <netdb.h>
+#include <memory>
+#include "logger.h"
+#include "shard_map.h"
 
 #ifndef C_IN
     #define C_IN 1  // Internet class
@@ -48,6 +51,8 @@ vector<int> client_sockets;               // List of active client sockets
 pthread_mutex_t client_mutex = PTHREAD_MUTEX_INITIALIZER;
 sem_t *connection_semaphore;              // Semaphore for limiting concurrent connections
 bool shutting_down = false;               // Shutdown flag
+shared_ptr<const shardmap::ShardMap> shard_map;  // cached SHARD_MAP: kept current by WATCH pushes (and STALE_EPOCH replies)
+pthread_mutex_t shard_map_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // Helper: Recv exactly n bytes
 static std::string recv_all(int fd, size_t n) {
@@ -60,7 +65,7 @@ static std::string recv_all(int fd, size_t n) {
         if (r <= 0) break;
         buf.append(tmp, r);
     }
-    std::cout << "Successfully received "<< n << " bytes from client " << fd <<  std::endl;
+    LOG_DEBUG("Successfully received "<< n << " bytes from client " << fd);
     return buf;
 }
 
@@ -103,13 +108,17 @@ string get_timestamp() {
     return string(buffer);
 }
 
-// Helper Function: Ask Master for Redirection and Connect to Backend Node
-int getBackendSocket(const string &key) {
+// Helper Function: Fetch the shard map from Master (SHARD_MAP) unless the cached one is already at min_epoch or newer
+void refreshShardMap(uint64_t min_epoch) {
+    pthread_mutex_lock(&shard_map_mutex);
+    bool fresh = shard_map && shard_map->epoch >= min_epoch;
+    pthread_mutex_unlock(&shard_map_mutex);
+    if (fresh) return;  // another thread already refreshed it
     // Connect to master node on a fixed port (5050)
     int master_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (master_socket < 0) {
         perror("Master node socket creation failed");
-        return -1;
+        return;
     }
     struct sockaddr_in master_addr;
     memset(&master_addr, 0, sizeof(master_addr));
@@ -119,41 +128,133 @@ int getBackendSocket(const string &key) {
     if (connect(master_socket, (struct sockaddr *)&master_addr, sizeof(master_addr)) < 0) {
         perror("Master node connection failed");
         close(master_socket);
-        return -1;
+        return;
     }
     char response_buffer[BUFFER_SIZE];
     int bytes = recv(master_socket, response_buffer, sizeof(response_buffer)-1, 0);
     if (bytes < 0) {
         perror("Failed to receive response from master node");
-        return -1;
-    }
-    // Send the ASK command for redirection
-    string ask_cmd = "ASK " + key + "\r\n";
-    if (send(master_socket, ask_cmd.c_str(), ask_cmd.size(), 0) < 0) {
-        perror("Failed to send ASK command");
         close(master_socket);
-        return -1;
+        return;
     }
-    // Receive the response for redirection from the master node
-    memset(response_buffer, 0, sizeof(response_buffer));
-    recv(master_socket, response_buffer, sizeof(response_buffer)-1, 0);
-    // Parse the response (expected format: "+OK REDIRECT ip:port\r\n")
-    string master_response(response_buffer);
-    const string prefix = "+OK REDIRECT ";
-    if (master_response.compare(0, prefix.size(), prefix) != 0) {
-        cerr << "Invalid response from master node: " << master_response << endl;
-        return -1;
+    send_all(master_socket, "SHARD_MAP\r\n");
+    // Receive the whole map (one line: "+OK epoch E ring P point shard ... groups G shard primary|- alive_count addr ...")
+    string master_response;
+    while (master_response.size() < 2 || master_response.compare(master_response.size() - 2, 2, "\r\n") != 0) {
+        bytes = recv(master_socket, response_buffer, sizeof(response_buffer), 0);
+        if (bytes <= 0) break;
+        master_response.append(response_buffer, bytes);
     }
     string quit = "QUIT\r\n";
     send(master_socket, quit.c_str(), quit.size(), 0);
     close(master_socket);
-    string port_str = master_response.substr(prefix.size());
-    port_str.erase(port_str.find_last_not_of(" \r\n") + 1);
-    size_t colonPos = port_str.find(":");
-    string ip_str = port_str.substr(0, colonPos);
+    auto map = make_shared<shardmap::ShardMap>();
+    if (!map->parse(master_response)) {
+        LOG_WARN("Invalid shard map from master node: " << master_response.substr(0, 100));
+        return;
+    }
+    LOG_DEBUG("Shard map epoch " << map->epoch << " with " << map->groups.size() << " groups");
+    pthread_mutex_lock(&shard_map_mutex);
+    shard_map = map;
+    pthread_mutex_unlock(&shard_map_mutex);
+}
+
+// Apply one line the master pushed on the WATCH connection ("+OK WATCHING E", "DELTA from to ...", "RESYNC E")
+void applyShardMapPush(const string &line) {
+    istringstream iss(line);
+    string word;
+    uint64_t from = 0, to = 0;
+    iss >> word;
+    if (word == "+OK") {
+        iss >> word >> to;
+        if (word == "WATCHING") refreshShardMap(to);
+    } else if (word == "RESYNC") {  // the ring changed: deltas cannot describe that
+        iss >> to;
+        refreshShardMap(to);
+    } else if (word == "DELTA" && iss >> from >> to) {
+        pthread_mutex_lock(&shard_map_mutex);
+        bool applied = shard_map && shard_map->epoch >= to;  // already at least this new
+        if (!applied && shard_map) {
+            auto map = make_shared<shardmap::ShardMap>(*shard_map);
+            if ((applied = map->apply_delta(line))) shard_map = map;
+        }
+        pthread_mutex_unlock(&shard_map_mutex);
+        if (applied) LOG_DEBUG("Shard map epoch " << to << " (pushed)");
+        else refreshShardMap(to);  // missed a push (or have no map yet)
+    }
+}
+
+// Thread: keep the cached shard map current from the master's WATCH pushes (reconnects every second while it is away)
+void *watchShardMap(void *) {
+    while (!shutting_down) {
+        int master_socket = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in master_addr;
+        memset(&master_addr, 0, sizeof(master_addr));
+        master_addr.sin_family = AF_INET;
+        master_addr.sin_port = htons(MASTER_PORT);
+        master_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        if (master_socket >= 0 && connect(master_socket, (struct sockaddr *)&master_addr, sizeof(master_addr)) == 0) {
+            send_all(master_socket, "WATCH\r\n");
+            string buffer;
+            char chunk[BUFFER_SIZE];
+            int bytes;
+            while ((bytes = recv(master_socket, chunk, sizeof(chunk), 0)) > 0) {
+                buffer.append(chunk, bytes);
+                size_t pos;
+                while ((pos = buffer.find("\r\n")) != string::npos) {
+                    applyShardMapPush(buffer.substr(0, pos));
+                    buffer.erase(0, pos + 2);
+                }
+            }
+            LOG_WARN("Lost the WATCH connection to master node");
+        }
+        if (master_socket >= 0) close(master_socket);
+        sleep(1);
+    }
+    return nullptr;
+}
+
+shared_ptr<const shardmap::ShardMap> currentShardMap() {
+    pthread_mutex_lock(&shard_map_mutex);
+    auto map = shard_map;
+    pthread_mutex_unlock(&shard_map_mutex);
+    if (map) return map;
+    refreshShardMap(0);
+    pthread_mutex_lock(&shard_map_mutex);
+    map = shard_map;
+    pthread_mutex_unlock(&shard_map_mutex);
+    return map;
+}
+
+// Helper Function: Primaries of many keys from the cached shard map; "" for a key whose shard is down. epoch is set to
+// the epoch of the map they were taken from, for connectBackend
+vector<string> resolveBackends(const vector<string> &keys, uint64_t &epoch) {
+    vector<string> addresses(keys.size());
+    epoch = 0;
+    if (keys.empty()) return addresses;
+    auto map = currentShardMap();
+    if (!map) return addresses;
+    bool down = false;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        addresses[i] = map->primary_of(keys[i]);
+        down |= addresses[i].empty();
+    }
+    if (down) {  // the cached map says a shard is down: it may have come back since
+        refreshShardMap(map->epoch + 1);
+        map = currentShardMap();
+        for (size_t i = 0; i < keys.size(); ++i) addresses[i] = map->primary_of(keys[i]);
+    }
+    epoch = map->epoch;
+    return addresses;
+}
+
+// Helper Function: Connect to a backend node given as "ip:port", taken from the shard map of this epoch
+int connectBackend(const string &address, uint64_t epoch) {
+    size_t colonPos = address.find(":");
+    if (address.empty() || colonPos == string::npos) return -1;
+    string ip_str = address.substr(0, colonPos);
     const char* ip = ip_str.c_str();
-    string port = port_str.substr(colonPos + 1);
-    int backend_port = atoi(port.c_str());
+    int backend_port = atoi(address.substr(colonPos + 1).c_str());
     // Connect to the backend node
     int backend_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (backend_socket < 0) {
@@ -168,19 +269,47 @@ int getBackendSocket(const string &key) {
     if (connect(backend_socket, (struct sockaddr *)&backend_addr, sizeof(backend_addr)) < 0) {
         perror("Backend node connection failed");
         close(backend_socket);
+        refreshShardMap(epoch + 1);  // the master has probably elected a new primary by now
         return -1;
     }
     char* buf_[32]; recv(backend_socket, buf_, sizeof(buf_)-1, 0); // expect "+OK Connected\r\n"
+    // A mail operation is several commands on this connection, so check once up front that the shard map we routed
+    // with is still current (and that the node is not fake dead) with an epoch-tagged CHECK
+    string check_response;
+    if (!sendReceiveCommand(backend_socket, "@" + to_string(epoch) + " CHECK\r\n", check_response) || check_response.compare(0, 3, "+OK") != 0) {
+        LOG_DEBUG("Backend " << address << " refused shard map epoch " << epoch << ": " << check_response);
+        string quit = "QUIT\r\n";
+        send(backend_socket, quit.c_str(), quit.size(), 0);
+        close(backend_socket);
+        bool stale = check_response.compare(0, 16, "-ERR STALE_EPOCH") == 0;
+        refreshShardMap(stale ? strtoull(check_response.c_str() + 16, nullptr, 10) : epoch + 1);
+        return -1;
+    }
     return backend_socket;
 }
 
+// Helper Function: Find the key's primary in the shard map and connect to it (once more after a refresh if that fails)
+int getBackendSocket(const string &key) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        uint64_t epoch;
+        string address = resolveBackends({key}, epoch)[0];
+        if (address.empty()) {
+            LOG_WARN("No backend available for " << key);
+            return -1;
+        }
+        int backend_socket = connectBackend(address, epoch);
+        if (backend_socket >= 0) return backend_socket;
+    }
+    return -1;
+}
+
 // Generate next unique email ID as a string for a user
 string generate_email_id(const string& user) {
     int backend_socket = getBackendSocket(user);
     string get_cmd = "GET " + user + " emails\r\n";  // get ID list
     string backend_response;
     sendReceiveCommand(backend_socket, get_cmd, backend_response);
-    cout << "Backend response for GET emailIDs: " << backend_response << endl;
+    LOG_DEBUG("Backend response for GET emailIDs: " << backend_response);
     const string ok_prefix = "+OK ";
     string mail_id;
     if (backend_response.compare(0, ok_prefix.size(), ok_prefix) != 0) { // be "-ERR Not found", we initialize it
@@ -206,7 +335,7 @@ string generate_email_id(const string& user) {
 void send_smtp_command(int sock, const string &cmd) {
     string full_cmd = cmd + "\r\n";
     send(sock, full_cmd.c_str(), full_cmd.length(), 0);
-    cerr << "C: " << cmd << endl;
+    LOG_DEBUG("C: " << cmd);
 }
 
 // Receive SMTP response from outside server (e.g., gmail)
@@ -214,7 +343,7 @@ string recv_smtp_response(int sock) {
     char buffer[BUFFER_SIZE];
     memset(buffer, 0, BUFFER_SIZE);
     recv(sock, buffer, BUFFER_SIZE - 1, 0);
-    cerr << "S: " << buffer;
+    LOG_DEBUG("S: " << buffer);
     return string(buffer);
 }
 
@@ -223,7 +352,7 @@ string get_mx_record(const string &domain) {
     unsigned char query_buffer[NS_PACKETSZ];
     int query_len = res_query(domain.c_str(), C_IN, T_MX, query_buffer, sizeof(query_buffer));
     if (query_len < 0) {
-        cerr << "[ERROR] res_query failed for domain: " << domain << endl;
+        LOG_ERROR("res_query failed for domain: " << domain);
         return "";
     }
     ns_msg handle;
@@ -261,14 +390,14 @@ bool relay_email_to_outside(const string &sender, const vector<string> &recipien
     for (auto &[domain, recips] : domain_map) {
         string mail_server = get_mx_record(domain);
         if (mail_server.empty()) {
-            cerr << "[ERROR] No MX record found for domain: " << domain << endl;
+            LOG_ERROR("No MX record found for domain: " << domain);
             all_success = false;
             break;
         }
         // Resolve mail server address
         struct hostent *server = gethostbyname(mail_server.c_str());
         if (!server) {
-            cerr << "[ERROR] Failed to resolve " << mail_server << endl;
+            LOG_ERROR("Failed to resolve " << mail_server);
             all_success = false;
             break;
         }
@@ -280,7 +409,7 @@ bool relay_email_to_outside(const string &sender, const vector<string> &recipien
         // Connect to the mail server
         int sock = socket(AF_INET, SOCK_STREAM, 0);
         if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-            cerr << "[ERROR] Failed to connect to " << mail_server << endl;
+            LOG_ERROR("Failed to connect to " << mail_server);
             close(sock);
             all_success = false;
             break;
@@ -298,7 +427,7 @@ bool relay_email_to_outside(const string &sender, const vector<string> &recipien
             send_smtp_command(sock, "RCPT TO:<" + rcpt + ">");
             string response = recv_smtp_response(sock);
             if (response.find("250") == string::npos) {
-                cerr << "[ERROR] Recipient rejected: " << rcpt << endl;
+                LOG_ERROR("Recipient rejected: " << rcpt);
                 all_success = false;
                 break;
             }
@@ -319,7 +448,8 @@ bool relay_email_to_outside(const string &sender, const vector<string> &recipien
 }
 
 // KV Store Storage Functionality for Local Recipients
-void store_email_in_kv(const string &recipient, const string &sender, const string &subject, const string &content) {
+void store_email_in_kv(const string &recipient, const string &sender, const string &subject, const string &content, const string &backend = "",
+                       uint64_t epoch = 0) {
     string timestamp = get_timestamp();
     string mail_id = generate_email_id(recipient);
     // Build plain text
@@ -334,7 +464,8 @@ void store_email_in_kv(const string &recipient, const string &sender, const stri
     cmd << "PUT " << recipient << " EMAIL" << mail_id << " " << plain_text.size() << "\r\n";
     string put_cmd = cmd.str();
 
-    int backend_socket = getBackendSocket(recipient); // use helper function
+    int backend_socket = backend.empty() ? -1 : connectBackend(backend, epoch);
+    if (backend_socket < 0) backend_socket = getBackendSocket(recipient); // use helper function
     if (backend_socket < 0) {
         perror("Failed to connect to backend partition");
         return;
@@ -342,18 +473,18 @@ void store_email_in_kv(const string &recipient, const string &sender, const stri
     // Send the PUT command and receive response (use helper function)
     string backend_response;
     sendReceiveCommand(backend_socket, put_cmd, backend_response);
-    cout << "Backend response for PUT command: " << backend_response << endl;
+    LOG_DEBUG("Backend response for PUT command: " << backend_response);
     send_all(backend_socket, plain_text);
     char* buf_[64];
     recv(backend_socket,buf_,sizeof(buf_)-1,0); // expect "+OK All bytes received\r\n" here
-    cout << "Email stored successfully: " << plain_text << endl;
+    LOG_DEBUG("Email stored successfully: " << plain_text);
     // Then, we must also update the emailID list for this recipient
     string get_cmd = "GET " + recipient + " emails\r\n";
     if (!sendReceiveCommand(backend_socket, get_cmd, backend_response)) {
         close(backend_socket);
         return;
     }
-    cout << "Backend response for GET command: " << backend_response << endl;
+    LOG_DEBUG("Backend response for GET command: " << backend_response);
     const string ok_prefix = "+OK ";
     if (backend_response.compare(0, ok_prefix.size(), ok_prefix) != 0) { // be "-ERR Not found", we initialize it
         put_cmd = "PUT " + recipient + " emails " + to_string(mail_id.size()) + "\r\n";
@@ -374,7 +505,7 @@ void store_email_in_kv(const string &recipient, const string &sender, const stri
         send_all(backend_socket, IDs);
         recv(backend_socket, buf_, sizeof(buf_)-1, 0);
     }
-    cout << "Updating email IDs completed" << endl;
+    LOG_DEBUG("Updating email IDs completed");
     string quit = "QUIT\r\n";
     send(backend_socket, quit.c_str(), quit.size(), 0);
     close(backend_socket);
@@ -394,14 +525,14 @@ void delete_email(const string& username, const string& mail_id) {
         close(backend_socket);
         return;
     }
-    cout << "Backend response for DELETE command: " << backend_response << endl;
+    LOG_DEBUG("Backend response for DELETE command: " << backend_response);
     // Update the email ID list for the user
     string get_cmd = "GET " + username + " emails\r\n";
     if (!sendReceiveCommand(backend_socket, get_cmd, backend_response)) {
         close(backend_socket);
         return;
     }
-    cout << "Backend response for GET command: " << backend_response << endl;
+    LOG_DEBUG("Backend response for GET command: " << backend_response);
     backend_response.erase(0, 4);  // erase "+OK "           
     backend_response.erase(backend_response.find_first_of("\r\n"));  
     size_t sz = std::stoull(backend_response);
@@ -429,7 +560,7 @@ void delete_email(const string& username, const string& mail_id) {
             close(backend_socket);
             return;
         }
-        cout << "Backend response for updating email IDs (after deletion): " << backend_response << endl;
+        LOG_DEBUG("Backend response for updating email IDs (after deletion): " << backend_response);
         send_all(backend_socket, updated_ids);
         char* buf_[128];
         recv(backend_socket, buf_, sizeof(buf_)-1, 0);  // expect "+OK All bytes received"
@@ -440,7 +571,7 @@ void delete_email(const string& username, const string& mail_id) {
             close(backend_socket);
             return;
         }
-        cout << "Backend response for DELETE command (now no emails at all): " << backend_response << endl;
+        LOG_DEBUG("Backend response for DELETE command (now no emails at all): " << backend_response);
     }
     string quit = "QUIT\r\n";
     send(backend_socket, quit.c_str(), quit.size(), 0);
@@ -492,15 +623,17 @@ void forward_email(const string& username, const string& mail_id, const vector<s
         outgoing_content += "\r\n" + tokens[i];
     }
     // deal with locals
-    for (const auto &local : locals) {
-        store_email_in_kv(local, forwarder, subject, contentWithDelim); // store email in kv and also update email ID list
+    uint64_t epoch;
+    vector<string> backends = resolveBackends(locals, epoch);  // all from the cached shard map
+    for (size_t i = 0; i < locals.size(); ++i) {
+        store_email_in_kv(locals[i], forwarder, subject, contentWithDelim, backends[i], epoch); // store email in kv and also update email ID list
     }
     // deal with non_locals
     ostringstream full_message;
     full_message << "Subject: " << subject << "\r\n" << outgoing_content;
     int countTry = 0;
     while (!relay_email_to_outside(forwarder, non_locals, full_message.str()) && countTry <= 10) {
-        cerr << "[INFO] Relay failed, retrying..." << endl;
+        LOG_INFO("Relay failed, retrying...");
         countTry++;
     }
     string quit = "QUIT\r\n";
@@ -569,13 +702,13 @@ void reply_helper(const string& username, const string& mail_id, vector<string>&
 void send_response(int client_fd, const string &code, const string &message) {
     string response = code + " " + message + "\r\n";
     send(client_fd, response.c_str(), response.size(), 0);
-    cerr << "[" << client_fd << "] S: " << response;
+    LOG_DEBUG("[" << client_fd << "] S: " << response);
 }
 
 void *handle_client(void *arg) {
     int client_fd = *(int *)arg;
     delete (int *)arg;
-    cerr << "[" << client_fd << "] New connection" << endl;
+    LOG_DEBUG("[" << client_fd << "] New connection");
     send_response(client_fd, "220", "mail_server.penncloud SMTP ready");
 
     char recv_buffer[BUFFER_SIZE];
@@ -596,14 +729,16 @@ void *handle_client(void *arg) {
         while ((pos = buffer.find("\r\n")) != string::npos) {
             string command = buffer.substr(0, pos);
             buffer.erase(0, pos + 2);
-            cerr << "[" << client_fd << "] C: " << command << endl;
+            LOG_DEBUG("[" << client_fd << "] C: " << command);
             // If in DATA mode, process as message content
             if (in_data_mode) {
                 if (command == ".") { // can be either sending or replying
                     // End DATA mode—process email:
                     // For each local recipient, store in KV as plain text with "|" delimiters
-                    for (const auto &rcpt : local_recipients) {
-                        store_email_in_kv(rcpt, sender_email, email_subject, email_content);
+                    uint64_t epoch;
+                    vector<string> backends = resolveBackends(local_recipients, epoch);  // all from the cached shard map
+                    for (size_t i = 0; i < local_recipients.size(); ++i) {
+                        store_email_in_kv(local_recipients[i], sender_email, email_subject, email_content, backends[i], epoch);
                     }
                     // For external recipients, use relay_email.
                     if (!external_recipients.empty()) {
@@ -618,7 +753,7 @@ void *handle_client(void *arg) {
                         full_message << "Subject: " << email_subject << "\r\n" << outgoing_content;
                         int countTry = 0;
                         while (!relay_email_to_outside(sender_email, external_recipients, full_message.str()) && countTry <= 10) {
-                            cerr << "[INFO] Relay failed, retrying..." << endl;
+                            LOG_INFO("Relay failed, retrying...");
                             countTry++;
                         }
                     }
@@ -755,7 +890,7 @@ void *handle_client(void *arg) {
                 }
                 else if (cmd == "QUIT") {
                     send_response(client_fd, "221", "Bye");
-                    cerr << "[" << client_fd << "] Connection closed" << endl;
+                    LOG_DEBUG("[" << client_fd << "] Connection closed");
                     shutdown(client_fd, SHUT_RDWR);
                     close(client_fd);
                     pthread_mutex_lock(&client_mutex);
@@ -777,7 +912,7 @@ void *handle_client(void *arg) {
 // Signal Handler for Graceful Shutdown
 void handle_shutdown(int signal) {
     shutting_down = true;
-    cerr << "\n[Server] Received SIGINT. Shutting down mail_server..." << endl;
+    LOG_INFO("[Server] Received SIGINT. Shutting down mail_server...");
     pthread_mutex_lock(&client_mutex);
     for (int sock : client_sockets) {
         send_response(sock, "421", "Server shutting down");
@@ -789,7 +924,7 @@ void handle_shutdown(int signal) {
     close(server_socket);
     sem_close(connection_semaphore);
     sem_unlink("/mailserver_semaphore");
-    cerr << "[Server] Gracefully shut down." << endl;
+    LOG_INFO("[Server] Gracefully shut down.");
     exit(0);
 }
 
@@ -807,7 +942,7 @@ int main(int argc, char *argv[]) {
     // Set up server socket
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket < 0) {
-        cerr << "[ERROR] Unable to create server socket." << endl;
+        LOG_ERROR("Unable to create server socket.");
         return 1;
     }
     int opt = 1;
@@ -819,19 +954,21 @@ int main(int argc, char *argv[]) {
     server_addr.sin_port = htons(SERVER_PORT);
 
     if (::bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        cerr << "[ERROR] Failed to bind to port " << SERVER_PORT << endl;
+        LOG_ERROR("Failed to bind to port " << SERVER_PORT);
         return 1;
     }
     if (listen(server_socket, MAX_CLIENTS) < 0) {
-        cerr << "[ERROR] Failed to listen on port " << SERVER_PORT << endl;
+        LOG_ERROR("Failed to listen on port " << SERVER_PORT);
         return 1;
     }
     connection_semaphore = sem_open("/mailserver_semaphore", O_CREAT, 0644, MAX_CLIENTS);
     if (connection_semaphore == SEM_FAILED) {
-        cerr << "[ERROR] Failed to initialize semaphore" << endl;
+        LOG_ERROR("Failed to initialize semaphore");
         return 1;
     }
-    cout << "Mail Server is running on port " << SERVER_PORT << "..." << endl;
+    LOG_INFO("Mail Server is running on port " << SERVER_PORT << "...");
+    pthread_t watcher;  // keeps the shard map current, so deliveries follow a failover without asking the master
+    if (pthread_create(&watcher, nullptr, watchShardMap, nullptr) == 0) pthread_detach(watcher);
 
     while (!shutting_down) {
         sem_wait(connection_semaphore);
@@ -840,7 +977,7 @@ int main(int argc, char *argv[]) {
         socklen_t addr_len = sizeof(client_addr);
         *client_fd = accept(server_socket, (sockaddr *)&client_addr, &addr_len);
         if (*client_fd < 0) {
-            cerr << "[ERROR] Failed to accept connection." << endl;
+            LOG_ERROR("Failed to accept connection.");
             delete client_fd;
             continue;
         }
@@ -850,7 +987,7 @@ int main(int argc, char *argv[]) {
 
         pthread_t client_thread;
         if (pthread_create(&client_thread, nullptr, handle_client, client_fd) != 0) {
-            cerr << "[ERROR] Failed to create thread for new client." << endl;
+            LOG_ERROR("Failed to create thread for new client.");
             pthread_mutex_lock(&client_mutex);
             client_sockets.erase(remove(client_sockets.begin(), client_sockets.end(), *client_fd), client_sockets.end());
             close(*client_fd);